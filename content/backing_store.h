@@ -32,6 +32,14 @@ enum backing_store_flags {
 	BACKING_STORE_NONE = 0,
 	/** data is metadata */
 	BACKING_STORE_META = 1,
+	/** data is already in a compressed format */
+	BACKING_STORE_COMPRESSED = 2,
+};
+
+/** backing store statistics */
+struct llcache_store_stats {
+	/** index lookups which probed past the identifier's home slot */
+	uint64_t probe_count;
 };
 
 /**
@@ -66,7 +74,8 @@ struct gui_llcache_table {
 	 * The backing store will take a reference to the
 	 *  passed data, subsequently the caller should explicitly
 	 *  release the allocation using the release method and not
-	 *  free the data itself.
+	 *  free the data itself. If the store fails no reference is
+	 *  held and the caller remains responsible for the data.
 	 *
 	 * The caller may not assume that the persistent storage has
 	 *  been completely written on return.
@@ -121,6 +130,43 @@ struct gui_llcache_table {
 	 */
 	nserror (*invalidate)(struct nsurl *url);
 
+	/**
+	 * Retrieve an object from the backing store asynchronously.
+	 *
+	 * This is an optional operation and may be NULL if the
+	 *  backing store cannot perform retrieval without blocking.
+	 *
+	 * On success the completion callback will be called exactly
+	 *  once, never from within this call, with the result of the
+	 *  retrieval. The data passed to a successful completion is
+	 *  managed as if it had been returned from the fetch method and
+	 *  must be freed by calling the release method.
+	 *
+	 * @param[in] url The url is used as the unique primary key for the data.
+	 * @param[in] flags The flags to control how the object is retrieved.
+	 * @param[in] cb The completion callback.
+	 * @param[in] pw The context passed to the completion callback.
+	 * @return NSERROR_OK if the retrieval has been started or
+	 *         error code on failure in which case the callback will
+	 *         not be called.
+	 */
+	nserror (*fetch_async)(struct nsurl *url,
+			       enum backing_store_flags flags,
+			       void (*cb)(nserror res,
+					  uint8_t *data,
+					  size_t datalen,
+					  void *pw),
+			       void *pw);
+
+	/**
+	 * Retrieve backing store statistics.
+	 *
+	 * This is an optional operation and may be NULL.
+	 *
+	 * @param[out] stats The statistics.
+	 * @return NSERROR_OK on success or error code on failure.
+	 */
+	nserror (*stats)(struct llcache_store_stats *stats);
 };
 
 extern struct gui_llcache_table* null_llcache_table;
@@ -1239,6 +1239,15 @@ const char *content__get_source_data(struct content *c, unsigned long *size)
 	return (const char *) data;
 }
 
+/* exported interface documented in content/content_protected.h */
+nserror content__get_source_buffer(struct content *c, struct llcache_buffer **buffer)
+{
+	if (c == NULL)
+		return NSERROR_BAD_PARAMETER;
+
+	return llcache_handle_get_source_buffer(c->llcache, buffer);
+}
+
 /* exported interface documented in content/content.h */
 void content_invalidate_reuse_data(hlcache_handle *h)
 {
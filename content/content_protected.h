@@ -34,6 +34,7 @@
 
 struct content_redraw_data;
 struct http_parameter;
+struct llcache_buffer;
 
 struct content_handler {
 	void (*fini)(void);
@@ -255,6 +256,18 @@ int content__get_available_width(struct content *c);
  */
 const char *content__get_source_data(struct content *c, unsigned long *size);
 
+/**
+ * Retrieve a reference to the source of content.
+ *
+ * The source is shared with the low level cache rather than copied
+ * and must be released with llcache_buffer_unref().
+ *
+ * \param c      Content to retrieve source of.
+ * \param buffer Pointer to location to receive the source buffer.
+ * \return NSERROR_OK on success or error code on failure.
+ */
+nserror content__get_source_buffer(struct content *c, struct llcache_buffer **buffer);
+
 /**
  * Invalidate content reuse data.
  *
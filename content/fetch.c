@@ -27,8 +27,26 @@
  *
  * Active fetches are held in the circular linked list ::fetch_ring. There may
  * be at most nsoption max_fetchers_per_host active requests per Host: header.
- * There may be at most nsoption max_fetchers active requests overall. Inactive
- * fetches are stored in the ::queue_ring waiting for use.
+ * There may be at most nsoption max_fetchers active requests overall.
+ *
+ * Each host with fetches, keyed by its interned origin (scheme, host and
+ * port), has an entry in the ::fetch_hosts table holding its active and
+ * queued counts. Inactive fetches wait in a ring per priority class on
+ * their host entry. Hosts which are permitted to start a fetch are kept on
+ * the ::fetch_ready rings for the priority of their most urgent queued
+ * fetch, so the most urgent fetch the limits permit is found without
+ * examining the queue. Entries are freed once the host is idle.
+ *
+ * Hosts a fetcher has reported as multiplexing requests over a single
+ * connection (e.g. HTTP/2) are limited by nsoption max_streams_per_host
+ * instead and, as they do not need a connection of their own, fetches to
+ * them are not counted against max_fetchers. The total of these fetches
+ * is limited by nsoption max_streams.
+ *
+ * Fetchers are normally polled every SCHEDULE_TIME while there are active
+ * fetches. Where the frontend waits on the descriptor from fetch_event_fd()
+ * instead, fetchers which provide the fd_ready operation register their
+ * descriptors with an epoll set and are only run when they are ready.
  */
 
 #include <stdlib.h>
@@ -41,6 +59,12 @@
 #include <libwapcaplet/libwapcaplet.h>
 
 #include "utils/config.h"
+#ifdef HAVE_EPOLL
+#include <stdint.h>
+#include <unistd.h>
+#include <sys/epoll.h>
+#endif
+
 #include "utils/corestrings.h"
 #include "utils/nsoption.h"
 #include "utils/log.h"
@@ -73,6 +97,15 @@
 /** The fdset timeout in ms */
 #define FDSET_TIMEOUT 1000
 
+/** The maximum number of descriptor events processed in one call */
+#define EVENT_BATCH 64
+
+/** The number of buckets in the host table */
+#define HOST_TABLE_SIZE 64
+
+/** The number of fetch priority classes */
+#define PRIORITY_COUNT (FETCH_PRIORITY_PREFETCH + 1)
+
 /**
  * Information about a fetcher for a given scheme.
  */
@@ -93,17 +126,59 @@ struct fetch {
 	bool send_referer;	/**< Valid to send the referer */
 	bool verifiable;	/**< Transaction is verifiable */
 	void *p;		/**< Private data for callback. */
-	lwc_string *host;	/**< Host part of URL, interned */
+	lwc_string *origin;	/**< Origin of URL, interned, or NULL */
+	struct fetch_host *host_entry; /**< Accounting for host, or NULL */
 	long http_code;		/**< HTTP response code, or 0. */
+	uint64_t wire_size;	/**< Body bytes received, before decoding */
+	uint64_t decoded_size;	/**< Body bytes after content decoding */
+	fetch_priority priority; /**< Priority class of the fetch. */
 	int fetcherd;           /**< Fetcher descriptor for this fetch */
 	void *fetcher_handle;	/**< The handle for the fetcher. */
 	bool fetch_is_active;	/**< This fetch is active. */
-	struct fetch *r_prev;	/**< Previous active fetch in ::fetch_ring. */
-	struct fetch *r_next;	/**< Next active fetch in ::fetch_ring. */
+	struct fetch *r_prev;	/**< Previous fetch in ::fetch_ring or queue. */
+	struct fetch *r_next;	/**< Next fetch in ::fetch_ring or queue. */
+};
+
+/** Fetch accounting for a single host. */
+struct fetch_host {
+	lwc_string *origin;	/**< Origin of the host, interned, or NULL */
+	struct fetch_host *next; /**< Next host in table bucket */
+
+	int active;		/**< Number of active fetches */
+	int queued;		/**< Number of queued fetches */
+	bool multiplexed;	/**< Host multiplexes fetches on a connection */
+
+	/** Rings of queued fetches for each priority class */
+	struct fetch *queue[PRIORITY_COUNT];
+
+	struct fetch_host **ready; /**< Ready ring the host is on, or NULL */
+	struct fetch_host *r_prev; /**< Previous host in ready ring */
+	struct fetch_host *r_next; /**< Next host in ready ring */
 };
 
 static struct fetch *fetch_ring = NULL;	/**< Ring of active fetches. */
-static struct fetch *queue_ring = NULL;	/**< Ring of queued fetches */
+
+/** Table of hosts with fetches */
+static struct fetch_host *fetch_hosts[HOST_TABLE_SIZE];
+
+/**
+ * Rings of hosts able to start a fetch, indexed by whether the host is
+ * multiplexed and the priority of its most urgent queued fetch.
+ */
+static struct fetch_host *fetch_ready[2][PRIORITY_COUNT];
+
+static int fetch_active_count = 0; /**< Number of active fetches */
+static int fetch_queued_count = 0; /**< Number of queued fetches */
+static int fetch_connection_count = 0; /**< Active fetches not multiplexed */
+static int fetch_stream_count = 0; /**< Active fetches multiplexed */
+
+#ifdef HAVE_EPOLL
+/** epoll set of the descriptors fetchers are waiting on or -1 */
+static int fetch_epoll_fd = -1;
+#endif
+
+/** The frontend is waiting on descriptor events instead of polling */
+static bool fetch_events_enabled = false;
 
 /******************************************************************************
  * fetch internals							      *
@@ -142,85 +217,272 @@ static int get_fetcher_for_scheme(lwc_string *scheme)
 	return -1;
 }
 
+/**
+ * Get the origin a fetch is accounted against.
+ *
+ * The origin is the scheme, host and port of the url so fetches to
+ * the same host with a different scheme or port, which cannot share
+ * a connection, are accounted separately.
+ *
+ * \param url The url being fetched.
+ * \param origin_out Updated with the interned origin or NULL if the
+ *                   url has no host.
+ * \return NSERROR_OK on success or error code on failure.
+ */
+static nserror fetch_origin(nsurl *url, lwc_string **origin_out)
+{
+	char *origin;
+	size_t origin_len;
+	nserror res;
+
+	*origin_out = NULL;
+
+	if (!nsurl_has_component(url, NSURL_HOST)) {
+		return NSERROR_OK;
+	}
+
+	res = nsurl_get(url, NSURL_SCHEME | NSURL_HOST | NSURL_PORT,
+			&origin, &origin_len);
+	if (res != NSERROR_OK) {
+		return res;
+	}
+
+	if (lwc_intern_string(origin, origin_len, origin_out) != lwc_error_ok) {
+		res = NSERROR_NOMEM;
+	}
+	free(origin);
+
+	return res;
+}
+
+/**
+ * Find the table bucket for an origin.
+ */
+static inline struct fetch_host **fetch_host_bucket(lwc_string *origin)
+{
+	if (origin == NULL) {
+		return &fetch_hosts[0];
+	}
+	return &fetch_hosts[lwc_string_hash_value(origin) % HOST_TABLE_SIZE];
+}
+
+/**
+ * Find the accounting entry for a host.
+ *
+ * \param origin The interned origin of the host, may be NULL.
+ * \param create true to create an entry if there is not one.
+ * \return The host entry or NULL if not found or on memory exhaustion.
+ */
+static struct fetch_host *fetch_host_find(lwc_string *origin, bool create)
+{
+	struct fetch_host **bucket = fetch_host_bucket(origin);
+	struct fetch_host *h;
+	bool match;
+
+	for (h = *bucket; h != NULL; h = h->next) {
+		if ((h->origin == origin) ||
+		    ((h->origin != NULL) && (origin != NULL) &&
+		     (lwc_string_isequal(h->origin, origin, &match) ==
+		      lwc_error_ok) &&
+		     (match == true))) {
+			return h;
+		}
+	}
+
+	if (!create) {
+		return NULL;
+	}
+
+	h = calloc(1, sizeof(*h));
+	if (h == NULL) {
+		return NULL;
+	}
+	if (origin != NULL) {
+		h->origin = lwc_string_ref(origin);
+	}
+	h->next = *bucket;
+	*bucket = h;
+
+	return h;
+}
+
+/**
+ * Remove a host entry from the table and free it.
+ */
+static void fetch_host_free(struct fetch_host *h)
+{
+	struct fetch_host **link;
+
+	for (link = fetch_host_bucket(h->origin); *link != h;
+	     link = &(*link)->next) {
+		assert(*link != NULL);
+	}
+	*link = h->next;
+
+	if (h->origin != NULL) {
+		lwc_string_unref(h->origin);
+	}
+	free(h);
+}
+
+/**
+ * Get the most urgent priority class a host has queued fetches in.
+ *
+ * \return The priority class or PRIORITY_COUNT if nothing is queued.
+ */
+static inline int fetch_host_priority(struct fetch_host *h)
+{
+	int priority;
+
+	for (priority = 0; priority < PRIORITY_COUNT; priority++) {
+		if (h->queue[priority] != NULL) {
+			break;
+		}
+	}
+	return priority;
+}
+
+/**
+ * Take a host off the ready ring it is on, if any.
+ */
+static inline void fetch_host_unready(struct fetch_host *h)
+{
+	if (h->ready != NULL) {
+		RING_REMOVE((*h->ready), h);
+		h->ready = NULL;
+	}
+}
+
+/**
+ * Bring a host entry up to date after its counts or queue changed.
+ *
+ * The host is placed on the ready ring matching its most urgent
+ * queued fetch if it may start another fetch, and taken off the
+ * ready rings otherwise. Entries with nothing left to account for
+ * are freed so the caller must not use \a h after this.
+ */
+static void fetch_host_update(struct fetch_host *h)
+{
+	struct fetch_host **ready = NULL;
+	int limit;
+
+	if (h->multiplexed) {
+		limit = nsoption_int(max_streams_per_host);
+	} else {
+		limit = nsoption_int(max_fetchers_per_host);
+	}
+
+	if ((h->queued > 0) && (h->active < limit)) {
+		ready = &fetch_ready[h->multiplexed][fetch_host_priority(h)];
+	}
+
+	if (h->ready != ready) {
+		fetch_host_unready(h);
+		if (ready != NULL) {
+			RING_INSERT((*ready), h);
+			h->ready = ready;
+		}
+	}
+
+	if ((h->active == 0) && (h->queued == 0)) {
+		fetch_host_free(h);
+	}
+}
+
+/**
+ * Add a fetch to the end of its priority class on its host queue.
+ */
+static void fetch_queue_insert(struct fetch *fetch)
+{
+	struct fetch_host *h = fetch->host_entry;
+
+	RING_INSERT(h->queue[fetch->priority], fetch);
+	h->queued++;
+	fetch_queued_count++;
+}
+
+/**
+ * Remove a fetch from its host queue.
+ */
+static void fetch_queue_remove(struct fetch *fetch)
+{
+	struct fetch_host *h = fetch->host_entry;
+
+	RING_REMOVE(h->queue[fetch->priority], fetch);
+	h->queued--;
+	fetch_queued_count--;
+}
+
 /**
  * Dispatch a single job
  */
 static bool fetch_dispatch_job(struct fetch *fetch)
 {
-	RING_REMOVE(queue_ring, fetch);
+	struct fetch_host *h = fetch->host_entry;
+	bool started;
+
+	fetch_queue_remove(fetch);
 	NSLOG(fetch, DEBUG,
 	      "Attempting to start fetch %p, fetcher %p, url %s", fetch,
 	      fetch->fetcher_handle,
 	      nsurl_access(fetch->url));
 
-	if (!fetchers[fetch->fetcherd].ops.start(fetch->fetcher_handle)) {
-		RING_INSERT(queue_ring, fetch); /* Put it back on the end of the queue */
-		return false;
+	/* the host goes to the back of its ready ring so hosts with
+	 * fetches of the same priority take turns.
+	 */
+	fetch_host_unready(h);
+
+	started = fetchers[fetch->fetcherd].ops.start(fetch->fetcher_handle);
+	if (!started) {
+		fetch_queue_insert(fetch); /* Put it back on the end of its class */
 	} else {
 		RING_INSERT(fetch_ring, fetch);
 		fetch->fetch_is_active = true;
-		return true;
+		h->active++;
+		fetch_active_count++;
+		if (h->multiplexed) {
+			fetch_stream_count++;
+		} else {
+			fetch_connection_count++;
+		}
 	}
+
+	fetch_host_update(h);
+
+	return started;
 }
 
 /**
  * Choose and dispatch a single job. Return false if we failed to dispatch
  * anything.
  *
- * We don't check the overall dispatch size here because we're not called unless
- * there is room in the fetch queue for us.
+ * The overall dispatch size is checked by the caller, which indicates
+ * whether a fetch needing its own connection may be started. Fetches
+ * to multiplexed hosts only consume a stream on an existing connection
+ * and are limited separately.
+ *
+ * \param connection_available true if a fetch may open a new connection.
+ * \param stream_available true if a fetch may use a multiplexed stream.
  */
-static bool fetch_choose_and_dispatch(void)
-{
-	bool same_host;
-	struct fetch *queueitem;
-	queueitem = queue_ring;
-	do {
-		/* We can dispatch the selected item if there is room in the
-		 * fetch ring
-		 */
-		int countbyhost;
-		RING_COUNTBYLWCHOST(struct fetch, fetch_ring, countbyhost,
-				    queueitem->host);
-		if (countbyhost < nsoption_int(max_fetchers_per_host)) {
-			/* We can dispatch this item in theory */
-			return fetch_dispatch_job(queueitem);
-		}
-		/* skip over other items with the same host */
-		same_host = true;
-		while (same_host == true && queueitem->r_next != queue_ring) {
-			if (lwc_string_isequal(queueitem->host,
-					       queueitem->r_next->host, &same_host) ==
-			    lwc_error_ok && same_host == true) {
-				queueitem = queueitem->r_next;
-			}
-		}
-		queueitem = queueitem->r_next;
-	} while (queueitem != queue_ring);
-	return false;
-}
-
-static void dump_rings(void)
+static bool
+fetch_choose_and_dispatch(bool connection_available, bool stream_available)
 {
-	struct fetch *q;
-	struct fetch *f;
+	struct fetch_host *h;
+	int priority;
 
-	q = queue_ring;
-	if (q) {
-		do {
-			NSLOG(fetch, DEBUG, "queue_ring: %s",
-			      nsurl_access(q->url));
-			q = q->r_next;
-		} while (q != queue_ring);
-	}
-	f = fetch_ring;
-	if (f) {
-		do {
-			NSLOG(fetch, DEBUG, "fetch_ring: %s",
-			      nsurl_access(f->url));
-			f = f->r_next;
-		} while (f != fetch_ring);
+	for (priority = 0; priority < PRIORITY_COUNT; priority++) {
+		h = NULL;
+		if (stream_available) {
+			h = fetch_ready[true][priority];
+		}
+		if ((h == NULL) && connection_available) {
+			h = fetch_ready[false][priority];
+		}
+		if (h != NULL) {
+			return fetch_dispatch_job(h->queue[priority]);
+		}
 	}
+	return false;
 }
 
 /**
@@ -230,50 +492,85 @@ static void dump_rings(void)
  */
 static bool fetch_dispatch_jobs(void)
 {
-	int all_active;
-	int all_queued;
-
-	RING_GETSIZE(struct fetch, queue_ring, all_queued);
-	RING_GETSIZE(struct fetch, fetch_ring, all_active);
-
 	NSLOG(fetch, DEBUG,
-	      "queue_ring %i, fetch_ring %i",
-	      all_queued,
-	      all_active);
-	dump_rings();
-
-	while ((all_queued != 0) &&
-	       (all_active < nsoption_int(max_fetchers)) &&
-	       fetch_choose_and_dispatch()) {
-			all_queued--;
-			all_active++;
+	      "queued %i, active %i, connections %i, streams %i",
+	      fetch_queued_count,
+	      fetch_active_count,
+	      fetch_connection_count,
+	      fetch_stream_count);
+
+	while ((fetch_queued_count != 0) &&
+	       fetch_choose_and_dispatch(
+		       fetch_connection_count < nsoption_int(max_fetchers),
+		       fetch_stream_count < nsoption_int(max_streams))) {
 			NSLOG(fetch, DEBUG,
 			      "%d queued, %d fetching",
-			      all_queued,
-			      all_active);
+			      fetch_queued_count,
+			      fetch_active_count);
 	}
 
-	NSLOG(fetch, DEBUG, "Fetch ring is now %d elements.", all_active);
-	NSLOG(fetch, DEBUG, "Queue ring is now %d elements.", all_queued);
+	NSLOG(fetch, DEBUG, "Fetch ring is now %d elements.",
+	      fetch_active_count);
+	NSLOG(fetch, DEBUG, "Queue is now %d elements.", fetch_queued_count);
 
-	return (all_active > 0);
+	return (fetch_active_count > 0);
 }
 
-static void fetcher_poll(void *unused)
+/**
+ * Determine if a fetcher is run by descriptor events instead of polling.
+ */
+static inline bool fetch_fetcher_evented(int fetcherd)
+{
+	return fetch_events_enabled &&
+		(fetchers[fetcherd].ops.fd_ready != NULL);
+}
+
+/**
+ * Poll the fetchers which are not run by descriptor events.
+ */
+static void fetch_poll_fetchers(void)
 {
 	int fetcherd;
 
-	if (fetch_dispatch_jobs()) {
-		NSLOG(fetch, DEBUG, "Polling fetchers");
-		for (fetcherd = 0; fetcherd < MAX_FETCHERS; fetcherd++) {
-			if (fetchers[fetcherd].refcount > 0) {
-				/* fetcher present */
-				fetchers[fetcherd].ops.poll(fetchers[fetcherd].scheme);
-			}
+	NSLOG(fetch, DEBUG, "Polling fetchers");
+	for (fetcherd = 0; fetcherd < MAX_FETCHERS; fetcherd++) {
+		if ((fetchers[fetcherd].refcount > 0) &&
+		    !fetch_fetcher_evented(fetcherd)) {
+			/* fetcher present */
+			fetchers[fetcherd].ops.poll(fetchers[fetcherd].scheme);
 		}
+	}
+}
 
-		/* schedule active fetchers to run again in 10ms */
-		guit->misc->schedule(SCHEDULE_TIME, fetcher_poll, NULL);
+/**
+ * Determine if any active fetch needs its fetcher polled.
+ */
+static bool fetch_need_poll(void)
+{
+	struct fetch *f = fetch_ring;
+
+	if (f != NULL) {
+		do {
+			if (!fetch_fetcher_evented(f->fetcherd)) {
+				return true;
+			}
+			f = f->r_next;
+		} while (f != fetch_ring);
+	}
+	return false;
+}
+
+static void fetcher_poll(void *unused)
+{
+	if (fetch_dispatch_jobs()) {
+		fetch_poll_fetchers();
+
+		/* schedule active fetchers to run again in 10ms, fetchers
+		 * run by descriptor events do not need it.
+		 */
+		if (fetch_need_poll()) {
+			guit->misc->schedule(SCHEDULE_TIME, fetcher_poll, NULL);
+		}
 	}
 }
 
@@ -315,6 +612,14 @@ nserror fetcher_init(void)
 
 	ret = fetch_javascript_register();
 
+#ifdef HAVE_EPOLL
+	fetch_epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+	if (fetch_epoll_fd == -1) {
+		NSLOG(fetch, INFO, "Unable to create epoll set: %s",
+		      strerror(errno));
+	}
+#endif
+
 	return ret;
 }
 
@@ -322,6 +627,7 @@ nserror fetcher_init(void)
 void fetcher_quit(void)
 {
 	int fetcherd; /* fetcher index */
+	int idx;
 	for (fetcherd = 0; fetcherd < MAX_FETCHERS; fetcherd++) {
 		if (fetchers[fetcherd].refcount > 1) {
 			/* fetcher still has reference at quit. This
@@ -350,6 +656,27 @@ void fetcher_quit(void)
 			fetch_unref_fetcher(fetcherd);
 		}
 	}
+
+	for (idx = 0; idx < HOST_TABLE_SIZE; idx++) {
+		while (fetch_hosts[idx] != NULL) {
+			struct fetch_host *h = fetch_hosts[idx];
+			fetch_hosts[idx] = h->next;
+			if (h->origin != NULL) {
+				lwc_string_unref(h->origin);
+			}
+			free(h);
+		}
+	}
+	memset(fetch_ready, 0, sizeof(fetch_ready));
+	fetch_stream_count = 0;
+
+#ifdef HAVE_EPOLL
+	if (fetch_epoll_fd != -1) {
+		close(fetch_epoll_fd);
+		fetch_epoll_fd = -1;
+	}
+#endif
+	fetch_events_enabled = false;
 }
 
 /* exported interface documented in content/fetchers.h */
@@ -396,14 +723,7 @@ fetch_fdset(fd_set *read_fd_set,
 		return NSERROR_OK;
 	}
 
-	NSLOG(fetch, DEBUG, "Polling fetchers");
-
-	for (fetcherd = 0; fetcherd < MAX_FETCHERS; fetcherd++) {
-		if (fetchers[fetcherd].refcount > 0) {
-			/* fetcher present */
-			fetchers[fetcherd].ops.poll(fetchers[fetcherd].scheme);
-		}
-	}
+	fetch_poll_fetchers();
 
 	FD_ZERO(read_fd_set);
 	FD_ZERO(write_fd_set);
@@ -444,6 +764,145 @@ fetch_fdset(fd_set *read_fd_set,
 	return NSERROR_OK;
 }
 
+/* exported interface documented in content/fetch.h */
+nserror fetch_event_fd(int *fd_out)
+{
+#ifdef HAVE_EPOLL
+	int fetcherd;
+
+	if (fetch_epoll_fd == -1) {
+		return NSERROR_NOT_IMPLEMENTED;
+	}
+
+	if (!fetch_events_enabled) {
+		NSLOG(fetch, INFO, "Fetchers now run by descriptor events");
+		fetch_events_enabled = true;
+
+		/* timeouts which passed while polled must be processed */
+		for (fetcherd = 0; fetcherd < MAX_FETCHERS; fetcherd++) {
+			if ((fetchers[fetcherd].refcount > 0) &&
+			    (fetchers[fetcherd].ops.fd_ready != NULL)) {
+				fetchers[fetcherd].ops.fd_ready(
+					fetchers[fetcherd].scheme, -1, 0);
+			}
+		}
+	}
+
+	*fd_out = fetch_epoll_fd;
+
+	return NSERROR_OK;
+#else
+	return NSERROR_NOT_IMPLEMENTED;
+#endif
+}
+
+/* exported interface documented in content/fetch.h */
+nserror fetch_event_process(void)
+{
+#ifdef HAVE_EPOLL
+	struct epoll_event events[EVENT_BATCH];
+	int count;
+	int idx;
+
+	if (!fetch_events_enabled) {
+		return NSERROR_INVALID;
+	}
+
+	count = epoll_wait(fetch_epoll_fd, events, EVENT_BATCH, 0);
+	if (count == -1) {
+		if (errno == EINTR) {
+			return NSERROR_OK;
+		}
+		NSLOG(fetch, INFO, "epoll_wait failed: %s", strerror(errno));
+		return NSERROR_INVALID;
+	}
+
+	for (idx = 0; idx < count; idx++) {
+		int fetcherd = events[idx].data.u64 >> 32;
+		int fd = (int)(uint32_t)events[idx].data.u64;
+		unsigned int ready = FETCHER_FD_NONE;
+
+		if ((events[idx].events & (EPOLLIN | EPOLLHUP)) != 0) {
+			ready |= FETCHER_FD_READ;
+		}
+		if ((events[idx].events & EPOLLOUT) != 0) {
+			ready |= FETCHER_FD_WRITE;
+		}
+		if ((events[idx].events & EPOLLERR) != 0) {
+			ready |= FETCHER_FD_ERROR;
+		}
+
+		if ((fetchers[fetcherd].refcount > 0) &&
+		    (fetchers[fetcherd].ops.fd_ready != NULL)) {
+			fetchers[fetcherd].ops.fd_ready(
+				fetchers[fetcherd].scheme, fd, ready);
+		}
+	}
+
+	return NSERROR_OK;
+#else
+	return NSERROR_NOT_IMPLEMENTED;
+#endif
+}
+
+/* exported interface documented in content/fetchers.h */
+nserror fetcher_fd_watch(lwc_string *scheme, int fd, unsigned int events)
+{
+#ifdef HAVE_EPOLL
+	struct epoll_event ev;
+	int fetcherd;
+	int res;
+
+	if (fetch_epoll_fd == -1) {
+		return NSERROR_NOT_IMPLEMENTED;
+	}
+
+	if (events == FETCHER_FD_NONE) {
+		/* the descriptor may already have been closed */
+		res = epoll_ctl(fetch_epoll_fd, EPOLL_CTL_DEL, fd, NULL);
+		if ((res == -1) && (errno != ENOENT) && (errno != EBADF)) {
+			NSLOG(fetch, INFO, "Unable to remove fd %d: %s",
+			      fd, strerror(errno));
+		}
+		return NSERROR_OK;
+	}
+
+	fetcherd = get_fetcher_for_scheme(scheme);
+	if (fetcherd == -1) {
+		return NSERROR_NO_FETCH_HANDLER;
+	}
+
+	ev.events = 0;
+	if ((events & FETCHER_FD_READ) != 0) {
+		ev.events |= EPOLLIN;
+	}
+	if ((events & FETCHER_FD_WRITE) != 0) {
+		ev.events |= EPOLLOUT;
+	}
+	ev.data.u64 = ((uint64_t)fetcherd << 32) | (uint32_t)fd;
+
+	res = epoll_ctl(fetch_epoll_fd, EPOLL_CTL_MOD, fd, &ev);
+	if ((res == -1) && (errno == ENOENT)) {
+		res = epoll_ctl(fetch_epoll_fd, EPOLL_CTL_ADD, fd, &ev);
+	}
+	if (res == -1) {
+		NSLOG(fetch, INFO, "Unable to watch fd %d: %s",
+		      fd, strerror(errno));
+		return NSERROR_INVALID;
+	}
+
+	return NSERROR_OK;
+#else
+	return NSERROR_NOT_IMPLEMENTED;
+#endif
+}
+
+/* exported interface documented in content/fetchers.h */
+bool fetcher_fd_events(void)
+{
+	return fetch_events_enabled;
+}
+
 /* exported interface documented in content/fetch.h */
 nserror
 fetch_start(nsurl *url,
@@ -456,6 +915,7 @@ fetch_start(nsurl *url,
 	    bool verifiable,
 	    bool downgrade_tls,
 	    const char *headers[],
+	    fetch_priority priority,
 	    struct fetch **fetch_out)
 {
 	struct fetch *fetch;
@@ -487,13 +947,19 @@ fetch_start(nsurl *url,
 	fetch->verifiable = verifiable;
 	fetch->p = p;
 	fetch->http_code = 0;
+	fetch->wire_size = 0;
+	fetch->decoded_size = 0;
+	fetch->priority = priority;
 	fetch->r_prev = NULL;
 	fetch->r_next = NULL;
 	fetch->referer = NULL;
 	fetch->send_referer = false;
 	fetch->fetcher_handle = NULL;
 	fetch->fetch_is_active = false;
-	fetch->host = nsurl_get_component(url, NSURL_HOST);
+	if (fetch_origin(url, &fetch->origin) != NSERROR_OK) {
+		/* accounted with the fetches which have no host */
+		fetch->origin = NULL;
+	}
 
 	if (referer != NULL) {
 		lwc_string *ref_scheme;
@@ -538,6 +1004,22 @@ fetch_start(nsurl *url,
 	/* these aren't needed past here */
 	lwc_string_unref(scheme);
 
+	/* account the fetch against its host */
+	fetch->host_entry = fetch_host_find(fetch->origin, true);
+	if (fetch->host_entry == NULL) {
+		if (fetch->origin != NULL)
+			lwc_string_unref(fetch->origin);
+
+		nsurl_unref(fetch->url);
+
+		if (fetch->referer != NULL)
+			nsurl_unref(fetch->referer);
+
+		free(fetch);
+
+		return NSERROR_NOMEM;
+	}
+
 	/* try and set up the fetch */
 	fetch->fetcher_handle = fetchers[fetch->fetcherd].ops.setup(fetch, url,
 						only_2xx, downgrade_tls,
@@ -545,8 +1027,11 @@ fetch_start(nsurl *url,
 						headers);
 	if (fetch->fetcher_handle == NULL) {
 
-		if (fetch->host != NULL)
-			lwc_string_unref(fetch->host);
+		/* drops the host entry if it is otherwise unused */
+		fetch_host_update(fetch->host_entry);
+
+		if (fetch->origin != NULL)
+			lwc_string_unref(fetch->origin);
 
 		if (fetch->url != NULL)
 			nsurl_unref(fetch->url);
@@ -567,7 +1052,7 @@ fetch_start(nsurl *url,
 	fetch_ref_fetcher(fetch->fetcherd);
 
 	/* Dump new fetch in the queue. */
-	RING_INSERT(queue_ring, fetch);
+	fetch_queue_insert(fetch);
 
 	/* Ask the queue to run. */
 	if (fetch_dispatch_jobs()) {
@@ -590,6 +1075,29 @@ void fetch_abort(struct fetch *f)
 	fetchers[f->fetcherd].ops.abort(f->fetcher_handle);
 }
 
+/* exported interface documented in content/fetch.h */
+void fetch_set_priority(struct fetch *fetch, fetch_priority priority)
+{
+	assert(fetch);
+
+	if (fetch->priority == priority) {
+		return;
+	}
+
+	NSLOG(fetch, DEBUG, "fetch %p priority %d to %d",
+	      fetch, fetch->priority, priority);
+
+	if (!fetch->fetch_is_active && (fetch->host_entry != NULL)) {
+		/* still queued */
+		fetch_queue_remove(fetch);
+		fetch->priority = priority;
+		fetch_queue_insert(fetch);
+		fetch_host_update(fetch->host_entry);
+	} else {
+		fetch->priority = priority;
+	}
+}
+
 /* exported interface documented in content/fetch.h */
 void fetch_free(struct fetch *f)
 {
@@ -602,12 +1110,17 @@ void fetch_free(struct fetch *f)
 
 	fetch_unref_fetcher(f->fetcherd);
 
+	if (fetch_events_enabled && (fetch_queued_count > 0)) {
+		/* nothing polls to dispatch the queue in event mode */
+		guit->misc->schedule(0, fetcher_poll, NULL);
+	}
+
 	nsurl_unref(f->url);
 	if (f->referer != NULL) {
 		nsurl_unref(f->referer);
 	}
-	if (f->host != NULL) {
-		lwc_string_unref(f->host);
+	if (f->origin != NULL) {
+		lwc_string_unref(f->origin);
 	}
 	free(f);
 }
@@ -646,6 +1159,15 @@ long fetch_http_code(struct fetch *fetch)
 	return fetch->http_code;
 }
 
+/* exported interface documented in content/fetch.h */
+void fetch_transfer_size(struct fetch *fetch,
+			 uint64_t *wire_size,
+			 uint64_t *decoded_size)
+{
+	*wire_size = fetch->wire_size;
+	*decoded_size = fetch->decoded_size;
+}
+
 
 /* exported interface documented in content/fetch.h */
 struct fetch_multipart_data *
@@ -741,27 +1263,38 @@ fetch_send_callback(const fetch_msg *msg, struct fetch *fetch)
 /* exported interface documented in content/fetch.h */
 void fetch_remove_from_queues(struct fetch *fetch)
 {
-	int all_active;
-	int all_queued;
+	struct fetch_host *h = fetch->host_entry;
 
 	NSLOG(fetch, DEBUG,
 	      "Fetch %p, fetcher %p can be freed",
 	      fetch,
 	      fetch->fetcher_handle);
 
+	if (h == NULL) {
+		/* already removed */
+		return;
+	}
+
 	/* Go ahead and free the fetch properly now */
 	if (fetch->fetch_is_active) {
 		RING_REMOVE(fetch_ring, fetch);
+		h->active--;
+		fetch_active_count--;
+		if (h->multiplexed) {
+			fetch_stream_count--;
+		} else {
+			fetch_connection_count--;
+		}
 	} else {
-		RING_REMOVE(queue_ring, fetch);
+		fetch_queue_remove(fetch);
 	}
 
+	fetch->host_entry = NULL;
+	fetch_host_update(h);
 
-	RING_GETSIZE(struct fetch, fetch_ring, all_active);
-	RING_GETSIZE(struct fetch, queue_ring, all_queued);
-
-	NSLOG(fetch, DEBUG, "Fetch ring is now %d elements.", all_active);
-	NSLOG(fetch, DEBUG, "Queue ring is now %d elements.", all_queued);
+	NSLOG(fetch, DEBUG, "Fetch ring is now %d elements.",
+	      fetch_active_count);
+	NSLOG(fetch, DEBUG, "Queue is now %d elements.", fetch_queued_count);
 }
 
 
@@ -773,6 +1306,38 @@ void fetch_set_http_code(struct fetch *fetch, long http_code)
 	fetch->http_code = http_code;
 }
 
+/* exported interface documented in content/fetch.h */
+void fetch_set_transfer_size(struct fetch *fetch,
+			     uint64_t wire_size,
+			     uint64_t decoded_size)
+{
+	fetch->wire_size = wire_size;
+	fetch->decoded_size = decoded_size;
+}
+
+/* exported interface documented in content/fetch.h */
+void fetch_set_host_multiplexed(struct fetch *fetch)
+{
+	struct fetch_host *h;
+
+	assert(fetch);
+
+	h = fetch->host_entry;
+	if ((h == NULL) || h->multiplexed) {
+		return;
+	}
+
+	NSLOG(fetch, INFO, "Host %s multiplexes fetches",
+	      h->origin != NULL ? lwc_string_data(h->origin) : "");
+
+	/* the host's active fetches now share a connection */
+	fetch_connection_count -= h->active;
+	fetch_stream_count += h->active;
+	h->multiplexed = true;
+
+	fetch_host_update(h);
+}
+
 /* exported interface documented in content/fetch.h */
 const char *fetch_get_referer_to_send(struct fetch *fetch)
 {
@@ -24,6 +24,7 @@
 #define _NETSURF_DESKTOP_FETCH_H_
 
 #include <stdbool.h>
+#include <stdint.h>
 
 #include "utils/config.h"
 #include "utils/nsurl.h"
@@ -33,6 +34,20 @@ struct content;
 struct fetch;
 struct ssl_cert_info;
 
+/**
+ * Fetch priority classes.
+ *
+ * Queued fetches are dispatched in this order, most urgent first, and
+ * in the order they were started within a class.
+ */
+typedef enum {
+	FETCH_PRIORITY_DOCUMENT = 0, /**< Top level documents and frames */
+	FETCH_PRIORITY_BLOCKING, /**< Render blocking stylesheets and scripts */
+	FETCH_PRIORITY_VISIBLE, /**< Objects visible to the user */
+	FETCH_PRIORITY_NORMAL, /**< Everything not otherwise classified */
+	FETCH_PRIORITY_PREFETCH, /**< Speculative and decorative fetches */
+} fetch_priority;
+
 typedef enum {
 	FETCH_PROGRESS,
 	FETCH_HEADER,
@@ -125,6 +140,7 @@ typedef void (*fetch_callback)(const fetch_msg *msg, void *p);
  * \param verifiable
  * \param downgrade_tls
  * \param headers
+ * \param priority The priority class of the fetch.
  * \param fetch_out ponter to recive new fetch object.
  * \return NSERROR_OK and fetch_out updated else appropriate error code
  */
@@ -132,7 +148,19 @@ nserror fetch_start(nsurl *url, nsurl *referer, fetch_callback callback,
 		    void *p, bool only_2xx, const char *post_urlenc,
 		    const struct fetch_multipart_data *post_multipart,
 		    bool verifiable, bool downgrade_tls,
-		    const char *headers[], struct fetch **fetch_out);
+		    const char *headers[], fetch_priority priority,
+		    struct fetch **fetch_out);
+
+/**
+ * Change the priority of a fetch.
+ *
+ * A queued fetch is moved behind the other queued fetches of its new
+ * priority class. An active fetch is unaffected.
+ *
+ * \param fetch The fetch to change.
+ * \param priority The new priority class.
+ */
+void fetch_set_priority(struct fetch *fetch, fetch_priority priority);
 
 /**
  * Abort a fetch.
@@ -158,6 +186,20 @@ void fetch_change_callback(struct fetch *fetch, fetch_callback callback, void *p
  */
 long fetch_http_code(struct fetch *fetch);
 
+/**
+ * Get the size of the body transferred by a finished fetch.
+ *
+ * Both sizes are zero if the fetcher does not report them.
+ *
+ * \param fetch The fetch to examine.
+ * \param wire_size Updated with the body bytes received before any
+ *                  content coding is removed.
+ * \param decoded_size Updated with the body bytes after decoding.
+ */
+void fetch_transfer_size(struct fetch *fetch,
+			 uint64_t *wire_size,
+			 uint64_t *decoded_size);
+
 
 /**
  * Free a linked list of fetch_multipart_data.
@@ -194,6 +236,33 @@ void fetch_free(struct fetch *f);
  */
 void fetch_set_http_code(struct fetch *fetch, long http_code);
 
+/**
+ * set the size of the body transferred by a fetch
+ *
+ * Fetchers call this before sending FETCH_FINISHED.
+ *
+ * \param fetch The fetch which has finished.
+ * \param wire_size The body bytes received before content decoding.
+ * \param decoded_size The body bytes after content decoding.
+ */
+void fetch_set_transfer_size(struct fetch *fetch,
+			     uint64_t wire_size,
+			     uint64_t decoded_size);
+
+/**
+ * record that the host of a fetch multiplexes fetches
+ *
+ * Fetchers call this once they know a fetch is multiplexed over a
+ * shared connection (e.g. HTTP/2). Such hosts are scheduled by
+ * max_streams_per_host rather than max_fetchers_per_host until they
+ * have no fetches. Responses which are not multiplexed do not change
+ * this as fetches started before the shared connection was
+ * established may still arrive over connections of their own.
+ *
+ * \param fetch The fetch whose host is being described.
+ */
+void fetch_set_host_multiplexed(struct fetch *fetch);
+
 /**
  * get the referer from the fetch
  */
@@ -230,4 +299,33 @@ void fetch_set_cookie(struct fetch *fetch, const char *data);
  */
 nserror fetch_fdset(fd_set *read_fd_set, fd_set *write_fd_set, fd_set *except_fd_set, int *maxfd);
 
+/**
+ * Get a file descriptor to wait on for fetcher activity.
+ *
+ * This is an alternative to fetch_fdset() for frontends which can wait
+ * on a descriptor in their main loop. The fetchers register the
+ * descriptors they use with the fetch system as they change, so there
+ * is no set to rebuild on each iteration.
+ *
+ * Once this has been called, fetchers which support descriptor events
+ * are no longer polled. The caller must call fetch_event_process()
+ * whenever the returned descriptor becomes readable and should not
+ * continue to use fetch_fdset().
+ *
+ * \param[out] fd_out The file descriptor which becomes readable when
+ *                    fetchers have activity.
+ * \return NSERROR_OK on success, NSERROR_NOT_IMPLEMENTED if this is not
+ *         available in which case fetch_fdset() must be used.
+ */
+nserror fetch_event_fd(int *fd_out);
+
+/**
+ * Process fetcher activity on the descriptor from fetch_event_fd().
+ *
+ * Only the fetcher file descriptors which are ready are serviced.
+ *
+ * \return NSERROR_OK on success or appropriate error code.
+ */
+nserror fetch_event_process(void);
+
 #endif
@@ -32,6 +32,16 @@ struct nsurl;
 struct fetch_multipart_data;
 struct fetch;
 
+/**
+ * File descriptor events a fetcher may wait upon.
+ */
+enum fetcher_fd_event {
+	FETCHER_FD_NONE = 0, /**< descriptor is no longer of interest */
+	FETCHER_FD_READ = 1, /**< descriptor readable */
+	FETCHER_FD_WRITE = 2, /**< descriptor writable */
+	FETCHER_FD_ERROR = 4, /**< descriptor has an error condition */
+};
+
 /**
  * Fetcher operations API
  *
@@ -96,6 +106,19 @@ struct fetcher_operation_table {
 	int (*fdset)(lwc_string *scheme, fd_set *read_set, fd_set *write_set,
 		     fd_set *error_set);
 
+	/**
+	 * make progress on a file descriptor with pending events.
+	 *
+	 * Optional. A fetcher providing this registers the descriptors
+	 * it is waiting on with fetcher_fd_watch() and is not polled
+	 * while the frontend is waiting for descriptor events.
+	 *
+	 * \param scheme The scheme the fetcher was registered for.
+	 * \param fd The descriptor or -1 to process expired timeouts.
+	 * \param events The fetcher_fd_event flags which are ready.
+	 */
+	void (*fd_ready)(lwc_string *scheme, int fd, unsigned int events);
+
 	/**
 	 * Finalise the fetcher.
 	 */
@@ -113,6 +136,32 @@ struct fetcher_operation_table {
 nserror fetcher_add(lwc_string *scheme, const struct fetcher_operation_table *ops);
 
 
+/**
+ * Change the events a fetcher is waiting on for a file descriptor.
+ *
+ * Fetchers providing the fd_ready operation call this as the set of
+ * descriptors they use changes. Once the frontend waits on these
+ * events the fetcher's fd_ready operation is called when they occur.
+ *
+ * \param scheme The scheme the fetcher was registered for.
+ * \param fd The file descriptor.
+ * \param events The fetcher_fd_event flags to wait for or
+ *               FETCHER_FD_NONE to stop watching the descriptor.
+ * \return NSERROR_OK on success, NSERROR_NOT_IMPLEMENTED if descriptor
+ *         events are unavailable or appropriate error code.
+ */
+nserror fetcher_fd_watch(lwc_string *scheme, int fd, unsigned int events);
+
+
+/**
+ * Determine if fetchers are driven by file descriptor events.
+ *
+ * \return true if the frontend is waiting on descriptor events and
+ *         fetchers providing fd_ready are not being polled.
+ */
+bool fetcher_fd_events(void);
+
+
 /**
  * Initialise all registered fetchers.
  *
@@ -40,6 +40,7 @@
 #include "content/fetch.h"
 #include "content/fetchers.h"
 #include "content/fetchers/about.h"
+#include "content/llcache.h"
 #include "image/image_cache.h"
 
 
@@ -288,6 +289,134 @@ fetch_about_imagecache_handler_aborted:
 	return false;
 }
 
+/** Handler to generate about:llcache page */
+static bool fetch_about_llcache_handler(struct fetch_about_context *ctx)
+{
+	fetch_msg msg;
+	char buffer[2048]; /* output buffer */
+	int code = 200;
+	int slen;
+	unsigned int cent_loop = 0;
+	int res = 0;
+
+	/* content is going to return ok */
+	fetch_set_http_code(ctx->fetchh, code);
+
+	/* content type */
+	if (fetch_about_send_header(ctx, "Content-Type: text/html"))
+		goto fetch_about_llcache_handler_aborted;
+
+	msg.type = FETCH_DATA;
+	msg.data.header_or_data.buf = (const uint8_t *) buffer;
+
+	/* page head */
+	slen = snprintf(buffer, sizeof buffer,
+			"<html>\n<head>\n"
+			"<title>NetSurf Browser Source Cache Status</title>\n"
+			"<link rel=\"stylesheet\" type=\"text/css\" "
+			"href=\"resource:internal.css\">\n"
+			"</head>\n"
+			"<body id =\"cachelist\">\n"
+			"<p class=\"banner\">"
+			"<a href=\"http://www.netsurf-browser.org/\">"
+			"<img src=\"resource:netsurf.png\" alt=\"NetSurf\"></a>"
+			"</p>\n"
+			"<h1>NetSurf Browser Source Cache Status</h1>\n" );
+	msg.data.header_or_data.len = slen;
+	if (fetch_about_send_callback(&msg, ctx))
+		goto fetch_about_llcache_handler_aborted;
+
+	/* source cache summary */
+	slen = llcache_snsummaryf(buffer, sizeof(buffer),
+		"<p>Configured limit of %a</p>\n"
+		"<p>Total size in use %b (%c cached and %d uncached objects)"
+				"</p>\n"
+		"<p>Fetches with a mismatched length %e</p>\n"
+		"<p>Retrievals total/RAM/disc/stale/validated/miss/uncached "
+				"(counts) %j/%k/%l/%m/%n/%o/%q "
+				"(%pj%%/%pk%%/%pl%%/%pm%%/%pn%%/%po%%/%pq%%)</p>\n"
+		"<p>Conditional requests %r of which %s not modified "
+				"(%ps%%)</p>\n"
+		"<p>Data total/RAM/disc/network (size) %t/%u/%v/%w "
+				"(%pt%%/%pu%%/%pv%%/%pw%%)</p>\n"
+		"<p>Network body received %h bytes decoded to %i bytes</p>\n"
+		"<p>Backing store written %x bytes in %yms (%z bytes/s)</p>\n"
+		"<p>Backing store identifier collisions %f, "
+				"index lookups which probed %g</p>\n"
+		"<h2>Current source cache contents</h2>\n");
+	if ((slen < 0) || (slen >= (int) (sizeof(buffer))))
+		goto fetch_about_llcache_handler_aborted; /* overflow */
+
+	msg.data.header_or_data.len = slen;
+	if (fetch_about_send_callback(&msg, ctx))
+		goto fetch_about_llcache_handler_aborted;
+
+
+	/* source cache entry table */
+	slen = snprintf(buffer, sizeof buffer,
+			"<p class=\"llcachelist\">\n"
+			"<strong>"
+			"<span>Entry</span>"
+			"<span>Size</span>"
+			"<span>Age</span>"
+			"<span>Freshness</span>"
+			"<span>Store</span>"
+			"<span>Users</span>"
+			"<span>Hits</span>"
+			"<span>List</span>"
+			"<span>URL</span>"
+			"</strong>\n");
+	do {
+		res = llcache_snentryf(buffer + slen, sizeof buffer - slen,
+				cent_loop,
+				"<a href=\"%U\">"
+				"<span>%e</span>"
+				"<span>%s</span>"
+				"<span>%as</span>"
+				"<span>%fs</span>"
+				"<span>%d</span>"
+				"<span>%u</span>"
+				"<span>%h</span>"
+				"<span>%c</span>"
+				"<span>%U</span>"
+				"</a>\n");
+		if (res <= 0)
+			break; /* last option */
+
+		if (res >= (int) (sizeof buffer - slen)) {
+			if (slen == 0) {
+				/* entry can never fit in buffer, omit it */
+				cent_loop++;
+				continue;
+			}
+			/* last entry would not fit in buffer, submit buffer */
+			msg.data.header_or_data.len = slen;
+			if (fetch_about_send_callback(&msg, ctx))
+				goto fetch_about_llcache_handler_aborted;
+			slen = 0;
+		} else {
+			/* normal addition */
+			slen += res;
+			cent_loop++;
+		}
+	} while (res > 0);
+
+	slen += snprintf(buffer + slen, sizeof buffer - slen,
+			 "</p>\n</body>\n</html>\n");
+
+	msg.data.header_or_data.len = slen;
+	if (fetch_about_send_callback(&msg, ctx))
+		goto fetch_about_llcache_handler_aborted;
+
+	msg.type = FETCH_FINISHED;
+	fetch_about_send_callback(&msg, ctx);
+
+	return true;
+
+fetch_about_llcache_handler_aborted:
+	return false;
+}
+
 /** Handler to generate about:config page */
 static bool fetch_about_config_handler(struct fetch_about_context *ctx)
 {
@@ -608,6 +737,9 @@ struct about_handlers about_handler_list[] = {
 	/* details about the image cache */
 	{ "imagecache", SLEN("imagecache"), NULL,
 			fetch_about_imagecache_handler, true },
+	/* details about the source cache */
+	{ "llcache", SLEN("llcache"), NULL,
+			fetch_about_llcache_handler, true },
 	/* The default blank page */
 	{ "blank", SLEN("blank"), NULL,
 			fetch_about_blank_handler, true }
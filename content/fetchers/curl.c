@@ -24,6 +24,12 @@
  *
  * This implementation uses libcurl's 'multi' interface.
  *
+ * The multi handle is driven with curl_multi_perform() while the fetchers
+ * are polled. When the frontend waits on descriptor events the sockets
+ * cURL reports through its socket callback are registered with the fetch
+ * layer and only those which are ready are serviced with
+ * curl_multi_socket_action().
+ *
  * The CURL handles are cached in the curl_handle_ring.
  */
 
@@ -108,6 +114,7 @@ struct curl_fetch_info {
 	long http_code; /**< HTTP result code from cURL. */
 	struct curl_httppost *post_multipart;	/**< Multipart post data, or 0. */
 	uint64_t last_progress_update;	/**< Time of last progress update */
+	uint64_t decoded_size;	/**< Bytes of decoded body passed on */
 	int cert_depth; /**< deepest certificate in use */
 	struct cert_info cert_data[MAX_CERTS];	/**< HTTPS certificate data */
 };
@@ -133,6 +140,9 @@ static struct cache_handle *curl_handle_ring = 0;
 /** Count of how many schemes the curl fetcher is handling */
 static int curl_fetchers_registered = 0;
 
+/** Scheme the cURL sockets are registered with the fetch layer under */
+static lwc_string *curl_fd_scheme = NULL;
+
 /** Flag for runtime detection of openssl usage */
 static bool curl_with_openssl;
 
@@ -177,6 +187,8 @@ static bool fetch_curl_initialise(lwc_string *scheme)
 }
 
 
+static void fetch_curl_timeout(void *p);
+
 /**
  * Finalise a cURL fetcher.
  *
@@ -202,6 +214,12 @@ static void fetch_curl_finalise(lwc_string *scheme)
 			NSLOG(netsurf, INFO,
 			      "curl_multi_cleanup failed: ignoring");
 
+		guit->misc->schedule(-1, fetch_curl_timeout, NULL);
+		if (curl_fd_scheme != NULL) {
+			lwc_string_unref(curl_fd_scheme);
+			curl_fd_scheme = NULL;
+		}
+
 		curl_global_cleanup();
 	}
 
@@ -355,6 +373,7 @@ fetch_curl_setup(struct fetch *parent_fetch,
 	fetch->had_headers = false;
 	fetch->abort = false;
 	fetch->stopped = false;
+	fetch->decoded_size = 0;
 	fetch->only_2xx = only_2xx;
 	fetch->downgrade_tls = downgrade_tls;
 	fetch->headers = NULL;
@@ -877,6 +896,34 @@ static void fetch_curl_free(void *vf)
 }
 
 
+/**
+ * Obtain the HTTP status code of a fetch and inform the fetch layer.
+ *
+ * The fetch layer is also told if the response arrived on a
+ *  multiplexed connection so further fetches to the host can share it.
+ */
+static void fetch_curl_get_http_code(struct curl_fetch_info *f)
+{
+	CURLcode code;
+#if LIBCURL_VERSION_NUM >= 0x073200
+	long http_version;
+#endif
+
+	code = curl_easy_getinfo(f->curl_handle, CURLINFO_HTTP_CODE,
+				 &f->http_code);
+	fetch_set_http_code(f->fetch_handle, f->http_code);
+	assert(code == CURLE_OK);
+
+#if LIBCURL_VERSION_NUM >= 0x073200
+	code = curl_easy_getinfo(f->curl_handle, CURLINFO_HTTP_VERSION,
+				 &http_version);
+	if ((code == CURLE_OK) && (http_version >= CURL_HTTP_VERSION_2_0)) {
+		fetch_set_host_multiplexed(f->fetch_handle);
+	}
+#endif
+}
+
+
 /**
  * Find the status code and content type and inform the caller.
  *
@@ -885,16 +932,12 @@ static void fetch_curl_free(void *vf)
 static bool fetch_curl_process_headers(struct curl_fetch_info *f)
 {
 	long http_code;
-	CURLcode code;
 	fetch_msg msg;
 
 	f->had_headers = true;
 
 	if (!f->http_code) {
-		code = curl_easy_getinfo(f->curl_handle, CURLINFO_HTTP_CODE,
-					 &f->http_code);
-		fetch_set_http_code(f->fetch_handle, f->http_code);
-		assert(code == CURLE_OK);
+		fetch_curl_get_http_code(f);
 	}
 	http_code = f->http_code;
 	NSLOG(netsurf, INFO, "HTTP status code %li", http_code);
@@ -1047,6 +1090,44 @@ curl_start_cert_validate(struct curl_fetch_info *f,
 	fetch_send_callback(&msg, f->fetch_handle);
 }
 
+/**
+ * Report the bytes transferred by a completed fetch to the fetch layer.
+ *
+ * The body received from the network is counted before any content
+ * coding is removed, so compares with the decoded size passed on to
+ * show the saving from content encoding.
+ *
+ * \param f The fetch which has completed.
+ */
+static void fetch_curl_record_stats(struct curl_fetch_info *f)
+{
+	uint64_t wire_size = 0;
+	CURLcode code;
+#if LIBCURL_VERSION_NUM >= 0x073700
+	curl_off_t size;
+
+	/* built against 7.55.0 or later: integer transfer size */
+	code = curl_easy_getinfo(f->curl_handle, CURLINFO_SIZE_DOWNLOAD_T, &size);
+	if ((code == CURLE_OK) && (size > 0)) {
+		wire_size = size;
+	}
+#else
+	double size;
+
+	code = curl_easy_getinfo(f->curl_handle, CURLINFO_SIZE_DOWNLOAD, &size);
+	if ((code == CURLE_OK) && (size > 0)) {
+		wire_size = size;
+	}
+#endif
+
+	NSLOG(netsurf, DEBUG,
+	      "received %"PRIu64" bytes decoded to %"PRIu64" for %s",
+	      wire_size, f->decoded_size, nsurl_access(f->url));
+
+	fetch_set_transfer_size(f->fetch_handle, wire_size, f->decoded_size);
+}
+
+
 /**
  * Handle a completed fetch (CURLMSG_DONE from curl_multi_info_read()).
  *
@@ -1072,6 +1153,10 @@ static void fetch_curl_done(CURL *curl_handle, CURLcode result)
 	abort_fetch = f->abort;
 	NSLOG(netsurf, INFO, "done %s", nsurl_access(f->url));
 
+	if (abort_fetch == false) {
+		fetch_curl_record_stats(f);
+	}
+
 	if ((abort_fetch == false) &&
 	    (result == CURLE_OK ||
 	     ((result == CURLE_WRITE_ERROR) && (f->stopped == false)))) {
@@ -1154,6 +1239,29 @@ static void fetch_curl_done(CURL *curl_handle, CURLcode result)
 }
 
 
+/**
+ * Handle the results of completed cURL transfers.
+ */
+static void fetch_curl_process_messages(void)
+{
+	int queue;
+	CURLMsg *curl_msg;
+
+	curl_msg = curl_multi_info_read(fetch_curl_multi, &queue);
+	while (curl_msg) {
+		switch (curl_msg->msg) {
+			case CURLMSG_DONE:
+				fetch_curl_done(curl_msg->easy_handle,
+						curl_msg->data.result);
+				break;
+			default:
+				break;
+		}
+		curl_msg = curl_multi_info_read(fetch_curl_multi, &queue);
+	}
+}
+
+
 /**
  * Do some work on current fetches.
  *
@@ -1161,9 +1269,8 @@ static void fetch_curl_done(CURL *curl_handle, CURLcode result)
  */
 static void fetch_curl_poll(lwc_string *scheme_ignored)
 {
-	int running, queue;
+	int running;
 	CURLMcode codem;
-	CURLMsg *curl_msg;
 
 	if (nsoption_bool(suppress_curl_debug) == false) {
 		fd_set read_fd_set, write_fd_set, exc_fd_set;
@@ -1215,19 +1322,125 @@ static void fetch_curl_poll(lwc_string *scheme_ignored)
 		}
 	} while (codem == CURLM_CALL_MULTI_PERFORM);
 
-	/* process curl results */
-	curl_msg = curl_multi_info_read(fetch_curl_multi, &queue);
-	while (curl_msg) {
-		switch (curl_msg->msg) {
-			case CURLMSG_DONE:
-				fetch_curl_done(curl_msg->easy_handle,
-						curl_msg->data.result);
-				break;
-			default:
-				break;
-		}
-		curl_msg = curl_multi_info_read(fetch_curl_multi, &queue);
+	fetch_curl_process_messages();
+}
+
+
+/**
+ * Service a socket, or expired timeouts, in descriptor event mode.
+ *
+ * \param s The ready socket or CURL_SOCKET_TIMEOUT.
+ * \param ev_bitmask The CURL_CSELECT_ flags for the socket.
+ */
+static void fetch_curl_socket_action(curl_socket_t s, int ev_bitmask)
+{
+	int running;
+	CURLMcode codem;
+
+	codem = curl_multi_socket_action(fetch_curl_multi, s,
+					 ev_bitmask, &running);
+	if (codem != CURLM_OK) {
+		NSLOG(netsurf, WARNING, "curl_multi_socket_action: %i %s",
+		      codem, curl_multi_strerror(codem));
+		return;
+	}
+
+	fetch_curl_process_messages();
+}
+
+
+/**
+ * Make progress on a socket which is ready.
+ *
+ * \param scheme_ignored The scheme the fetcher was registered for.
+ * \param fd The ready socket or -1 to process expired timeouts.
+ * \param events The fetcher_fd_event flags which are ready.
+ */
+static void
+fetch_curl_fd_ready(lwc_string *scheme_ignored, int fd, unsigned int events)
+{
+	int ev_bitmask = 0;
+
+	if (fd < 0) {
+		fetch_curl_socket_action(CURL_SOCKET_TIMEOUT, 0);
+		return;
+	}
+
+	if ((events & FETCHER_FD_READ) != 0) {
+		ev_bitmask |= CURL_CSELECT_IN;
 	}
+	if ((events & FETCHER_FD_WRITE) != 0) {
+		ev_bitmask |= CURL_CSELECT_OUT;
+	}
+	if ((events & FETCHER_FD_ERROR) != 0) {
+		ev_bitmask |= CURL_CSELECT_ERR;
+	}
+
+	fetch_curl_socket_action(fd, ev_bitmask);
+}
+
+
+/**
+ * Scheduled callback when the cURL timeout expires.
+ */
+static void fetch_curl_timeout(void *p)
+{
+	fetch_curl_socket_action(CURL_SOCKET_TIMEOUT, 0);
+}
+
+
+/**
+ * cURL socket callback.
+ *
+ * Passes changes to the sockets cURL is waiting on to the fetch layer.
+ */
+static int
+fetch_curl_socket(CURL *easy, curl_socket_t s, int what,
+		  void *userp, void *socketp)
+{
+	unsigned int events;
+
+	switch (what) {
+	case CURL_POLL_IN:
+		events = FETCHER_FD_READ;
+		break;
+
+	case CURL_POLL_OUT:
+		events = FETCHER_FD_WRITE;
+		break;
+
+	case CURL_POLL_INOUT:
+		events = FETCHER_FD_READ | FETCHER_FD_WRITE;
+		break;
+
+	default:
+		events = FETCHER_FD_NONE;
+		break;
+	}
+
+	if (curl_fd_scheme != NULL) {
+		fetcher_fd_watch(curl_fd_scheme, s, events);
+	}
+
+	return 0;
+}
+
+
+/**
+ * cURL timer callback.
+ *
+ * cURL must not be called back from within this so the timeout is
+ * serviced from the scheduler.
+ */
+static int fetch_curl_timer(CURLM *multi, long timeout_ms, void *userp)
+{
+	/* while polled curl_multi_perform deals with timeouts. A
+	 * negative timeout removes the scheduled callback.
+	 */
+	if ((timeout_ms < 0) || fetcher_fd_events()) {
+		guit->misc->schedule(timeout_ms, fetch_curl_timeout, NULL);
+	}
+	return 0;
 }
 
 
@@ -1302,15 +1515,11 @@ static int fetch_curl_ignore_debug(CURL *handle,
 static size_t fetch_curl_data(char *data, size_t size, size_t nmemb, void *_f)
 {
 	struct curl_fetch_info *f = _f;
-	CURLcode code;
 	fetch_msg msg;
 
 	/* ensure we only have to get this information once */
 	if (!f->http_code) {
-		code = curl_easy_getinfo(f->curl_handle, CURLINFO_HTTP_CODE,
-					 &f->http_code);
-		fetch_set_http_code(f->fetch_handle, f->http_code);
-		assert(code == CURLE_OK);
+		fetch_curl_get_http_code(f);
 	}
 
 	/* ignore body if this is a 401 reply by skipping it and reset
@@ -1332,6 +1541,8 @@ static size_t fetch_curl_data(char *data, size_t size, size_t nmemb, void *_f)
 	msg.data.header_or_data.len = size * nmemb;
 	fetch_send_callback(&msg, f->fetch_handle);
 
+	f->decoded_size += size * nmemb;
+
 	if (f->abort) {
 		f->stopped = true;
 		return 0;
@@ -1442,6 +1653,43 @@ static int fetch_curl_fdset(lwc_string *scheme, fd_set *read_set,
 }
 
 
+/**
+ * Get the content codings to accept.
+ *
+ * cURL decodes the response body as it is received so the data
+ * passed on is always the decoded content.
+ *
+ * \return The Accept-Encoding value, the empty string accepts every
+ *         coding this build of cURL can decode.
+ */
+static const char *fetch_curl_accept_encoding(void)
+{
+	const char *encoding = nsoption_charp(accept_encoding);
+	curl_version_info_data *data;
+
+	if ((encoding != NULL) && (encoding[0] != '\0')) {
+		NSLOG(netsurf, INFO, "accept_encoding: '%s'", encoding);
+		return encoding;
+	}
+
+	data = curl_version_info(CURLVERSION_NOW);
+	NSLOG(netsurf, INFO, "accepting cURL supported codings:%s%s%s",
+	      (data->features & CURL_VERSION_LIBZ) ? " gzip deflate" : "",
+#ifdef CURL_VERSION_BROTLI
+	      (data->features & CURL_VERSION_BROTLI) ? " br" : "",
+#else
+	      "",
+#endif
+#ifdef CURL_VERSION_ZSTD
+	      (data->features & CURL_VERSION_ZSTD) ? " zstd" : ""
+#else
+	      ""
+#endif
+		);
+
+	return "";
+}
+
 
 /* exported function documented in content/fetchers/curl.h */
 nserror fetch_curl_register(void)
@@ -1459,6 +1707,7 @@ nserror fetch_curl_register(void)
 		.free = fetch_curl_free,
 		.poll = fetch_curl_poll,
 		.fdset = fetch_curl_fdset,
+		.fd_ready = fetch_curl_fd_ready,
 		.finalise = fetch_curl_finalise
 	};
 
@@ -1492,9 +1741,31 @@ nserror fetch_curl_register(void)
 		SETOPT(CURLMOPT_MAXCONNECTS, maxconnects);
 		SETOPT(CURLMOPT_MAX_TOTAL_CONNECTIONS, maxconnects);
 		SETOPT(CURLMOPT_MAX_HOST_CONNECTIONS, nsoption_int(max_fetchers_per_host));
+#if LIBCURL_VERSION_NUM >= 0x072b00
+		/* 7.43.0 or later can multiplex fetches over HTTP/2 */
+		SETOPT(CURLMOPT_PIPELINING, CURLPIPE_MULTIPLEX);
+#endif
+#if LIBCURL_VERSION_NUM >= 0x074300
+		SETOPT(CURLMOPT_MAX_CONCURRENT_STREAMS,
+		       (long)nsoption_int(max_streams_per_host));
+#endif
 	}
 #endif
 
+	/* report sockets and timeouts for descriptor event operation */
+	{
+		CURLMcode mcode;
+
+#undef SETOPT
+#define SETOPT(option, value) \
+	mcode = curl_multi_setopt(fetch_curl_multi, option, value);	\
+	if (mcode != CURLM_OK)						\
+		goto curl_multi_setopt_failed;
+
+		SETOPT(CURLMOPT_SOCKETFUNCTION, fetch_curl_socket);
+		SETOPT(CURLMOPT_TIMERFUNCTION, fetch_curl_timer);
+	}
+
 	/* Create a curl easy handle with the options that are common to all
 	 *  fetches.
 	 */
@@ -1524,7 +1795,11 @@ nserror fetch_curl_register(void)
 	SETOPT(CURLOPT_PROGRESSFUNCTION, fetch_curl_progress);
 	SETOPT(CURLOPT_NOPROGRESS, 0);
 	SETOPT(CURLOPT_USERAGENT, user_agent_string());
-	SETOPT(CURLOPT_ENCODING, "gzip");
+#if LIBCURL_VERSION_NUM >= 0x071506
+	SETOPT(CURLOPT_ACCEPT_ENCODING, fetch_curl_accept_encoding());
+#else
+	SETOPT(CURLOPT_ENCODING, fetch_curl_accept_encoding());
+#endif
 	SETOPT(CURLOPT_LOW_SPEED_LIMIT, 1L);
 	SETOPT(CURLOPT_LOW_SPEED_TIME, 180L);
 	SETOPT(CURLOPT_NOSIGNAL, 1L);
@@ -1542,6 +1817,27 @@ nserror fetch_curl_register(void)
 		SETOPT(CURLOPT_CAPATH, nsoption_charp(ca_path));
 	}
 
+	data = curl_version_info(CURLVERSION_NOW);
+
+#if LIBCURL_VERSION_NUM >= 0x072f00
+	/* Negotiate HTTP/2 for https where the library supports it. Older
+	 *  libraries may lack nghttp2 so failure is not fatal.
+	 */
+	if (data->features & CURL_VERSION_HTTP2) {
+		code = curl_easy_setopt(fetch_blank_curl,
+				CURLOPT_HTTP_VERSION, CURL_HTTP_VERSION_2TLS);
+		if (code != CURLE_OK) {
+			NSLOG(netsurf, INFO, "Unable to enable HTTP/2");
+		}
+	}
+#endif
+#if LIBCURL_VERSION_NUM >= 0x072b00
+	/* Prefer waiting for a connection that may be multiplexed over
+	 *  opening another one to the same host.
+	 */
+	SETOPT(CURLOPT_PIPEWAIT, 1L);
+#endif
+
 	/* Detect whether the SSL CTX function API works */
 	curl_with_openssl = true;
 	code = curl_easy_setopt(fetch_blank_curl,
@@ -1555,8 +1851,6 @@ nserror fetch_curl_register(void)
 
 	/* cURL initialised okay, register the fetchers */
 
-	data = curl_version_info(CURLVERSION_NOW);
-
 	for (i = 0; data->protocols[i]; i++) {
 		if (strcmp(data->protocols[i], "http") == 0) {
 			scheme = lwc_string_ref(corestring_lwc_http);
@@ -1573,6 +1867,9 @@ nserror fetch_curl_register(void)
 			NSLOG(netsurf, INFO,
 			      "Unable to register cURL fetcher for %s",
 			      data->protocols[i]);
+		} else if (curl_fd_scheme == NULL) {
+			/* all the schemes share the multi handle */
+			curl_fd_scheme = lwc_string_ref(scheme);
 		}
 	}
 
@@ -1582,9 +1879,7 @@ curl_easy_setopt_failed:
 	NSLOG(netsurf, INFO, "curl_easy_setopt failed.");
 	return NSERROR_INIT_FAILED;
 
-#if LIBCURL_VERSION_NUM >= 0x071e00
 curl_multi_setopt_failed:
 	NSLOG(netsurf, INFO, "curl_multi_setopt failed.");
 	return NSERROR_INIT_FAILED;
-#endif
 }
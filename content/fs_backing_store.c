@@ -22,17 +22,18 @@
  *
  * file based backing store.
  *
- * \todo Consider improving eviction sorting to include objects size
+ * \todo Consider improving eviction ordering to include objects size
  *         and remaining lifetime and other cost metrics.
  *
- * \todo Implement mmap retrieval where supported.
- *
  * \todo Implement static retrieval for metadata objects as their heap
  *         lifetime is typically very short, though this may be obsoleted
  *         by a small object storage strategy.
  *
  */
 
+#include "utils/config.h"
+
+#include <assert.h>
 #include <unistd.h>
 #include <string.h>
 #include <sys/stat.h>
@@ -41,7 +42,19 @@
 #include <errno.h>
 #include <time.h>
 #include <stdlib.h>
+#include <zlib.h>
+#ifdef HAVE_MMAP
+#include <sys/mman.h>
+#endif
+#ifdef HAVE_PWRITEV
+#include <limits.h>
+#include <sys/uio.h>
+#endif
+#ifdef WITH_BACKING_STORE_THREAD
+#include <pthread.h>
+#endif
 #include <nsutils/unistd.h>
+#include <nsutils/time.h>
 
 #include "netsurf/inttypes.h"
 #include "utils/filepath.h"
@@ -54,33 +67,55 @@
 
 #include "content/backing_store.h"
 
-/** Default number of bits of the ident to use in index hash */
-#define DEFAULT_IDENT_SIZE 20
+/** Default log2 number of slots in the address map */
+#define DEFAULT_IDENT_SIZE 17
 
 /** Default number of bits to use for an entry index. */
 #define DEFAULT_ENTRY_SIZE 16
 
 /** Backing store file format version */
-#define CONTROL_VERSION 130
+#define CONTROL_VERSION 133
 
 /** Number of milliseconds after a update before control data maintenance is performed  */
 #define CONTROL_MAINT_TIME 10000
 
-/** Get address from ident */
-#define BS_ADDRESS(ident, state) ((ident) & ((1 << state->ident_bits) - 1))
+/** Get home address map slot from ident */
+#define BS_ADDRESS(ident, state) ((ident) & ((1U << state->ident_bits) - 1))
 
 /** Lookup store entry index from ident */
-#define BS_ENTRY_INDEX(ident, state) state->addrmap[(ident) & ((1 << state->ident_bits) - 1)]
+#define BS_ENTRY_INDEX(ident, state) state->addrmap[entry_map_find(state, (ident))]
 
-/** Get store entry from ident. */
-#define BS_ENTRY(ident, state) state->entries[state->addrmap[(ident) & ((1 << state->ident_bits) - 1)]]
+/**
+ * Log while loading the entry index.
+ *
+ * The index may be loaded on the I/O thread which must not log, in
+ * that case only the outcome is logged once the load completes.
+ */
+#define LOAD_NSLOG(state, catname, level, logmsg, args...)		\
+	do {								\
+		if ((state)->load_async == false) {			\
+			NSLOG(catname, level, logmsg , ##args);		\
+		}							\
+	} while(0)
 
 /** Filename of serialised entries */
 #define ENTRIES_FNAME "entries"
 
-/** Filename of block file index */
+/** Filename of obsolete block file index */
 #define BLOCKS_FNAME "blocks"
 
+/** Filename of entry journal */
+#define JOURNAL_FNAME "journal"
+
+/** Filename of the writer lock of a shared store */
+#define LOCK_FNAME "lock"
+
+/** Number of journal records buffered before they are written */
+#define JOURNAL_BUFFER_SIZE 64
+
+/** Minimum number of journal records before it is compacted */
+#define JOURNAL_COMPACT_MIN 1024
+
 /** log2 block data address length (64k) */
 #define BLOCK_ADDR_LEN 16
 
@@ -90,15 +125,45 @@
 /** log2 number of data block files */
 #define BLOCK_FILE_COUNT (BLOCK_ADDR_LEN - BLOCK_ENTRY_COUNT)
 
-/** log2 size of data blocks (8k) */
-#define BLOCK_DATA_SIZE 13
+/** number of block files for each element */
+#define BLOCK_FILES (1 << BLOCK_FILE_COUNT)
+
+/** number of block size classes */
+#define BLOCK_CLASS_COUNT 4
 
-/** log2 size of metadata blocks (1k) */
-#define BLOCK_META_SIZE 10
+/** number of block files for each block size class */
+#define BLOCK_CLASS_FILES (BLOCK_FILES / BLOCK_CLASS_COUNT)
 
 /** length in bytes of a block files use map */
 #define BLOCK_USE_MAP_SIZE (1 << (BLOCK_ENTRY_COUNT - 3))
 
+/** Number of eviction buckets, one per bit of the entry use count */
+#define EVICT_BUCKET_COUNT 16
+
+/** Time in ms an eviction batch may take before it is deferred */
+#define EVICT_TIME_BUDGET 10
+
+/** Maximum number of small block writes held for coalescing */
+#define WRITE_BEHIND_COUNT 128
+
+/** Maximum number of bytes of small block writes held for coalescing */
+#define WRITE_BEHIND_SIZE (4 * 1024 * 1024)
+
+/** Maximum number of held writes coalesced into a single write */
+#if !defined(IOV_MAX)
+#define WRITE_BEHIND_RUN 8
+#elif (IOV_MAX < (WRITE_BEHIND_COUNT * 2))
+#define WRITE_BEHIND_RUN (IOV_MAX / 2)
+#else
+#define WRITE_BEHIND_RUN WRITE_BEHIND_COUNT
+#endif
+
+/** log2 size of the largest block size class */
+#define BLOCK_MAX_SIZE 15
+
+/** Elements smaller than this are not worth compressing */
+#define STORE_COMPRESS_MIN_SIZE 256
+
 /**
  * The type used to store index values referring to store entries. Care
  * must be taken with this type as it is used to build address to
@@ -110,9 +175,11 @@ typedef uint16_t entry_index_t;
 /**
  * The type used as a binary identifier for each entry derived from
  * the URL. A larger identifier will have fewer collisions but
- * requires proportionately more storage.
+ * requires proportionately more storage. At 64 bits collisions are
+ * not expected in a store of any practical size so the identifier
+ * is treated as unique.
  */
-typedef uint32_t entry_ident_t;
+typedef uint64_t entry_ident_t;
 
 /**
  * The type used to store block file index values. If this is changed
@@ -144,6 +211,10 @@ enum store_entry_elem_flags {
 	ENTRY_ELEM_FLAG_MMAP = 0x2,
 	/** entry data allocation is in small object pool */
 	ENTRY_ELEM_FLAG_SMALL = 0x4,
+	/** entry data allocation is being filled by the I/O thread */
+	ENTRY_ELEM_FLAG_PENDING = 0x8,
+	/** entry data is compressed on disc */
+	ENTRY_ELEM_FLAG_COMPRESSED = 0x10,
 };
 
 
@@ -160,7 +231,7 @@ enum store_entry_flags {
  * An element keeps data about:
  *  - the current memory allocation
  *  - the number of outstanding references to the memory
- *  - the size of the element data
+ *  - the size of the element data on disc and once decompressed
  *  - flags controlling how the memory and element are handled
  *
  * @note Order is important to avoid excessive structure packing overhead.
@@ -168,6 +239,7 @@ enum store_entry_flags {
 struct store_entry_element {
 	uint8_t* data; /**< data allocated */
 	uint32_t size; /**< size of entry element on disc */
+	uint32_t length; /**< length of entry element data */
 	block_index_t block; /**< small object data block */
 	uint8_t ref; /**< element data reference count */
 	uint8_t flags; /**< entry flags */
@@ -192,22 +264,73 @@ struct store_entry {
 	struct store_entry_element elem[ENTRY_ELEM_COUNT];
 };
 
+/**
+ * Entry journal operations.
+ */
+enum store_journal_op {
+	JOURNAL_OP_SET = 1, /**< entry has been inserted or updated */
+	JOURNAL_OP_REMOVE = 2, /**< entry has been removed */
+};
+
+/**
+ * Entry journal record.
+ *
+ * The journal is a sequence of these records appended to as the
+ * entries are changed. The crc allows a record which was only
+ * partially written to be detected.
+ */
+struct store_journal_record {
+	uint32_t crc; /**< crc32 of the remainder of the record */
+	uint32_t op; /**< the journal operation */
+	struct store_entry entry; /**< the entry the operation applies to */
+};
+
 /**
  * Small block file.
  */
 struct block_file {
 	/** file descriptor of the block file */
 	int fd;
+	/** read only mapping of the whole block file or NULL */
+	uint8_t *map;
 	/** map of used and unused entries within the block file */
 	uint8_t use_map[BLOCK_USE_MAP_SIZE];
 };
 
 /**
- * log2 of block size.
+ * log2 of block size for each block size class.
+ *
+ * Elements are placed in a block from the smallest class they fit
+ * and any element larger than the largest class is stored in its
+ * own file. Each class has its own block files.
+ */
+static const unsigned int log2_block_size[ENTRY_ELEM_COUNT][BLOCK_CLASS_COUNT] = {
+	{ 9, 11, 13, 15 }, /**< Data block sizes (512, 2k, 8k and 32k) */
+	{ 8, 9, 10, 11 }   /**< Metadata block sizes (256, 512, 1k and 2k) */
+};
+
+/**
+ * log2 size of the blocks in a block file.
+ *
+ * \param elem_idx The element index the block file is for.
+ * \param bf The block file index.
+ * \return The log2 size of the block files blocks.
+ */
+static inline unsigned int block_file_log2_size(int elem_idx, block_index_t bf)
+{
+	return log2_block_size[elem_idx][bf / BLOCK_CLASS_FILES];
+}
+
+/**
+ * Small block write held in the write behind buffer.
  */
-static const unsigned int log2_block_size[ENTRY_ELEM_COUNT] = {
-	BLOCK_DATA_SIZE, /**< Data block size */
-	BLOCK_META_SIZE  /**< Metadata block size */
+struct store_write {
+	entry_ident_t ident; /**< identifier of the entry */
+	int elem_idx; /**< index of the entry element */
+	block_index_t block; /**< small block to write */
+	const uint8_t *data; /**< element data as stored on disc */
+	uint8_t *alloc; /**< compressed data owned by the write or NULL */
+	size_t size; /**< size of the data */
 };
 
 /**
@@ -218,8 +341,23 @@ struct store_state {
 	char *path; /**< The path to the backing store */
 	size_t limit; /**< The backing store upper bound target size */
 	size_t hysteresis; /**< The hysteresis around the target size */
+	bool compress; /**< compress elements where it reduces their size */
+
+	/**
+	 * Store sharing.
+	 *
+	 * A shared store may be opened by several processes. The
+	 * process holding the writer lock maintains the store as
+	 * usual, the others only read it and follow the writers
+	 * journal to keep their index current.
+	 */
+	bool shared; /**< store is shared with other processes */
+	bool readonly; /**< another process is the writer of the store */
+	int lock_fd; /**< lock file descriptor or -1 */
+	int journal_rfd; /**< journal followed by a reader or -1 */
+	off_t journal_offset; /**< offset of the next record to follow */
 
-	unsigned int ident_bits; /**< log2 number of bits to use for address. */
+	unsigned int ident_bits; /**< log2 number of slots in the address map. */
 
 
 	/* cache entry management */
@@ -232,6 +370,49 @@ struct store_state {
 	 */
 	bool entries_dirty;
 
+	/** flag indicating the index has been loaded, until it is
+	 * set no other store state may be accessed on the main thread
+	 * and all lookups miss.
+	 */
+	bool ready;
+
+	/** flag indicating the index is being loaded on the I/O thread
+	 * which must not log.
+	 */
+	bool load_async;
+
+	/** flag indicating the index could not be loaded and the store
+	 * will never become ready.
+	 */
+	bool load_failed;
+
+	/** identifiers of entries invalidated while the index was
+	 * loading, these are removed once it is ready.
+	 */
+	entry_ident_t *pending_invalidate;
+	size_t pending_invalidate_count; /**< number of pending invalidations */
+	size_t pending_invalidate_alloc; /**< allocated pending invalidations */
+
+	/** journal records which replace entries in use when they were
+	 * followed, these are applied once the entry is released.
+	 */
+	struct store_journal_record *deferred;
+	size_t deferred_count; /**< number of deferred records */
+	size_t deferred_alloc; /**< allocated deferred records */
+
+	/**
+	 * Entry journal.
+	 *
+	 * Changes to the entries are appended to the journal, the
+	 * entries file is only rewritten when the journal is
+	 * compacted.
+	 */
+	int journal_fd; /**< journal file descriptor or -1 */
+	unsigned int journal_records; /**< number of records in journal file */
+	unsigned int journal_pending; /**< number of records in buffer */
+	/** records waiting to be written */
+	struct store_journal_record journal_buffer[JOURNAL_BUFFER_SIZE];
+
 	/**
 	 * URL identifier to entry index mapping.
 	 *
@@ -241,14 +422,33 @@ struct store_state {
 	 */
 	entry_index_t *addrmap;
 
+	/**
+	 * Eviction order.
+	 *
+	 * Entries are kept on a list per eviction bucket, the bucket
+	 * is selected by the log2 of the entries use count and each
+	 * list is ordered from least to most recently used. The
+	 * lists are linked by entry index, with index 0 (the empty
+	 * sentinel) terminating them.
+	 */
+	entry_index_t *evict_prev; /**< previous entry in eviction list */
+	entry_index_t *evict_next; /**< next entry in eviction list */
+	entry_index_t evict_head[EVICT_BUCKET_COUNT]; /**< least recently used */
+	entry_index_t evict_tail[EVICT_BUCKET_COUNT]; /**< most recently used */
+
 
 	/** small block indexes */
-	struct block_file blocks[ENTRY_ELEM_COUNT][BLOCK_FILE_COUNT];
+	struct block_file blocks[ENTRY_ELEM_COUNT][BLOCK_FILES];
 
-	/** flag indicating if the block file use maps have been made
-	 * persistent since they were last changed.
+	/**
+	 * Write behind buffer.
+	 *
+	 * Small block writes are held until the next maintenance so
+	 * writes to consecutive blocks can be coalesced.
 	 */
-	bool blocks_dirty;
+	struct store_write write_behind[WRITE_BEHIND_COUNT];
+	unsigned int write_behind_count; /**< number of writes held */
+	size_t write_behind_size; /**< number of bytes held */
 
 	/** flag indicating if a block file has been opened for update
 	 * since maintenance was previously done.
@@ -262,6 +462,7 @@ struct store_state {
 	size_t hit_count; /**< number of cache hits */
 	uint64_t hit_size; /**< size of storage served */
 	size_t miss_count; /**< number of cache misses */
+	uint64_t probe_count; /**< address map lookups which probed past the home slot */
 
 };
 
@@ -274,6 +475,257 @@ struct store_state {
 struct store_state *storestate;
 
 
+/**
+ * Compute the eviction bucket of an entry.
+ *
+ * @param bse The entry.
+ * @return The eviction bucket of the entry.
+ */
+static inline unsigned int evict_bucket(const struct store_entry *bse)
+{
+	unsigned int bucket = 0;
+	unsigned int use_count = bse->use_count;
+
+	while ((use_count > 1) && (bucket < (EVICT_BUCKET_COUNT - 1))) {
+		use_count >>= 1;
+		bucket++;
+	}
+
+	return bucket;
+}
+
+/**
+ * Remove an entry from the eviction order.
+ *
+ * Must be called before the use count of the entry is altered.
+ *
+ * @param state The store state to use.
+ * @param sei The index of the entry to remove.
+ */
+static void evict_unlink(struct store_state *state, entry_index_t sei)
+{
+	unsigned int bucket = evict_bucket(&state->entries[sei]);
+	entry_index_t prev = state->evict_prev[sei];
+	entry_index_t next = state->evict_next[sei];
+
+	if (prev != 0) {
+		state->evict_next[prev] = next;
+	} else {
+		state->evict_head[bucket] = next;
+	}
+
+	if (next != 0) {
+		state->evict_prev[next] = prev;
+	} else {
+		state->evict_tail[bucket] = prev;
+	}
+
+	state->evict_prev[sei] = 0;
+	state->evict_next[sei] = 0;
+}
+
+/**
+ * Add an entry to the eviction order as the most recently used.
+ *
+ * @param state The store state to use.
+ * @param sei The index of the entry to add.
+ */
+static void evict_link(struct store_state *state, entry_index_t sei)
+{
+	unsigned int bucket = evict_bucket(&state->entries[sei]);
+	entry_index_t tail = state->evict_tail[bucket];
+
+	state->evict_prev[sei] = tail;
+	state->evict_next[sei] = 0;
+
+	if (tail != 0) {
+		state->evict_next[tail] = sei;
+	} else {
+		state->evict_head[bucket] = sei;
+	}
+	state->evict_tail[bucket] = sei;
+}
+
+/**
+ * Move an entry's position in the eviction order to a new index.
+ *
+ * @param state The store state to use.
+ * @param from The index the entry was at.
+ * @param to The index the entry is now at.
+ */
+static void
+evict_move(struct store_state *state, entry_index_t from, entry_index_t to)
+{
+	unsigned int bucket = evict_bucket(&state->entries[to]);
+	entry_index_t prev = state->evict_prev[from];
+	entry_index_t next = state->evict_next[from];
+
+	state->evict_prev[to] = prev;
+	state->evict_next[to] = next;
+
+	if (prev != 0) {
+		state->evict_next[prev] = to;
+	} else {
+		state->evict_head[bucket] = to;
+	}
+
+	if (next != 0) {
+		state->evict_prev[next] = to;
+	} else {
+		state->evict_tail[bucket] = to;
+	}
+
+	state->evict_prev[from] = 0;
+	state->evict_next[from] = 0;
+}
+
+
+/**
+ * Write buffered journal records to the journal file.
+ *
+ * The journal is not synchronised to the storage device so records
+ * are ordered before subsequent writes to the store only through the
+ * operating system page cache. That survives the browser crashing
+ * but not the system failing.
+ *
+ * \param state The backing store state.
+ * \return NSERROR_OK on success or error code on failure.
+ */
+static nserror journal_flush(struct store_state *state)
+{
+	size_t jsize;
+	ssize_t wr;
+
+	if (state->journal_pending == 0) {
+		return NSERROR_OK;
+	}
+
+	jsize = state->journal_pending * sizeof(struct store_journal_record);
+	state->journal_pending = 0;
+
+	if (state->journal_fd == -1) {
+		return NSERROR_SAVE_FAILED;
+	}
+
+	wr = write(state->journal_fd, state->journal_buffer, jsize);
+	if (wr != (ssize_t)jsize) {
+		NSLOG(netsurf, INFO, "Journal write failed errno %d", errno);
+		/* a partial record would stop replay so discard the journal */
+		close(state->journal_fd);
+		state->journal_fd = -1;
+		return NSERROR_SAVE_FAILED;
+	}
+	state->journal_records += jsize / sizeof(struct store_journal_record);
+
+	return NSERROR_OK;
+}
+
+/**
+ * Add a record of an entry change to the journal.
+ *
+ * Records are buffered until the buffer is full or the journal is
+ * flushed.
+ *
+ * \param state The backing store state.
+ * \param op The journal operation.
+ * \param bse The entry which has changed.
+ */
+static void
+journal_record(struct store_state *state,
+	       enum store_journal_op op,
+	       const struct store_entry *bse)
+{
+	struct store_journal_record *rec;
+
+	if (state->readonly == true) {
+		/* only the writer of a shared store changes it */
+		return;
+	}
+
+	rec = &state->journal_buffer[state->journal_pending++];
+	rec->op = op;
+	rec->entry = *bse;
+	rec->crc = crc32(0L,
+			 (const Bytef *)&rec->op,
+			 sizeof(*rec) - sizeof(rec->crc));
+
+	state->entries_dirty = true;
+
+	if (state->journal_pending == JOURNAL_BUFFER_SIZE) {
+		journal_flush(state);
+	}
+}
+
+/**
+ * Find the address map slot for an ident.
+ *
+ * The address map is an open addressing table with linear probing
+ * which always has more slots than there are entries. The search
+ * therefore ends at either the slot referencing the entry with the
+ * ident or the empty slot where it would be inserted.
+ *
+ * @param state The store state to use.
+ * @param ident The entry identifier.
+ * @return The address map slot.
+ */
+static unsigned int
+entry_map_find(struct store_state *state, entry_ident_t ident)
+{
+	unsigned int mask = (1U << state->ident_bits) - 1;
+	unsigned int slot = BS_ADDRESS(ident, state);
+	entry_index_t sei;
+
+	sei = state->addrmap[slot];
+	if ((sei == 0) || (state->entries[sei].ident == ident)) {
+		return slot;
+	}
+
+	state->probe_count++;
+
+	do {
+		slot = (slot + 1) & mask;
+		sei = state->addrmap[slot];
+	} while ((sei != 0) && (state->entries[sei].ident != ident));
+
+	return slot;
+}
+
+/**
+ * Remove an entry from the address map.
+ *
+ * Entries after the removed slot are moved back so the probe
+ * sequence of every remaining entry stays unbroken.
+ *
+ * @param state The store state to use.
+ * @param slot The address map slot to empty.
+ */
+static void entry_map_remove(struct store_state *state, unsigned int slot)
+{
+	unsigned int mask = (1U << state->ident_bits) - 1;
+	unsigned int next = slot;
+	unsigned int home;
+
+	for (;;) {
+		next = (next + 1) & mask;
+		if (state->addrmap[next] == 0) {
+			break;
+		}
+
+		home = BS_ADDRESS(state->entries[state->addrmap[next]].ident,
+				  state);
+
+		/* move the entry back if the empty slot lies between
+		 * its home slot and the slot it occupies.
+		 */
+		if (((next - home) & mask) >= ((next - slot) & mask)) {
+			state->addrmap[slot] = state->addrmap[next];
+			slot = next;
+		}
+	}
+
+	state->addrmap[slot] = 0;
+}
+
 /**
  * Remove a backing store entry from the entry table.
  *
@@ -290,16 +742,26 @@ static nserror
 remove_store_entry(struct store_state *state, struct store_entry **bse)
 {
 	entry_index_t sei; /* store entry index */
+	unsigned int slot; /* address map slot */
 
 	/* sei is index to entry to be removed, we swap it to the end
 	 * of the table so there are no gaps and the returned entry is
 	 * held in storage with reasonable lifetime.
 	 */
 
-	sei = BS_ENTRY_INDEX((*bse)->ident, state);
+	slot = entry_map_find(state, (*bse)->ident);
+	sei = state->addrmap[slot];
 
 	/* remove entry from map */
-	BS_ENTRY_INDEX((*bse)->ident, state) = 0;
+	entry_map_remove(state, slot);
+
+	/* remove entry from eviction order */
+	evict_unlink(state, sei);
+
+	/* record the removal */
+	if (state->journal_fd != -1) {
+		journal_record(state, JOURNAL_OP_REMOVE, &state->entries[sei]);
+	}
 
 	/* global allocation accounting  */
 	state->total_alloc -= state->entries[sei].elem[ENTRY_ELEM_DATA].size;
@@ -314,12 +776,18 @@ remove_store_entry(struct store_state *state, struct store_entry **bse)
 		/* need to swap entries */
 		struct store_entry tent;
 
+		/* update map for moved entry, the map is searched by
+		 * comparing entry idents so this must be done before
+		 * the entries are swapped.
+		 */
+		BS_ENTRY_INDEX(state->entries[state->last_entry].ident, state) = sei;
+
 		tent = state->entries[sei];
 		state->entries[sei] = state->entries[state->last_entry];
 		state->entries[state->last_entry] = tent;
 
-		/* update map for moved entry */
-		BS_ENTRY_INDEX(state->entries[sei].ident, state) = sei;
+		/* update eviction order for moved entry */
+		evict_move(state, state->last_entry, sei);
 
 		*bse = &state->entries[state->last_entry];
 	}
@@ -346,9 +814,15 @@ remove_store_entry(struct store_state *state, struct store_entry **bse)
  * much data as possible in the least number of characters.
  *
  * To achieve all these goals we use RFC4648 base32 encoding which
- * packs 5bits into each character of the filename. To represent a 32
- * bit ident this requires a total path length of between 17 and 22
- * bytes (including directory separators) BA/BB/BC/BD/BE/ABCDEFG
+ * packs 5bits into each character of the filename. The five
+ * directory levels encode the low 30 bits of the ident and the
+ * filename the remaining 34 bits which requires a total path length
+ * of between 17 and 22 bytes (including directory separators)
+ * BA/BB/BC/BD/BE/ABCDEFG
+ *
+ * @note Versions prior to 1.33 used a 32 bit ident and the filename
+ * encoded the low bits of the ident already present in the directory
+ * names.
  *
  * @note Version 1.00 of the cache implementation used base64 to
  * encode this, however that did not meet the requirement for only
@@ -414,14 +888,14 @@ store_fname(struct store_state *state,
 		{ 'B', '6', 0 }, { 'B', '7', 0 }  /* 62 */
 	};
 
-	/* base32 encode ident */
-	b32u_i[0] = encoding_table[(ident      ) & 0x1f][0];
-	b32u_i[1] = encoding_table[(ident >>  5) & 0x1f][0];
-	b32u_i[2] = encoding_table[(ident >> 10) & 0x1f][0];
-	b32u_i[3] = encoding_table[(ident >> 15) & 0x1f][0];
-	b32u_i[4] = encoding_table[(ident >> 20) & 0x1f][0];
-	b32u_i[5] = encoding_table[(ident >> 25) & 0x1f][0];
-	b32u_i[6] = encoding_table[(ident >> 30) & 0x1f][0];
+	/* base32 encode ident bits not used by the directories */
+	b32u_i[0] = encoding_table[(ident >> 30) & 0x1f][0];
+	b32u_i[1] = encoding_table[(ident >> 35) & 0x1f][0];
+	b32u_i[2] = encoding_table[(ident >> 40) & 0x1f][0];
+	b32u_i[3] = encoding_table[(ident >> 45) & 0x1f][0];
+	b32u_i[4] = encoding_table[(ident >> 50) & 0x1f][0];
+	b32u_i[5] = encoding_table[(ident >> 55) & 0x1f][0];
+	b32u_i[6] = encoding_table[(ident >> 60) & 0x1f][0];
 	b32u_i[7] = 0; /* null terminate ident string */
 
 	/* base32 encode directory separators */
@@ -454,6 +928,29 @@ store_fname(struct store_state *state,
 	return fname;
 }
 
+/**
+ * Release a small block.
+ *
+ * @param state The store state to use.
+ * @param elem_idx The element index the block is for.
+ * @param block The small block index.
+ */
+static void
+free_block(struct store_state *state, int elem_idx, block_index_t block)
+{
+	block_index_t bf;
+	block_index_t bi;
+
+	/* block file block resides in */
+	bf = (block >> BLOCK_ENTRY_COUNT) & ((1 << BLOCK_FILE_COUNT) - 1);
+
+	/* block index in file */
+	bi = block & ((1U << BLOCK_ENTRY_COUNT) -1);
+
+	/* clear bit in use map */
+	state->blocks[elem_idx][bf].use_map[bi >> 3] &= ~(1U << (bi & 7));
+}
+
 /**
  * invalidate an element of an entry
  *
@@ -467,19 +964,13 @@ invalidate_element(struct store_state *state,
 		   struct store_entry *bse,
 		   int elem_idx)
 {
-	if (bse->elem[elem_idx].block != 0) {
-		block_index_t bf;
-		block_index_t bi;
-
-		/* block file block resides in */
-		bf = (bse->elem[elem_idx].block >> BLOCK_ENTRY_COUNT) &
-			((1 << BLOCK_FILE_COUNT) - 1);
-
-		/* block index in file */
-		bi = bse->elem[elem_idx].block & ((1U << BLOCK_ENTRY_COUNT) -1);
+	if (state->readonly == true) {
+		/* the storage belongs to the writer of a shared store */
+		return NSERROR_OK;
+	}
 
-		/* clear bit in use map */
-		state->blocks[elem_idx][bf].use_map[bi >> 3] &= ~(1U << (bi & 7));
+	if (bse->elem[elem_idx].block != 0) {
+		free_block(state, elem_idx, bse->elem[elem_idx].block);
 	} else {
 		char *fname;
 
@@ -495,6 +986,8 @@ invalidate_element(struct store_state *state,
 	return NSERROR_OK;
 }
 
+static void journal_apply_deferred(struct store_state *state, entry_ident_t ident);
+
 /**
  * Remove the entry and files associated with an identifier.
  *
@@ -506,6 +999,7 @@ static nserror
 invalidate_entry(struct store_state *state, struct store_entry *bse)
 {
 	nserror ret;
+	entry_ident_t ident = bse->ident;
 
 	/* mark entry as invalid */
 	bse->flags |= ENTRY_FLAGS_INVALID;
@@ -542,53 +1036,10 @@ invalidate_entry(struct store_state *state, struct store_entry *bse)
 		NSLOG(netsurf, INFO, "Error invalidating data element");
 	}
 
-	return NSERROR_OK;
-}
-
-
-/**
- * Quick sort comparison.
- */
-static int compar(const void *va, const void *vb)
-{
-	const struct store_entry *a = &BS_ENTRY(*(entry_ident_t *)va, storestate);
-	const struct store_entry *b = &BS_ENTRY(*(entry_ident_t *)vb, storestate);
-
-	/* consider the allocation flags - if an entry has an
-	 * allocation it is considered more valuable as it cannot be
-	 * freed.
-	 */
-	if ((a->elem[ENTRY_ELEM_DATA].flags == ENTRY_ELEM_FLAG_NONE) &&
-	    (b->elem[ENTRY_ELEM_DATA].flags != ENTRY_ELEM_FLAG_NONE)) {
-		return -1;
-	} else if ((a->elem[ENTRY_ELEM_DATA].flags != ENTRY_ELEM_FLAG_NONE) &&
-		   (b->elem[ENTRY_ELEM_DATA].flags == ENTRY_ELEM_FLAG_NONE)) {
-		return 1;
-	}
-
-	if ((a->elem[ENTRY_ELEM_META].flags == ENTRY_ELEM_FLAG_NONE) &&
-	    (b->elem[ENTRY_ELEM_META].flags != ENTRY_ELEM_FLAG_NONE)) {
-		return -1;
-	} else if ((a->elem[ENTRY_ELEM_META].flags != ENTRY_ELEM_FLAG_NONE) &&
-		   (b->elem[ENTRY_ELEM_META].flags == ENTRY_ELEM_FLAG_NONE)) {
-		return 1;
-	}
-
-	if (a->use_count < b->use_count) {
-		return -1;
-	} else if (a->use_count > b->use_count) {
-		return 1;
-	}
-	/* use count is the same - now consider last use time */
-
-	if (a->last_used < b->last_used) {
-		return -1;
-	} else if (a->last_used > b->last_used) {
-		return 1;
-	}
+	/* a replacement followed while the entry was in use */
+	journal_apply_deferred(state, ident);
 
-	/* they are the same */
-	return 0;
+	return NSERROR_OK;
 }
 
 
@@ -599,19 +1050,28 @@ static int compar(const void *va, const void *vb)
  * configured limits on size and number of entries.
  *
  * The approach is to check if the cache limits have been exceeded and
- * if so build and sort list of entries to evict. The list is sorted
- * by use count and then by age, so oldest object with least number of uses
- * get evicted first.
+ * if so evict entries in eviction order, so the least recently used
+ * objects with the fewest uses get evicted first. The eviction order
+ * is maintained as entries are used so only the evicted entries are
+ * visited.
+ *
+ * Entries with an outstanding allocation are skipped as they cannot
+ * be freed. Once a new entry is available the batch is bounded by
+ * EVICT_TIME_BUDGET, any remaining excess is evicted by the next
+ * store.
  *
  * @param state The store state to use.
  * @return NSERROR_OK on success or error code on failure.
  */
 static nserror store_evict(struct store_state *state)
 {
-	entry_ident_t *elist; /* sorted list of entry identifiers */
-	unsigned int ent;
-	unsigned int ent_count;
-	size_t removed; /* size of removed entries */
+	unsigned int bucket;
+	entry_index_t sei; /* store entry index */
+	entry_index_t next; /* next entry index in eviction order */
+	unsigned int ent = 0; /* number of entries evicted */
+	size_t removed = 0; /* size of removed entries */
+	uint64_t start_ms;
+	uint64_t now_ms;
 	nserror ret = NSERROR_OK;
 
 	/* check if the cache has exceeded configured limit */
@@ -626,41 +1086,59 @@ static nserror store_evict(struct store_state *state)
 	      state->total_alloc,
 	      state->hysteresis);
 
-	/* allocate storage for the list */
-	elist = malloc(sizeof(entry_ident_t) * state->last_entry);
-	if (elist == NULL) {
-		return NSERROR_NOMEM;
-	}
+	nsu_getmonotonic_ms(&start_ms);
 
-	/* sort the list avoiding entry 0 which is the empty sentinel */
-	for (ent = 1; ent < state->last_entry; ent++) {
-		elist[ent - 1] = state->entries[ent].ident;
-	}
-	ent_count = ent - 1; /* important to keep this as the entry count will change when entries are removed */
-	qsort(elist, ent_count, sizeof(entry_ident_t), compar);
+	for (bucket = 0; bucket < EVICT_BUCKET_COUNT; bucket++) {
+		sei = state->evict_head[bucket];
+		while (sei != 0) {
+			struct store_entry *bse = &state->entries[sei];
 
-	/* evict entries in listed order */
-	removed = 0;
-	for (ent = 0; ent < ent_count; ent++) {
-		struct store_entry *bse;
+			next = state->evict_next[sei];
 
-		bse = &BS_ENTRY(elist[ent], state);
+			if (((bse->elem[ENTRY_ELEM_DATA].flags |
+			      bse->elem[ENTRY_ELEM_META].flags) &
+			     (ENTRY_ELEM_FLAG_HEAP |
+			      ENTRY_ELEM_FLAG_MMAP |
+			      ENTRY_ELEM_FLAG_PENDING)) != 0) {
+				/* entry is in use */
+				sei = next;
+				continue;
+			}
 
-		removed += bse->elem[ENTRY_ELEM_DATA].size;
-		removed += bse->elem[ENTRY_ELEM_META].size;
+			removed += bse->elem[ENTRY_ELEM_DATA].size;
+			removed += bse->elem[ENTRY_ELEM_META].size;
 
-		ret = invalidate_entry(state, bse);
-		if (ret != NSERROR_OK) {
-			break;
-		}
+			ret = invalidate_entry(state, bse);
+			if (ret != NSERROR_OK) {
+				goto evict_done;
+			}
+			ent++;
 
-		if (removed > state->hysteresis) {
-			break;
+			/* removal moves the last entry into the
+			 * removed entries index.
+			 */
+			if (next == state->last_entry) {
+				next = sei;
+			}
+
+			if (removed > state->hysteresis) {
+				goto evict_done;
+			}
+
+			if (state->last_entry < (1U << state->entry_bits)) {
+				nsu_getmonotonic_ms(&now_ms);
+				if ((now_ms - start_ms) > EVICT_TIME_BUDGET) {
+					NSLOG(netsurf, INFO,
+					      "Eviction time budget exhausted");
+					goto evict_done;
+				}
+			}
+
+			sei = next;
 		}
 	}
 
-	free(elist);
-
+evict_done:
 	NSLOG(netsurf, INFO, "removed %"PRIsizet" in %d entries", removed,
 	      ent);
 
@@ -730,91 +1208,396 @@ static nserror write_entries(struct store_state *state)
 		return NSERROR_SAVE_FAILED;
 	}
 
+	free(tname);
+	free(fname);
+
 	return NSERROR_OK;
 }
 
 /**
- * Write block file use map to file.
+ * Open the journal file for appending.
  *
- * Serialise block file use map out to storage.
+ * An emptied journal is created as a new file which replaces the
+ * existing one instead of truncating it, so readers of a shared
+ * store can finish following the records of the old journal.
  *
- * \param state The backing store state to serialise.
+ * \param state The backing store state.
+ * \param openflags Additional flags for the open call.
  * \return NSERROR_OK on success or error code on failure.
  */
-static nserror write_blocks(struct store_state *state)
+static nserror journal_open(struct store_state *state, int openflags)
 {
-	int fd;
 	char *tname = NULL; /* temporary file name for atomic replace */
-	char *fname = NULL; /* target filename */
-	size_t blocks_size;
-	size_t written = 0;
-	size_t wr;
+	char *fname = NULL;
 	nserror ret;
-	int bfidx; /* block file index */
-	int elem_idx;
-
-	if (state->blocks_dirty == false) {
-		/* blocks use maps have not been updated since last write */
-		return NSERROR_OK;
-	}
 
-	ret = netsurf_mkpath(&tname, NULL, 2, state->path, "t"BLOCKS_FNAME);
+	ret = netsurf_mkpath(&fname, NULL, 2, state->path, JOURNAL_FNAME);
 	if (ret != NSERROR_OK) {
 		return ret;
 	}
 
-	fd = open(tname, O_RDWR | O_CREAT | O_TRUNC, S_IRUSR | S_IWUSR);
-	if (fd == -1) {
-		free(tname);
-		return NSERROR_SAVE_FAILED;
-	}
-
-	blocks_size = (BLOCK_FILE_COUNT * ENTRY_ELEM_COUNT) * BLOCK_USE_MAP_SIZE;
-
-	for (elem_idx = 0; elem_idx < ENTRY_ELEM_COUNT; elem_idx++) {
-		for (bfidx = 0; bfidx < BLOCK_FILE_COUNT; bfidx++) {
-			wr = write(fd,
-				   &state->blocks[elem_idx][bfidx].use_map[0],
-				   BLOCK_USE_MAP_SIZE);
-			if (wr != BLOCK_USE_MAP_SIZE) {
-				NSLOG(netsurf, INFO,
-				      "writing block file %d use index on file number %d failed",
-				      elem_idx,
-				      bfidx);
-				goto wr_err;
-			}
-			written += wr;
+	if ((openflags & O_TRUNC) == 0) {
+		state->journal_fd = open(fname,
+					 O_WRONLY | O_CREAT | O_APPEND | openflags,
+					 S_IRUSR | S_IWUSR);
+		free(fname);
+		if (state->journal_fd == -1) {
+			LOAD_NSLOG(state, netsurf, INFO,
+				   "Journal open failed errno %d", errno);
+			return NSERROR_SAVE_FAILED;
 		}
+		return NSERROR_OK;
 	}
-wr_err:
-	close(fd);
 
-	/* check all data was written */
-	if (written != blocks_size) {
-		unlink(tname);
-		free(tname);
-		return NSERROR_SAVE_FAILED;
+	ret = netsurf_mkpath(&tname, NULL, 2, state->path, "t"JOURNAL_FNAME);
+	if (ret != NSERROR_OK) {
+		free(fname);
+		return ret;
 	}
 
-	ret = netsurf_mkpath(&fname, NULL, 2, state->path, BLOCKS_FNAME);
-	if (ret != NSERROR_OK) {
-		unlink(tname);
+	state->journal_fd = open(tname,
+				 O_WRONLY | O_CREAT | O_APPEND | openflags,
+				 S_IRUSR | S_IWUSR);
+	if (state->journal_fd == -1) {
 		free(tname);
-		return ret;
+		free(fname);
+		return NSERROR_SAVE_FAILED;
 	}
 
 	/* remove() call is to handle non-POSIX rename() implementations */
 	(void)remove(fname);
 	if (rename(tname, fname) != 0) {
+		close(state->journal_fd);
+		state->journal_fd = -1;
 		unlink(tname);
 		free(tname);
 		free(fname);
 		return NSERROR_SAVE_FAILED;
 	}
+	free(tname);
+	free(fname);
 
 	return NSERROR_OK;
 }
 
+/**
+ * Compact the journal.
+ *
+ * The entries file is rewritten with the current entries and the
+ * journal emptied. Replaying a journal over entries which already
+ * include its changes gives the same result so there is no window
+ * where a crash loses changes.
+ *
+ * \param state The backing store state.
+ * \return NSERROR_OK on success or error code on failure.
+ */
+static nserror journal_compact(struct store_state *state)
+{
+	nserror ret;
+
+	journal_flush(state);
+
+	ret = write_entries(state);
+	if (ret != NSERROR_OK) {
+		return ret;
+	}
+	state->entries_dirty = false;
+
+	if (state->journal_fd != -1) {
+		close(state->journal_fd);
+	}
+	state->journal_records = 0;
+
+	return journal_open(state, O_TRUNC);
+}
+
+/**
+ * Check if an entry has an allocation referencing its elements.
+ *
+ * \param bse The entry to check.
+ * \return true if either element has an allocation.
+ */
+static inline bool entry_in_use(const struct store_entry *bse)
+{
+	return (((bse->elem[ENTRY_ELEM_DATA].flags &
+		  (ENTRY_ELEM_FLAG_HEAP | ENTRY_ELEM_FLAG_MMAP)) != 0) ||
+		((bse->elem[ENTRY_ELEM_META].flags &
+		  (ENTRY_ELEM_FLAG_HEAP | ENTRY_ELEM_FLAG_MMAP)) != 0));
+}
+
+/**
+ * Find the deferred journal record for an entry.
+ *
+ * \param state The backing store state.
+ * \param ident The identifier of the entry.
+ * \return The index of the deferred record or deferred_count if none.
+ */
+static size_t
+journal_deferred_find(struct store_state *state, entry_ident_t ident)
+{
+	size_t idx;
+
+	for (idx = 0; idx < state->deferred_count; idx++) {
+		if (state->deferred[idx].entry.ident == ident) {
+			break;
+		}
+	}
+	return idx;
+}
+
+/**
+ * Defer a journal record until the entry it replaces is released.
+ *
+ * Only the latest record for an entry is kept, a removal simply
+ * discards any earlier replacement.
+ *
+ * \param state The backing store state.
+ * \param rec The record to defer.
+ */
+static void
+journal_defer(struct store_state *state, const struct store_journal_record *rec)
+{
+	struct store_journal_record *deferred;
+	size_t idx;
+	size_t alloc;
+
+	idx = journal_deferred_find(state, rec->entry.ident);
+
+	if (rec->op == JOURNAL_OP_REMOVE) {
+		if (idx != state->deferred_count) {
+			state->deferred[idx] = state->deferred[--state->deferred_count];
+		}
+		return;
+	}
+
+	if (idx == state->deferred_count) {
+		if (state->deferred_count == state->deferred_alloc) {
+			alloc = state->deferred_alloc * 2;
+			if (alloc == 0) {
+				alloc = 8;
+			}
+			deferred = realloc(state->deferred,
+					   alloc * sizeof(struct store_journal_record));
+			if (deferred == NULL) {
+				/* without the replacement the entry
+				 * is only missing once released.
+				 */
+				return;
+			}
+			state->deferred = deferred;
+			state->deferred_alloc = alloc;
+		}
+		state->deferred_count++;
+	}
+	state->deferred[idx] = *rec;
+}
+
+/**
+ * Apply a journal record to the entries.
+ *
+ * Entries only have allocations when a reader of a shared store
+ * follows the journal. Such an entry cannot be changed under its
+ * users so it is invalidated and removed once they release it, any
+ * replacement is deferred until then.
+ *
+ * \param state The backing store state.
+ * \param rec The record to apply.
+ */
+static void
+journal_apply(struct store_state *state, const struct store_journal_record *rec)
+{
+	entry_index_t sei; /* store entry index */
+	struct store_entry *bse;
+
+	sei = BS_ENTRY_INDEX(rec->entry.ident, state);
+
+	if ((sei != 0) && entry_in_use(&state->entries[sei])) {
+		state->entries[sei].flags |= ENTRY_FLAGS_INVALID;
+		journal_defer(state, rec);
+		return;
+	}
+
+	switch (rec->op) {
+	case JOURNAL_OP_SET:
+		if (sei == 0) {
+			if (state->last_entry >= (1U << state->entry_bits)) {
+				/* no space for entry */
+				return;
+			}
+			sei = state->last_entry;
+			state->last_entry++;
+			BS_ENTRY_INDEX(rec->entry.ident, state) = sei;
+		} else {
+			evict_unlink(state, sei);
+			state->total_alloc -= state->entries[sei].elem[ENTRY_ELEM_DATA].size;
+			state->total_alloc -= state->entries[sei].elem[ENTRY_ELEM_META].size;
+		}
+
+		bse = &state->entries[sei];
+		*bse = rec->entry;
+		bse->elem[ENTRY_ELEM_DATA].flags &= ~(ENTRY_ELEM_FLAG_HEAP | ENTRY_ELEM_FLAG_MMAP | ENTRY_ELEM_FLAG_PENDING);
+		bse->elem[ENTRY_ELEM_META].flags &= ~(ENTRY_ELEM_FLAG_HEAP | ENTRY_ELEM_FLAG_MMAP | ENTRY_ELEM_FLAG_PENDING);
+
+		state->total_alloc += bse->elem[ENTRY_ELEM_DATA].size;
+		state->total_alloc += bse->elem[ENTRY_ELEM_META].size;
+		evict_link(state, sei);
+		break;
+
+	case JOURNAL_OP_REMOVE:
+		if (sei != 0) {
+			bse = &state->entries[sei];
+			remove_store_entry(state, &bse);
+		}
+		break;
+	}
+}
+
+/**
+ * Apply the deferred replacement of an entry once it is removed.
+ *
+ * \param state The backing store state.
+ * \param ident The identifier of the removed entry.
+ */
+static void
+journal_apply_deferred(struct store_state *state, entry_ident_t ident)
+{
+	struct store_journal_record rec;
+	size_t idx;
+
+	idx = journal_deferred_find(state, ident);
+	if (idx == state->deferred_count) {
+		return;
+	}
+
+	rec = state->deferred[idx];
+	state->deferred[idx] = state->deferred[--state->deferred_count];
+
+	journal_apply(state, &rec);
+}
+
+/**
+ * Replay the journal over the entries read from the entries file.
+ *
+ * Replay stops at the first damaged record, which is expected after
+ * an unclean shutdown, and the journal is truncated there so later
+ * records are not lost behind it.
+ *
+ * May be called from the I/O thread so logs with LOAD_NSLOG().
+ *
+ * \param state The backing store state.
+ * \return NSERROR_OK on success or error code on failure.
+ */
+static nserror journal_replay(struct store_state *state)
+{
+	struct store_journal_record rec;
+	unsigned int count = 0;
+	char *fname = NULL;
+	int openflags = 0;
+	nserror ret;
+	int fd;
+
+	ret = netsurf_mkpath(&fname, NULL, 2, state->path, JOURNAL_FNAME);
+	if (ret != NSERROR_OK) {
+		return ret;
+	}
+
+	fd = open(fname, O_RDWR);
+	free(fname);
+	if (fd != -1) {
+		while (read(fd, &rec, sizeof(rec)) == sizeof(rec)) {
+			if (rec.crc != crc32(0L,
+					     (const Bytef *)&rec.op,
+					     sizeof(rec) - sizeof(rec.crc))) {
+				LOAD_NSLOG(state, netsurf, INFO,
+					   "Damaged journal record %u", count);
+				break;
+			}
+			journal_apply(state, &rec);
+			count++;
+		}
+
+		if (ftruncate(fd, count * sizeof(rec)) == -1) {
+			LOAD_NSLOG(state, netsurf, INFO,
+				   "Journal truncate failed errno %d", errno);
+			/* records appended after the damage would be
+			 * lost on the next replay so discard the journal,
+			 * its changes are written out at compaction.
+			 */
+			openflags = O_TRUNC;
+		}
+		close(fd);
+
+		LOAD_NSLOG(state, netsurf, INFO,
+			   "Replayed %u journal records", count);
+	}
+
+	state->journal_records = (openflags == 0) ? count : 0;
+	if (count > 0) {
+		state->entries_dirty = true;
+	}
+
+	return journal_open(state, openflags);
+}
+
+/**
+ * Follow the journal of a shared store written by another process.
+ *
+ * Records appended since the journal was last followed are applied
+ * to the entries. A record still being written is damaged and is
+ * applied once it is complete. When the writer compacts the journal
+ * the old journal is replaced, it is followed to its end before
+ * following continues with the new journal.
+ *
+ * May be called from the I/O thread so must not log.
+ *
+ * \param state The backing store state.
+ */
+static void journal_follow(struct store_state *state)
+{
+	struct store_journal_record rec;
+	struct stat jstat;
+	char *fname = NULL;
+
+	for (;;) {
+		if (state->journal_rfd == -1) {
+			if (netsurf_mkpath(&fname, NULL, 2,
+					   state->path, JOURNAL_FNAME) != NSERROR_OK) {
+				return;
+			}
+			state->journal_rfd = open(fname, O_RDONLY);
+			free(fname);
+			fname = NULL;
+			state->journal_offset = 0;
+			if (state->journal_rfd == -1) {
+				/* no journal has been written yet */
+				return;
+			}
+		}
+
+		while (nsu_pread(state->journal_rfd,
+				 &rec,
+				 sizeof(rec),
+				 state->journal_offset) == sizeof(rec)) {
+			if (rec.crc != crc32(0L,
+					     (const Bytef *)&rec.op,
+					     sizeof(rec) - sizeof(rec.crc))) {
+				/* incomplete record */
+				break;
+			}
+			journal_apply(state, &rec);
+			state->journal_offset += sizeof(rec);
+		}
+
+		/* continue with the replacement of a compacted journal */
+		if ((fstat(state->journal_rfd, &jstat) != 0) ||
+		    (jstat.st_nlink != 0)) {
+			return;
+		}
+		close(state->journal_rfd);
+		state->journal_rfd = -1;
+	}
+}
+
 /**
  * Ensures block files are of the correct extent
  *
@@ -838,10 +1621,10 @@ static nserror set_block_extents(struct store_state *state)
 
 	NSLOG(netsurf, INFO, "Starting");
 	for (elem_idx = 0; elem_idx < ENTRY_ELEM_COUNT; elem_idx++) {
-		for (bfidx = 0; bfidx < BLOCK_FILE_COUNT; bfidx++) {
+		for (bfidx = 0; bfidx < BLOCK_FILES; bfidx++) {
 			if (state->blocks[elem_idx][bfidx].fd != -1) {
 				/* ensure block file is correct extent */
-				ftr = ftruncate(state->blocks[elem_idx][bfidx].fd, 1U << (log2_block_size[elem_idx] + BLOCK_ENTRY_COUNT));
+				ftr = ftruncate(state->blocks[elem_idx][bfidx].fd, 1U << (block_file_log2_size(elem_idx, bfidx) + BLOCK_ENTRY_COUNT));
 				if (ftr == -1) {
 					NSLOG(netsurf, INFO,
 					      "Truncate failed errno:%d",
@@ -857,12 +1640,15 @@ static nserror set_block_extents(struct store_state *state)
 	return NSERROR_OK;
 }
 
+static void store_write_flush(struct store_state *state);
+
 /**
  * maintenance of control structures.
  *
  * callback scheduled when control data has been update. Currently
- * this is for when the entries table is dirty and requires
- * serialising.
+ * this is for when small block writes are held in the write behind
+ * buffer, the entries table has changed and the journal requires
+ * writing, and compacting once it has grown as large as the entries.
  *
  * \param s store state to maintain.
  */
@@ -870,12 +1656,49 @@ static void control_maintinance(void *s)
 {
 	struct store_state *state = s;
 
-	write_entries(state);
-	write_blocks(state);
+	if (state->readonly == true) {
+		/* only the writer of a shared store maintains it */
+		return;
+	}
+
+	store_write_flush(state);
+	journal_flush(state);
+
+	/* readers of a shared store cannot see removals while the
+	 * journal is discarded after a write failure, compaction
+	 * replaces it.
+	 */
+	if (((state->journal_records > JOURNAL_COMPACT_MIN) &&
+	     (state->journal_records > state->last_entry)) ||
+	    ((state->shared == true) && (state->journal_fd == -1))) {
+		journal_compact(state);
+	}
 	set_block_extents(state);
 }
 
 
+/**
+ * Compute the entry identifier for a url.
+ *
+ * This is the 64 bit FNV-1a hash of the url.
+ *
+ * @param url The url to compute the identifier of.
+ * @return The entry identifier.
+ */
+static entry_ident_t store_ident(nsurl *url)
+{
+	const uint8_t *data = (const uint8_t *)nsurl_access(url);
+	size_t len = nsurl_length(url);
+	uint64_t hash = 0xcbf29ce484222325ULL;
+
+	while (len-- > 0) {
+		hash ^= *data++;
+		hash *= 0x100000001b3ULL;
+	}
+
+	return hash;
+}
+
 /**
  * Lookup a backing store entry in the entry table from a url.
  *
@@ -897,46 +1720,68 @@ get_store_entry(struct store_state *state, nsurl *url, struct store_entry **bse)
 
 	NSLOG(netsurf, INFO, "url:%s", nsurl_access(url));
 
-	/* use the url hash as the entry identifier */
-	ident = nsurl_hash(url);
+	if (state->readonly == true) {
+		/* bring the index up to date with the writer */
+		journal_follow(state);
+	}
+
+	ident = store_ident(url);
 
 	sei = BS_ENTRY_INDEX(ident, state);
 
 	if (sei == 0) {
-		NSLOG(netsurf, INFO, "Failed to find ident 0x%x in index",
+		NSLOG(netsurf, INFO, "Failed to find ident 0x%"PRIx64" in index",
 		      ident);
 		return NSERROR_NOT_FOUND;
 	}
 
-	if (state->entries[sei].ident != ident) {
-		/* entry ident did not match */
-		NSLOG(netsurf, INFO, "ident did not match entry");
-		return NSERROR_NOT_FOUND;
-	}
-
 	*bse = &state->entries[sei];
 
+	evict_unlink(state, sei);
 	state->entries[sei].last_used = time(NULL);
 	state->entries[sei].use_count++;
+	evict_link(state, sei);
 
-	state->entries_dirty = true;
-
-	guit->misc->schedule(CONTROL_MAINT_TIME, control_maintinance, state);
+	/* use changes only order eviction so they are not journaled,
+	 * they are written with the entry when it next changes and
+	 * with all the entries when the journal is compacted.
+	 */
+	if (state->readonly == false) {
+		state->entries_dirty = true;
+	}
 
 	return NSERROR_OK;
 }
 
 /**
  * Find next available small block.
+ *
+ * The block is allocated from the smallest block size class the
+ * element will fit in, falling back to larger classes when that is
+ * full.
+ *
+ * @param state The store state to use.
+ * @param elem_idx The element index the block is for.
+ * @param size The size of the element to be stored.
+ * @return The allocated block or 0 if no block is available.
  */
-static block_index_t alloc_block(struct store_state *state, int elem_idx)
+static block_index_t
+alloc_block(struct store_state *state, int elem_idx, size_t size)
 {
+	int bclass;
 	int bf;
 	int idx;
 	int bit;
 	uint8_t *map;
 
-	for (bf = 0; bf < BLOCK_FILE_COUNT; bf++) {
+	/* smallest class the element fits in */
+	for (bclass = 0; bclass < BLOCK_CLASS_COUNT; bclass++) {
+		if (size <= (1U << log2_block_size[elem_idx][bclass])) {
+			break;
+		}
+	}
+
+	for (bf = bclass * BLOCK_CLASS_FILES; bf < BLOCK_FILES; bf++) {
 		map = &state->blocks[elem_idx][bf].use_map[0];
 
 		for (idx = 0; idx < BLOCK_USE_MAP_SIZE; idx++) {
@@ -946,7 +1791,6 @@ static block_index_t alloc_block(struct store_state *state, int elem_idx)
 					if (((*(map + idx)) & (1U << bit)) == 0) {
 						/* mark block as used */
 						*(map + idx) |= 1U << bit;
-						state->blocks_dirty = true;
 						return (((bf * BLOCK_USE_MAP_SIZE) + idx) * 8) + bit;
 					}
 				}
@@ -967,6 +1811,8 @@ static block_index_t alloc_block(struct store_state *state, int elem_idx)
  * @param elem_idx The index of the entry element to use.
  * @param data The data to store
  * @param datalen The length of data in \a data
+ * @param csize The size of the compressed data on disc or 0 if the
+ *              data is stored uncompressed.
  * @param bse Pointer used to return value.
  * @return NSERROR_OK and \a bse updated on success or NSERROR_NOT_FOUND
  *         if no entry corresponds to the url.
@@ -977,6 +1823,7 @@ set_store_entry(struct store_state *state,
 		int elem_idx,
 		uint8_t *data,
 		const size_t datalen,
+		const size_t csize,
 		struct store_entry **bse)
 {
 	entry_ident_t ident;
@@ -995,8 +1842,7 @@ set_store_entry(struct store_state *state,
 		return ret;
 	}
 
-	/* use the url hash as the entry identifier */
-	ident = nsurl_hash(url);
+	ident = store_ident(url);
 
 	/* get the entry index from the ident */
 	sei = BS_ENTRY_INDEX(ident, state);
@@ -1011,24 +1857,14 @@ set_store_entry(struct store_state *state,
 
 		/* clear the new entry */
 		memset(se, 0, sizeof(struct store_entry));
+		se->ident = ident;
+
+		evict_link(state, sei);
 	} else {
 		/* index found existing entry */
 
 		/* the entry */
 		se = &state->entries[sei];
-
-		if (se->ident != ident) {
-			/** @todo Is there a better heuristic than
-			 * first come, first served? Should we check
-			 * to see if the old entry is in use and if
-			 * not prefer the newly stored entry instead?
-			 */
-			NSLOG(netsurf, INFO,
-			      "Entry index collision trying to replace %x with %x",
-			      se->ident,
-			      ident);
-			return NSERROR_PERMISSION;
-		}
 	}
 
 	/* the entry element */
@@ -1044,10 +1880,19 @@ set_store_entry(struct store_state *state,
 		return NSERROR_PERMISSION;
 	}
 
+	/* readers of a shared store must stop using an element
+	 * before its storage is reused.
+	 */
+	if ((state->shared == true) && (elem->size != 0)) {
+		journal_record(state, JOURNAL_OP_REMOVE, se);
+	}
+
 	/* set the common entry data */
+	evict_unlink(state, sei);
 	se->ident = ident;
 	se->use_count = 1;
 	se->last_used = time(NULL);
+	evict_link(state, sei);
 
 	/* store the data in the element */
 	elem->flags |= ENTRY_ELEM_FLAG_HEAP;
@@ -1056,16 +1901,26 @@ set_store_entry(struct store_state *state,
 
 	/* account for size of entry element */
 	state->total_alloc -= elem->size;
-	elem->size = datalen;
+	elem->length = datalen;
+	if (csize != 0) {
+		elem->size = csize;
+		elem->flags |= ENTRY_ELEM_FLAG_COMPRESSED;
+	} else {
+		elem->size = datalen;
+		elem->flags &= ~ENTRY_ELEM_FLAG_COMPRESSED;
+	}
 	state->total_alloc += elem->size;
 
-	/* if the element will fit in a small block attempt to allocate one */
-	if (elem->size <= (1U << log2_block_size[elem_idx])) {
-		elem->block = alloc_block(state, elem_idx);
+	/* release any block from a previous store of the element */
+	if (elem->block != 0) {
+		free_block(state, elem_idx, elem->block);
+		elem->block = 0;
 	}
 
+	/* attempt to allocate a small block for the element */
+	elem->block = alloc_block(state, elem_idx, elem->size);
+
 	/* ensure control maintenance scheduled. */
-	state->entries_dirty = true;
 	guit->misc->schedule(CONTROL_MAINT_TIME, control_maintinance, state);
 
 	*bse = se;
@@ -1132,6 +1987,8 @@ store_open(struct store_state *state,
  * As the entire entry list must be iterated over to construct the map
  * we also compute the total storage in use.
  *
+ * May be called from the I/O thread so logs with LOAD_NSLOG().
+ *
  * @param state The backing store global state.
  * @return NSERROR_OK on success or NSERROR_NOMEM if the map storage
  *         could not be allocated.
@@ -1141,34 +1998,49 @@ build_entrymap(struct store_state *state)
 {
 	unsigned int eloop;
 
-	NSLOG(netsurf, INFO, "Allocating %"PRIsizet" bytes for max of %d buckets",
-	      (1 << state->ident_bits) * sizeof(entry_index_t),
-	      1 << state->ident_bits);
+	LOAD_NSLOG(state, netsurf, INFO,
+		   "Allocating %"PRIsizet" bytes for max of %d buckets",
+		   (1 << state->ident_bits) * sizeof(entry_index_t),
+		   1 << state->ident_bits);
 
 	state->addrmap = calloc(1 << state->ident_bits, sizeof(entry_index_t));
 	if (state->addrmap == NULL) {
 		return NSERROR_NOMEM;
 	}
 
+	state->evict_prev = calloc(1 << state->entry_bits, sizeof(entry_index_t));
+	state->evict_next = calloc(1 << state->entry_bits, sizeof(entry_index_t));
+	if ((state->evict_prev == NULL) || (state->evict_next == NULL)) {
+		free(state->evict_prev);
+		free(state->evict_next);
+		free(state->addrmap);
+		return NSERROR_NOMEM;
+	}
+
 	state->total_alloc = 0;
 
 	for (eloop = 1; eloop < state->last_entry; eloop++) {
 
-		NSLOG(llcache, DEEPDEBUG,
-		      "entry:%d ident:0x%08x used:%d",
-		      eloop,
-		      BS_ADDRESS(state->entries[eloop].ident, state),
-		      state->entries[eloop].use_count);
+		LOAD_NSLOG(state, llcache, DEEPDEBUG,
+			   "entry:%d ident:0x%016"PRIx64" used:%d",
+			   eloop,
+			   state->entries[eloop].ident,
+			   state->entries[eloop].use_count);
 
 		/* update the address map to point at the entry */
 		BS_ENTRY_INDEX(state->entries[eloop].ident, state) = eloop;
 
+		/* add the entry to the eviction order, the entries
+		 * table is approximately in order of last use.
+		 */
+		evict_link(state, eloop);
+
 		/* account for the storage space */
 		state->total_alloc += state->entries[eloop].elem[ENTRY_ELEM_DATA].size;
 		state->total_alloc += state->entries[eloop].elem[ENTRY_ELEM_META].size;
 		/* ensure entry does not have any allocation state */
-		state->entries[eloop].elem[ENTRY_ELEM_DATA].flags &= ~(ENTRY_ELEM_FLAG_HEAP | ENTRY_ELEM_FLAG_MMAP);
-		state->entries[eloop].elem[ENTRY_ELEM_META].flags &= ~(ENTRY_ELEM_FLAG_HEAP | ENTRY_ELEM_FLAG_MMAP);
+		state->entries[eloop].elem[ENTRY_ELEM_DATA].flags &= ~(ENTRY_ELEM_FLAG_HEAP | ENTRY_ELEM_FLAG_MMAP | ENTRY_ELEM_FLAG_PENDING);
+		state->entries[eloop].elem[ENTRY_ELEM_META].flags &= ~(ENTRY_ELEM_FLAG_HEAP | ENTRY_ELEM_FLAG_MMAP | ENTRY_ELEM_FLAG_PENDING);
 	}
 
 	return NSERROR_OK;
@@ -1193,6 +2065,15 @@ unlink_entries(struct store_state *state)
 
 	unlink(fname);
 
+	free(fname);
+
+	ret = netsurf_mkpath(&fname, NULL, 2, state->path, JOURNAL_FNAME);
+	if (ret != NSERROR_OK) {
+		return ret;
+	}
+
+	unlink(fname);
+
 	free(fname);
 	return NSERROR_OK;
 }
@@ -1200,6 +2081,8 @@ unlink_entries(struct store_state *state)
 /**
  * Read description entries into memory.
  *
+ * May be called from the I/O thread so logs with LOAD_NSLOG().
+ *
  * @param state The backing store state to put the loaded entries in.
  * @return NSERROR_OK on success or error code on faliure.
  */
@@ -1219,12 +2102,12 @@ read_entries(struct store_state *state)
 
 	entries_size = (1 << state->entry_bits) * sizeof(struct store_entry);
 
-	NSLOG(netsurf, INFO,
-	      "Allocating %"PRIsizet" bytes for max of %d entries of %"PRIsizet" length elements %"PRIsizet" length",
-	      entries_size,
-	      1 << state->entry_bits,
-	      sizeof(struct store_entry),
-	      sizeof(struct store_entry_element));
+	LOAD_NSLOG(state, netsurf, INFO,
+		   "Allocating %"PRIsizet" bytes for max of %d entries of %"PRIsizet" length elements %"PRIsizet" length",
+		   entries_size,
+		   1 << state->entry_bits,
+		   sizeof(struct store_entry),
+		   sizeof(struct store_entry_element));
 
 	state->entries = calloc(1, entries_size);
 	if (state->entries == NULL) {
@@ -1232,15 +2115,15 @@ read_entries(struct store_state *state)
 		return NSERROR_NOMEM;
 	}
 
-	fd = open(fname, O_RDWR);
+	fd = open(fname, O_RDONLY);
 	free(fname);
 	if (fd != -1) {
 		rd = read(fd, state->entries, entries_size);
 		close(fd);
 		if (rd > 0) {
 			state->last_entry = rd / sizeof(struct store_entry);
-			NSLOG(netsurf, INFO, "Read %d entries",
-			      state->last_entry);
+			LOAD_NSLOG(state, netsurf, INFO, "Read %d entries",
+				   state->last_entry);
 		}
 	} else {
 		/* could rebuild entries from fs */
@@ -1251,58 +2134,63 @@ read_entries(struct store_state *state)
 
 
 /**
- * Read block file usage bitmaps.
+ * Initialise block file usage bitmaps.
  *
- * @param state The backing store state to put the loaded entries in.
+ * The use maps are derived from the blocks referenced by the entries
+ * so they are always consistent with them.
+ *
+ * May be called from the I/O thread so logs with LOAD_NSLOG().
+ *
+ * @param state The backing store state with the loaded entries.
  * @return NSERROR_OK on success or error code on failure.
  */
 static nserror
-read_blocks(struct store_state *state)
+init_blocks(struct store_state *state)
 {
 	int bfidx; /* block file index */
 	int elem_idx;
-	int fd;
-	ssize_t rd;
+	unsigned int eloop;
+	block_index_t block;
+	block_index_t bf;
+	block_index_t bi;
 	char *fname = NULL;
 	nserror ret;
 
-	ret = netsurf_mkpath(&fname, NULL, 2, state->path, BLOCKS_FNAME);
-	if (ret != NSERROR_OK) {
-		return ret;
+	/* the use maps were previously stored in a separate file */
+	if (state->readonly == false) {
+		ret = netsurf_mkpath(&fname, NULL, 2, state->path, BLOCKS_FNAME);
+		if (ret != NSERROR_OK) {
+			return ret;
+		}
+		unlink(fname);
+		free(fname);
 	}
 
-	NSLOG(netsurf, INFO, "Initialising block use map from %s", fname);
+	LOAD_NSLOG(state, netsurf, INFO,
+		   "Initialising block use map from entries");
 
-	fd = open(fname, O_RDWR);
-	free(fname);
-	if (fd != -1) {
-		/* initialise block file use array */
+	/* ensure block 0 (invalid sentinel) is skipped */
+	state->blocks[ENTRY_ELEM_DATA][0].use_map[0] = 1;
+	state->blocks[ENTRY_ELEM_META][0].use_map[0] = 1;
+
+	for (eloop = 1; eloop < state->last_entry; eloop++) {
 		for (elem_idx = 0; elem_idx < ENTRY_ELEM_COUNT; elem_idx++) {
-			for (bfidx = 0; bfidx < BLOCK_FILE_COUNT; bfidx++) {
-				rd = read(fd,
-					  &state->blocks[elem_idx][bfidx].use_map[0],
-					  BLOCK_USE_MAP_SIZE);
-				if (rd <= 0) {
-					NSLOG(netsurf, INFO,
-					      "reading block file %d use index on file number %d failed",
-					      elem_idx,
-					      bfidx);
-					goto rd_err;
-				}
+			block = state->entries[eloop].elem[elem_idx].block;
+			if (block == 0) {
+				continue;
 			}
-		}
-	rd_err:
-		close(fd);
+			/* block file block resides in */
+			bf = (block >> BLOCK_ENTRY_COUNT) &
+				((1 << BLOCK_FILE_COUNT) - 1);
+			/* block index in file */
+			bi = block & ((1U << BLOCK_ENTRY_COUNT) -1);
 
-	} else {
-		NSLOG(netsurf, INFO, "Initialising block use map to defaults");
-		/* ensure block 0 (invalid sentinel) is skipped */
-		state->blocks[ENTRY_ELEM_DATA][0].use_map[0] = 1;
-		state->blocks[ENTRY_ELEM_META][0].use_map[0] = 1;
+			state->blocks[elem_idx][bf].use_map[bi >> 3] |= 1U << (bi & 7);
+		}
 	}
 
 	/* initialise block file file descriptors */
-	for (bfidx = 0; bfidx < BLOCK_FILE_COUNT; bfidx++) {
+	for (bfidx = 0; bfidx < BLOCK_FILES; bfidx++) {
 		state->blocks[ENTRY_ELEM_DATA][bfidx].fd = -1;
 		state->blocks[ENTRY_ELEM_META][bfidx].fd = -1;
 	}
@@ -1311,20 +2199,168 @@ read_blocks(struct store_state *state)
 }
 
 /**
- * Write the cache tag file.
+ * Load the entry index.
  *
- * @param state The cache state.
- * @return NSERROR_OK on success or error code on failure.
+ * Reads the entries, builds the entry map, replays the journal and
+ * initialises the block use maps. This may be performed on the I/O
+ * thread while the store is not ready so logs with LOAD_NSLOG().
+ *
+ * @param state The backing store state to load the index into.
+ * @return NSERROR_OK on success or error code on failure in which
+ *         case the index is released.
  */
-static nserror
-write_cache_tag(struct store_state *state)
+static nserror load_index(struct store_state *state)
 {
-	FILE *fcachetag;
-	nserror ret;
 	char *fname = NULL;
+	nserror ret;
 
-	ret = netsurf_mkpath(&fname, NULL, 2, state->path, "CACHEDIR.TAG");
-	if (ret != NSERROR_OK) {
+	if (state->readonly == true) {
+		/* the journal is opened before the entries are read so
+		 * if they are replaced by a compaction in between the
+		 * records of the old journal are applied over them.
+		 */
+		ret = netsurf_mkpath(&fname, NULL, 2, state->path, JOURNAL_FNAME);
+		if (ret != NSERROR_OK) {
+			return ret;
+		}
+		state->journal_rfd = open(fname, O_RDONLY);
+		free(fname);
+	}
+
+	/* read filesystem entries */
+	ret = read_entries(state);
+	if (ret != NSERROR_OK) {
+		if (state->journal_rfd != -1) {
+			close(state->journal_rfd);
+			state->journal_rfd = -1;
+		}
+		return ret;
+	}
+
+	/* build entry hash map */
+	ret = build_entrymap(state);
+	if (ret != NSERROR_OK) {
+		if (state->journal_rfd != -1) {
+			close(state->journal_rfd);
+			state->journal_rfd = -1;
+		}
+		free(state->entries);
+		state->entries = NULL;
+		return ret;
+	}
+
+	/* apply changes made since the entries were written, failing
+	 * to open the journal only prevents changes being recorded.
+	 */
+	if (state->readonly == true) {
+		journal_follow(state);
+	} else {
+		journal_replay(state);
+	}
+
+	ret = init_blocks(state);
+	if (ret != NSERROR_OK) {
+		if (state->journal_fd != -1) {
+			close(state->journal_fd);
+			state->journal_fd = -1;
+		}
+		if (state->journal_rfd != -1) {
+			close(state->journal_rfd);
+			state->journal_rfd = -1;
+		}
+		free(state->evict_prev);
+		free(state->evict_next);
+		free(state->addrmap);
+		free(state->entries);
+		state->evict_prev = NULL;
+		state->evict_next = NULL;
+		state->addrmap = NULL;
+		state->entries = NULL;
+		return ret;
+	}
+
+	return NSERROR_OK;
+}
+
+
+/**
+ * Load an empty entry index after the stored one failed to load.
+ *
+ * The stored entries are discarded, as they are when the control
+ * file is invalid, so the store starts empty. Readers of a shared
+ * store cannot discard the entries so they only retry the load.
+ *
+ * @param state The backing store state to load the index into.
+ * @return NSERROR_OK on success or error code on failure.
+ */
+static nserror load_empty_index(struct store_state *state)
+{
+	if (state->readonly == false) {
+		unlink_entries(state);
+	}
+
+	return load_index(state);
+}
+
+
+/**
+ * Mark the store ready once the entry index has been loaded.
+ *
+ * Entries invalidated while the index was loading are removed.
+ *
+ * @param state The backing store state with the loaded index.
+ */
+static void load_index_complete(struct store_state *state)
+{
+	entry_index_t sei;
+	size_t idx;
+
+	state->ready = true;
+
+	for (idx = 0; idx < state->pending_invalidate_count; idx++) {
+		sei = BS_ENTRY_INDEX(state->pending_invalidate[idx], state);
+		if (sei != 0) {
+			invalidate_entry(state, &state->entries[sei]);
+		}
+	}
+	if (state->pending_invalidate_count > 0) {
+		NSLOG(netsurf, INFO, "Applied %"PRIsizet" pending invalidations",
+		      state->pending_invalidate_count);
+	}
+	free(state->pending_invalidate);
+	state->pending_invalidate = NULL;
+	state->pending_invalidate_count = 0;
+	state->pending_invalidate_alloc = 0;
+
+	NSLOG(netsurf, INFO,
+	      "Loaded %d entries of %"PRIsizet" bytes into %d buckets, replayed %u journal records",
+	      state->last_entry,
+	      sizeof(struct store_entry),
+	      1 << state->ident_bits,
+	      state->journal_records);
+	if (state->journal_fd == -1) {
+		NSLOG(netsurf, INFO, "Unable to open journal");
+	}
+	NSLOG(netsurf, INFO, "Using %"PRIu64"/%"PRIsizet,
+	      state->total_alloc, state->limit);
+}
+
+
+/**
+ * Write the cache tag file.
+ *
+ * @param state The cache state.
+ * @return NSERROR_OK on success or error code on failure.
+ */
+static nserror
+write_cache_tag(struct store_state *state)
+{
+	FILE *fcachetag;
+	nserror ret;
+	char *fname = NULL;
+
+	ret = netsurf_mkpath(&fname, NULL, 2, state->path, "CACHEDIR.TAG");
+	if (ret != NSERROR_OK) {
 		return ret;
 	}
 
@@ -1476,8 +2512,1516 @@ control_error: /* problem with the control file */
 
 
 
+/**
+ * Take the writer lock of a shared store.
+ *
+ * The lock is an advisory write lock on the lock file held for as
+ * long as the store is open. The process holding it is the only
+ * writer of the store, when it is already held the store is opened
+ * read only.
+ *
+ * @param state The store state to use.
+ * @return NSERROR_OK on success, NSERROR_NOT_IMPLEMENTED if the
+ *         platform has no file locking or error code on failure.
+ */
+static nserror store_lock(struct store_state *state)
+{
+#ifdef F_SETLK
+	struct flock lock;
+	char *fname = NULL;
+	nserror ret;
+
+	ret = netsurf_mkpath(&fname, NULL, 2, state->path, LOCK_FNAME);
+	if (ret != NSERROR_OK) {
+		return ret;
+	}
+
+	ret = netsurf_mkdir_all(fname);
+	if (ret != NSERROR_OK) {
+		free(fname);
+		return ret;
+	}
+
+	state->lock_fd = open(fname, O_RDWR | O_CREAT, S_IRUSR | S_IWUSR);
+	free(fname);
+	if (state->lock_fd == -1) {
+		return NSERROR_INIT_FAILED;
+	}
+
+	memset(&lock, 0, sizeof(lock));
+	lock.l_type = F_WRLCK;
+	lock.l_whence = SEEK_SET;
+
+	if (fcntl(state->lock_fd, F_SETLK, &lock) == -1) {
+		if ((errno != EACCES) && (errno != EAGAIN)) {
+			NSLOG(netsurf, INFO, "Locking store failed errno %d",
+			      errno);
+			close(state->lock_fd);
+			state->lock_fd = -1;
+			return NSERROR_INIT_FAILED;
+		}
+
+		/* another process is the writer */
+		state->readonly = true;
+	}
+
+	NSLOG(netsurf, INFO, "Shared store opened as %s",
+	      state->readonly ? "reader" : "writer");
+
+	return NSERROR_OK;
+#else
+	return NSERROR_NOT_IMPLEMENTED;
+#endif
+}
+
+
 /* Functions exported in the backing store table */
 
+/**
+ * release any allocation for an entry
+ */
+static nserror entry_release_alloc(struct store_entry_element *elem)
+{
+	if ((elem->flags & ENTRY_ELEM_FLAG_HEAP) != 0) {
+		elem->ref--;
+		if (elem->ref == 0) {
+			NSLOG(netsurf, INFO, "freeing %p", elem->data);
+			free(elem->data);
+			elem->flags &= ~ENTRY_ELEM_FLAG_HEAP;
+		}
+	}
+#ifdef HAVE_MMAP
+	if ((elem->flags & ENTRY_ELEM_FLAG_MMAP) != 0) {
+		elem->ref--;
+		if (elem->ref == 0) {
+			/* small block views are released with the block
+			 * file mapping, individual files have their own.
+			 */
+			if (elem->block == 0) {
+				NSLOG(netsurf, INFO, "unmapping %p", elem->data);
+				munmap(elem->data, elem->size);
+			}
+			elem->flags &= ~ENTRY_ELEM_FLAG_MMAP;
+		}
+	}
+#endif
+	return NSERROR_OK;
+}
+
+/**
+ * Get the file descriptor and offset of a small block.
+ *
+ * The block file is opened if it has not been already.
+ *
+ * \param state The backing store state to use.
+ * \param elem_idx The element index the block is for.
+ * \param block The small block index.
+ * \param offst_out The offset of the block within the block file.
+ * \return The block file descriptor or -1 on error.
+ */
+static int store_block_fd(struct store_state *state,
+			  int elem_idx,
+			  block_index_t block,
+			  off_t *offst_out)
+{
+	block_index_t bf = (block >> BLOCK_ENTRY_COUNT) &
+		((1 << BLOCK_FILE_COUNT) - 1); /* block file block resides in */
+	block_index_t bi = block & ((1U << BLOCK_ENTRY_COUNT) -1); /* block index in file */
+
+	/* ensure the block file fd is good */
+	if (state->blocks[elem_idx][bf].fd == -1) {
+		if (state->readonly == true) {
+			state->blocks[elem_idx][bf].fd = store_open(state, bf,
+					elem_idx + ENTRY_ELEM_COUNT, O_RDONLY);
+		} else {
+			state->blocks[elem_idx][bf].fd = store_open(state, bf,
+					elem_idx + ENTRY_ELEM_COUNT, O_CREAT | O_RDWR);
+		}
+		if (state->blocks[elem_idx][bf].fd == -1) {
+			NSLOG(netsurf, INFO, "Open failed errno %d", errno);
+			return -1;
+		}
+
+		/* flag that a block file has been opened for update */
+		if (state->readonly == false) {
+			state->blocks_opened = true;
+		}
+	}
+
+	*offst_out = (off_t)bi << block_file_log2_size(elem_idx, bf);
+
+	return state->blocks[elem_idx][bf].fd;
+}
+
+
+/**
+ * Compress element data for storage.
+ *
+ * The compressed data is only returned if it is usefully smaller
+ * than the original.
+ *
+ * \param data The data to compress.
+ * \param datalen The length of \a data.
+ * \param size_out The size of the compressed data.
+ * \return A heap allocation of the compressed data or NULL if the
+ *         data should be stored uncompressed.
+ */
+static uint8_t *
+store_compress(const uint8_t *data, size_t datalen, size_t *size_out)
+{
+	uLongf csize;
+	uint8_t *cdata;
+
+	csize = compressBound(datalen);
+	cdata = malloc(csize);
+	if (cdata == NULL) {
+		return NULL;
+	}
+
+	/* compression is performed when storing, favour speed */
+	if ((compress2(cdata, &csize, data, datalen, Z_BEST_SPEED) != Z_OK) ||
+	    (csize >= (datalen - (datalen / 8)))) {
+		free(cdata);
+		return NULL;
+	}
+
+	*size_out = csize;
+
+	return cdata;
+}
+
+
+/**
+ * Decompress stored element data.
+ *
+ * May be called from the I/O thread so must not touch the store
+ * state or log.
+ *
+ * \param cdata The compressed data.
+ * \param csize The size of \a cdata.
+ * \param data The buffer to decompress into.
+ * \param datalen The length of the decompressed data.
+ * \return NSERROR_OK on success or NSERROR_INVALID if the data was not
+ *         the expected length once decompressed.
+ */
+static nserror
+store_decompress(const uint8_t *cdata, size_t csize, uint8_t *data, size_t datalen)
+{
+	uLongf dlen = datalen;
+
+	if ((uncompress(data, &dlen, cdata, csize) != Z_OK) ||
+	    (dlen != datalen)) {
+		return NSERROR_INVALID;
+	}
+
+	return NSERROR_OK;
+}
+
+
+#ifdef HAVE_MMAP
+
+/**
+ * Map an element of an entry from a small block file.
+ *
+ * The whole block file is mapped read only the first time any of
+ * its blocks is required and the element is given a view into the
+ * mapping.
+ *
+ * \param state The backing store state to use.
+ * \param bse The entry to map.
+ * \param elem_idx The element index within the entry.
+ * \return NSERROR_OK on success or error code.
+ */
+static nserror store_map_block(struct store_state *state,
+			       struct store_entry *bse,
+			       int elem_idx)
+{
+	struct block_file *bfile;
+	block_index_t bf;
+	size_t extent;
+	struct stat fdstat;
+	off_t offst;
+	void *map;
+	int fd;
+
+	fd = store_block_fd(state, elem_idx, bse->elem[elem_idx].block, &offst);
+	if (fd == -1) {
+		return NSERROR_NOT_FOUND;
+	}
+
+	/* block file block resides in */
+	bf = (bse->elem[elem_idx].block >> BLOCK_ENTRY_COUNT) &
+		((1 << BLOCK_FILE_COUNT) - 1);
+	bfile = &state->blocks[elem_idx][bf];
+
+	if (bfile->map == NULL) {
+		extent = (size_t)1 << (block_file_log2_size(elem_idx, bf) + BLOCK_ENTRY_COUNT);
+
+		/* accessing a mapping beyond the end of the file
+		 * faults so the block file must be at its full
+		 * extent. Files are only extended when written, until
+		 * then the element is read instead.
+		 */
+		if (fstat(fd, &fdstat) != 0) {
+			NSLOG(netsurf, INFO, "Block file stat failed errno %d",
+			      errno);
+			return NSERROR_NOT_FOUND;
+		}
+		if ((size_t)fdstat.st_size < extent) {
+			return NSERROR_NOT_FOUND;
+		}
+
+		map = mmap(NULL, extent, PROT_READ, MAP_SHARED, fd, 0);
+		if (map == MAP_FAILED) {
+			NSLOG(netsurf, INFO, "Mapping block file failed errno %d",
+			      errno);
+			return NSERROR_NOMEM;
+		}
+		bfile->map = map;
+	}
+
+	bse->elem[elem_idx].data = bfile->map + offst;
+
+	return NSERROR_OK;
+}
+
+
+/**
+ * Map an element of an entry from an individual file.
+ *
+ * \param state The backing store state to use.
+ * \param bse The entry to map.
+ * \param elem_idx The element index within the entry.
+ * \return NSERROR_OK on success or error code.
+ */
+static nserror store_map_file(struct store_state *state,
+			      struct store_entry *bse,
+			      int elem_idx)
+{
+	struct stat fdstat;
+	void *map;
+	int fd;
+
+	fd = store_open(state, bse->ident, elem_idx, O_RDONLY);
+	if (fd < 0) {
+		NSLOG(netsurf, INFO, "Open failed %d errno %d", fd, errno);
+		return NSERROR_NOT_FOUND;
+	}
+
+	/* a truncated file would fault when accessed */
+	if ((fstat(fd, &fdstat) != 0) ||
+	    ((size_t)fdstat.st_size < bse->elem[elem_idx].size)) {
+		close(fd);
+		return NSERROR_NOT_FOUND;
+	}
+
+	map = mmap(NULL, bse->elem[elem_idx].size, PROT_READ, MAP_PRIVATE, fd, 0);
+	close(fd);
+	if (map == MAP_FAILED) {
+		NSLOG(netsurf, INFO, "Mapping file failed errno %d", errno);
+		return NSERROR_NOMEM;
+	}
+
+	bse->elem[elem_idx].data = map;
+
+	return NSERROR_OK;
+}
+
+#endif
+
+
+/**
+ * Map an element of an entry from the backing storage.
+ *
+ * On success the element holds a read only view of the data on disc
+ * with a single reference, no allocation or copy is made.
+ *
+ * \param state The backing store state to use.
+ * \param bse The entry to map.
+ * \param elem_idx The element index within the entry.
+ * \return NSERROR_OK on success or error code in which case the
+ *         element must be read instead.
+ */
+static nserror store_map_element(struct store_state *state,
+				 struct store_entry *bse,
+				 int elem_idx)
+{
+#ifdef HAVE_MMAP
+	struct store_entry_element *elem = &bse->elem[elem_idx];
+	nserror ret;
+
+	if ((elem->size == 0) ||
+	    ((elem->flags & ENTRY_ELEM_FLAG_COMPRESSED) != 0)) {
+		/* zero length mappings are not permitted and
+		 * compressed data must be read to be decompressed.
+		 */
+		return NSERROR_NOT_FOUND;
+	}
+
+	if (state->readonly == true) {
+		/* the writer of a shared store reuses blocks and
+		 * rewrites files so a view of them could change while
+		 * it is in use.
+		 */
+		return NSERROR_NOT_FOUND;
+	}
+
+	if (elem->block != 0) {
+		ret = store_map_block(state, bse, elem_idx);
+	} else {
+		ret = store_map_file(state, bse, elem_idx);
+	}
+	if (ret != NSERROR_OK) {
+		return ret;
+	}
+
+	NSLOG(netsurf, INFO, "Mapped %d bytes at %p", elem->size, elem->data);
+
+	/* mark the entry as having a valid mapping */
+	elem->flags |= ENTRY_ELEM_FLAG_MMAP;
+	elem->ref = 1;
+
+	return NSERROR_OK;
+#else
+	return NSERROR_NOT_IMPLEMENTED;
+#endif
+}
+
+
+/**
+ * Zero filled buffer used to pad coalesced small block writes.
+ */
+static uint8_t store_write_pad[1 << BLOCK_MAX_SIZE];
+
+/**
+ * Write the data of a run of held writes to consecutive small blocks.
+ *
+ * The gaps between the data of each write and the start of the next
+ * block are filled with padding so the run can be issued as a single
+ * vectored write. The store state is not accessed so this may be
+ * called on the I/O thread.
+ *
+ * \param fd The block file descriptor.
+ * \param offst The offset of the first block within the file.
+ * \param bsize The size of the blocks.
+ * \param wr The first held write of the run.
+ * \param count The number of writes in the run.
+ * \param err Updated with errno on failure.
+ * \return NSERROR_OK on success or NSERROR_SAVE_FAILED.
+ */
+static nserror
+store_write_blocks(int fd,
+		   off_t offst,
+		   size_t bsize,
+		   const struct store_write *wr,
+		   unsigned int count,
+		   int *err)
+{
+	ssize_t written;
+	unsigned int idx;
+#ifdef HAVE_PWRITEV
+	struct iovec iov[WRITE_BEHIND_RUN * 2];
+	unsigned int iovcnt = 0;
+	size_t total = 0;
+
+	for (idx = 0; idx < count; idx++) {
+		iov[iovcnt].iov_base = (void *)wr[idx].data;
+		iov[iovcnt].iov_len = wr[idx].size;
+		iovcnt++;
+		total += wr[idx].size;
+
+		/* pad to the start of the next block */
+		if (((idx + 1) < count) && (wr[idx].size < bsize)) {
+			iov[iovcnt].iov_base = store_write_pad;
+			iov[iovcnt].iov_len = bsize - wr[idx].size;
+			iovcnt++;
+			total += bsize - wr[idx].size;
+		}
+	}
+
+	written = pwritev(fd, iov, iovcnt, offst);
+	if (written != (ssize_t)total) {
+		*err = errno;
+		return NSERROR_SAVE_FAILED;
+	}
+#else
+	for (idx = 0; idx < count; idx++) {
+		written = nsu_pwrite(fd, wr[idx].data, wr[idx].size,
+				     offst + (off_t)(idx * bsize));
+		if (written != (ssize_t)wr[idx].size) {
+			*err = errno;
+			return NSERROR_SAVE_FAILED;
+		}
+	}
+#endif
+
+	return NSERROR_OK;
+}
+
+/**
+ * Complete a run of held writes.
+ *
+ * Each entry is recorded in the journal once its data is written or
+ * invalidated if the write failed.
+ *
+ * \param state The backing store state to use.
+ * \param wr The first held write of the run.
+ * \param count The number of writes in the run.
+ * \param res The result of writing the run.
+ */
+static void
+store_write_complete(struct store_state *state,
+		     struct store_write *wr,
+		     unsigned int count,
+		     nserror res)
+{
+	unsigned int idx;
+	entry_index_t sei;
+	struct store_entry *bse;
+
+	for (idx = 0; idx < count; idx++) {
+		/* entries with allocations cannot be removed */
+		sei = BS_ENTRY_INDEX(wr[idx].ident, state);
+		if (sei == 0) {
+			NSLOG(netsurf, INFO,
+			      "entry 0x%"PRIx64" for write has gone",
+			      wr[idx].ident);
+			free(wr[idx].alloc);
+			continue;
+		}
+		bse = &state->entries[sei];
+
+		if (res != NSERROR_OK) {
+			bse->flags |= ENTRY_FLAGS_INVALID;
+		}
+
+		/* drop the reference held while the write was held */
+		entry_release_alloc(&bse->elem[wr[idx].elem_idx]);
+		if ((bse->flags & ENTRY_FLAGS_INVALID) != 0) {
+			invalidate_entry(state, bse);
+		} else {
+			/* record the entry once its data is written */
+			journal_record(state, JOURNAL_OP_SET, bse);
+		}
+
+		free(wr[idx].alloc);
+	}
+}
+
+
+#ifdef WITH_BACKING_STORE_THREAD
+
+/**
+ * Time between checks for completed I/O thread operations in ms.
+ */
+#define STORE_IO_POLL_TIME 10
+
+/**
+ * Upper bound on the number of bytes queued to be written by the I/O
+ * thread. Stores beyond this limit are written synchronously to
+ * bound the memory held by outstanding writes.
+ */
+#define STORE_IO_QUEUE_LIMIT (8 * 1024 * 1024)
+
+/**
+ * Operations performed by the I/O thread.
+ */
+enum store_io_op {
+	STORE_IO_WRITE, /**< write element data to disc */
+	STORE_IO_READ, /**< read element data from disc */
+	STORE_IO_NONE, /**< no I/O, element data is already present */
+	STORE_IO_LOAD, /**< load the entry index */
+	STORE_IO_WRITE_RUN, /**< write a run of small blocks to disc */
+};
+
+/**
+ * I/O thread operation.
+ *
+ * The I/O thread only accesses the operation parameters and result,
+ * all backing store state is updated on the main thread when the
+ * completed operation is collected.
+ */
+struct store_io_job {
+	struct store_io_job *next; /**< next job in queue or completion list */
+	struct store_io_job *inext; /**< next job in flight (main thread only) */
+	struct store_io_job *waiters; /**< fetches waiting on this read (main thread only) */
+
+	enum store_io_op op; /**< the operation */
+	entry_ident_t ident; /**< identifier of the entry */
+	int elem_idx; /**< index of the entry element */
+
+	int fd; /**< small block file descriptor */
+	char *fname; /**< file name if not a small block */
+	off_t offset; /**< offset of the small block */
+	uint8_t *data; /**< element data */
+	size_t size; /**< size of the element data */
+	uint8_t *alloc; /**< allocation owned by the job */
+	uint8_t *inflate; /**< buffer to decompress read data into */
+	size_t inflate_size; /**< length of the decompressed data */
+	struct store_state *load; /**< store state to load the index into */
+	struct store_write *writes; /**< run of held writes */
+	unsigned int count; /**< number of writes in the run */
+	size_t bsize; /**< size of the blocks of the run */
+
+	nserror res; /**< result of the operation */
+	int err; /**< errno on failure */
+	bool done; /**< the operation has been performed */
+
+	/** completion callback of a fetch */
+	void (*cb)(nserror res, uint8_t *data, size_t datalen, void *pw);
+	void *pw; /**< completion callback context */
+};
+
+/**
+ * I/O thread state.
+ */
+static struct {
+	pthread_t thread; /**< the I/O thread */
+	pthread_mutex_t lock; /**< protects the queue and completion list */
+	pthread_cond_t work; /**< signalled when work is queued */
+	pthread_cond_t done; /**< signalled when a job has been performed */
+	struct store_io_job *queue; /**< jobs waiting for the I/O thread */
+	struct store_io_job *queue_tail; /**< last job in queue */
+	struct store_io_job *complete; /**< jobs completed by the I/O thread */
+	struct store_io_job *complete_tail; /**< last completed job */
+	bool quit; /**< the I/O thread should exit once the queue is drained */
+
+	/* main thread only */
+	bool running; /**< the I/O thread has been started */
+	struct store_io_job *inflight; /**< jobs not yet collected */
+	unsigned int outstanding; /**< number of jobs not yet collected */
+	size_t queued_bytes; /**< size of writes not yet collected */
+} storeio;
+
+
+/**
+ * Perform a job's I/O.
+ *
+ * Called on the I/O thread, or by a thread waiting on the job. Must
+ * not touch the store state or log other than loading the index of a
+ * store which is not yet ready.
+ *
+ * \param job The job to perform.
+ */
+static void store_io_perform(struct store_io_job *job)
+{
+	ssize_t rd;
+	ssize_t wr;
+	size_t tot;
+	int fd;
+
+	job->res = NSERROR_OK;
+
+	switch (job->op) {
+	case STORE_IO_WRITE:
+		if (job->fname == NULL) {
+			wr = nsu_pwrite(job->fd, job->data, job->size, job->offset);
+			job->err = errno;
+		} else {
+			fd = open(job->fname, O_CREAT | O_WRONLY, S_IRUSR | S_IWUSR);
+			if (fd < 0) {
+				job->err = errno;
+				job->res = NSERROR_SAVE_FAILED;
+				break;
+			}
+			wr = write(fd, job->data, job->size);
+			job->err = errno; /* close can change errno */
+			close(fd);
+		}
+		if (wr != (ssize_t)job->size) {
+			job->res = NSERROR_SAVE_FAILED;
+		}
+		break;
+
+	case STORE_IO_READ:
+		if (job->fname == NULL) {
+			rd = nsu_pread(job->fd, job->data, job->size, job->offset);
+			if (rd != (ssize_t)job->size) {
+				job->err = errno;
+				job->res = NSERROR_SAVE_FAILED;
+			}
+		} else {
+			fd = open(job->fname, O_RDONLY);
+			if (fd < 0) {
+				job->err = errno;
+				job->res = NSERROR_NOT_FOUND;
+				break;
+			}
+			tot = 0;
+			while (tot < job->size) {
+				rd = read(fd, job->data + tot, job->size - tot);
+				if (rd <= 0) {
+					job->err = errno;
+					job->res = NSERROR_NOT_FOUND;
+					break;
+				}
+				tot += rd;
+			}
+			close(fd);
+		}
+
+		if ((job->res == NSERROR_OK) && (job->inflate != NULL)) {
+			job->res = store_decompress(job->data, job->size,
+						    job->inflate,
+						    job->inflate_size);
+		}
+		break;
+
+	case STORE_IO_NONE:
+		break;
+
+	case STORE_IO_LOAD:
+		job->res = load_index(job->load);
+		break;
+
+	case STORE_IO_WRITE_RUN:
+		job->res = store_write_blocks(job->fd, job->offset, job->bsize,
+					      job->writes, job->count,
+					      &job->err);
+		break;
+	}
+}
+
+
+/**
+ * Place a performed job on the completion list.
+ *
+ * \pre The I/O thread lock is held.
+ *
+ * \param job The performed job.
+ */
+static void store_io_job_done(struct store_io_job *job)
+{
+	job->done = true;
+	job->next = NULL;
+	if (storeio.complete_tail == NULL) {
+		storeio.complete = job;
+	} else {
+		storeio.complete_tail->next = job;
+	}
+	storeio.complete_tail = job;
+
+	pthread_cond_broadcast(&storeio.done);
+}
+
+
+/**
+ * I/O thread main loop.
+ *
+ * Jobs are performed in the order they were submitted until the
+ * thread is asked to quit and the queue is empty.
+ *
+ * \param ctx unused.
+ * \return NULL
+ */
+static void *store_io_thread(void *ctx)
+{
+	struct store_io_job *job;
+
+	pthread_mutex_lock(&storeio.lock);
+	for (;;) {
+		while ((storeio.queue == NULL) && (storeio.quit == false)) {
+			pthread_cond_wait(&storeio.work, &storeio.lock);
+		}
+
+		job = storeio.queue;
+		if (job == NULL) {
+			/* asked to quit and there is nothing left to do */
+			break;
+		}
+		storeio.queue = job->next;
+		if (storeio.queue == NULL) {
+			storeio.queue_tail = NULL;
+		}
+		pthread_mutex_unlock(&storeio.lock);
+
+		store_io_perform(job);
+
+		pthread_mutex_lock(&storeio.lock);
+		store_io_job_done(job);
+	}
+	pthread_mutex_unlock(&storeio.lock);
+
+	return NULL;
+}
+
+
+/**
+ * Wait for a single job to be performed.
+ *
+ * A job the I/O thread has not yet started is taken off the queue
+ * and performed on the calling thread so it does not wait behind
+ * the rest of the queue. The job is still collected from the
+ * completion list as usual.
+ *
+ * \param job The job to wait for.
+ */
+static void store_io_wait_job(struct store_io_job *job)
+{
+	struct store_io_job **prev;
+	struct store_io_job *last = NULL;
+
+	pthread_mutex_lock(&storeio.lock);
+	for (prev = &storeio.queue; *prev != NULL; prev = &(*prev)->next) {
+		if (*prev == job) {
+			break;
+		}
+		last = *prev;
+	}
+
+	if (*prev == job) {
+		*prev = job->next;
+		if (storeio.queue_tail == job) {
+			storeio.queue_tail = last;
+		}
+		pthread_mutex_unlock(&storeio.lock);
+
+		store_io_perform(job);
+
+		pthread_mutex_lock(&storeio.lock);
+		store_io_job_done(job);
+	} else {
+		while (job->done == false) {
+			pthread_cond_wait(&storeio.done, &storeio.lock);
+		}
+	}
+	pthread_mutex_unlock(&storeio.lock);
+}
+
+
+/**
+ * Find the read job in flight for an entry element.
+ *
+ * \param ident The entry identifier.
+ * \param elem_idx The element index.
+ * \return The read job or NULL if there is none.
+ */
+static struct store_io_job *store_io_find_read(entry_ident_t ident, int elem_idx)
+{
+	struct store_io_job *job;
+
+	for (job = storeio.inflight; job != NULL; job = job->inext) {
+		if ((job->op == STORE_IO_READ) &&
+		    (job->ident == ident) &&
+		    (job->elem_idx == elem_idx)) {
+			return job;
+		}
+	}
+	return NULL;
+}
+
+
+/**
+ * Find an entry from its identifier.
+ *
+ * Entries may be moved within the entry table so completed jobs
+ * must locate their entry by identifier.
+ *
+ * \param state The store state to use.
+ * \param ident The entry identifier.
+ * \return The entry or NULL if there is no entry for the identifier.
+ */
+static struct store_entry *
+store_io_entry(struct store_state *state, entry_ident_t ident)
+{
+	entry_index_t sei; /* store entry index */
+
+	sei = BS_ENTRY_INDEX(ident, state);
+	if (sei == 0) {
+		return NULL;
+	}
+	return &state->entries[sei];
+}
+
+
+/**
+ * Complete a fetch from a collected job.
+ *
+ * The job holds a reference to the element allocation which is
+ * either handed to the callback or released on failure.
+ *
+ * \param state The store state to use.
+ * \param job The job to complete.
+ * \param res The result of the read.
+ */
+static void
+store_io_complete_fetch(struct store_state *state,
+			struct store_io_job *job,
+			nserror res)
+{
+	struct store_entry *bse;
+	struct store_entry_element *elem;
+
+	/* entries with allocations cannot be removed */
+	bse = store_io_entry(state, job->ident);
+	if (bse == NULL) {
+		NSLOG(netsurf, INFO, "entry 0x%"PRIx64" for fetch has gone", job->ident);
+		job->cb(NSERROR_NOT_FOUND, NULL, 0, job->pw);
+		return;
+	}
+	elem = &bse->elem[job->elem_idx];
+
+	if (res == NSERROR_OK) {
+		state->hit_size += elem->length;
+		job->cb(NSERROR_OK, elem->data, elem->length, job->pw);
+		return;
+	}
+
+	entry_release_alloc(elem);
+	if ((bse->flags & ENTRY_FLAGS_INVALID) != 0) {
+		invalidate_entry(state, bse);
+	}
+	job->cb(res, NULL, 0, job->pw);
+}
+
+
+/**
+ * Process a job collected from the I/O thread.
+ *
+ * \param state The store state to use.
+ * \param job The completed job.
+ */
+static void store_io_complete(struct store_state *state, struct store_io_job *job)
+{
+	struct store_io_job **prev;
+	struct store_io_job *waiter;
+	struct store_entry *bse;
+
+	/* remove job from the in flight list */
+	for (prev = &storeio.inflight; *prev != job; prev = &(*prev)->inext);
+	*prev = job->inext;
+	storeio.outstanding--;
+
+	switch (job->op) {
+	case STORE_IO_WRITE:
+		storeio.queued_bytes -= job->size;
+
+		bse = store_io_entry(state, job->ident);
+		if (bse == NULL) {
+			NSLOG(netsurf, INFO, "entry 0x%"PRIx64" for write has gone",
+			      job->ident);
+			break;
+		}
+
+		if (job->res != NSERROR_OK) {
+			NSLOG(netsurf, INFO,
+			      "Write of %"PRIsizet" bytes for 0x%"PRIx64" failed errno %d",
+			      job->size, job->ident, job->err);
+			bse->flags |= ENTRY_FLAGS_INVALID;
+		}
+
+		/* drop the reference held while the write was in flight */
+		entry_release_alloc(&bse->elem[job->elem_idx]);
+		if ((bse->flags & ENTRY_FLAGS_INVALID) != 0) {
+			invalidate_entry(state, bse);
+		} else {
+			/* record the entry once its data is written */
+			journal_record(state, JOURNAL_OP_SET, bse);
+		}
+		break;
+
+	case STORE_IO_READ:
+		if (job->res != NSERROR_OK) {
+			NSLOG(netsurf, INFO,
+			      "Read of %"PRIsizet" bytes for 0x%"PRIx64" failed errno %d",
+			      job->size, job->ident, job->err);
+		}
+
+		bse = store_io_entry(state, job->ident);
+		if (bse != NULL) {
+			bse->elem[job->elem_idx].flags &= ~ENTRY_ELEM_FLAG_PENDING;
+		}
+
+		/* the writer of a shared store may have changed the
+		 * entry while it was read.
+		 */
+		if ((job->res == NSERROR_OK) && (state->readonly == true)) {
+			journal_follow(state);
+			bse = store_io_entry(state, job->ident);
+			if ((bse != NULL) &&
+			    ((bse->flags & ENTRY_FLAGS_INVALID) != 0)) {
+				job->res = NSERROR_NOT_FOUND;
+			}
+		}
+
+		store_io_complete_fetch(state, job, job->res);
+
+		/* complete fetches which arrived while the read was in flight */
+		while (job->waiters != NULL) {
+			waiter = job->waiters;
+			job->waiters = waiter->waiters;
+			store_io_complete_fetch(state, waiter, job->res);
+			free(waiter);
+		}
+		break;
+
+	case STORE_IO_NONE:
+		store_io_complete_fetch(state, job, NSERROR_OK);
+		break;
+
+	case STORE_IO_LOAD:
+		state->load_async = false;
+		if (job->res != NSERROR_OK) {
+			NSLOG(netsurf, WARNING,
+			      "Loading index failed %s, using an empty index",
+			      messages_get_errorcode(job->res));
+			if (load_empty_index(state) != NSERROR_OK) {
+				NSLOG(netsurf, ERROR,
+				      "Loading empty index failed, backing store disabled");
+				state->load_failed = true;
+				break;
+			}
+		}
+		load_index_complete(state);
+		break;
+
+	case STORE_IO_WRITE_RUN:
+		storeio.queued_bytes -= job->size;
+
+		if (job->res != NSERROR_OK) {
+			NSLOG(netsurf, INFO,
+			      "Write of %u blocks at 0x%jx failed errno %d",
+			      job->count, (uintmax_t)job->offset, job->err);
+		}
+
+		store_write_complete(state, job->writes, job->count, job->res);
+		free(job->writes);
+		break;
+	}
+
+	free(job->alloc);
+	free(job->fname);
+	free(job);
+}
+
+
+/**
+ * Scheduled collection of jobs completed by the I/O thread.
+ *
+ * \param s store state.
+ */
+static void store_io_poll(void *s)
+{
+	struct store_state *state = s;
+	struct store_io_job *job;
+	struct store_io_job *next;
+
+	pthread_mutex_lock(&storeio.lock);
+	job = storeio.complete;
+	storeio.complete = NULL;
+	storeio.complete_tail = NULL;
+	pthread_mutex_unlock(&storeio.lock);
+
+	while (job != NULL) {
+		next = job->next;
+		store_io_complete(state, job);
+		job = next;
+	}
+
+	if (storeio.outstanding > 0) {
+		guit->misc->schedule(STORE_IO_POLL_TIME, store_io_poll, state);
+	}
+}
+
+
+/**
+ * Queue a job for the I/O thread.
+ *
+ * \param state The store state to use.
+ * \param job The job to queue.
+ */
+static void store_io_submit(struct store_state *state, struct store_io_job *job)
+{
+	job->next = NULL;
+	job->inext = storeio.inflight;
+	storeio.inflight = job;
+
+	if (storeio.outstanding == 0) {
+		guit->misc->schedule(STORE_IO_POLL_TIME, store_io_poll, state);
+	}
+	storeio.outstanding++;
+
+	pthread_mutex_lock(&storeio.lock);
+	if (storeio.queue_tail == NULL) {
+		storeio.queue = job;
+	} else {
+		storeio.queue_tail->next = job;
+	}
+	storeio.queue_tail = job;
+	pthread_cond_signal(&storeio.work);
+	pthread_mutex_unlock(&storeio.lock);
+}
+
+
+/**
+ * Create a job to transfer an entry element.
+ *
+ * The small block file or the path of the element file is resolved
+ * on the main thread as it requires access to the store state.
+ *
+ * \param state The store state to use.
+ * \param bse The entry.
+ * \param elem_idx The element index within the entry.
+ * \param op The operation to perform.
+ * \return The new job or NULL on error.
+ */
+static struct store_io_job *
+store_io_job_create(struct store_state *state,
+		    struct store_entry *bse,
+		    int elem_idx,
+		    enum store_io_op op)
+{
+	struct store_io_job *job;
+	struct store_entry_element *elem = &bse->elem[elem_idx];
+
+	job = calloc(1, sizeof(struct store_io_job));
+	if (job == NULL) {
+		return NULL;
+	}
+
+	job->op = op;
+	job->ident = bse->ident;
+	job->elem_idx = elem_idx;
+	job->data = elem->data;
+	job->size = elem->size;
+	job->fd = -1;
+
+	if (op == STORE_IO_NONE) {
+		return job;
+	}
+
+	if (elem->block != 0) {
+		job->fd = store_block_fd(state, elem_idx, elem->block, &job->offset);
+		if (job->fd == -1) {
+			free(job);
+			return NULL;
+		}
+	} else {
+		job->fname = store_fname(state, bse->ident, elem_idx);
+		if (job->fname == NULL) {
+			free(job);
+			return NULL;
+		}
+
+		/* ensure all path elements to file exist if creating file */
+		if ((op == STORE_IO_WRITE) &&
+		    (netsurf_mkdir_all(job->fname) != NSERROR_OK)) {
+			NSLOG(netsurf, INFO,
+			      "file path \"%s\" could not be created",
+			      job->fname);
+			free(job->fname);
+			free(job);
+			return NULL;
+		}
+	}
+
+	if ((op == STORE_IO_READ) &&
+	    ((elem->flags & ENTRY_ELEM_FLAG_COMPRESSED) != 0)) {
+		/* read the compressed data into a staging buffer and
+		 * decompress it into the element allocation.
+		 */
+		job->alloc = malloc(elem->size);
+		if (job->alloc == NULL) {
+			free(job->fname);
+			free(job);
+			return NULL;
+		}
+		job->data = job->alloc;
+		job->inflate = elem->data;
+		job->inflate_size = elem->length;
+	}
+
+	return job;
+}
+
+
+/**
+ * Write an element of an entry to backing storage as an individual file
+ * on the I/O thread.
+ *
+ * The element allocation is referenced until the write completes.
+ *
+ * \param state The backing store state to use.
+ * \param bse The entry to store
+ * \param elem_idx The element index within the entry.
+ * \param cdata The compressed element data or NULL if the element is
+ *              stored uncompressed. The job takes ownership of it.
+ * \return NSERROR_OK on success or error code.
+ */
+static nserror store_io_write(struct store_state *state,
+			      struct store_entry *bse,
+			      int elem_idx,
+			      uint8_t *cdata)
+{
+	struct store_io_job *job;
+
+	job = store_io_job_create(state, bse, elem_idx, STORE_IO_WRITE);
+	if (job == NULL) {
+		free(cdata);
+		return NSERROR_SAVE_FAILED;
+	}
+
+	if (cdata != NULL) {
+		job->data = job->alloc = cdata;
+	}
+
+	bse->elem[elem_idx].ref++;
+	storeio.queued_bytes += job->size;
+
+	store_io_submit(state, job);
+
+	return NSERROR_OK;
+}
+
+
+/**
+ * Write a run of held writes to consecutive small blocks on the I/O
+ * thread.
+ *
+ * The element allocations remain referenced until the run is
+ * collected and completed.
+ *
+ * \param state The backing store state to use.
+ * \param wr The first held write of the run.
+ * \param count The number of writes in the run.
+ * \return NSERROR_OK on success or error code in which case the run
+ *         must be written synchronously.
+ */
+static nserror store_io_write_run(struct store_state *state,
+				  struct store_write *wr,
+				  unsigned int count)
+{
+	struct store_io_job *job;
+	unsigned int idx;
+	size_t size = 0;
+
+	for (idx = 0; idx < count; idx++) {
+		size += wr[idx].size;
+	}
+	if ((storeio.queued_bytes + size) > STORE_IO_QUEUE_LIMIT) {
+		return NSERROR_NOSPACE;
+	}
+
+	job = calloc(1, sizeof(struct store_io_job));
+	if (job == NULL) {
+		return NSERROR_NOMEM;
+	}
+
+	job->writes = malloc(count * sizeof(struct store_write));
+	if (job->writes == NULL) {
+		free(job);
+		return NSERROR_NOMEM;
+	}
+
+	job->fd = store_block_fd(state, wr->elem_idx, wr->block, &job->offset);
+	if (job->fd == -1) {
+		free(job->writes);
+		free(job);
+		return NSERROR_SAVE_FAILED;
+	}
+
+	memcpy(job->writes, wr, count * sizeof(struct store_write));
+	job->op = STORE_IO_WRITE_RUN;
+	job->ident = wr->ident;
+	job->elem_idx = wr->elem_idx;
+	job->count = count;
+	job->size = size;
+	job->bsize = (size_t)1 << block_file_log2_size(wr->elem_idx,
+					wr->block >> BLOCK_ENTRY_COUNT);
+
+	storeio.queued_bytes += size;
+
+	store_io_submit(state, job);
+
+	return NSERROR_OK;
+}
+
+
+/**
+ * Start the I/O thread.
+ *
+ * Failure to start the thread is not fatal, all I/O is simply
+ * performed synchronously.
+ */
+static void store_io_start(void)
+{
+	memset(&storeio, 0, sizeof(storeio));
+
+	pthread_mutex_init(&storeio.lock, NULL);
+	pthread_cond_init(&storeio.work, NULL);
+	pthread_cond_init(&storeio.done, NULL);
+
+	if (pthread_create(&storeio.thread, NULL, store_io_thread, NULL) != 0) {
+		NSLOG(netsurf, INFO, "Unable to start I/O thread");
+		pthread_cond_destroy(&storeio.done);
+		pthread_cond_destroy(&storeio.work);
+		pthread_mutex_destroy(&storeio.lock);
+		return;
+	}
+
+	storeio.running = true;
+}
+
+
+/**
+ * Load the entry index on the I/O thread.
+ *
+ * The store is not ready, and all lookups miss, until the load has
+ * completed.
+ *
+ * \param state The store state to load the index into.
+ * \return NSERROR_OK if the load was started or error code on failure.
+ */
+static nserror store_io_load(struct store_state *state)
+{
+	struct store_io_job *job;
+
+	job = calloc(1, sizeof(struct store_io_job));
+	if (job == NULL) {
+		return NSERROR_NOMEM;
+	}
+
+	job->op = STORE_IO_LOAD;
+	job->load = state;
+
+	store_io_submit(state, job);
+
+	return NSERROR_OK;
+}
+
+
+/**
+ * Discard a fetch job without calling its callback.
+ *
+ * \param state The store state to use.
+ * \param job The fetch job to discard.
+ */
+static void store_io_discard(struct store_state *state, struct store_io_job *job)
+{
+	struct store_io_job *waiter;
+	struct store_entry *bse;
+
+	bse = store_io_entry(state, job->ident);
+	if (bse != NULL) {
+		bse->elem[job->elem_idx].flags &= ~ENTRY_ELEM_FLAG_PENDING;
+		entry_release_alloc(&bse->elem[job->elem_idx]);
+	}
+
+	while (job->waiters != NULL) {
+		waiter = job->waiters;
+		job->waiters = waiter->waiters;
+		waiter->waiters = NULL;
+		store_io_discard(state, waiter);
+	}
+
+	free(job->alloc);
+	free(job->fname);
+	free(job);
+}
+
+
+/**
+ * Stop the I/O thread.
+ *
+ * Queued jobs are completed before the thread exits. Fetches still
+ * outstanding have their allocation released without their
+ * callback being called as the cache is being finalised.
+ *
+ * \param state The store state to use.
+ */
+static void store_io_stop(struct store_state *state)
+{
+	struct store_io_job *job;
+
+	if (storeio.running == false) {
+		return;
+	}
+
+	guit->misc->schedule(-1, store_io_poll, state);
+
+	pthread_mutex_lock(&storeio.lock);
+	storeio.quit = true;
+	pthread_cond_signal(&storeio.work);
+	pthread_mutex_unlock(&storeio.lock);
+
+	pthread_join(storeio.thread, NULL);
+
+	/* every job is now on the completion list */
+	storeio.complete = NULL;
+	storeio.complete_tail = NULL;
+
+	while (storeio.inflight != NULL) {
+		job = storeio.inflight;
+		if ((job->op == STORE_IO_WRITE) ||
+		    (job->op == STORE_IO_WRITE_RUN) ||
+		    (job->op == STORE_IO_LOAD)) {
+			store_io_complete(state, job);
+		} else {
+			storeio.inflight = job->inext;
+			storeio.outstanding--;
+			store_io_discard(state, job);
+		}
+	}
+
+	pthread_cond_destroy(&storeio.done);
+	pthread_cond_destroy(&storeio.work);
+	pthread_mutex_destroy(&storeio.lock);
+
+	storeio.running = false;
+}
+
+
+/**
+ * Retrieve an object from the backing store on the I/O thread.
+ *
+ * @param[in] url The url is used as the unique primary key for the data.
+ * @param[in] bsflags The flags to control how the object is retrieved.
+ * @param[in] cb The completion callback.
+ * @param[in] pw The context passed to the completion callback.
+ * @return NSERROR_OK on success or error code on failure.
+ */
+static nserror
+fetch_async(nsurl *url,
+	    enum backing_store_flags bsflags,
+	    void (*cb)(nserror res, uint8_t *data, size_t datalen, void *pw),
+	    void *pw)
+{
+	nserror ret;
+	struct store_entry *bse;
+	struct store_entry_element *elem;
+	struct store_io_job *job;
+	struct store_io_job *read;
+	int elem_idx;
+
+	/* check backing store is initialised */
+	if (storestate == NULL) {
+		return NSERROR_INIT_FAILED;
+	}
+
+	if (storeio.running == false) {
+		return NSERROR_NOT_IMPLEMENTED;
+	}
+
+	/* all lookups miss until the index is loaded */
+	if (storestate->ready == false) {
+		storestate->miss_count++;
+		return NSERROR_NOT_FOUND;
+	}
+
+	/* fetch store entry */
+	ret = get_store_entry(storestate, url, &bse);
+	if (ret != NSERROR_OK) {
+		NSLOG(netsurf, INFO, "entry not found");
+		storestate->miss_count++;
+		return ret;
+	}
+	storestate->hit_count++;
+
+	/* calculate the entry element index */
+	if ((bsflags & BACKING_STORE_META) != 0) {
+		elem_idx = ENTRY_ELEM_META;
+	} else {
+		elem_idx = ENTRY_ELEM_DATA;
+	}
+	elem = &bse->elem[elem_idx];
+
+	if ((elem->flags & ENTRY_ELEM_FLAG_PENDING) != 0) {
+		/* wait for the read already in flight */
+		read = store_io_find_read(bse->ident, elem_idx);
+		if (read == NULL) {
+			return NSERROR_NOT_FOUND;
+		}
+
+		job = calloc(1, sizeof(struct store_io_job));
+		if (job == NULL) {
+			return NSERROR_NOMEM;
+		}
+		job->op = STORE_IO_NONE;
+		job->ident = bse->ident;
+		job->elem_idx = elem_idx;
+		job->cb = cb;
+		job->pw = pw;
+
+		elem->ref++;
+		job->waiters = read->waiters;
+		read->waiters = job;
+
+		return NSERROR_OK;
+	}
+
+	if ((elem->flags & (ENTRY_ELEM_FLAG_HEAP | ENTRY_ELEM_FLAG_MMAP)) != 0) {
+		/* use the existing allocation, the callback is still
+		 * delivered from the completion poll.
+		 */
+		job = store_io_job_create(storestate, bse, elem_idx, STORE_IO_NONE);
+		if (job == NULL) {
+			return NSERROR_NOMEM;
+		}
+		elem->ref++;
+	} else if (store_map_element(storestate, bse, elem_idx) == NSERROR_OK) {
+		/* mapped data needs no I/O */
+		job = store_io_job_create(storestate, bse, elem_idx, STORE_IO_NONE);
+		if (job == NULL) {
+			entry_release_alloc(elem);
+			return NSERROR_NOMEM;
+		}
+	} else {
+		elem->data = malloc(elem->length);
+		if (elem->data == NULL) {
+			NSLOG(netsurf, INFO,
+			      "Failed to create new heap allocation");
+			return NSERROR_NOMEM;
+		}
+
+		job = store_io_job_create(storestate, bse, elem_idx, STORE_IO_READ);
+		if (job == NULL) {
+			free(elem->data);
+			return NSERROR_NOT_FOUND;
+		}
+
+		/* mark the entry as having a heap allocation being filled */
+		elem->flags |= ENTRY_ELEM_FLAG_HEAP | ENTRY_ELEM_FLAG_PENDING;
+		elem->ref = 1;
+	}
+	job->cb = cb;
+	job->pw = pw;
+
+	store_io_submit(storestate, job);
+
+	return NSERROR_OK;
+}
+
+
+/**
+ * Retrieve an element whose read is in flight on the I/O thread.
+ *
+ * Waits for only that read to complete. The read job still completes
+ * the fetch which started it when collected.
+ *
+ * \param bse The entry.
+ * \param elem_idx The element index within the entry.
+ * \return NSERROR_OK on success or error code.
+ */
+static nserror store_io_fetch_pending(struct store_entry *bse, int elem_idx)
+{
+	struct store_io_job *read;
+
+	read = store_io_find_read(bse->ident, elem_idx);
+	if (read == NULL) {
+		return NSERROR_NOT_FOUND;
+	}
+
+	store_io_wait_job(read);
+
+	if (read->res == NSERROR_OK) {
+		bse->elem[elem_idx].ref++;
+	}
+
+	return read->res;
+}
+
+#endif
+
 /**
  * Initialise the backing store.
  *
@@ -1514,6 +4058,10 @@ initialise(const struct llcache_store_parameters *parameters)
 	newstate->path = strdup(parameters->path);
 	newstate->limit = parameters->limit;
 	newstate->hysteresis = parameters->hysteresis;
+	newstate->compress = parameters->compress;
+	newstate->journal_fd = -1;
+	newstate->journal_rfd = -1;
+	newstate->lock_fd = -1;
 
 	if (parameters->address_size == 0) {
 		newstate->ident_bits = DEFAULT_IDENT_SIZE;
@@ -1527,9 +4075,20 @@ initialise(const struct llcache_store_parameters *parameters)
 		newstate->entry_bits = parameters->entry_size;
 	}
 
+	if (parameters->shared == true) {
+		ret = store_lock(newstate);
+		if (ret == NSERROR_OK) {
+			newstate->shared = true;
+		} else if (ret != NSERROR_NOT_IMPLEMENTED) {
+			free(newstate->path);
+			free(newstate);
+			return ret;
+		}
+	}
+
 	/* read store control and create new if required */
 	ret = read_control(newstate);
-	if (ret != NSERROR_OK) {
+	if ((ret != NSERROR_OK) && (newstate->readonly == false)) {
 		NSLOG(netsurf, INFO, "read control failed %s",
 		      messages_get_errorcode(ret));
 		ret = write_control(newstate);
@@ -1540,6 +4099,9 @@ initialise(const struct llcache_store_parameters *parameters)
 	}
 	if (ret != NSERROR_OK) {
 		/* that went well obviously */
+		if (newstate->lock_fd != -1) {
+			close(newstate->lock_fd);
+		}
 		free(newstate->path);
 		free(newstate);
 		return ret;
@@ -1552,36 +4114,48 @@ initialise(const struct llcache_store_parameters *parameters)
 		newstate->entry_bits = (8 * sizeof(entry_index_t));
 	}
 
-	/* read filesystem entries */
-	ret = read_entries(newstate);
-	if (ret != NSERROR_OK) {
-		/* that went well obviously */
-		free(newstate->path);
-		free(newstate);
-		return ret;
+	/* the address map must always have empty slots */
+	if (newstate->ident_bits <= newstate->entry_bits) {
+		newstate->ident_bits = newstate->entry_bits + 1;
 	}
 
-	/* build entry hash map */
-	ret = build_entrymap(newstate);
-	if (ret != NSERROR_OK) {
-		/* that obviously went well */
-		free(newstate->entries);
-		free(newstate->path);
-		free(newstate);
-		return ret;
-	}
+#ifdef WITH_BACKING_STORE_THREAD
+	store_io_start();
 
-	ret = read_blocks(newstate);
-	if (ret != NSERROR_OK) {
-		/* oh dear */
-		free(newstate->addrmap);
-		free(newstate->entries);
-		free(newstate->path);
-		free(newstate);
-		return ret;
+	/* load the index in the background so the cost of starting
+	 * does not depend on the size of the store.
+	 */
+	if (storeio.running == true) {
+		newstate->load_async = true;
+		if (store_io_load(newstate) == NSERROR_OK) {
+			storestate = newstate;
+		} else {
+			newstate->load_async = false;
+		}
 	}
+#endif
+
+	if (storestate == NULL) {
+		ret = load_index(newstate);
+		if (ret != NSERROR_OK) {
+			/* that went well obviously */
+#ifdef WITH_BACKING_STORE_THREAD
+			store_io_stop(newstate);
+#endif
+			if (newstate->journal_rfd != -1) {
+				close(newstate->journal_rfd);
+			}
+			if (newstate->lock_fd != -1) {
+				close(newstate->lock_fd);
+			}
+			free(newstate->path);
+			free(newstate);
+			return ret;
+		}
 
-	storestate = newstate;
+		storestate = newstate;
+		load_index_complete(newstate);
+	}
 
 	NSLOG(netsurf, INFO, "FS backing store init successful");
 
@@ -1592,8 +4166,6 @@ initialise(const struct llcache_store_parameters *parameters)
 	      newstate->hysteresis,
 	      newstate->ident_bits,
 	      newstate->entry_bits);
-	NSLOG(netsurf, INFO, "Using %"PRIu64"/%"PRIsizet,
-	      newstate->total_alloc, newstate->limit);
 
 	return NSERROR_OK;
 }
@@ -1614,17 +4186,39 @@ finalise(void)
 	unsigned int op_count;
 
 	if (storestate != NULL) {
+#ifdef WITH_BACKING_STORE_THREAD
+		store_io_stop(storestate);
+#endif
 		guit->misc->schedule(-1, control_maintinance, storestate);
-		write_entries(storestate);
-		write_blocks(storestate);
 
-		/* ensure all block files are closed */
-		for (bf = 0; bf < BLOCK_FILE_COUNT; bf++) {
-			if (storestate->blocks[ENTRY_ELEM_DATA][bf].fd != -1) {
-				close(storestate->blocks[ENTRY_ELEM_DATA][bf].fd);
+		/* nothing was opened if the index never loaded */
+		if (storestate->ready == true) {
+			store_write_flush(storestate);
+			if (storestate->readonly == false) {
+				journal_compact(storestate);
+			}
+			if (storestate->journal_fd != -1) {
+				close(storestate->journal_fd);
 			}
-			if (storestate->blocks[ENTRY_ELEM_META][bf].fd != -1) {
-				close(storestate->blocks[ENTRY_ELEM_META][bf].fd);
+
+			/* ensure all block files are closed */
+			for (bf = 0; bf < BLOCK_FILES; bf++) {
+#ifdef HAVE_MMAP
+				if (storestate->blocks[ENTRY_ELEM_DATA][bf].map != NULL) {
+					munmap(storestate->blocks[ENTRY_ELEM_DATA][bf].map,
+					       (size_t)1 << (block_file_log2_size(ENTRY_ELEM_DATA, bf) + BLOCK_ENTRY_COUNT));
+				}
+				if (storestate->blocks[ENTRY_ELEM_META][bf].map != NULL) {
+					munmap(storestate->blocks[ENTRY_ELEM_META][bf].map,
+					       (size_t)1 << (block_file_log2_size(ENTRY_ELEM_META, bf) + BLOCK_ENTRY_COUNT));
+				}
+#endif
+				if (storestate->blocks[ENTRY_ELEM_DATA][bf].fd != -1) {
+					close(storestate->blocks[ENTRY_ELEM_DATA][bf].fd);
+				}
+				if (storestate->blocks[ENTRY_ELEM_META][bf].fd != -1) {
+					close(storestate->blocks[ENTRY_ELEM_META][bf].fd);
+				}
 			}
 		}
 
@@ -1642,9 +4236,24 @@ finalise(void)
 			      (storestate->miss_count * 100) / op_count,
 			      0);
 		}
+		NSLOG(netsurf, INFO, "Address map lookups which probed %"PRIu64,
+		      storestate->probe_count);
+
+		if (storestate->journal_rfd != -1) {
+			close(storestate->journal_rfd);
+		}
+
+		/* closing the lock file releases the writer lock */
+		if (storestate->lock_fd != -1) {
+			close(storestate->lock_fd);
+		}
 
+		free(storestate->evict_prev);
+		free(storestate->evict_next);
 		free(storestate->addrmap);
 		free(storestate->entries);
+		free(storestate->pending_invalidate);
+		free(storestate->deferred);
 		free(storestate->path);
 		free(storestate);
 		storestate = NULL;
@@ -1654,58 +4263,161 @@ finalise(void)
 
 
 /**
- * Write an element of an entry to backing storage in a small block file.
+ * Order held writes by element and block.
+ *
+ * \param a The first write.
+ * \param b The second write.
+ * \return less than, equal to, or greater than zero as \a a is
+ *         ordered before, with or after \a b.
+ */
+static int store_write_cmp(const void *a, const void *b)
+{
+	const struct store_write *wa = a;
+	const struct store_write *wb = b;
+
+	if (wa->elem_idx != wb->elem_idx) {
+		return wa->elem_idx - wb->elem_idx;
+	}
+	if (wa->block < wb->block) {
+		return -1;
+	}
+	return (wa->block > wb->block) ? 1 : 0;
+}
+
+/**
+ * Write a run of held writes to consecutive small blocks.
  *
  * \param state The backing store state to use.
- * \param bse The entry to store
- * \param elem_idx The element index within the entry.
+ * \param wr The first held write of the run.
+ * \param count The number of writes in the run.
  * \return NSERROR_OK on success or error code.
  */
-static nserror store_write_block(struct store_state *state,
-			 struct store_entry *bse,
-			 int elem_idx)
+static nserror store_write_run(struct store_state *state,
+			       struct store_write *wr,
+			       unsigned int count)
 {
-	block_index_t bf = (bse->elem[elem_idx].block >> BLOCK_ENTRY_COUNT) &
-		((1 << BLOCK_FILE_COUNT) - 1); /* block file block resides in */
-	block_index_t bi = bse->elem[elem_idx].block & ((1U << BLOCK_ENTRY_COUNT) -1); /* block index in file */
-	ssize_t wr;
 	off_t offst;
+	size_t bsize;
+	int fd;
+	int err = 0;
+	nserror res;
 
-	/* ensure the block file fd is good */
-	if (state->blocks[elem_idx][bf].fd == -1) {
-		state->blocks[elem_idx][bf].fd = store_open(state, bf,
-				elem_idx + ENTRY_ELEM_COUNT, O_CREAT | O_RDWR);
-		if (state->blocks[elem_idx][bf].fd == -1) {
-			NSLOG(netsurf, INFO, "Open failed errno %d", errno);
-			return NSERROR_SAVE_FAILED;
-		}
+	fd = store_block_fd(state, wr->elem_idx, wr->block, &offst);
+	if (fd == -1) {
+		return NSERROR_SAVE_FAILED;
+	}
+	bsize = (size_t)1 << block_file_log2_size(wr->elem_idx,
+						  wr->block >> BLOCK_ENTRY_COUNT);
 
-		/* flag that a block file has been opened */
-		state->blocks_opened = true;
+	res = store_write_blocks(fd, offst, bsize, wr, count, &err);
+	if (res != NSERROR_OK) {
+		NSLOG(netsurf, INFO,
+		      "Write of %u blocks at 0x%jx block %d failed errno %d",
+		      count, (uintmax_t)offst, wr->block, err);
+		return res;
 	}
 
-	offst = (unsigned int)bi << log2_block_size[elem_idx];
+	NSLOG(netsurf, DEEPDEBUG, "Wrote %u blocks at 0x%jx block %d",
+	      count, (uintmax_t)offst, wr->block);
 
-	wr = nsu_pwrite(state->blocks[elem_idx][bf].fd,
-		    bse->elem[elem_idx].data,
-		    bse->elem[elem_idx].size,
-		    offst);
-	if (wr != (ssize_t)bse->elem[elem_idx].size) {
-		NSLOG(netsurf, INFO,
-		      "Write failed %"PRIssizet" of %d bytes from %p at 0x%jx block %d errno %d",
-		      wr,
-		      bse->elem[elem_idx].size,
-		      bse->elem[elem_idx].data,
-		      (uintmax_t)offst,
-		      bse->elem[elem_idx].block,
-		      errno);
-		return NSERROR_SAVE_FAILED;
+	return NSERROR_OK;
+}
+
+/**
+ * Write out all the small block writes held in the write behind buffer.
+ *
+ * Held writes are sorted by block so writes to consecutive blocks of
+ * a block file are coalesced. Each coalesced run is written on the
+ * I/O thread when it is running. Each entry is recorded in the
+ * journal once its data is written or invalidated if the write failed.
+ *
+ * \param state The backing store state to use.
+ */
+static void store_write_flush(struct store_state *state)
+{
+	struct store_write *wr = state->write_behind;
+	unsigned int count = state->write_behind_count;
+	unsigned int first;
+	unsigned int run;
+	nserror res;
+
+	if (count == 0) {
+		return;
 	}
 
-	NSLOG(netsurf, INFO,
-	      "Wrote %"PRIssizet" bytes from %p at 0x%jx block %d", wr,
-	      bse->elem[elem_idx].data, (uintmax_t)offst,
-	      bse->elem[elem_idx].block);
+	/* the buffer is empty from here on as completion may cause
+	 * entries to be stored.
+	 */
+	state->write_behind_count = 0;
+	state->write_behind_size = 0;
+
+	qsort(wr, count, sizeof(struct store_write), store_write_cmp);
+
+	for (first = 0; first < count; first += run) {
+		/* find the run of consecutive blocks in the same file */
+		for (run = 1; (first + run) < count; run++) {
+			if ((wr[first + run].elem_idx != wr[first].elem_idx) ||
+			    (wr[first + run].block != (wr[first].block + run)) ||
+			    ((wr[first + run].block >> BLOCK_ENTRY_COUNT) !=
+			     (wr[first].block >> BLOCK_ENTRY_COUNT)) ||
+			    (run == WRITE_BEHIND_RUN)) {
+				break;
+			}
+		}
+
+#ifdef WITH_BACKING_STORE_THREAD
+		if ((storeio.running == true) &&
+		    (store_io_write_run(state, &wr[first], run) == NSERROR_OK)) {
+			/* completed once collected from the I/O thread */
+			continue;
+		}
+#endif
+
+		res = store_write_run(state, &wr[first], run);
+		store_write_complete(state, &wr[first], run, res);
+	}
+
+	NSLOG(netsurf, INFO, "Flushed %u held writes", count);
+}
+
+/**
+ * Hold a write of an element of an entry to a small block file.
+ *
+ * The write is held in the write behind buffer until the next
+ * maintenance or the buffer is full. The element allocation is
+ * referenced until the write completes.
+ *
+ * \param state The backing store state to use.
+ * \param bse The entry to store
+ * \param elem_idx The element index within the entry.
+ * \param cdata The compressed element data or NULL if the element is
+ *              stored uncompressed. The held write takes ownership of it.
+ * \return NSERROR_OK on success or error code.
+ */
+static nserror store_write_behind(struct store_state *state,
+				  struct store_entry *bse,
+				  int elem_idx,
+				  uint8_t *cdata)
+{
+	struct store_entry_element *elem = &bse->elem[elem_idx];
+	struct store_write *wr;
+
+	wr = &state->write_behind[state->write_behind_count++];
+	wr->ident = bse->ident;
+	wr->elem_idx = elem_idx;
+	wr->block = elem->block;
+	wr->data = (cdata != NULL) ? cdata : elem->data;
+	wr->alloc = cdata;
+	wr->size = elem->size;
+
+	elem->ref++;
+	state->write_behind_size += wr->size;
+
+	/* bse may not be used after a flush as entries can move */
+	if ((state->write_behind_count == WRITE_BEHIND_COUNT) ||
+	    (state->write_behind_size >= WRITE_BEHIND_SIZE)) {
+		store_write_flush(state);
+	}
 
 	return NSERROR_OK;
 }
@@ -1716,11 +4428,13 @@ static nserror store_write_block(struct store_state *state,
  * \param state The backing store state to use.
  * \param bse The entry to store
  * \param elem_idx The element index within the entry.
+ * \param data The element data as stored on disc.
  * \return NSERROR_OK on success or error code.
  */
 static nserror store_write_file(struct store_state *state,
 			 struct store_entry *bse,
-			 int elem_idx)
+			 int elem_idx,
+			 const uint8_t *data)
 {
 	ssize_t wr;
 	int fd;
@@ -1733,7 +4447,7 @@ static nserror store_write_file(struct store_state *state,
 		return NSERROR_SAVE_FAILED;
 	}
 
-	wr = write(fd, bse->elem[elem_idx].data, bse->elem[elem_idx].size);
+	wr = write(fd, data, bse->elem[elem_idx].size);
 	err = errno; /* close can change errno */
 
 	close(fd);
@@ -1742,7 +4456,7 @@ static nserror store_write_file(struct store_state *state,
 		      "Write failed %"PRIssizet" of %d bytes from %p errno %d",
 		      wr,
 		      bse->elem[elem_idx].size,
-		      bse->elem[elem_idx].data,
+		      data,
 		      err);
 
 		/** @todo Delete the file? */
@@ -1750,15 +4464,39 @@ static nserror store_write_file(struct store_state *state,
 	}
 
 	NSLOG(netsurf, INFO, "Wrote %"PRIssizet" bytes from %p", wr,
-	      bse->elem[elem_idx].data);
+	      data);
 
 	return NSERROR_OK;
 }
 
+/**
+ * Return the data of a failed store to the caller.
+ *
+ * The element no longer references the data, which remains owned by
+ * the caller, and the entry is invalidated as nothing was written.
+ *
+ * \param state The backing store state to use.
+ * \param bse The entry which failed to be stored.
+ * \param elem_idx The element index within the entry.
+ */
+static void
+store_disown(struct store_state *state, struct store_entry *bse, int elem_idx)
+{
+	struct store_entry_element *elem = &bse->elem[elem_idx];
+
+	elem->flags &= ~ENTRY_ELEM_FLAG_HEAP;
+	elem->data = NULL;
+	elem->ref = 0;
+
+	invalidate_entry(state, bse);
+}
+
+
 /**
  * Place an object in the backing store.
  *
- * takes ownership of the heap block passed in.
+ * takes ownership of the heap block passed in on success, on failure
+ * it remains owned by the caller.
  *
  * @param url The url is used as the unique primary key for the data.
  * @param bsflags The flags to control how the object is stored.
@@ -1775,12 +4513,28 @@ store(nsurl *url,
 	nserror ret;
 	struct store_entry *bse;
 	int elem_idx;
+	uint8_t *cdata = NULL; /* compressed data */
+	size_t csize = 0; /* size of compressed data */
 
 	/* check backing store is initialised */
 	if (storestate == NULL) {
 		return NSERROR_INIT_FAILED;
 	}
 
+	/* the entries cannot be updated until the index is loaded */
+	if (storestate->ready == false) {
+		if (storestate->load_failed == true) {
+			/* the index will never load */
+			return NSERROR_SAVE_FAILED;
+		}
+		return NSERROR_INIT_FAILED;
+	}
+
+	/* only the writer of a shared store places objects in it */
+	if (storestate->readonly == true) {
+		return NSERROR_PERMISSION;
+	}
+
 	/* calculate the entry element index */
 	if ((bsflags & BACKING_STORE_META) != 0) {
 		elem_idx = ENTRY_ELEM_META;
@@ -1788,37 +4542,62 @@ store(nsurl *url,
 		elem_idx = ENTRY_ELEM_DATA;
 	}
 
+	/* compress the data if it is worthwhile */
+	if ((storestate->compress == true) &&
+	    ((bsflags & BACKING_STORE_COMPRESSED) == 0) &&
+	    (datalen >= STORE_COMPRESS_MIN_SIZE)) {
+		cdata = store_compress(data, datalen, &csize);
+		if (cdata != NULL) {
+			NSLOG(netsurf, INFO, "Compressed %"PRIsizet" to %"PRIsizet,
+			      datalen, csize);
+		}
+	}
+
 	/* set the store entry up */
-	ret = set_store_entry(storestate, url, elem_idx, data, datalen, &bse);
+	ret = set_store_entry(storestate, url, elem_idx, data, datalen, csize, &bse);
 	if (ret != NSERROR_OK) {
 		NSLOG(netsurf, INFO, "store entry setting failed");
+		free(cdata);
 		return ret;
 	}
 
+	/* the removal of any evicted entries must be written before
+	 * their blocks are reused, see journal_flush() for the
+	 * guarantee this gives.
+	 */
+	journal_flush(storestate);
+
 	if (bse->elem[elem_idx].block != 0) {
-		/* small block storage */
-		ret = store_write_block(storestate, bse, elem_idx);
-	} else {
-		/* separate file in backing store */
-		ret = store_write_file(storestate, bse, elem_idx);
+		/* small block storage is coalesced by the write behind */
+		return store_write_behind(storestate, bse, elem_idx, cdata);
 	}
 
-	return ret;
-}
-
-/**
- * release any allocation for an entry
- */
-static nserror entry_release_alloc(struct store_entry_element *elem)
-{
-	if ((elem->flags & ENTRY_ELEM_FLAG_HEAP) != 0) {
-		elem->ref--;
-		if (elem->ref == 0) {
-			NSLOG(netsurf, INFO, "freeing %p", elem->data);
-			free(elem->data);
-			elem->flags &= ~ENTRY_ELEM_FLAG_HEAP;
+#ifdef WITH_BACKING_STORE_THREAD
+	if ((storeio.running == true) &&
+	    ((storeio.queued_bytes + bse->elem[elem_idx].size) <= STORE_IO_QUEUE_LIMIT)) {
+		/* write on the I/O thread */
+		ret = store_io_write(storestate, bse, elem_idx, cdata);
+		if (ret != NSERROR_OK) {
+			store_disown(storestate, bse, elem_idx);
 		}
+		return ret;
+	}
+#endif
+
+	/* separate file in backing store */
+	ret = store_write_file(storestate, bse, elem_idx,
+			       (cdata != NULL) ? cdata : data);
+
+	free(cdata);
+
+	if (ret != NSERROR_OK) {
+		store_disown(storestate, bse, elem_idx);
+		return ret;
 	}
+
+	/* record the entry once its data is written */
+	journal_record(storestate, JOURNAL_OP_SET, bse);
+
 	return NSERROR_OK;
 }
 
@@ -1829,35 +4608,25 @@ static nserror entry_release_alloc(struct store_entry_element *elem)
  * \param state The backing store state to use.
  * \param bse The entry to read.
  * \param elem_idx The element index within the entry.
+ * \param data The buffer to read the element as stored on disc into.
  * \return NSERROR_OK on success or error code.
  */
 static nserror store_read_block(struct store_state *state,
 			 struct store_entry *bse,
-			 int elem_idx)
+			 int elem_idx,
+			 uint8_t *data)
 {
-	block_index_t bf = (bse->elem[elem_idx].block >> BLOCK_ENTRY_COUNT) &
-		((1 << BLOCK_FILE_COUNT) - 1); /* block file block resides in */
-	block_index_t bi = bse->elem[elem_idx].block & ((1 << BLOCK_ENTRY_COUNT) -1); /* block index in file */
 	ssize_t rd;
 	off_t offst;
+	int fd;
 
-	/* ensure the block file fd is good */
-	if (state->blocks[elem_idx][bf].fd == -1) {
-		state->blocks[elem_idx][bf].fd = store_open(state, bf,
-				elem_idx + ENTRY_ELEM_COUNT, O_CREAT | O_RDWR);
-		if (state->blocks[elem_idx][bf].fd == -1) {
-			NSLOG(netsurf, INFO, "Open failed errno %d", errno);
-			return NSERROR_SAVE_FAILED;
-		}
-
-		/* flag that a block file has been opened */
-		state->blocks_opened = true;
+	fd = store_block_fd(state, elem_idx, bse->elem[elem_idx].block, &offst);
+	if (fd == -1) {
+		return NSERROR_SAVE_FAILED;
 	}
 
-	offst = (unsigned int)bi << log2_block_size[elem_idx];
-
-	rd = nsu_pread(state->blocks[elem_idx][bf].fd,
-		   bse->elem[elem_idx].data,
+	rd = nsu_pread(fd,
+		   data,
 		   bse->elem[elem_idx].size,
 		   offst);
 	if (rd != (ssize_t)bse->elem[elem_idx].size) {
@@ -1865,7 +4634,7 @@ static nserror store_read_block(struct store_state *state,
 		      "Failed reading %"PRIssizet" of %d bytes into %p from 0x%jx block %d errno %d",
 		      rd,
 		      bse->elem[elem_idx].size,
-		      bse->elem[elem_idx].data,
+		      data,
 		      (uintmax_t)offst,
 		      bse->elem[elem_idx].block,
 		      errno);
@@ -1874,7 +4643,7 @@ static nserror store_read_block(struct store_state *state,
 
 	NSLOG(netsurf, INFO,
 	      "Read %"PRIssizet" bytes into %p from 0x%jx block %d", rd,
-	      bse->elem[elem_idx].data, (uintmax_t)offst,
+	      data, (uintmax_t)offst,
 	      bse->elem[elem_idx].block);
 
 	return NSERROR_OK;
@@ -1886,11 +4655,13 @@ static nserror store_read_block(struct store_state *state,
  * \param state The backing store state to use.
  * \param bse The entry to read.
  * \param elem_idx The element index within the entry.
+ * \param data The buffer to read the element as stored on disc into.
  * \return NSERROR_OK on success or error code.
  */
 static nserror store_read_file(struct store_state *state,
 			 struct store_entry *bse,
-			 int elem_idx)
+			 int elem_idx,
+			 uint8_t *data)
 {
 	int fd;
 	ssize_t rd; /* return from read */
@@ -1907,7 +4678,7 @@ static nserror store_read_file(struct store_state *state,
 
 	while (tot < bse->elem[elem_idx].size) {
 		rd = read(fd,
-			  bse->elem[elem_idx].data + tot,
+			  data + tot,
 			  bse->elem[elem_idx].size - tot);
 		if (rd <= 0) {
 			NSLOG(netsurf, INFO,
@@ -1922,8 +4693,57 @@ static nserror store_read_file(struct store_state *state,
 
 	close(fd);
 
-	NSLOG(netsurf, INFO, "Read %"PRIsizet" bytes into %p", tot,
-	      bse->elem[elem_idx].data);
+	NSLOG(netsurf, INFO, "Read %"PRIsizet" bytes into %p", tot, data);
+
+	return ret;
+}
+
+/**
+ * Read an element of an entry from the backing storage.
+ *
+ * Compressed elements are read into a temporary buffer and
+ * decompressed into the element allocation.
+ *
+ * \param state The backing store state to use.
+ * \param bse The entry to read.
+ * \param elem_idx The element index within the entry.
+ * \return NSERROR_OK on success or error code.
+ */
+static nserror store_read_element(struct store_state *state,
+				  struct store_entry *bse,
+				  int elem_idx)
+{
+	struct store_entry_element *elem = &bse->elem[elem_idx];
+	uint8_t *data;
+	nserror ret;
+
+	if ((elem->flags & ENTRY_ELEM_FLAG_COMPRESSED) != 0) {
+		data = malloc(elem->size);
+		if (data == NULL) {
+			return NSERROR_NOMEM;
+		}
+	} else {
+		data = elem->data;
+	}
+
+	if (elem->block != 0) {
+		ret = store_read_block(state, bse, elem_idx, data);
+	} else {
+		ret = store_read_file(state, bse, elem_idx, data);
+	}
+
+	if (data != elem->data) {
+		if (ret == NSERROR_OK) {
+			ret = store_decompress(data, elem->size,
+					       elem->data, elem->length);
+			if (ret != NSERROR_OK) {
+				NSLOG(netsurf, INFO,
+				      "Decompressing %d bytes failed",
+				      elem->size);
+			}
+		}
+		free(data);
+	}
 
 	return ret;
 }
@@ -1946,6 +4766,7 @@ fetch(nsurl *url,
 	nserror ret;
 	struct store_entry *bse;
 	struct store_entry_element *elem;
+	entry_ident_t ident;
 	int elem_idx;
 
 	/* check backing store is initialised */
@@ -1953,6 +4774,12 @@ fetch(nsurl *url,
 		return NSERROR_INIT_FAILED;
 	}
 
+	/* all lookups miss until the index is loaded */
+	if (storestate->ready == false) {
+		storestate->miss_count++;
+		return NSERROR_NOT_FOUND;
+	}
+
 	/* fetch store entry */
 	ret = get_store_entry(storestate, url, &bse);
 	if (ret != NSERROR_OK) {
@@ -1973,8 +4800,22 @@ fetch(nsurl *url,
 	}
 	elem = &bse->elem[elem_idx];
 
+#ifdef WITH_BACKING_STORE_THREAD
+	if ((elem->flags & ENTRY_ELEM_FLAG_PENDING) != 0) {
+		/* allocation is being filled on the I/O thread */
+		ret = store_io_fetch_pending(bse, elem_idx);
+		if (ret == NSERROR_OK) {
+			storestate->hit_size += elem->length;
+
+			*data_out = elem->data;
+			*datalen_out = elem->length;
+		}
+		return ret;
+	}
+#endif
+
 	/* if an allocation already exists return it */
-	if ((elem->flags & ENTRY_ELEM_FLAG_HEAP) != 0) {
+	if ((elem->flags & (ENTRY_ELEM_FLAG_HEAP | ENTRY_ELEM_FLAG_MMAP)) != 0) {
 		/* use the existing allocation and bump the ref count. */
 		elem->ref++;
 
@@ -1982,9 +4823,9 @@ fetch(nsurl *url,
 		      "Using existing entry (%p) allocation %p refs:%d", bse,
 		      elem->data, elem->ref);
 
-	} else {
+	} else if (store_map_element(storestate, bse, elem_idx) != NSERROR_OK) {
 		/* allocate from the heap */
-		elem->data = malloc(elem->size);
+		elem->data = malloc(elem->length);
 		if (elem->data == NULL) {
 			NSLOG(netsurf, INFO,
 			      "Failed to create new heap allocation");
@@ -1998,22 +4839,38 @@ fetch(nsurl *url,
 		elem->ref = 1;
 
 		/* fill the new block */
-		if (elem->block != 0) {
-			ret = store_read_block(storestate, bse, elem_idx);
-		} else {
-			ret = store_read_file(storestate, bse, elem_idx);
+		ret = store_read_element(storestate, bse, elem_idx);
+
+		/* the writer of a shared store journals the removal
+		 * of an entry before reusing its storage, following
+		 * the journal once the read is complete finds any
+		 * change made while it was read.
+		 */
+		if ((ret == NSERROR_OK) && (storestate->readonly == true)) {
+			ident = bse->ident;
+			journal_follow(storestate);
+
+			/* entries with allocations cannot be removed */
+			bse = &storestate->entries[BS_ENTRY_INDEX(ident, storestate)];
+			elem = &bse->elem[elem_idx];
+			if ((bse->flags & ENTRY_FLAGS_INVALID) != 0) {
+				ret = NSERROR_NOT_FOUND;
+			}
 		}
 	}
 
 	/* free the allocation if there is a read error */
 	if (ret != NSERROR_OK) {
 		entry_release_alloc(elem);
+		if ((bse->flags & ENTRY_FLAGS_INVALID) != 0) {
+			invalidate_entry(storestate, bse);
+		}
 	} else {
 		/* update stats and setup return pointers */
-		storestate->hit_size += elem->size;
+		storestate->hit_size += elem->length;
 
 		*data_out = elem->data;
-		*datalen_out = elem->size;
+		*datalen_out = elem->length;
 	}
 
 	return ret;
@@ -2038,6 +4895,10 @@ static nserror release(nsurl *url, enum backing_store_flags bsflags)
 		return NSERROR_INIT_FAILED;
 	}
 
+	if (storestate->ready == false) {
+		return NSERROR_NOT_FOUND;
+	}
+
 	ret = get_store_entry(storestate, url, &bse);
 	if (ret != NSERROR_OK) {
 		NSLOG(netsurf, INFO, "entry not found");
@@ -2066,6 +4927,39 @@ static nserror release(nsurl *url, enum backing_store_flags bsflags)
 }
 
 
+/**
+ * Record an entry invalidated while the index is loading.
+ *
+ * @param state The backing store state whose index is loading.
+ * @param ident The identifier of the invalidated entry.
+ * @return NSERROR_OK on success or NSERROR_NOMEM on allocation failure.
+ */
+static nserror
+pending_invalidate_add(struct store_state *state, entry_ident_t ident)
+{
+	entry_ident_t *pending;
+	size_t alloc;
+
+	if (state->pending_invalidate_count == state->pending_invalidate_alloc) {
+		alloc = state->pending_invalidate_alloc * 2;
+		if (alloc == 0) {
+			alloc = 16;
+		}
+		pending = realloc(state->pending_invalidate,
+				  alloc * sizeof(entry_ident_t));
+		if (pending == NULL) {
+			return NSERROR_NOMEM;
+		}
+		state->pending_invalidate = pending;
+		state->pending_invalidate_alloc = alloc;
+	}
+
+	state->pending_invalidate[state->pending_invalidate_count++] = ident;
+
+	return NSERROR_OK;
+}
+
+
 /**
  * Invalidate a source object from the backing store.
  *
@@ -2086,6 +4980,14 @@ invalidate(nsurl *url)
 		return NSERROR_INIT_FAILED;
 	}
 
+	if (storestate->ready == false) {
+		if (storestate->load_failed == true) {
+			return NSERROR_NOT_FOUND;
+		}
+		/* remove the entry once the index has loaded */
+		return pending_invalidate_add(storestate, store_ident(url));
+	}
+
 	ret = get_store_entry(storestate, url, &bse);
 	if (ret != NSERROR_OK) {
 		return ret;
@@ -2095,6 +4997,25 @@ invalidate(nsurl *url)
 }
 
 
+/**
+ * Retrieve backing store statistics.
+ *
+ * @param[out] stats The statistics.
+ * @return NSERROR_OK on success or error code on failure.
+ */
+static nserror stats(struct llcache_store_stats *stats)
+{
+	/* check backing store is initialised */
+	if (storestate == NULL) {
+		return NSERROR_INIT_FAILED;
+	}
+
+	stats->probe_count = storestate->probe_count;
+
+	return NSERROR_OK;
+}
+
+
 static struct gui_llcache_table llcache_table = {
 	.initialise = initialise,
 	.finalise = finalise,
@@ -2102,6 +5023,10 @@ static struct gui_llcache_table llcache_table = {
 	.fetch = fetch,
 	.invalidate = invalidate,
 	.release = release,
+#ifdef WITH_BACKING_STORE_THREAD
+	.fetch_async = fetch_async,
+#endif
+	.stats = stats,
 };
 
 struct gui_llcache_table *filesystem_llcache_table = &llcache_table;
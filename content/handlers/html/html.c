@@ -865,6 +865,8 @@ html_create_html_data(html_content *c, const http_parameter *params)
 	c->universal = NULL;
 	c->num_objects = 0;
 	c->object_list = NULL;
+	c->visible_scheduled = false;
+	c->objects_prioritised = false;
 	c->forms = NULL;
 	c->imagemaps = NULL;
 	c->bw = NULL;
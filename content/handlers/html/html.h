@@ -99,6 +99,7 @@ struct content_html_object {
 	/** Bitmap of acceptable content types */
 	content_type permitted_types;
 	bool background;  /**< This object is a background image. */
+	bool prioritised; /**< Fetch promoted as the object was visible. */
 };
 
 
@@ -177,7 +177,8 @@ html_stylesheet_from_domnode(html_content *c,
 		return error;
 	}
 
-	error = hlcache_handle_retrieve(url, 0,
+	error = hlcache_handle_retrieve(url,
+			LLCACHE_RETRIEVE_PRIORITY_BLOCKING,
 			content_get_url(&c->base), NULL,
 			html_convert_css_callback, c, &child, CONTENT_CSS,
 			sheet);
@@ -451,7 +452,8 @@ bool html_css_process_link(html_content *htmlc, dom_node *node)
 	child.charset = htmlc->encoding;
 	child.quirks = htmlc->base.quirks;
 
-	ns_error = hlcache_handle_retrieve(joined, 0,
+	ns_error = hlcache_handle_retrieve(joined,
+			LLCACHE_RETRIEVE_PRIORITY_BLOCKING,
 			content_get_url(&htmlc->base),
 			NULL, html_convert_css_callback,
 			htmlc, &child, CONTENT_CSS,
@@ -521,7 +523,8 @@ nserror html_css_quirks_stylesheets(html_content *c)
 		child.quirks = c->base.quirks;
 
 		ns_error = hlcache_handle_retrieve(html_quirks_stylesheet_url,
-				0, content_get_url(&c->base), NULL,
+				LLCACHE_RETRIEVE_PRIORITY_BLOCKING,
+				content_get_url(&c->base), NULL,
 				html_convert_css_callback, c, &child,
 				CONTENT_CSS,
 				&c->stylesheets[STYLESHEET_QUIRKS].sheet);
@@ -565,7 +568,8 @@ nserror html_css_new_stylesheets(html_content *c)
 	child.charset = c->encoding;
 	child.quirks = c->base.quirks;
 
-	ns_error = hlcache_handle_retrieve(html_default_stylesheet_url, 0,
+	ns_error = hlcache_handle_retrieve(html_default_stylesheet_url,
+			LLCACHE_RETRIEVE_PRIORITY_BLOCKING,
 			content_get_url(&c->base), NULL,
 			html_convert_css_callback, c, &child, CONTENT_CSS,
 			&c->stylesheets[STYLESHEET_BASE].sheet);
@@ -579,7 +583,8 @@ nserror html_css_new_stylesheets(html_content *c)
 
 	if (nsoption_bool(block_advertisements)) {
 		ns_error = hlcache_handle_retrieve(html_adblock_stylesheet_url,
-				0, content_get_url(&c->base), NULL,
+				LLCACHE_RETRIEVE_PRIORITY_BLOCKING,
+				content_get_url(&c->base), NULL,
 				html_convert_css_callback,
 				c, &child, CONTENT_CSS,
 				&c->stylesheets[STYLESHEET_ADBLOCK].sheet);
@@ -592,7 +597,8 @@ nserror html_css_new_stylesheets(html_content *c)
 
 	}
 
-	ns_error = hlcache_handle_retrieve(html_user_stylesheet_url, 0,
+	ns_error = hlcache_handle_retrieve(html_user_stylesheet_url,
+			LLCACHE_RETRIEVE_PRIORITY_BLOCKING,
 			content_get_url(&c->base), NULL,
 			html_convert_css_callback, c, &child, CONTENT_CSS,
 			&c->stylesheets[STYLESHEET_USER].sheet);
@@ -162,6 +162,13 @@ typedef struct html_content {
 	unsigned int num_objects;
 	/** List of objects. */
 	struct content_html_object *object_list;
+	/** Area shown since the last visible object pass, in document
+	 *  coordinates. Only meaningful while a pass is scheduled. */
+	struct rect visible_area;
+	/** Whether a visible object pass is scheduled. */
+	bool visible_scheduled;
+	/** Whether every object still being fetched has been raised. */
+	bool objects_prioritised;
 	/** Forms, in reverse order to document. */
 	struct form *forms;
 	/** Hash table of imagemaps. */
@@ -393,6 +400,24 @@ nserror html_object_close_objects(html_content *html);
 nserror html_object_open_objects(html_content *html, struct browser_window *bw);
 nserror html_object_abort_objects(html_content *html);
 
+/**
+ * Note an area of the document as shown to the user.
+ *
+ * Objects still being fetched whose boxes intersect the areas shown
+ * have their fetch priority raised above those not yet seen. The
+ * objects are examined by a scheduled pass so redrawing many
+ * rectangles costs only one walk of the object list. Nothing is done
+ * once every object being fetched has been raised.
+ *
+ * \param  html   content of type CONTENT_HTML
+ * \param  x      coordinate of the content origin
+ * \param  y      coordinate of the content origin
+ * \param  scale  scale the content is being drawn at
+ * \param  clip   the area being redrawn
+ */
+void html_object_prioritise_visible(html_content *html, int x, int y,
+		float scale, const struct rect *clip);
+
 /* Events */
 /**
  * Construct an event and fire it at the DOM
@@ -33,6 +33,7 @@
 #include "utils/config.h"
 #include "utils/log.h"
 #include "utils/nsoption.h"
+#include "utils/utils.h"
 #include "netsurf/content.h"
 #include "netsurf/misc.h"
 #include "content/hlcache.h"
@@ -44,6 +45,9 @@
 #include "html/box.h"
 #include "html/html_internal.h"
 
+/* Delay before raising the fetches of objects shown, in ms */
+#define HTML_PRIORITISE_DELAY 100
+
 /* break reference loop */
 static void html_object_refresh(void *p);
 
@@ -538,6 +542,9 @@ static bool html_replace_object(struct content_html_object *object, nsurl *url)
 	if (error != NSERROR_OK)
 		return false;
 
+	object->prioritised = false;
+	c->objects_prioritised = false;
+
 	for (page = c; page != NULL; page = page->page) {
 		page->base.active++;
 		NSLOG(netsurf, INFO, "%d fetches active", c->base.active);
@@ -634,10 +641,89 @@ nserror html_object_abort_objects(html_content *htmlc)
 	return NSERROR_OK;
 }
 
+/**
+ * Raise the fetch priority of objects shown since the last pass.
+ *
+ * \param p html content whose objects are examined
+ */
+static void html_object_prioritise_pass(void *p)
+{
+	html_content *html = p;
+	struct content_html_object *object;
+	const struct rect *area = &html->visible_area;
+	unsigned int remaining = 0;
+	struct rect r;
+
+	html->visible_scheduled = false;
+
+	for (object = html->object_list;
+	     object != NULL;
+	     object = object->next) {
+		if ((object->content == NULL) ||
+		    (object->box == NULL) ||
+		    object->prioritised)
+			continue;
+
+		if (content_get_status(object->content) == CONTENT_STATUS_DONE)
+			continue;
+
+		box_bounds(object->box, &r);
+		if ((r.x1 < area->x0) ||
+		    (r.x0 > area->x1) ||
+		    (r.y1 < area->y0) ||
+		    (r.y0 > area->y1)) {
+			remaining++;
+			continue;
+		}
+
+		object->prioritised = true;
+		hlcache_handle_set_priority(object->content,
+				LLCACHE_RETRIEVE_PRIORITY_VISIBLE);
+	}
+
+	if (remaining == 0) {
+		html->objects_prioritised = true;
+	}
+}
+
+/* exported interface documented in html/html_internal.h */
+void html_object_prioritise_visible(html_content *html, int x, int y,
+		float scale, const struct rect *clip)
+{
+	struct rect area;
+
+	if (html->objects_prioritised)
+		return;
+
+	/* convert the redraw area to document coordinates */
+	area.x0 = (clip->x0 - x) / scale;
+	area.y0 = (clip->y0 - y) / scale;
+	area.x1 = (clip->x1 - x) / scale + 1;
+	area.y1 = (clip->y1 - y) / scale + 1;
+
+	if (html->visible_scheduled) {
+		html->visible_area.x0 = min(html->visible_area.x0, area.x0);
+		html->visible_area.y0 = min(html->visible_area.y0, area.y0);
+		html->visible_area.x1 = max(html->visible_area.x1, area.x1);
+		html->visible_area.y1 = max(html->visible_area.y1, area.y1);
+		return;
+	}
+
+	html->visible_area = area;
+	if (guit->misc->schedule(HTML_PRIORITISE_DELAY,
+				 html_object_prioritise_pass,
+				 html) == NSERROR_OK) {
+		html->visible_scheduled = true;
+	}
+}
+
 nserror html_object_close_objects(html_content *html)
 {
 	struct content_html_object *object, *next;
 
+	guit->misc->schedule(-1, html_object_prioritise_pass, html);
+	html->visible_scheduled = false;
+
 	for (object = html->object_list; object != NULL; object = next) {
 		next = object->next;
 
@@ -658,6 +744,9 @@ nserror html_object_close_objects(html_content *html)
 
 nserror html_object_free_objects(html_content *html)
 {
+	guit->misc->schedule(-1, html_object_prioritise_pass, html);
+	html->visible_scheduled = false;
+
 	while (html->object_list != NULL) {
 		struct content_html_object *victim = html->object_list;
 
@@ -723,6 +812,7 @@ bool html_fetch_object(html_content *c, nsurl *url, struct box *box,
 
 	c->num_objects++;
 	if (box != NULL) {
+		c->objects_prioritised = false;
 		c->base.active++;
 		NSLOG(netsurf, INFO, "%d fetches active", c->base.active);
 	}
@@ -1931,6 +1931,12 @@ bool html_redraw(struct content *c, struct content_redraw_data *data,
 
 		result &= html_redraw_box(html, box, data->x, data->y, clip,
 				data->scale, pstyle_fill_bg.fill_colour, ctx);
+
+		/* objects being shown should be fetched first */
+		if (ctx->interactive) {
+			html_object_prioritise_visible(html, data->x, data->y,
+					data->scale, clip);
+		}
 	}
 
 	if (select) {
@@ -436,8 +436,10 @@ exec_src_script(html_content *c,
 	child.charset = c->encoding;
 	child.quirks = c->base.quirks;
 
+	/* only syncronous scripts hold up the parse */
 	ns_error = hlcache_handle_retrieve(joined,
-					   0,
+					   (script_type == HTML_SCRIPT_SYNC) ?
+					   LLCACHE_RETRIEVE_PRIORITY_BLOCKING : 0,
 					   content_get_url(&c->base),
 					   NULL,
 					   script_cb,
@@ -54,6 +54,7 @@ typedef struct nsgif_content {
 
 	struct gif_animation *gif; /**< GIF animation data */
 	int current_frame;   /**< current frame to display [0...(max-1)] */
+	llcache_buffer *source; /**< Source data frames are decoded from */
 } nsgif_content;
 
 
@@ -236,12 +237,20 @@ static bool nsgif_convert(struct content *c)
 {
 	nsgif_content *gif = (nsgif_content *) c;
 	int res;
-	const char *data;
-	unsigned long size;
+	const uint8_t *data;
+	size_t size;
 	char *title;
-
-	/* Get the animation */
-	data = content__get_source_data(c, &size);
+	nserror err;
+
+	/* Frames are decoded from the source data for the lifetime of
+	 * the content so hold a reference to it.
+	 */
+	err = content__get_source_buffer(c, &gif->source);
+	if (err != NSERROR_OK) {
+		content_broadcast_errorcode(c, err);
+		return false;
+	}
+	data = llcache_buffer_get_data(gif->source, &size);
 
 	/* Initialise the GIF */
 	do {
@@ -354,6 +363,10 @@ static void nsgif_destroy(struct content *c)
 	guit->misc->schedule(-1, nsgif_animate, c);
 	gif_finalise(gif->gif);
 	free(gif->gif);
+
+	if (gif->source != NULL) {
+		llcache_buffer_unref(gif->source);
+	}
 }
 
 
@@ -59,6 +59,12 @@ static char nsjpeg_error_buffer[JMSG_LENGTH_MAX];
 
 static unsigned char nsjpeg_eoi[] = { 0xff, JPEG_EOI };
 
+typedef struct nsjpeg_content {
+	struct content base; /**< base content type */
+
+	llcache_buffer *source; /**< Source data the bitmap is decoded from */
+} nsjpeg_content;
+
 /**
  * Content create entry point.
  */
@@ -67,21 +73,21 @@ static nserror nsjpeg_create(const content_handler *handler,
 		llcache_handle *llcache, const char *fallback_charset,
 		bool quirks, struct content **c)
 {
-	struct content *jpeg;
+	nsjpeg_content *jpeg;
 	nserror error;
 
-	jpeg = calloc(1, sizeof(struct content));
+	jpeg = calloc(1, sizeof(nsjpeg_content));
 	if (jpeg == NULL)
 		return NSERROR_NOMEM;
 
-	error = content__init(jpeg, handler, imime_type, params,
+	error = content__init(&jpeg->base, handler, imime_type, params,
 			      llcache, fallback_charset, quirks);
 	if (error != NSERROR_OK) {
 		free(jpeg);
 		return error;
 	}
 
-	*c = jpeg;
+	*c = (struct content *) jpeg;
 
 	return NSERROR_OK;
 }
@@ -164,8 +170,9 @@ static void nsjpeg_error_exit(j_common_ptr cinfo)
 static struct bitmap *
 jpeg_cache_convert(struct content *c)
 {
-	uint8_t *source_data; /* Jpeg source data */
-	unsigned long source_size; /* length of Jpeg source data */
+	nsjpeg_content *jpeg = (nsjpeg_content *) c;
+	const uint8_t *source_data; /* Jpeg source data */
+	size_t source_size; /* length of Jpeg source data */
 	struct jpeg_decompress_struct cinfo;
 	struct jpeg_error_mgr jerr;
 	jmp_buf setjmp_buffer;
@@ -184,7 +191,10 @@ jpeg_cache_convert(struct content *c)
 		nsjpeg_term_source };
 
 	/* obtain jpeg source data and perfom minimal sanity checks */
-	source_data = (uint8_t *)content__get_source_data(c, &source_size);
+	if (jpeg->source == NULL) {
+		return NULL;
+	}
+	source_data = llcache_buffer_get_data(jpeg->source, &source_size);
 
 	if ((source_data == NULL) ||
 	    (source_size < MIN_JPEG_SIZE)) {
@@ -303,6 +313,7 @@ jpeg_cache_convert(struct content *c)
  */
 static bool nsjpeg_convert(struct content *c)
 {
+	nsjpeg_content *jpeg = (nsjpeg_content *) c;
 	struct jpeg_decompress_struct cinfo;
 	struct jpeg_error_mgr jerr;
 	jmp_buf setjmp_buffer;
@@ -311,12 +322,22 @@ static bool nsjpeg_convert(struct content *c)
 		nsjpeg_skip_input_data, jpeg_resync_to_restart,
 		nsjpeg_term_source };
 	union content_msg_data msg_data;
-	const char *data;
-	unsigned long size;
+	const uint8_t *data;
+	size_t size;
 	char *title;
+	nserror err;
+
+	/* The image cache decodes the bitmap from the source data
+	 * whenever it is required so hold a reference to it.
+	 */
+	err = content__get_source_buffer(c, &jpeg->source);
+	if (err != NSERROR_OK) {
+		content_broadcast_errorcode(c, err);
+		return false;
+	}
 
 	/* check image header is valid and get width/height */
-	data = content__get_source_data(c, &size);
+	data = llcache_buffer_get_data(jpeg->source, &size);
 
 	cinfo.err = jpeg_std_error(&jerr);
 	jerr.error_exit = nsjpeg_error_exit;
@@ -332,7 +353,7 @@ static bool nsjpeg_convert(struct content *c)
 
 	cinfo.client_data = &setjmp_buffer;
 	jpeg_create_decompress(&cinfo);
-	source_mgr.next_input_byte = (unsigned char *) data;
+	source_mgr.next_input_byte = data;
 	source_mgr.bytes_in_buffer = size;
 	cinfo.src = &source_mgr;
 	jpeg_read_header(&cinfo, TRUE);
@@ -367,34 +388,49 @@ static bool nsjpeg_convert(struct content *c)
 
 
 
+/**
+ * Destroy a CONTENT_JPEG and free all resources it owns.
+ */
+static void nsjpeg_destroy(struct content *c)
+{
+	nsjpeg_content *jpeg = (nsjpeg_content *) c;
+
+	image_cache_destroy(c);
+
+	if (jpeg->source != NULL) {
+		llcache_buffer_unref(jpeg->source);
+	}
+}
+
+
 /**
  * Clone content.
  */
 static nserror nsjpeg_clone(const struct content *old, struct content **newc)
 {
-	struct content *jpeg_c;
+	nsjpeg_content *jpeg_c;
 	nserror error;
 
-	jpeg_c = calloc(1, sizeof(struct content));
+	jpeg_c = calloc(1, sizeof(nsjpeg_content));
 	if (jpeg_c == NULL)
 		return NSERROR_NOMEM;
 
-	error = content__clone(old, jpeg_c);
+	error = content__clone(old, &jpeg_c->base);
 	if (error != NSERROR_OK) {
-		content_destroy(jpeg_c);
+		content_destroy(&jpeg_c->base);
 		return error;
 	}
 
 	/* re-convert if the content is ready */
 	if ((old->status == CONTENT_STATUS_READY) ||
 	    (old->status == CONTENT_STATUS_DONE)) {
-		if (nsjpeg_convert(jpeg_c) == false) {
-			content_destroy(jpeg_c);
+		if (nsjpeg_convert(&jpeg_c->base) == false) {
+			content_destroy(&jpeg_c->base);
 			return NSERROR_CLONE_FAILED;
 		}
 	}
 
-	*newc = jpeg_c;
+	*newc = (struct content *) jpeg_c;
 
 	return NSERROR_OK;
 }
@@ -402,7 +438,7 @@ static nserror nsjpeg_clone(const struct content *old, struct content **newc)
 static const content_handler nsjpeg_content_handler = {
 	.create = nsjpeg_create,
 	.data_complete = nsjpeg_convert,
-	.destroy = image_cache_destroy,
+	.destroy = nsjpeg_destroy,
 	.redraw = image_cache_redraw,
 	.clone = nsjpeg_clone,
 	.get_internal = image_cache_get_internal,
@@ -55,6 +55,7 @@ typedef struct nspng_content {
 	struct bitmap *bitmap;	/**< Created NetSurf bitmap */
 	size_t rowstride, bpp; /**< Bitmap rowstride and bpp */
 	size_t rowbytes; /**< Number of bytes per row */
+	llcache_buffer *source; /**< Source data the bitmap is decoded from */
 } nspng_content;
 
 static unsigned int interlace_start[8] = {0, 16, 0, 8, 0, 4, 0};
@@ -428,6 +429,7 @@ static png_bytep *calc_row_pointers(struct bitmap *bitmap)
 static struct bitmap *
 png_cache_convert(struct content *c)
 {
+	nspng_content *png_c = (nspng_content *) c;
 	png_structp png_ptr;
 	png_infop info_ptr;
 	png_infop end_info_ptr;
@@ -435,15 +437,21 @@ png_cache_convert(struct content *c)
 	struct png_cache_read_data_s png_cache_read_data;
 	png_uint_32 width, height;
 	volatile png_bytep * volatile row_pointers = NULL;
+	const uint8_t *data;
+	size_t size;
 
-	png_cache_read_data.data = 
-		content__get_source_data(c, &png_cache_read_data.size);
+	if (png_c->source == NULL) {
+		return NULL;
+	}
 
-	if ((png_cache_read_data.data == NULL) || 
-	    (png_cache_read_data.size <= 8)) {
+	data = llcache_buffer_get_data(png_c->source, &size);
+	if ((data == NULL) || (size <= 8)) {
 		return NULL;
 	}
 
+	png_cache_read_data.data = (const char *) data;
+	png_cache_read_data.size = size;
+
 	png_ptr = png_create_read_struct(PNG_LIBPNG_VER_STRING, NULL,
 			nspng_error, nspng_warning);
 	if (png_ptr == NULL) {
@@ -516,6 +524,7 @@ static bool nspng_convert(struct content *c)
 {
 	nspng_content *png_c = (nspng_content *) c;
 	char *title;
+	nserror err;
 
 	assert(png_c->png != NULL);
 	assert(png_c->info != NULL);
@@ -523,6 +532,15 @@ static bool nspng_convert(struct content *c)
 	/* clean up png structures */
 	png_destroy_read_struct(&png_c->png, &png_c->info, 0);
 
+	/* The image cache decodes the bitmap again from the source data
+	 * whenever it has been discarded so hold a reference to it.
+	 */
+	err = content__get_source_buffer(c, &png_c->source);
+	if (err != NSERROR_OK) {
+		content_broadcast_errorcode(c, err);
+		return false;
+	}
+
 	/* set title text */
 	title = messages_get_buff("PNGTitle",
 			nsurl_access_leaf(llcache_handle_get_url(c->llcache)),
@@ -547,6 +565,18 @@ static bool nspng_convert(struct content *c)
 }
 
 
+static void nspng_destroy(struct content *c)
+{
+	nspng_content *png_c = (nspng_content *) c;
+
+	image_cache_destroy(c);
+
+	if (png_c->source != NULL) {
+		llcache_buffer_unref(png_c->source);
+	}
+}
+
+
 static nserror nspng_clone(const struct content *old_c, struct content **new_c)
 {
 	nspng_content *clone_png_c;
@@ -597,7 +627,7 @@ static const content_handler nspng_content_handler = {
 	.process_data = nspng_process_data,
 	.data_complete = nspng_convert,
 	.clone = nspng_clone,
-	.destroy = image_cache_destroy,
+	.destroy = nspng_destroy,
 	.redraw = image_cache_redraw,
 	.get_internal = image_cache_get_internal,
 	.type = image_cache_content_type,
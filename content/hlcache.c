@@ -733,6 +733,35 @@ struct content *hlcache_handle_get_content(const hlcache_handle *handle)
 	return NULL;
 }
 
+/* See hlcache.h for documentation */
+nserror hlcache_handle_set_priority(hlcache_handle *handle, uint32_t priority)
+{
+	struct hlcache_entry *entry = handle->entry;
+
+	if (entry == NULL) {
+		/* Not yet associated with a cache entry so the fetch
+		 * is owned by the retrieval context. */
+		RING_ITERATE_START(struct hlcache_retrieval_ctx,
+				   hlcache->retrieval_ctx_ring,
+				   ictx) {
+			if (ictx->handle == handle &&
+					ictx->migrate_target == false) {
+				llcache_handle_set_priority(ictx->llcache,
+							    priority);
+				RING_ITERATE_STOP(hlcache->retrieval_ctx_ring,
+						ictx);
+			}
+		} RING_ITERATE_END(hlcache->retrieval_ctx_ring, ictx);
+
+		return NSERROR_OK;
+	}
+
+	/* the priority is an attribute of the shared source object */
+	return llcache_handle_set_priority(
+		(llcache_handle *)content_get_llcache_handle(entry->content),
+		priority);
+}
+
 /* See hlcache.h for documentation */
 nserror hlcache_handle_abort(hlcache_handle *handle)
 {
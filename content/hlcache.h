@@ -137,6 +137,20 @@ nserror hlcache_handle_release(hlcache_handle *handle);
  */
 nserror hlcache_handle_abort(hlcache_handle *handle);
 
+/**
+ * Raise the fetch priority of a high-level cache handle
+ *
+ * Used to promote an object, for example when it becomes visible,
+ * ahead of other queued fetches. An object already fetched with a
+ * more urgent priority is left unchanged.
+ *
+ * \param handle  Handle to change
+ * \param priority  LLCACHE_RETRIEVE_PRIORITY_ flag of the priority class,
+ *                  or 0 for normal priority.
+ * \return NSERROR_OK on success, appropriate error otherwise
+ */
+nserror hlcache_handle_set_priority(hlcache_handle *handle, uint32_t priority);
+
 /**
  * Replace a high-level cache handle's callback
  *
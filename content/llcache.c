@@ -143,6 +143,12 @@ typedef struct {
 	time_t expires;		/**< Expires: response header */
 	int age;		/**< Age: response header */
 	int max_age;		/**< Max-Age Cache-control parameter */
+	int stale_while_revalidate; /**< Stale-While-Revalidate Cache-control
+				     * parameter or 0 if not present
+				     */
+	int stale_if_error;	/**< Stale-If-Error Cache-control parameter
+				 * or 0 if not present
+				 */
 	llcache_validate no_cache;	/**< No-Cache Cache-control parameter */
 	char *etag;		/**< Etag: response header */
 	time_t last_modified;	/**< Last-Modified: response header */
@@ -154,6 +160,43 @@ typedef struct {
 	char *value;		/**< Header value */
 } llcache_header;
 
+/**
+ * Size of the chunks source data is accumulated in while fetching.
+ */
+#define LLCACHE_CHUNK_SIZE (64 * 1024)
+
+/**
+ * Chunk of source data received while fetching.
+ *
+ * Data received from a fetch is appended to a list of chunks so the
+ * received data is never copied while the fetch progresses. The
+ * chunks are only flattened into a single contiguous buffer when a
+ * contiguous view is requested.
+ *
+ * Chunks following the tail chunk of an object are empty and kept
+ * for reuse by streamed fetches.
+ */
+typedef struct llcache_chunk {
+	struct llcache_chunk *next; /**< Next chunk in list */
+	size_t len; /**< Number of bytes used in chunk */
+	uint8_t data[LLCACHE_CHUNK_SIZE]; /**< Chunk data */
+} llcache_chunk;
+
+/**
+ * Reference counted immutable source data.
+ *
+ * Source data is shared between an object, its snapshots and any
+ * other holders through a buffer. The data is released when the last
+ * reference is dropped, either to the heap or, if it has been made
+ * persistent, to the backing store.
+ */
+struct llcache_buffer {
+	unsigned int refcnt; /**< Number of references to buffer */
+	uint8_t *data; /**< Buffer data */
+	size_t len; /**< Byte length of buffer data */
+	nsurl *url; /**< URL to release data to backing store or NULL */
+};
+
 /** Current status of an object's data */
 typedef enum {
 	LLCACHE_STATE_RAM = 0, /**< source data is stored in RAM only */
@@ -169,14 +212,37 @@ struct llcache_object {
 	llcache_object *prev;	     /**< Previous in list */
 	llcache_object *next;	     /**< Next in list */
 
+	llcache_object *hash_next;   /**< Next in list index hash chain */
+
 	nsurl *url;		     /**< Post-redirect URL for object */
+	uint32_t url_hash;	     /**< Hash of url used for list index */
 
-	/** \todo We need a generic dynamic buffer object */
-	uint8_t *source_data;	     /**< Source data for object */
+	/** Contiguous source data for object
+	 *
+	 * The object source data is the first (source_len -
+	 * source_chunked_len) bytes of this buffer followed by the
+	 * content of the source chunk list.
+	 */
+	uint8_t *source_data;
 	size_t source_len;	     /**< Byte length of source data */
 	size_t source_alloc;	     /**< Allocated size of source buffer */
+	llcache_buffer *source_buffer; /**< Shared buffer owning the
+					* contiguous source data, or NULL
+					*/
+
+	llcache_chunk *source_chunks; /**< Source data not yet flattened */
+	llcache_chunk *source_chunks_tail; /**< Last source chunk */
+	size_t source_chunked_len;   /**< Byte length of chunked data */
+	size_t source_expected_len;  /**< Content-Length or 0 if unknown */
+	bool source_encoded;	     /**< Source had a content coding removed
+				      * by the fetcher so Content-Length
+				      * does not give its length
+				      */
 
 	llcache_store_state store_state; /**< where the data for the object is stored */
+	bool source_pending;	     /**< Source data is being retrieved
+				      * from the backing store
+				      */
 
 	llcache_object_user *users;  /**< List of users */
 
@@ -189,9 +255,15 @@ struct llcache_object {
 	uint32_t candidate_count;    /**< Count of objects this is a
 				      * candidate for
 				      */
+	bool revalidating;	     /**< Object is a background revalidation
+				      * which is not used until complete
+				      */
 
 	llcache_header *headers;     /**< Fetch headers */
 	size_t num_headers;	     /**< Number of fetch headers */
+	bool headers_packed;	     /**< Headers array and strings are a
+				      * single allocation
+				      */
 
 	/* Instrumentation. These elements are strictly for information
 	 * to improve the cache performance and to provide performance
@@ -199,6 +271,75 @@ struct llcache_object {
 	 * determine object lifetime etc.
 	 */
 	time_t last_used; /**< time the last user was removed from the object */
+
+	/* Eviction ordering. These are heuristics used only to order
+	 * the discard of unused objects when the cache is over its limit.
+	 */
+	uint32_t hit_count; /**< Number of users ever added to the object */
+	uint64_t gdsf_base; /**< GDSF inflation value at the last use */
+	uint64_t evict_key; /**< Eviction order key, lowest evicted first */
+
+	/* Persistence ordering. */
+	size_t persist_pos; /**< Persistence queue position plus one or 0 */
+	uint64_t persist_score; /**< Persistence priority, highest first */
+};
+
+/**
+ * Initial number of buckets in an object list index.
+ *
+ * \note must be a power of two.
+ */
+#define LLCACHE_INDEX_INITIAL_SIZE 256
+
+/**
+ * Hash index over a low-level cache object list.
+ *
+ * Objects are chained through llcache_object::hash_next in buckets
+ * selected by the hash of their url. The table doubles in size when
+ * the average chain length exceeds two.
+ */
+struct llcache_object_index {
+	llcache_object **buckets; /**< Hash chain heads */
+	uint32_t size; /**< Number of buckets, always a power of two */
+	uint32_t count; /**< Number of objects in the index */
+};
+
+/**
+ * Low-level cache statistics.
+ *
+ * Retrievals are counted by how they were satisfied, each retrieval
+ * of a cachable object is counted exactly once.
+ */
+struct llcache_stats {
+	/** Retrievals satisfied by a fresh object already in RAM */
+	uint32_t ram_hit_count;
+	/** Retrievals satisfied by a fresh object from backing store */
+	uint32_t disc_hit_count;
+	/** Retrievals satisfied by a stale object being revalidated */
+	uint32_t stale_count;
+	/** Retrievals requiring validation of a candidate object */
+	uint32_t validate_count;
+	/** Retrievals with no usable object which were fetched */
+	uint32_t miss_count;
+	/** Retrievals of objects which may not be cached */
+	uint32_t uncached_count;
+	/** Conditional requests made to revalidate objects */
+	uint32_t conditional_count;
+	/** Conditional requests answered with not modified */
+	uint32_t notmodified_count;
+	/** Backing store retrievals which returned another URL's object */
+	uint32_t collision_count;
+
+	/** Source bytes of retrievals satisfied from RAM */
+	uint64_t ram_size;
+	/** Source bytes of retrievals satisfied from backing store */
+	uint64_t disc_size;
+	/** Source bytes received from the network */
+	uint64_t network_size;
+	/** Body bytes fetchers received before content decoding */
+	uint64_t wire_size;
+	/** Body bytes fetchers received after content decoding */
+	uint64_t decoded_size;
 };
 
 /**
@@ -217,6 +358,26 @@ struct llcache_s {
 	/** Head of the low-level uncached object list */
 	llcache_object *uncached_objects;
 
+	/** Url index of the cached object list */
+	struct llcache_object_index cached_index;
+
+	/** Url index of the uncached object list */
+	struct llcache_object_index uncached_index;
+
+	/** Heap of cached objects ordered by persistence score */
+	llcache_object **persist_queue;
+
+	/** Number of objects in the persistence queue */
+	size_t persist_queue_len;
+
+	/** Allocated size of the persistence queue */
+	size_t persist_queue_alloc;
+
+	/** The backing store does not accept writes, e.g. a reader of
+	 * a shared store, so nothing is queued for persistence.
+	 */
+	bool store_readonly;
+
 	/** The target upper bound for the RAM cache size */
 	uint32_t limit;
 
@@ -226,6 +387,12 @@ struct llcache_s {
 	/** Whether or not our users are caught up */
 	bool all_caught_up;
 
+	/** Order in which unused objects are evicted from RAM */
+	enum llcache_eviction_policy eviction_policy;
+
+	/** GDSF inflation value, the key of the last evicted object */
+	uint64_t gdsf_inflation;
+
 
 	/* backing store elements */
 
@@ -264,6 +431,26 @@ struct llcache_s {
 	 */
 	uint64_t total_elapsed;
 
+	/**
+	 * Number of fetches whose received length differed from the
+	 * Content-Length they declared.
+	 */
+	uint32_t length_mismatch_count;
+
+	/** Retrieval statistics */
+	struct llcache_stats stats;
+
+	/** Object last found by entry number, or NULL if the object
+	 * lists have changed since. Allows the entries to be
+	 * enumerated in sequence with a single pass over the lists.
+	 */
+	llcache_object *entry_cursor;
+
+	/** Entry number of the entry cursor object */
+	unsigned int entry_cursor_n;
+
+	/** Whether the entry cursor object is in the cached list */
+	bool entry_cursor_cached;
 };
 
 /** low level cache state */
@@ -431,6 +618,7 @@ static nserror llcache_object_new(nsurl *url, llcache_object **result)
 	NSLOG(llcache, DEBUG, "Created object %p (%s)", obj, nsurl_access(url));
 
 	obj->url = nsurl_ref(url);
+	obj->url_hash = nsurl_hash(url);
 
 	*result = obj;
 
@@ -573,6 +761,35 @@ static nserror llcache_fetch_split_header(const uint8_t *data, size_t len,
 	return NSERROR_OK;
 }
 
+/**
+ * parse the delta-seconds value of a cache control directive
+ *
+ * \param start The start of the directive
+ * \param end The end of the directive
+ * \return The directive value or INVALID_AGE if it has no value
+ */
+static int llcache_fetch_parse_delta_seconds(const char *start, const char *end)
+{
+	/* Find '=' */
+	while (start < end && *start != '=') {
+		start++;
+	}
+	if (start == end) {
+		return INVALID_AGE;
+	}
+
+	/* Skip over it and any whitespace */
+	start++;
+	while (start < end && (*start == ' ' || *start == '\t')) {
+		start++;
+	}
+	if (start == end) {
+		return INVALID_AGE;
+	}
+
+	return atoi(start);
+}
+
 /**
  * parse cache control header value
  *
@@ -585,6 +802,7 @@ llcache_fetch_parse_cache_control(llcache_object *object, char *value)
 {
 	const char *start = value;
 	const char *comma = value;
+	int delta;
 
 	while (*comma != '\0') {
 		while (*comma != '\0' && *comma != ',') {
@@ -601,24 +819,26 @@ llcache_fetch_parse_cache_control(llcache_object *object, char *value)
 			object->cache.no_cache = LLCACHE_VALIDATE_ALWAYS;
 		} else if ((7 < comma - start) &&
 			   strncasecmp(start, "max-age", 7) == 0) {
-			/* Find '=' */
-			while (start < comma && *start != '=') {
-				start++;
+			delta = llcache_fetch_parse_delta_seconds(start, comma);
+			if (delta != INVALID_AGE) {
+				object->cache.max_age = delta;
 			}
-
-			/* Skip over it */
-			start++;
-
-#define SKIP_ST(p) while (*p != '\0' && (*p == ' ' || *p == '\t')) p++
-
-			/* Skip whitespace */
-			SKIP_ST(start);
-
-			if (start < comma) {
-				object->cache.max_age = atoi(start);
+		} else if ((22 < comma - start) &&
+			   strncasecmp(start, "stale-while-revalidate", 22) == 0) {
+			delta = llcache_fetch_parse_delta_seconds(start, comma);
+			if (delta > 0) {
+				object->cache.stale_while_revalidate = delta;
+			}
+		} else if ((14 < comma - start) &&
+			   strncasecmp(start, "stale-if-error", 14) == 0) {
+			delta = llcache_fetch_parse_delta_seconds(start, comma);
+			if (delta > 0) {
+				object->cache.stale_if_error = delta;
 			}
 		}
 
+#define SKIP_ST(p) while (*p != '\0' && (*p == ' ' || *p == '\t')) p++
+
 		if (*comma != '\0') {
 			/* Skip past comma */
 			comma++;
@@ -725,6 +945,12 @@ llcache_fetch_header_cache_control(llcache_object *object,
  */
 static inline void llcache_destroy_headers(llcache_object *object)
 {
+	if (object->headers_packed) {
+		/* strings are within the headers allocation */
+		object->num_headers = 0;
+		object->headers_packed = false;
+	}
+
 	while (object->num_headers > 0) {
 		object->num_headers--;
 
@@ -735,6 +961,53 @@ static inline void llcache_destroy_headers(llcache_object *object)
 	object->headers = NULL;
 }
 
+/**
+ * Convert packed headers into individually allocated headers.
+ *
+ * Headers loaded from binary metadata share a single allocation
+ * which cannot be extended.
+ *
+ * \param object The object to unpack headers within.
+ * \return NSERROR_OK on success or NSERROR_NOMEM on memory exhaustion.
+ */
+static nserror llcache_unpack_headers(llcache_object *object)
+{
+	llcache_header *headers;
+	size_t hloop;
+
+	if (object->num_headers == 0) {
+		free(object->headers);
+		object->headers = NULL;
+		object->headers_packed = false;
+		return NSERROR_OK;
+	}
+
+	headers = calloc(object->num_headers, sizeof(llcache_header));
+	if (headers == NULL) {
+		return NSERROR_NOMEM;
+	}
+
+	for (hloop = 0; hloop < object->num_headers; hloop++) {
+		headers[hloop].name = strdup(object->headers[hloop].name);
+		headers[hloop].value = strdup(object->headers[hloop].value);
+		if ((headers[hloop].name == NULL) ||
+		    (headers[hloop].value == NULL)) {
+			do {
+				free(headers[hloop].name);
+				free(headers[hloop].value);
+			} while (hloop-- > 0);
+			free(headers);
+			return NSERROR_NOMEM;
+		}
+	}
+
+	free(object->headers);
+	object->headers = headers;
+	object->headers_packed = false;
+
+	return NSERROR_OK;
+}
+
 /**
  * Invalidate cache control data.
  *
@@ -786,6 +1059,9 @@ static nserror llcache_fetch_process_header(llcache_object *object,
 		object->cache.req_time = req_time;
 
 		llcache_destroy_headers(object);
+
+		object->source_expected_len = 0;
+		object->source_encoded = false;
 	}
 
 	/* Set fetch response time if not already set */
@@ -806,6 +1082,25 @@ static nserror llcache_fetch_process_header(llcache_object *object,
 		return NSERROR_OK;
 	}
 
+	/* record the expected length of the source data */
+	if ((strcasecmp(name, "Content-Length") == 0) &&
+	    (object->source_encoded == false)) {
+		char *end;
+		unsigned long long clen = strtoull(value, &end, 10);
+		if ((end != value) && (clen <= SIZE_MAX)) {
+			object->source_expected_len = clen;
+		}
+	}
+
+	/* the length of encoded content is that of the encoded data
+	 * not the decoded source passed on by the fetcher.
+	 */
+	if ((strcasecmp(name, "Content-Encoding") == 0) &&
+	    (strcasecmp(value, "identity") != 0)) {
+		object->source_encoded = true;
+		object->source_expected_len = 0;
+	}
+
 	/* update cache control data from header */
 	res = llcache_fetch_header_cache_control(object, name, value);
 	if (res != NSERROR_OK) {
@@ -814,6 +1109,16 @@ static nserror llcache_fetch_process_header(llcache_object *object,
 		return res;
 	}
 
+	/* packed headers cannot be extended */
+	if (object->headers_packed) {
+		res = llcache_unpack_headers(object);
+		if (res != NSERROR_OK) {
+			free(name);
+			free(value);
+			return res;
+		}
+	}
+
 	/* Append header data to the object's headers array */
 	temp = realloc(object->headers,
 		       (object->num_headers + 1) * sizeof(llcache_header));
@@ -833,6 +1138,56 @@ static nserror llcache_fetch_process_header(llcache_object *object,
 	return NSERROR_OK;
 }
 
+/**
+ * Determine the fetch priority class from retrieval flags
+ *
+ * \param flags Retrieval flags
+ * \return The most urgent priority class present in the flags.
+ */
+static fetch_priority llcache_fetch_priority(uint32_t flags)
+{
+	if ((flags & LLCACHE_RETRIEVE_PRIORITY_DOCUMENT) != 0) {
+		return FETCH_PRIORITY_DOCUMENT;
+	}
+	if ((flags & LLCACHE_RETRIEVE_PRIORITY_BLOCKING) != 0) {
+		return FETCH_PRIORITY_BLOCKING;
+	}
+	if ((flags & LLCACHE_RETRIEVE_PRIORITY_VISIBLE) != 0) {
+		return FETCH_PRIORITY_VISIBLE;
+	}
+	if ((flags & LLCACHE_RETRIEVE_PRIORITY_PREFETCH) != 0) {
+		return FETCH_PRIORITY_PREFETCH;
+	}
+	return FETCH_PRIORITY_NORMAL;
+}
+
+/**
+ * Raise the fetch priority of an object
+ *
+ * An object is shared by its users so it is fetched with the most
+ * urgent priority any of them asks for, a less urgent priority never
+ * demotes it.
+ *
+ * \param object Object to change
+ * \param priority Retrieval flags holding the new priority class
+ */
+static void llcache_object_set_priority(llcache_object *object,
+		uint32_t priority)
+{
+	if (llcache_fetch_priority(priority) >=
+	    llcache_fetch_priority(object->fetch.flags)) {
+		return;
+	}
+
+	object->fetch.flags &= ~LLCACHE_RETRIEVE_PRIORITY_MASK;
+	object->fetch.flags |= (priority & LLCACHE_RETRIEVE_PRIORITY_MASK);
+
+	if (object->fetch.fetch != NULL) {
+		fetch_set_priority(object->fetch.fetch,
+				llcache_fetch_priority(object->fetch.flags));
+	}
+}
+
 /**
  * (Re)fetch an object
  *
@@ -923,6 +1278,7 @@ static nserror llcache_object_refetch(llcache_object *object)
 			  object->fetch.flags & LLCACHE_RETRIEVE_VERIFIABLE,
 			  object->fetch.tried_with_tls_downgrade,
 			  (const char **)headers,
+			  llcache_fetch_priority(object->fetch.flags),
 			  &object->fetch.fetch);
 
 	/* Clean up cache-control headers */
@@ -979,6 +1335,222 @@ static nserror llcache_object_fetch(llcache_object *object, uint32_t flags,
 	return llcache_object_refetch(object);
 }
 
+/**
+ * Release the source chunks of a low-level cache object
+ *
+ * \note The object source length is not altered.
+ *
+ * \param object  Object to release chunks from
+ */
+static void llcache_object_free_chunks(llcache_object *object)
+{
+	llcache_chunk *chunk, *next;
+
+	for (chunk = object->source_chunks; chunk != NULL; chunk = next) {
+		next = chunk->next;
+		free(chunk);
+	}
+
+	object->source_chunks = NULL;
+	object->source_chunks_tail = NULL;
+	object->source_chunked_len = 0;
+}
+
+/**
+ * Share the contiguous source data of a low-level cache object
+ *
+ * The object's contiguous source data is placed in a buffer, if it
+ * is not already, and a new reference to the buffer is returned.
+ * Once shared the object no longer appends to the contiguous data.
+ *
+ * \param object  Object to share source data of
+ * \param buffer_out  Pointer to location to receive buffer reference
+ * \return NSERROR_OK on success, NSERROR_NOMEM on memory exhaustion
+ */
+static nserror
+llcache_object_share_source(llcache_object *object, llcache_buffer **buffer_out)
+{
+	llcache_buffer *buffer = object->source_buffer;
+
+	if (buffer == NULL) {
+		buffer = malloc(sizeof(llcache_buffer));
+		if (buffer == NULL) {
+			return NSERROR_NOMEM;
+		}
+
+		buffer->refcnt = 1; /* the object's reference */
+		buffer->data = object->source_data;
+		buffer->len = object->source_len - object->source_chunked_len;
+		if (object->store_state == LLCACHE_STATE_DISC) {
+			buffer->url = nsurl_ref(object->url);
+		} else {
+			buffer->url = NULL;
+		}
+
+		object->source_buffer = buffer;
+		object->source_alloc = buffer->len;
+	}
+
+	*buffer_out = llcache_buffer_ref(buffer);
+
+	return NSERROR_OK;
+}
+
+/**
+ * Release the contiguous source data of a low-level cache object
+ *
+ * \note The object source length is not altered.
+ *
+ * \param object  Object to release source data of
+ */
+static void llcache_object_release_source(llcache_object *object)
+{
+	if (object->source_buffer != NULL) {
+		llcache_buffer_unref(object->source_buffer);
+		object->source_buffer = NULL;
+	} else if (object->source_data != NULL) {
+		if (object->store_state == LLCACHE_STATE_DISC) {
+			guit->llcache->release(object->url, BACKING_STORE_NONE);
+		} else {
+			free(object->source_data);
+		}
+	}
+
+	object->source_data = NULL;
+	object->source_alloc = 0;
+}
+
+/**
+ * Flatten the source data of a low-level cache object
+ *
+ * The source chunks are appended to the contiguous source buffer
+ * which is sized exactly to the source length.
+ *
+ * \param object  Object to flatten
+ * \return NSERROR_OK on success, NSERROR_NOMEM on memory exhaustion
+ */
+static nserror llcache_object_flatten(llcache_object *object)
+{
+	llcache_chunk *chunk;
+	uint8_t *temp;
+	size_t offset;
+
+	if (object->source_chunked_len == 0) {
+		/* no data in chunks, at most emptied ones */
+		llcache_object_free_chunks(object);
+		return NSERROR_OK;
+	}
+
+	assert(object->store_state == LLCACHE_STATE_RAM);
+
+	offset = object->source_len - object->source_chunked_len;
+
+	if (object->source_buffer != NULL) {
+		/* shared data is immutable so must be copied */
+		temp = malloc(object->source_len);
+		if (temp == NULL) {
+			return NSERROR_NOMEM;
+		}
+		memcpy(temp, object->source_data, offset);
+
+		llcache_buffer_unref(object->source_buffer);
+		object->source_buffer = NULL;
+	} else {
+		temp = realloc(object->source_data, object->source_len);
+		if (temp == NULL) {
+			return NSERROR_NOMEM;
+		}
+	}
+
+	for (chunk = object->source_chunks; chunk != NULL; chunk = chunk->next) {
+		memcpy(temp + offset, chunk->data, chunk->len);
+		offset += chunk->len;
+	}
+
+	object->source_data = temp;
+	object->source_alloc = object->source_len;
+
+	llcache_object_free_chunks(object);
+
+	return NSERROR_OK;
+}
+
+/**
+ * Get a contiguous span of a low-level cache object's source data
+ *
+ * \param object  Object to get source data from
+ * \param offset  Offset of the span within the source data
+ * \param len     Pointer to location to receive the span length
+ * \return Pointer to the span data or NULL if offset is beyond the data
+ */
+static const uint8_t *
+llcache_object_source_span(const llcache_object *object,
+			   size_t offset,
+			   size_t *len)
+{
+	const llcache_chunk *chunk;
+	size_t flat_len = object->source_len - object->source_chunked_len;
+
+	if (offset < flat_len) {
+		*len = flat_len - offset;
+		return object->source_data + offset;
+	}
+
+	offset -= flat_len;
+	for (chunk = object->source_chunks; chunk != NULL; chunk = chunk->next) {
+		if (offset < chunk->len) {
+			*len = chunk->len - offset;
+			return chunk->data + offset;
+		}
+		offset -= chunk->len;
+	}
+
+	*len = 0;
+	return NULL;
+}
+
+/**
+ * Discard emitted source data from the start of a streamed object
+ *
+ * Discarded chunks are emptied and kept after the tail chunk for
+ * reuse instead of being freed, so the emitted data remains valid
+ * while the event is delivered and streaming does not allocate a
+ * chunk for every data event.
+ *
+ * \param object  Streamed object to discard source data of
+ * \param len     Byte length of the leading span that was emitted
+ */
+static void
+llcache_object_source_discard(llcache_object *object, size_t len)
+{
+	llcache_chunk *chunk = object->source_chunks;
+
+	if (object->source_len > object->source_chunked_len) {
+		/* the contiguous data is only emitted once flattened */
+		assert(chunk == NULL);
+
+		object->source_len = 0;
+
+		/* shared data is immutable so must not be appended to */
+		if (object->source_buffer != NULL) {
+			object->source_alloc = 0;
+		}
+		return;
+	}
+
+	assert((chunk != NULL) && (chunk->len == len));
+
+	object->source_len -= len;
+	object->source_chunked_len -= len;
+	chunk->len = 0;
+
+	if (chunk != object->source_chunks_tail) {
+		object->source_chunks = chunk->next;
+		chunk->next = object->source_chunks_tail->next;
+		object->source_chunks_tail->next = chunk;
+	}
+}
+
 /**
  * Destroy a low-level cache object
  *
@@ -991,18 +1563,12 @@ static nserror llcache_object_fetch(llcache_object *object, uint32_t flags,
  */
 static nserror llcache_object_destroy(llcache_object *object)
 {
-	size_t i;
-
 	NSLOG(llcache, DEBUG, "Destroying object %p, %s", object,
 	      nsurl_access(object->url));
 
-	if (object->source_data != NULL) {
-		if (object->store_state == LLCACHE_STATE_DISC) {
-			guit->llcache->release(object->url, BACKING_STORE_NONE);
-		} else {
-			free(object->source_data);
-		}
-	}
+	llcache_object_release_source(object);
+
+	llcache_object_free_chunks(object);
 
 	nsurl_unref(object->url);
 
@@ -1027,11 +1593,7 @@ static nserror llcache_object_destroy(llcache_object *object)
 
 	free(object->cache.etag);
 
-	for (i = 0; i < object->num_headers; i++) {
-		free(object->headers[i].name);
-		free(object->headers[i].value);
-	}
-	free(object->headers);
+	llcache_destroy_headers(object);
 
 	free(object);
 
@@ -1039,33 +1601,309 @@ static nserror llcache_object_destroy(llcache_object *object)
 }
 
 /**
- * Add a low-level cache object to a cache list
+ * Initialise an object list index
  *
- * \param object  Object to add
- * \param list	  List to add to
- * \return NSERROR_OK
+ * \param index  Index to initialise
+ * \return NSERROR_OK on success, NSERROR_NOMEM on memory exhaustion
  */
-static nserror llcache_object_add_to_list(llcache_object *object,
-		llcache_object **list)
+static nserror llcache_index_init(struct llcache_object_index *index)
 {
-	object->prev = NULL;
-	object->next = *list;
-
+	index->buckets = calloc(LLCACHE_INDEX_INITIAL_SIZE,
+				sizeof(llcache_object *));
+	if (index->buckets == NULL) {
+		return NSERROR_NOMEM;
+	}
+	index->size = LLCACHE_INDEX_INITIAL_SIZE;
+	index->count = 0;
+
+	return NSERROR_OK;
+}
+
+/**
+ * Finalise an object list index
+ *
+ * \note The indexed objects are not affected.
+ *
+ * \param index  Index to finalise
+ */
+static void llcache_index_fini(struct llcache_object_index *index)
+{
+	free(index->buckets);
+	index->buckets = NULL;
+	index->size = 0;
+	index->count = 0;
+}
+
+/**
+ * Double the number of buckets in an object list index
+ *
+ * If the larger table cannot be allocated the index is left as it
+ * was; lookups remain correct but chains get longer.
+ *
+ * \param index  Index to grow
+ */
+static void llcache_index_grow(struct llcache_object_index *index)
+{
+	llcache_object **buckets;
+	llcache_object *object, *next;
+	uint32_t size = index->size * 2;
+	uint32_t bucket;
+	uint32_t old;
+
+	buckets = calloc(size, sizeof(llcache_object *));
+	if (buckets == NULL) {
+		return;
+	}
+
+	for (old = 0; old < index->size; old++) {
+		for (object = index->buckets[old]; object != NULL; object = next) {
+			next = object->hash_next;
+			bucket = object->url_hash & (size - 1);
+			object->hash_next = buckets[bucket];
+			buckets[bucket] = object;
+		}
+	}
+
+	free(index->buckets);
+	index->buckets = buckets;
+	index->size = size;
+}
+
+/**
+ * Add an object to an object list index
+ *
+ * \param index   Index to add to
+ * \param object  Object to add
+ */
+static void
+llcache_index_insert(struct llcache_object_index *index, llcache_object *object)
+{
+	uint32_t bucket;
+
+	if (index->count >= (index->size * 2)) {
+		llcache_index_grow(index);
+	}
+
+	bucket = object->url_hash & (index->size - 1);
+	object->hash_next = index->buckets[bucket];
+	index->buckets[bucket] = object;
+	index->count++;
+}
+
+/**
+ * Remove an object from an object list index
+ *
+ * \param index   Index to remove from
+ * \param object  Object to remove
+ */
+static void
+llcache_index_remove(struct llcache_object_index *index, llcache_object *object)
+{
+	llcache_object **link;
+
+	link = &index->buckets[object->url_hash & (index->size - 1)];
+	while (*link != NULL) {
+		if (*link == object) {
+			*link = object->hash_next;
+			object->hash_next = NULL;
+			index->count--;
+			break;
+		}
+		link = &(*link)->hash_next;
+	}
+}
+
+/**
+ * Determine if an object is on the cached object list
+ *
+ * \param object  Object to search for
+ * \return True if the object is on the cached object list.
+ */
+static bool llcache_object_is_cached(const llcache_object *object)
+{
+	const llcache_object *entry;
+	const struct llcache_object_index *index = &llcache->cached_index;
+
+	for (entry = index->buckets[object->url_hash & (index->size - 1)];
+	     entry != NULL;
+	     entry = entry->hash_next) {
+		if (entry == object) {
+			return true;
+		}
+	}
+	return false;
+}
+
+/**
+ * Place an object at a persistence queue position
+ *
+ * \param pos     The zero based position
+ * \param object  The object to place
+ */
+static inline void
+llcache_persist_queue_set(size_t pos, llcache_object *object)
+{
+	llcache->persist_queue[pos] = object;
+	object->persist_pos = pos + 1;
+}
+
+/**
+ * Restore the persistence queue heap property from a position
+ *
+ * \param pos  The zero based position of the object which changed score
+ */
+static void llcache_persist_queue_sift(size_t pos)
+{
+	llcache_object **queue = llcache->persist_queue;
+	llcache_object *object = queue[pos];
+	size_t child;
+
+	/* move towards the root while of higher score than parent */
+	while ((pos > 0) &&
+	       (queue[(pos - 1) / 2]->persist_score < object->persist_score)) {
+		llcache_persist_queue_set(pos, queue[(pos - 1) / 2]);
+		pos = (pos - 1) / 2;
+	}
+
+	/* move towards the leaves while of lower score than a child */
+	while ((child = (pos * 2) + 1) < llcache->persist_queue_len) {
+		if ((child + 1 < llcache->persist_queue_len) &&
+		    (queue[child + 1]->persist_score >
+		     queue[child]->persist_score)) {
+			child++;
+		}
+		if (queue[child]->persist_score <= object->persist_score) {
+			break;
+		}
+		llcache_persist_queue_set(pos, queue[child]);
+		pos = child;
+	}
+
+	llcache_persist_queue_set(pos, object);
+}
+
+/**
+ * Add an object to the persistence queue using its current score
+ *
+ * \param object  The object to add
+ * \return NSERROR_OK on success or NSERROR_NOMEM if the queue could
+ *         not be extended.
+ */
+static nserror llcache_persist_queue_insert(llcache_object *object)
+{
+	if (llcache->persist_queue_len == llcache->persist_queue_alloc) {
+		size_t alloc = (llcache->persist_queue_alloc * 2) + 64;
+		llcache_object **queue;
+
+		queue = realloc(llcache->persist_queue,
+				alloc * sizeof(llcache_object *));
+		if (queue == NULL) {
+			return NSERROR_NOMEM;
+		}
+		llcache->persist_queue = queue;
+		llcache->persist_queue_alloc = alloc;
+	}
+
+	llcache_persist_queue_set(llcache->persist_queue_len++, object);
+	llcache_persist_queue_sift(llcache->persist_queue_len - 1);
+
+	return NSERROR_OK;
+}
+
+/**
+ * Remove an object from the persistence queue if it is queued
+ *
+ * \param object  The object to remove
+ */
+static void llcache_persist_queue_remove(llcache_object *object)
+{
+	size_t pos;
+	llcache_object *last;
+
+	if (object->persist_pos == 0) {
+		return;
+	}
+
+	pos = object->persist_pos - 1;
+	object->persist_pos = 0;
+
+	last = llcache->persist_queue[--llcache->persist_queue_len];
+	if (last != object) {
+		llcache_persist_queue_set(pos, last);
+		llcache_persist_queue_sift(pos);
+	}
+}
+
+/**
+ * Empty the persistence queue
+ */
+static void llcache_persist_queue_clear(void)
+{
+	size_t pos;
+
+	for (pos = 0; pos < llcache->persist_queue_len; pos++) {
+		llcache->persist_queue[pos]->persist_pos = 0;
+	}
+	llcache->persist_queue_len = 0;
+}
+
+/**
+ * Find the index associated with a cache list
+ *
+ * \param list  The list head
+ * \return The index of the list or NULL if the list is not indexed.
+ */
+static struct llcache_object_index *llcache_list_index(llcache_object **list)
+{
+	if (list == &llcache->cached_objects) {
+		return &llcache->cached_index;
+	}
+	if (list == &llcache->uncached_objects) {
+		return &llcache->uncached_index;
+	}
+	return NULL;
+}
+
+/**
+ * Add a low-level cache object to a cache list
+ *
+ * \param object  Object to add
+ * \param list	  List to add to
+ * \return NSERROR_OK
+ */
+static nserror llcache_object_add_to_list(llcache_object *object,
+		llcache_object **list)
+{
+	struct llcache_object_index *index;
+
+	object->prev = NULL;
+	object->next = *list;
+
 	if (*list != NULL)
 		(*list)->prev = object;
 	*list = object;
 
+	llcache->entry_cursor = NULL;
+
+	index = llcache_list_index(list);
+	if (index != NULL) {
+		llcache_index_insert(index, object);
+	}
+
 	return NSERROR_OK;
 }
 
 /**
- * Determine the remaining lifetime of a cache object using the
+ * Determine the current age and freshness lifetime of a cache object
  *
  * \param cd cache control data.
- * \return The length of time remaining for the object or 0 if expired.
+ * \param current_age_out The current age of the object.
+ * \param freshness_lifetime_out The freshness lifetime of the object.
  */
-static int
-llcache_object_rfc2616_remaining_lifetime(const llcache_cache_control *cd)
+static void
+llcache_object_rfc2616_age(const llcache_cache_control *cd,
+			   int *current_age_out,
+			   int *freshness_lifetime_out)
 {
 	int current_age, freshness_lifetime;
 	time_t now = time(NULL);
@@ -1086,6 +1924,23 @@ llcache_object_rfc2616_remaining_lifetime(const llcache_cache_control *cd)
 		freshness_lifetime = 0;
 	}
 
+	*current_age_out = current_age;
+	*freshness_lifetime_out = freshness_lifetime;
+}
+
+/**
+ * Determine the remaining lifetime of a cache object using the
+ *
+ * \param cd cache control data.
+ * \return The length of time remaining for the object or 0 if expired.
+ */
+static int
+llcache_object_rfc2616_remaining_lifetime(const llcache_cache_control *cd)
+{
+	int current_age, freshness_lifetime;
+
+	llcache_object_rfc2616_age(cd, &current_age, &freshness_lifetime);
+
 	NSLOG(llcache, DEBUG, "%d:%d", freshness_lifetime, current_age);
 
 	if ((cd->no_cache == LLCACHE_VALIDATE_FRESH) &&
@@ -1102,6 +1957,60 @@ llcache_object_rfc2616_remaining_lifetime(const llcache_cache_control *cd)
 	return 0; /* object has no remaining lifetime */
 }
 
+/**
+ * Compute the persistence score of an object
+ *
+ * Objects which are small, have a long remaining lifetime and have
+ * been used often score highest and are written to the backing store
+ * first.
+ *
+ * \param object  Object to score
+ * \return The score or 0 if the object should not be persisted.
+ */
+static uint64_t llcache_persist_score(const llcache_object *object)
+{
+	int remaining_lifetime;
+
+	if (object->store_state != LLCACHE_STATE_RAM) {
+		return 0;
+	}
+
+	remaining_lifetime = llcache_object_rfc2616_remaining_lifetime(
+			&object->cache);
+	if (remaining_lifetime <= llcache->minimum_lifetime) {
+		return 0;
+	}
+
+	return ((uint64_t)(object->hit_count + 1) *
+		(uint64_t)remaining_lifetime * 1024) /
+		(object->source_len + 1024);
+}
+
+/**
+ * Update the persistence queue entry of an object
+ *
+ * The object score is recomputed, and the object is added to,
+ * repositioned within or removed from the queue as appropriate.
+ *
+ * \param object  Object to update
+ */
+static void llcache_persist_queue_update(llcache_object *object)
+{
+	object->persist_score = llcache_persist_score(object);
+
+	if (object->persist_score == 0) {
+		llcache_persist_queue_remove(object);
+	} else if (object->persist_pos != 0) {
+		llcache_persist_queue_sift(object->persist_pos - 1);
+	} else if ((llcache->store_readonly == false) &&
+		   llcache_object_is_cached(object)) {
+		if (llcache_persist_queue_insert(object) != NSERROR_OK) {
+			NSLOG(llcache, INFO,
+			      "Unable to queue %p for persistence", object);
+		}
+	}
+}
+
 /**
  * Determine if an object is still fresh
  *
@@ -1130,6 +2039,34 @@ static bool llcache_object_is_fresh(const llcache_object *object)
 		 (object->fetch.state != LLCACHE_FETCH_COMPLETE)));
 }
 
+/**
+ * Determine if a stale object may still be used
+ *
+ * RFC 5861 permits a stale object to be used for a period after it
+ * has become stale while it is revalidated or if revalidation fails.
+ *
+ * \param object  Object to consider
+ * \param window  Period in seconds the object may be used for once stale
+ * \return True if the object is stale by less than \a window
+ */
+static bool
+llcache_object_within_stale_window(const llcache_object *object, int window)
+{
+	int current_age, freshness_lifetime;
+
+	if ((window <= 0) ||
+	    (object->cache.no_cache != LLCACHE_VALIDATE_FRESH) ||
+	    (object->fetch.state != LLCACHE_FETCH_COMPLETE)) {
+		return false;
+	}
+
+	llcache_object_rfc2616_age(&object->cache,
+				   &current_age,
+				   &freshness_lifetime);
+
+	return (current_age - freshness_lifetime) < window;
+}
+
 /**
  * Clone an object's cache data
  *
@@ -1179,6 +2116,14 @@ static nserror llcache_object_clone_cache_data(llcache_object *source,
 	if (source->cache.max_age != INVALID_AGE)
 		destination->cache.max_age = source->cache.max_age;
 
+	if (source->cache.stale_while_revalidate != 0)
+		destination->cache.stale_while_revalidate =
+			source->cache.stale_while_revalidate;
+
+	if (source->cache.stale_if_error != 0)
+		destination->cache.stale_if_error =
+			source->cache.stale_if_error;
+
 	if (source->cache.no_cache != LLCACHE_VALIDATE_FRESH)
 		destination->cache.no_cache = source->cache.no_cache;
 
@@ -1198,6 +2143,18 @@ static nserror llcache_object_clone_cache_data(llcache_object *source,
 static nserror
 llcache_object_remove_from_list(llcache_object *object, llcache_object **list)
 {
+	struct llcache_object_index *index;
+
+	index = llcache_list_index(list);
+	if (index != NULL) {
+		llcache_index_remove(index, object);
+	}
+
+	/* only cached objects are persisted */
+	if (list == &llcache->cached_objects) {
+		llcache_persist_queue_remove(object);
+	}
+
 	if (object == *list)
 		*list = object->next;
 	else
@@ -1206,6 +2163,8 @@ llcache_object_remove_from_list(llcache_object *object, llcache_object **list)
 	if (object->next != NULL)
 		object->next->prev = object->prev;
 
+	llcache->entry_cursor = NULL;
+
 	return NSERROR_OK;
 }
 
@@ -1237,10 +2196,316 @@ static nserror llcache_retrieve_persisted_data(llcache_object *object)
 				    &object->source_len);
 }
 
+/**
+ * Detach the objects using an object as their validation candidate
+ *
+ * Used when the candidate's persistent source data turns out to be
+ * unusable so a not modified response can no longer fall back onto
+ * it. Background revalidations of the candidate are abandoned and
+ * other dependent objects are fetched again unconditionally.
+ *
+ * \param object The candidate object.
+ */
+static void llcache_object_drop_dependents(llcache_object *object)
+{
+	llcache_object *lists[2];
+	llcache_object *dep, *next;
+	llcache_event event;
+	unsigned int list;
+
+	lists[0] = llcache->cached_objects;
+	lists[1] = llcache->uncached_objects;
+
+	for (list = 0; list < NOF_ELEMENTS(lists); list++) {
+		for (dep = lists[list];
+		     (dep != NULL) && (object->candidate_count != 0);
+		     dep = next) {
+			next = dep->next;
+
+			if (dep->candidate != object) {
+				continue;
+			}
+
+			NSLOG(llcache, DEBUG, "Dropping candidate %p of %p",
+			      object, dep);
+
+			fetch_abort(dep->fetch.fetch);
+			dep->fetch.fetch = NULL;
+
+			object->candidate_count--;
+			dep->candidate = NULL;
+
+			/* without its validators the object is stale */
+			llcache_invalidate_cache_control_data(dep);
+
+			if (dep->revalidating) {
+				/* no users, left for the cache cleaner */
+				dep->fetch.state = LLCACHE_FETCH_COMPLETE;
+				continue;
+			}
+
+			dep->fetch.retries_remaining = llcache->fetch_attempts;
+			if (llcache_object_refetch(dep) != NSERROR_OK) {
+				dep->fetch.state = LLCACHE_FETCH_COMPLETE;
+
+				event.type = LLCACHE_EVENT_ERROR;
+				event.data.msg = messages_get("FetchFailed");
+
+				llcache_send_event_to_users(dep, &event);
+			}
+		}
+	}
+}
+
+/**
+ * Discard a cached object whose persistent source data is unusable
+ *
+ * \param object The object to discard.
+ */
+static void llcache_object_discard_unusable(llcache_object *object)
+{
+	if (object->candidate_count != 0) {
+		llcache_object_drop_dependents(object);
+	}
+
+	llcache_object_remove_from_list(object, &llcache->cached_objects);
+	llcache_object_destroy(object);
+}
+
+/**
+ * Completion of an asynchronous source data retrieval.
+ *
+ * If the retrieval failed the persistent copy is unusable and the
+ * object is fetched again as if it had never been cached.
+ *
+ * \param res The result of the retrieval.
+ * \param data The retrieved source data.
+ * \param datalen The length of \a data
+ * \param pw The object the source data was retrieved for.
+ */
+static void
+llcache_persisted_data_cb(nserror res,
+			  uint8_t *data,
+			  size_t datalen,
+			  void *pw)
+{
+	llcache_object *object = pw;
+	llcache_event event;
+
+	object->source_pending = false;
+
+	if (res == NSERROR_OK) {
+		object->source_data = data;
+		object->source_len = datalen;
+
+		/* users may now catch up with the object */
+		llcache_users_not_caught_up();
+		return;
+	}
+
+	NSLOG(llcache, DEBUG, "Persistent retrieval failed for %p", object);
+
+	guit->llcache->invalidate(object->url);
+
+	/* objects validating against this one can no longer use it */
+	if (object->candidate_count != 0) {
+		llcache_object_drop_dependents(object);
+	}
+
+	/* reset the object to refetch it */
+	object->store_state = LLCACHE_STATE_RAM;
+	object->source_len = 0;
+	llcache_destroy_headers(object);
+	llcache_invalidate_cache_control_data(object);
+	object->fetch.retries_remaining = llcache->fetch_attempts;
+
+	res = llcache_object_refetch(object);
+	if (res != NSERROR_OK) {
+		object->fetch.state = LLCACHE_FETCH_COMPLETE;
+
+		event.type = LLCACHE_EVENT_ERROR;
+		event.data.msg = messages_get("FetchFailed");
+
+		llcache_send_event_to_users(object, &event);
+	}
+}
+
+/**
+ * Start retrieving source data for an object from persistent store.
+ *
+ * Where the backing store supports it the source data is retrieved
+ * without blocking and the object users are held until it is
+ * available, otherwise this is the same as
+ * llcache_retrieve_persisted_data()
+ *
+ * \param object the object to operate on.
+ * \return appropriate error code.
+ */
+static nserror llcache_retrieve_persisted_data_async(llcache_object *object)
+{
+	nserror res;
+
+	if ((object->source_pending == true) ||
+	    (object->source_data != NULL) ||
+	    (object->store_state != LLCACHE_STATE_DISC)) {
+		/* source data does not require retrieving */
+		return NSERROR_OK;
+	}
+
+	if (guit->llcache->fetch_async == NULL) {
+		return llcache_retrieve_persisted_data(object);
+	}
+
+	res = guit->llcache->fetch_async(object->url,
+					 BACKING_STORE_NONE,
+					 llcache_persisted_data_cb,
+					 object);
+	if (res == NSERROR_NOT_IMPLEMENTED) {
+		return llcache_retrieve_persisted_data(object);
+	}
+	if (res == NSERROR_OK) {
+		object->source_pending = true;
+	}
+	return res;
+}
+
+/**
+ * Version of the binary metadata format.
+ */
+#define LLCACHE_METADATA_VERSION 1
+
+/**
+ * Size of the fixed part of the binary metadata format.
+ *
+ * The fixed part is laid out as, all values little endian:
+ *   - 4 byte magic of a NUL followed by "LCM"
+ *   - uint32 format version
+ *   - uint64 source data length
+ *   - int64 request time
+ *   - int64 response time
+ *   - int64 completion time
+ *   - uint32 url length
+ *   - uint32 number of headers
+ *   - uint32 total length of all literal header strings and values
+ *     including their NUL terminators
+ *
+ * It is followed by the NUL terminated url and then each header as a
+ * uint8 interned name index, if the index is zero a uint16 name
+ * length and NUL terminated name, and finally a uint32 value length
+ * and NUL terminated value.
+ *
+ * The leading NUL distinguishes the format from the previous textual
+ * format which always started with a url.
+ */
+#define LLCACHE_METADATA_FIXED_SIZE 52
+
+/**
+ * Binary metadata format magic.
+ */
+static const uint8_t llcache_metadata_magic[4] = { 0, 'L', 'C', 'M' };
+
+/**
+ * Interned header names.
+ *
+ * The index of a name in this table is used in the binary metadata
+ * in place of the name text. Index zero indicates the name is stored
+ * literally. Entries may only ever be appended to this table.
+ */
+static const char *llcache_interned_headers[] = {
+	NULL,
+	"Content-Type",
+	"Content-Length",
+	"Date",
+	"Last-Modified",
+	"ETag",
+	"Cache-Control",
+	"Expires",
+	"Age",
+	"Content-Encoding",
+	"Server",
+	"Vary",
+	"Accept-Ranges",
+	"Connection",
+	"Content-Language",
+	"Content-Disposition",
+	"Strict-Transport-Security",
+	"Set-Cookie",
+	"Location",
+	"Pragma",
+	"Transfer-Encoding",
+	"Access-Control-Allow-Origin",
+	"X-Content-Type-Options",
+	"X-Frame-Options",
+	"Content-Security-Policy",
+	"Keep-Alive",
+	"Link",
+	"Via",
+};
+
+/**
+ * Find the interned index of a header name.
+ *
+ * \param name The header name.
+ * \return The index of the name or 0 if the name is not interned.
+ */
+static uint8_t llcache_header_intern_index(const char *name)
+{
+	uint8_t idx;
+
+	for (idx = 1; idx < NOF_ELEMENTS(llcache_interned_headers); idx++) {
+		if (strcasecmp(name, llcache_interned_headers[idx]) == 0) {
+			return idx;
+		}
+	}
+	return 0;
+}
+
+static inline uint8_t *metadata_put_u16(uint8_t *p, uint16_t v)
+{
+	p[0] = v & 0xff;
+	p[1] = (v >> 8) & 0xff;
+	return p + 2;
+}
+
+static inline uint8_t *metadata_put_u32(uint8_t *p, uint32_t v)
+{
+	p[0] = v & 0xff;
+	p[1] = (v >> 8) & 0xff;
+	p[2] = (v >> 16) & 0xff;
+	p[3] = (v >> 24) & 0xff;
+	return p + 4;
+}
+
+static inline uint8_t *metadata_put_u64(uint8_t *p, uint64_t v)
+{
+	p = metadata_put_u32(p, v & 0xffffffff);
+	return metadata_put_u32(p, v >> 32);
+}
+
+static inline uint16_t metadata_get_u16(const uint8_t *p)
+{
+	return p[0] | (p[1] << 8);
+}
+
+static inline uint32_t metadata_get_u32(const uint8_t *p)
+{
+	return (uint32_t)p[0] |
+		((uint32_t)p[1] << 8) |
+		((uint32_t)p[2] << 16) |
+		((uint32_t)p[3] << 24);
+}
+
+static inline uint64_t metadata_get_u64(const uint8_t *p)
+{
+	return (uint64_t)metadata_get_u32(p) |
+		((uint64_t)metadata_get_u32(p + 4) << 32);
+}
+
 /**
  * Generate a serialised version of an object's metadata
  *
- * The metadata includes object headers.
+ * The metadata includes object headers and is written in the binary
+ * format described by LLCACHE_METADATA_FIXED_SIZE.
  *
  * \param object The cache object to serialise the metadata of.
  * \param data_out Where the serialised buffer will be placed.
@@ -1256,27 +2521,37 @@ llcache_serialise_metadata(llcache_object *object,
 			   size_t *datasize_out)
 {
 	size_t allocsize;
-	int datasize;
+	size_t strings_len = 0;
+	size_t url_len;
+	size_t name_len;
+	size_t value_len;
 	uint8_t *data;
-	char *op;
+	uint8_t *op;
 	unsigned int hloop;
-	int use;
-
-	allocsize = 10 + 1; /* object length */
-
-	allocsize += 10 + 1; /* request time */
-
-	allocsize += 10 + 1; /* response time */
+	uint8_t name_idx;
 
-	allocsize += 10 + 1; /* completion time */
+	url_len = nsurl_length(object->url);
 
-	allocsize += 10 + 1; /* space for number of header entries */
-
-	allocsize += nsurl_length(object->url) + 1;
+	allocsize = LLCACHE_METADATA_FIXED_SIZE + url_len + 1;
 
 	for (hloop = 0 ; hloop < object->num_headers ; hloop++) {
-		allocsize += strlen(object->headers[hloop].name) + 1;
-		allocsize += strlen(object->headers[hloop].value) + 1;
+		name_idx = llcache_header_intern_index(
+				object->headers[hloop].name);
+		if (name_idx == 0) {
+			name_len = strlen(object->headers[hloop].name);
+			if (name_len > UINT16_MAX) {
+				return NSERROR_INVALID;
+			}
+			allocsize += 2 + name_len + 1;
+			strings_len += name_len + 1;
+		}
+		value_len = strlen(object->headers[hloop].value);
+		allocsize += 1 + 4 + value_len + 1;
+		strings_len += value_len + 1;
+	}
+
+	if ((url_len > UINT32_MAX) || (strings_len > UINT32_MAX)) {
+		return NSERROR_INVALID;
 	}
 
 	data = malloc(allocsize);
@@ -1284,123 +2559,234 @@ llcache_serialise_metadata(llcache_object *object,
 		return NSERROR_NOMEM;
 	}
 
-	op = (char *)data;
-	datasize = allocsize;
+	op = data;
+	memcpy(op, llcache_metadata_magic, sizeof(llcache_metadata_magic));
+	op += sizeof(llcache_metadata_magic);
+	op = metadata_put_u32(op, LLCACHE_METADATA_VERSION);
+	op = metadata_put_u64(op, object->source_len);
+	op = metadata_put_u64(op, (int64_t)object->cache.req_time);
+	op = metadata_put_u64(op, (int64_t)object->cache.res_time);
+	op = metadata_put_u64(op, (int64_t)object->cache.fin_time);
+	op = metadata_put_u32(op, url_len);
+	op = metadata_put_u32(op, object->num_headers);
+	op = metadata_put_u32(op, strings_len);
 
 	/* the url, used for checking for collisions */
-	use = snprintf(op, datasize, "%s", nsurl_access(object->url));
-	if (use < 0) {
-		goto operror;
-	}
-	use++; /* does not count the null */
-	if (use > datasize) {
-		goto overflow;
-	}
-	op += use;
-	datasize -= use;
-
-	/* object size */
-	use = snprintf(op, datasize, "%" PRIsizet, object->source_len);
-	if (use < 0) {
-		goto operror;
-	}
-	use++; /* does not count the null */
-	if (use > datasize)
-		goto overflow;
-	op += use;
-	datasize -= use;
-
-	/* Time of request */
-	use = nsc_sntimet(op, datasize, &object->cache.req_time);
-	if (use == 0)
-		goto overflow;
-	use++; /* does not count the null */
-	op += use;
-	datasize -= use;
-
-	/* Time of response */
-	use = nsc_sntimet(op, datasize, &object->cache.res_time);
-	if (use == 0)
-		goto overflow;
-	use++; /* does not count the null */
-	op += use;
-	datasize -= use;
-
-	/* Time of completion */
-	use = nsc_sntimet(op, datasize, &object->cache.fin_time);
-	if (use == 0)
-		goto overflow;
-	use++; /* does not count the null */
-	op += use;
-	datasize -= use;
-
-	/* number of headers */
-	use = snprintf(op, datasize, "%" PRIsizet, object->num_headers);
-	if (use < 0) {
-		goto operror;
-	}
-	use++; /* does not count the null */
-	if (use > datasize)
-		goto overflow;
-	op += use;
-	datasize -= use;
+	memcpy(op, nsurl_access(object->url), url_len + 1);
+	op += url_len + 1;
 
 	/* headers */
 	for (hloop = 0 ; hloop < object->num_headers ; hloop++) {
-		use = snprintf(op, datasize,
-			       "%s:%s",
-			       object->headers[hloop].name,
-			       object->headers[hloop].value);
-		if (use < 0) {
-			goto operror;
+		name_idx = llcache_header_intern_index(
+				object->headers[hloop].name);
+		*op++ = name_idx;
+		if (name_idx == 0) {
+			name_len = strlen(object->headers[hloop].name);
+			op = metadata_put_u16(op, name_len);
+			memcpy(op, object->headers[hloop].name, name_len + 1);
+			op += name_len + 1;
 		}
-		use++; /* does not count the null */
-		if (use > datasize)
-			goto overflow;
-		op += use;
-		datasize -= use;
+		value_len = strlen(object->headers[hloop].value);
+		op = metadata_put_u32(op, value_len);
+		memcpy(op, object->headers[hloop].value, value_len + 1);
+		op += value_len + 1;
 	}
 
-	NSLOG(llcache, DEBUG, "Filled buffer with %d spare", datasize);
+	assert((size_t)(op - data) == allocsize);
 
 	*data_out = data;
-	*datasize_out = allocsize - datasize;
+	*datasize_out = allocsize;
 
 	return NSERROR_OK;
+}
 
-overflow:
-	/* somehow we overflowed the buffer - hth? */
-	NSLOG(llcache, INFO, "Overflowed metadata buffer");
-	free(data);
-	return NSERROR_INVALID;
+/**
+ * Deserialise binary format metadata.
+ *
+ * The object headers array and all the header strings are placed in a
+ * single allocation. Interned header names reference the interned
+ * name table directly.
+ *
+ * \param object The object to update from the metadata.
+ * \param metadata The serialised metadata.
+ * \param metadatalen The length of the serialised metadata.
+ * \return NSERROR_OK on success or error code on failure.
+ */
+static nserror
+llcache_process_metadata_binary(llcache_object *object,
+				const uint8_t *metadata,
+				size_t metadatalen)
+{
+	const uint8_t *ip = metadata;
+	const uint8_t *end = metadata + metadatalen;
+	uint64_t source_length;
+	time_t request_time;
+	time_t response_time;
+	time_t completion_time;
+	uint32_t url_len;
+	uint32_t num_headers;
+	uint32_t strings_len;
+	llcache_header *headers;
+	char *sp;
+	char *send;
+	size_t len;
+	uint32_t hloop;
+	uint8_t name_idx;
+	nsurl *metadataurl;
+	nserror res;
+
+	if (metadatalen < LLCACHE_METADATA_FIXED_SIZE) {
+		return NSERROR_INVALID;
+	}
+	ip += sizeof(llcache_metadata_magic);
+
+	if (metadata_get_u32(ip) != LLCACHE_METADATA_VERSION) {
+		NSLOG(llcache, INFO, "Unsupported metadata version %"PRIu32,
+		      metadata_get_u32(ip));
+		return NSERROR_INVALID;
+	}
+	ip += 4;
+
+	source_length = metadata_get_u64(ip);
+	ip += 8;
+	request_time = (time_t)(int64_t)metadata_get_u64(ip);
+	ip += 8;
+	response_time = (time_t)(int64_t)metadata_get_u64(ip);
+	ip += 8;
+	completion_time = (time_t)(int64_t)metadata_get_u64(ip);
+	ip += 8;
+	url_len = metadata_get_u32(ip);
+	ip += 4;
+	num_headers = metadata_get_u32(ip);
+	ip += 4;
+	strings_len = metadata_get_u32(ip);
+	ip += 4;
+
+	if ((source_length > SIZE_MAX) ||
+	    ((size_t)(end - ip) <= url_len) ||
+	    (ip[url_len] != 0) ||
+	    (num_headers > (metadatalen / 6)) ||
+	    (strings_len > metadatalen)) {
+		return NSERROR_INVALID;
+	}
 
-operror:
-	/* output error */
-	NSLOG(llcache, INFO, "Output error");
-	free(data);
+	res = nsurl_create((const char *)ip, &metadataurl);
+	if (res != NSERROR_OK) {
+		return res;
+	}
+
+	if (nsurl_compare(object->url, metadataurl, NSURL_COMPLETE) != true) {
+		/* backing store returned the wrong object for the
+		 * request. This may occur if the backing store had
+		 * a collision in its storage method. We cope with this
+		 * by simply skipping caching of this object.
+		 */
+		NSLOG(llcache, INFO, "Got metadata for %s instead of %s",
+		      nsurl_access(metadataurl), nsurl_access(object->url));
+
+		nsurl_unref(metadataurl);
+
+		return NSERROR_BAD_URL;
+	}
+	nsurl_unref(metadataurl);
+	ip += url_len + 1;
+
+	/* single allocation for header array and strings */
+	headers = malloc((num_headers * sizeof(llcache_header)) + strings_len);
+	if (headers == NULL) {
+		return NSERROR_NOMEM;
+	}
+	sp = (char *)(headers + num_headers);
+	send = sp + strings_len;
+
+	for (hloop = 0; hloop < num_headers; hloop++) {
+		if (ip >= end) {
+			goto format_error;
+		}
+		name_idx = *ip++;
+
+		if (name_idx == 0) {
+			if ((end - ip) < 2) {
+				goto format_error;
+			}
+			len = metadata_get_u16(ip) + 1;
+			ip += 2;
+			if (((size_t)(end - ip) < len) ||
+			    ((size_t)(send - sp) < len) ||
+			    (ip[len - 1] != 0)) {
+				goto format_error;
+			}
+			memcpy(sp, ip, len);
+			headers[hloop].name = sp;
+			sp += len;
+			ip += len;
+		} else if (name_idx < NOF_ELEMENTS(llcache_interned_headers)) {
+			headers[hloop].name =
+				(char *)llcache_interned_headers[name_idx];
+		} else {
+			goto format_error;
+		}
+
+		if ((end - ip) < 4) {
+			goto format_error;
+		}
+		len = (size_t)metadata_get_u32(ip) + 1;
+		ip += 4;
+		if (((size_t)(end - ip) < len) ||
+		    ((size_t)(send - sp) < len) ||
+		    (ip[len - 1] != 0)) {
+			goto format_error;
+		}
+		memcpy(sp, ip, len);
+		headers[hloop].value = sp;
+		sp += len;
+		ip += len;
+	}
+
+	/* update object on successful parse of metadata */
+	llcache_destroy_headers(object);
+	object->headers = headers;
+	object->num_headers = num_headers;
+	object->headers_packed = true;
+
+	for (hloop = 0; hloop < num_headers; hloop++) {
+		res = llcache_fetch_header_cache_control(object,
+				headers[hloop].name,
+				headers[hloop].value);
+		if (res != NSERROR_OK) {
+			return res;
+		}
+	}
+
+	object->source_len = source_length;
+	object->cache.req_time = request_time;
+	object->cache.res_time = response_time;
+	object->cache.fin_time = completion_time;
+
+	return NSERROR_OK;
+
+format_error:
+	free(headers);
 	return NSERROR_INVALID;
 }
 
 /**
- * Deserialisation of an object's metadata.
+ * Deserialise textual format metadata.
  *
- * Attempt to retrieve and deserialise the metadata for an object from
- * the backing store.
+ * This is the format used by previous versions. It is still read so
+ * existing disc caches remain usable.
  *
- * This must only update object if it is successful otherwise difficult
- * to debug crashes happen later by using bad leftover object state.
- *
- * \param object The object to retrieve the metadata for.
- * \return NSERROR_OK if the metatdata was retrieved and deserialised
- *         or error code if URL is not in persistent storage or in
- *         event of deserialisation error.
+ * \param object The object to update from the metadata.
+ * \param metadata The serialised metadata.
+ * \param metadatalen The length of the serialised metadata.
+ * \return NSERROR_OK on success or error code on failure.
  */
 static nserror
-llcache_process_metadata(llcache_object *object)
+llcache_process_metadata_text(llcache_object *object,
+			      uint8_t *metadata,
+			      size_t metadatalen)
 {
 	nserror res;
-	uint8_t *metadata = NULL;
-	size_t metadatalen = 0;
 	nsurl *metadataurl;
 	unsigned int line;
 	char *ln;
@@ -1409,22 +2795,9 @@ llcache_process_metadata(llcache_object *object)
 	size_t source_length;
 	time_t request_time;
 	time_t response_time;
-	time_t completion_time;
-	size_t num_headers;
-	size_t hloop;
-
-	NSLOG(llcache, INFO, "Retrieving metadata");
-
-	/* attempt to retrieve object metadata from the backing store */
-	res = guit->llcache->fetch(object->url,
-				   BACKING_STORE_META,
-				   &metadata,
-				   &metadatalen);
-	if (res != NSERROR_OK) {
-		return res;
-	}
-
-	NSLOG(llcache, INFO, "Processing retrieved data");
+	time_t completion_time;
+	size_t num_headers;
+	size_t hloop;
 
 	/* metadata line 1 is the url the metadata referrs to */
 	line = 1;
@@ -1452,8 +2825,6 @@ llcache_process_metadata(llcache_object *object)
 
 		nsurl_unref(metadataurl);
 
-		guit->llcache->release(object->url, BACKING_STORE_META);
-
 		return NSERROR_BAD_URL;
 	}
 	nsurl_unref(metadataurl);
@@ -1523,29 +2894,80 @@ llcache_process_metadata(llcache_object *object)
 			goto format_error;
 	}
 
-	guit->llcache->release(object->url, BACKING_STORE_META);
-
 	/* update object on successful parse of metadata  */
 	object->source_len = source_length;
 
-	/** \todo really not sure this is right, nothing is allocated here? */
-	object->source_alloc = metadatalen;
-
 	object->cache.req_time = request_time;
 	object->cache.res_time = response_time;
 	object->cache.fin_time = completion_time;
 
-	/* object stored in backing store */
-	object->store_state = LLCACHE_STATE_DISC;
-
 	return NSERROR_OK;
 
 format_error:
 	NSLOG(llcache, INFO,
 	      "metadata error on line %d error code %d\n",
 	      line, res);
+
+	return res;
+}
+
+/**
+ * Deserialisation of an object's metadata.
+ *
+ * Attempt to retrieve and deserialise the metadata for an object from
+ * the backing store.
+ *
+ * This must only update object if it is successful otherwise difficult
+ * to debug crashes happen later by using bad leftover object state.
+ *
+ * \param object The object to retrieve the metadata for.
+ * \return NSERROR_OK if the metatdata was retrieved and deserialised
+ *         or error code if URL is not in persistent storage or in
+ *         event of deserialisation error.
+ */
+static nserror
+llcache_process_metadata(llcache_object *object)
+{
+	nserror res;
+	uint8_t *metadata = NULL;
+	size_t metadatalen = 0;
+
+	NSLOG(llcache, INFO, "Retrieving metadata");
+
+	/* attempt to retrieve object metadata from the backing store */
+	res = guit->llcache->fetch(object->url,
+				   BACKING_STORE_META,
+				   &metadata,
+				   &metadatalen);
+	if (res != NSERROR_OK) {
+		return res;
+	}
+
+	NSLOG(llcache, INFO, "Processing retrieved data");
+
+	if ((metadatalen >= sizeof(llcache_metadata_magic)) &&
+	    (memcmp(metadata,
+		    llcache_metadata_magic,
+		    sizeof(llcache_metadata_magic)) == 0)) {
+		res = llcache_process_metadata_binary(object,
+						      metadata,
+						      metadatalen);
+	} else {
+		res = llcache_process_metadata_text(object,
+						    metadata,
+						    metadatalen);
+	}
+
 	guit->llcache->release(object->url, BACKING_STORE_META);
 
+	if (res == NSERROR_OK) {
+		/* object stored in backing store */
+		object->store_state = LLCACHE_STATE_DISC;
+	} else if (res == NSERROR_BAD_URL) {
+		/* two urls have the same backing store identifier */
+		llcache->stats.collision_count++;
+	}
+
 	return res;
 }
 
@@ -1603,6 +3025,104 @@ llcache_object_fetch_persistent(llcache_object *object,
 	return NSERROR_OK;
 }
 
+/**
+ * Revalidate a stale object in the background
+ *
+ * A new object is fetched with the stale object as its candidate in
+ * the same way as a normal freshness validation, but without any
+ * users. A not modified response refreshes the stale object, any
+ * other response replaces it in the cache once it is complete. Until
+ * then retrievals continue to be given the stale object.
+ *
+ * \param stale	  The stale object to revalidate
+ * \param flags		  Fetch flags
+ * \param referer	  Referring URL, or NULL if none
+ * \param post		  POST data, or NULL for a GET request
+ * \param redirect_count  Number of redirects followed so far
+ * \param hsts_in_use     Whether HSTS applies to this fetch
+ * \return NSERROR_OK on success, appropriate error otherwise
+ */
+static nserror
+llcache_object_revalidate(llcache_object *stale,
+			  uint32_t flags,
+			  nsurl *referer,
+			  const llcache_post_data *post,
+			  uint32_t redirect_count,
+			  bool hsts_in_use)
+{
+	nserror error;
+	llcache_object *obj;
+
+	error = llcache_object_new(stale->url, &obj);
+	if (error != NSERROR_OK) {
+		return error;
+	}
+
+	NSLOG(llcache, DEBUG, "Revalidating %p in background (%p)", stale, obj);
+
+	error = llcache_object_clone_cache_data(stale, obj, true);
+	if (error != NSERROR_OK) {
+		llcache_object_destroy(obj);
+		return error;
+	}
+
+	stale->candidate_count++;
+	obj->candidate = stale;
+	obj->revalidating = true;
+
+	llcache->stats.conditional_count++;
+
+	error = llcache_object_fetch(obj, flags, referer, post,
+				     redirect_count, hsts_in_use);
+	if (error != NSERROR_OK) {
+		stale->candidate_count--;
+		llcache_object_destroy(obj);
+		return error;
+	}
+
+	llcache_object_add_to_list(obj, &llcache->cached_objects);
+
+	return NSERROR_OK;
+}
+
+/**
+ * Determine if an object's source data is held in RAM
+ *
+ * \param object The object to examine.
+ * \return true if the source data is in RAM else false.
+ */
+static inline bool
+llcache_object_source_in_ram(const llcache_object *object)
+{
+	return ((object->source_data != NULL) ||
+		(object->source_chunks != NULL) ||
+		(object->store_state != LLCACHE_STATE_DISC));
+}
+
+/**
+ * Account a retrieval satisfied by an existing object
+ *
+ * Only retrievals whose source data was made available are recorded,
+ * a failed retrieval is recorded as a miss instead.
+ *
+ * \param object The object satisfying the retrieval.
+ * \param in_ram Whether the source data was in RAM before retrieval.
+ * \param count  The counter to increment.
+ */
+static void
+llcache_stats_record_hit(const llcache_object *object,
+			 bool in_ram,
+			 uint32_t *count)
+{
+	(*count)++;
+
+	if (in_ram) {
+		llcache->stats.ram_size += object->source_len;
+	} else {
+		llcache->stats.disc_size += object->source_len;
+	}
+}
+
 /**
  * Retrieve a potentially cached object
  *
@@ -1625,7 +3145,9 @@ llcache_object_retrieve_from_cache(nsurl *url,
 				   llcache_object **result)
 {
 	nserror error;
-	llcache_object *obj, *newest = NULL;
+	llcache_object *obj, *newest = NULL, *revalidation = NULL;
+	uint32_t hash;
+	bool in_ram;
 
 	NSLOG(llcache, DEBUG,
 	      "Searching cache for %s flags:%x referer:%s post:%p",
@@ -1633,17 +3155,39 @@ llcache_object_retrieve_from_cache(nsurl *url,
 	      referer==NULL?"":nsurl_access(referer),
 	      post);
 
-	/* Search for the most recently fetched matching object */
-	for (obj = llcache->cached_objects; obj != NULL; obj = obj->next) {
+	/* Search the url's hash chain for the most recently fetched
+	 * matching object
+	 */
+	hash = nsurl_hash(url);
+	for (obj = llcache->cached_index.buckets[
+		     hash & (llcache->cached_index.size - 1)];
+	     obj != NULL;
+	     obj = obj->hash_next) {
+
+		if ((obj->url_hash != hash) ||
+		    (nsurl_compare(obj->url, url, NSURL_COMPLETE) == false)) {
+			continue;
+		}
 
-		if ((newest == NULL ||
-		     obj->cache.req_time > newest->cache.req_time) &&
-		    nsurl_compare(obj->url, url,
-				  NSURL_COMPLETE) == true) {
+		if (obj->revalidating) {
+			/* the stale object is used until a background
+			 * revalidation completes, failed revalidations
+			 * are ignored.
+			 */
+			if (obj->fetch.fetch != NULL) {
+				revalidation = obj;
+			}
+		} else if ((newest == NULL) ||
+			   (obj->cache.req_time > newest->cache.req_time)) {
 			newest = obj;
 		}
 	}
 
+	/* Without a stale object use the revalidation as it is fetched */
+	if (newest == NULL) {
+		newest = revalidation;
+	}
+
 	/* No viable object found in cache create one and attempt to
 	 * pull from persistent store.
 	 */
@@ -1681,12 +3225,18 @@ llcache_object_retrieve_from_cache(nsurl *url,
 		 * This will occur the next time that llcache_poll is called.
 		 */
 
+		in_ram = llcache_object_source_in_ram(newest);
+
 		/* ensure the source data is present */
-		error = llcache_retrieve_persisted_data(newest);
+		error = llcache_retrieve_persisted_data_async(newest);
 		if (error == NSERROR_OK) {
-			/* source data was successfully retrieved from
-			 * persistent store
+			/* source data was successfully retrieved, or is
+			 * being retrieved, from persistent store
 			 */
+			llcache_stats_record_hit(newest, in_ram, in_ram ?
+					&llcache->stats.ram_hit_count :
+					&llcache->stats.disc_hit_count);
+
 			*result = newest;
 
 			return NSERROR_OK;
@@ -1698,8 +3248,57 @@ llcache_object_retrieve_from_cache(nsurl *url,
 		 */
 		NSLOG(llcache, DEBUG, "Persistent retrieval failed for %p", newest);
 
-		llcache_object_remove_from_list(newest,	&llcache->cached_objects);
-		llcache_object_destroy(newest);
+		llcache_object_discard_unusable(newest);
+
+		error = llcache_object_new(url, &obj);
+		if (error != NSERROR_OK) {
+			return error;
+		}
+	} else if ((newest != NULL) &&
+		   llcache_object_within_stale_window(newest,
+				newest->cache.stale_while_revalidate)) {
+		/* Found a stale object which may be used while it is
+		 * revalidated in the background
+		 */
+		in_ram = llcache_object_source_in_ram(newest);
+
+		error = llcache_retrieve_persisted_data_async(newest);
+		if (error == NSERROR_OK) {
+			NSLOG(llcache, DEBUG, "Found stale %p", newest);
+
+			llcache_stats_record_hit(newest, in_ram,
+						 &llcache->stats.stale_count);
+
+			/* Only one revalidation is required however
+			 * many times the stale object is retrieved.
+			 */
+			if ((revalidation == NULL) &&
+			    (llcache_object_revalidate(newest, flags, referer,
+						       post, redirect_count,
+						       hsts_in_use) != NSERROR_OK)) {
+				NSLOG(llcache, DEBUG,
+				      "Unable to revalidate %p", newest);
+			}
+
+			*result = newest;
+
+			return NSERROR_OK;
+		}
+
+		NSLOG(llcache, DEBUG, "Persistent retrieval failed for %p", newest);
+
+		llcache_object_discard_unusable(newest);
+
+		error = llcache_object_new(url, &obj);
+		if (error != NSERROR_OK) {
+			return error;
+		}
+	} else if ((newest != NULL) && (newest->source_pending == true)) {
+		/* The candidate source data is still being retrieved
+		 * from persistent store so it cannot be validated,
+		 * fetch without it.
+		 */
+		NSLOG(llcache, DEBUG, "Candidate %p source pending", newest);
 
 		error = llcache_object_new(url, &obj);
 		if (error != NSERROR_OK) {
@@ -1707,10 +3306,13 @@ llcache_object_retrieve_from_cache(nsurl *url,
 		}
 	} else if (newest != NULL) {
 		/* Found a candidate object but it needs freshness validation */
+		in_ram = llcache_object_source_in_ram(newest);
 
 		/* ensure the source data is present */
 		error = llcache_retrieve_persisted_data(newest);
 		if (error == NSERROR_OK) {
+			llcache_stats_record_hit(newest, in_ram,
+					&llcache->stats.validate_count);
 
 			/* Create a new object */
 			error = llcache_object_new(url, &obj);
@@ -1730,6 +3332,8 @@ llcache_object_retrieve_from_cache(nsurl *url,
 			newest->candidate_count++;
 			obj->candidate = newest;
 
+			llcache->stats.conditional_count++;
+
 			/* Attempt to kick-off fetch */
 			error = llcache_object_fetch(obj, flags, referer, post,
 						     redirect_count, hsts_in_use);
@@ -1753,9 +3357,7 @@ llcache_object_retrieve_from_cache(nsurl *url,
 		 * failed, destroy cache object and fall though to
 		 * cache miss to re-retch
 		 */
-		llcache_object_remove_from_list(newest,
-						&llcache->cached_objects);
-		llcache_object_destroy(newest);
+		llcache_object_discard_unusable(newest);
 
 		error = llcache_object_new(url, &obj);
 		if (error != NSERROR_OK) {
@@ -1763,6 +3365,8 @@ llcache_object_retrieve_from_cache(nsurl *url,
 		}
 	}
 
+	llcache->stats.miss_count++;
+
 	/* Attempt to kick-off fetch */
 	error = llcache_object_fetch(obj, flags, referer, post,
 			redirect_count, hsts_in_use);
@@ -1861,6 +3465,8 @@ llcache_object_retrieve(nsurl *url,
 
 		/* Add new object to uncached list */
 		llcache_object_add_to_list(obj, &llcache->uncached_objects);
+
+		llcache->stats.uncached_count++;
 	} else {
 		error = llcache_object_retrieve_from_cache(defragmented_url,
 				flags, referer, post, redirect_count,
@@ -1906,6 +3512,15 @@ static nserror llcache_object_add_user(llcache_object *object,
 		object->users->prev = user;
 	object->users = user;
 
+	/* account the use for eviction ordering */
+	object->hit_count++;
+	object->gdsf_base = llcache->gdsf_inflation;
+
+	/* more frequently used objects are more valuable to persist */
+	if (object->persist_pos != 0) {
+		llcache_persist_queue_update(object);
+	}
+
 	NSLOG(llcache, DEBUG, "Adding user %p to %p", user, object);
 
 	return NSERROR_OK;
@@ -2143,6 +3758,11 @@ static nserror llcache_object_cache_update(llcache_object *object)
 	if (object->cache.date == 0)
 		object->cache.date = time(NULL);
 
+	/* cache state changed so reconsider for persistence */
+	if (object->fetch.fetch == NULL) {
+		llcache_persist_queue_update(object);
+	}
+
 	return NSERROR_OK;
 }
 
@@ -2164,6 +3784,8 @@ static nserror llcache_fetch_notmodified(llcache_object *object,
 	if (object->candidate != NULL) {
 		llcache_object_user *user, *next;
 
+		llcache->stats.notmodified_count++;
+
 		/* Move user(s) to candidate content */
 		for (user = object->users; user != NULL; user = next) {
 			next = user->next;
@@ -2212,6 +3834,44 @@ static nserror llcache_fetch_notmodified(llcache_object *object,
 	return NSERROR_OK;
 }
 
+/**
+ * Handle a failed fetch by using a stale candidate if permitted
+ *
+ * If the candidate the fetch was validating allows being used once
+ * stale on error the users are moved to it instead of receiving the
+ * error.
+ *
+ * \param object  Object whose fetch failed
+ * \return True if the users were moved to the candidate
+ */
+static bool llcache_fetch_stale_if_error(llcache_object *object)
+{
+	llcache_object *candidate = object->candidate;
+	llcache_object_user *user, *next;
+
+	if ((candidate == NULL) ||
+	    (llcache_object_within_stale_window(candidate,
+				candidate->cache.stale_if_error) == false)) {
+		return false;
+	}
+
+	NSLOG(llcache, DEBUG, "Using stale %p for failed %p", candidate, object);
+
+	/* Move user(s) to candidate content */
+	for (user = object->users; user != NULL; user = next) {
+		next = user->next;
+
+		llcache_object_remove_user(object, user);
+		llcache_object_add_user(candidate, user);
+	}
+
+	/* Candidate is no longer a candidate for us */
+	candidate->candidate_count--;
+	object->candidate = NULL;
+
+	return true;
+}
+
 /**
  * Process a chunk of fetched data
  *
@@ -2259,20 +3919,74 @@ llcache_fetch_process_data(llcache_object *object,
 		object->fetch.state = LLCACHE_FETCH_DATA;
 	}
 
-	/* Resize source buffer if it's too small */
-	if (object->source_len + len >= object->source_alloc) {
-		const size_t new_len = object->source_len + len + 64 * 1024;
-		uint8_t *temp = realloc(object->source_data, new_len);
-		if (temp == NULL)
-			return NSERROR_NOMEM;
+	llcache->stats.network_size += len;
+
+	/* Presize the source buffer when the expected length is known
+	 * and the object is not being streamed. Objects which would
+	 * not fit in the cache are left to grow in chunks.
+	 */
+	if ((object->source_data == NULL) &&
+	    (object->source_buffer == NULL) &&
+	    (object->source_chunks == NULL) &&
+	    (object->source_expected_len > 0) &&
+	    (object->source_expected_len <= llcache->limit) &&
+	    ((object->fetch.flags & LLCACHE_RETRIEVE_STREAM_DATA) == 0)) {
+		object->source_data = malloc(object->source_expected_len);
+		if (object->source_data != NULL) {
+			object->source_alloc = object->source_expected_len;
+		}
+	}
 
-		object->source_data = temp;
-		object->source_alloc = new_len;
+	/* Append to the contiguous buffer while it has space */
+	if ((object->source_chunks == NULL) &&
+	    (object->source_len + len <= object->source_alloc)) {
+		memcpy(object->source_data + object->source_len, data, len);
+		object->source_len += len;
+
+		return NSERROR_OK;
 	}
 
-	/* Append this data chunk to source buffer */
-	memcpy(object->source_data + object->source_len, data, len);
-	object->source_len += len;
+	/* Append the data to the source chunks */
+	while (len > 0) {
+		llcache_chunk *chunk = object->source_chunks_tail;
+		size_t space;
+
+		if ((chunk != NULL) &&
+		    (chunk->len == LLCACHE_CHUNK_SIZE) &&
+		    (chunk->next != NULL)) {
+			/* reuse an emptied chunk */
+			chunk = chunk->next;
+			object->source_chunks_tail = chunk;
+		} else if ((chunk == NULL) ||
+			   (chunk->len == LLCACHE_CHUNK_SIZE)) {
+			chunk = malloc(sizeof(llcache_chunk));
+			if (chunk == NULL) {
+				return NSERROR_NOMEM;
+			}
+			chunk->next = NULL;
+			chunk->len = 0;
+
+			if (object->source_chunks_tail == NULL) {
+				object->source_chunks = chunk;
+			} else {
+				object->source_chunks_tail->next = chunk;
+			}
+			object->source_chunks_tail = chunk;
+		}
+
+		space = LLCACHE_CHUNK_SIZE - chunk->len;
+		if (space > len) {
+			space = len;
+		}
+
+		memcpy(chunk->data + chunk->len, data, space);
+		chunk->len += space;
+		object->source_chunked_len += space;
+		object->source_len += space;
+
+		data += space;
+		len -= space;
+	}
 
 	return NSERROR_OK;
 }
@@ -2487,12 +4201,18 @@ static nserror llcache_fetch_ssl_error(llcache_object *object)
 /**
  * Construct a sorted list of objects available for writeout operation.
  *
- * The list contains fresh cacheable objects held in RAM with no
- * pending fetches. Any objects with a remaining lifetime less than
- * the configured minimum lifetime are simply not considered, they will
- * become stale before pushing to backing store is worth the cost.
+ * The list is taken, highest score first, from the persistence queue
+ * of fresh cacheable objects held in RAM. Objects whose score has
+ * decayed since they were queued are rescored and repositioned
+ * before being considered. Any objects with a remaining lifetime less
+ * than the configured minimum lifetime are removed from the queue,
+ * they will become stale before pushing to backing store is worth
+ * the cost.
+ *
+ * Objects with pending fetches are returned to the queue to be
+ * considered on a subsequent run.
  *
- * \todo calculate useful cost metrics to improve sorting.
+ * The returned objects are removed from the persistence queue.
  *
  * \param[out] lst_out list of candidate objects.
  * \param[out] lst_len_out Number of candidate objects in result.
@@ -2502,37 +4222,66 @@ static nserror llcache_fetch_ssl_error(llcache_object *object)
 static nserror
 build_candidate_list(struct llcache_object ***lst_out, int *lst_len_out)
 {
-	llcache_object *object, *next;
+	llcache_object *object;
 	struct llcache_object **lst;
 	int lst_len = 0;
-	int remaining_lifetime;
+	int deferred = 0;
+	uint64_t score;
 
 #define MAX_PERSIST_PER_RUN 128
 
+	if (llcache->persist_queue_len == 0) {
+		return NSERROR_NOT_FOUND;
+	}
+
 	lst = calloc(MAX_PERSIST_PER_RUN, sizeof(struct llcache_object *));
 	if (lst == NULL) {
 		return NSERROR_NOMEM;
 	}
 
-	for (object = llcache->cached_objects; object != NULL; object = next) {
-		next = object->next;
+	/* candidates fill the list from the start and deferred
+	 * objects from the end.
+	 */
+	while ((llcache->persist_queue_len > 0) &&
+	       ((lst_len + deferred) < MAX_PERSIST_PER_RUN)) {
+		object = llcache->persist_queue[0];
 
-		remaining_lifetime = llcache_object_rfc2616_remaining_lifetime(
-				&object->cache);
+		score = llcache_persist_score(object);
+		if (score == 0) {
+			llcache_persist_queue_remove(object);
+			continue;
+		}
 
-		/* cacehable objects with no pending fetches, not
-		 * already on disc and with sufficient lifetime to
-		 * make disc cache worthwhile
-		 */
-		if ((object->candidate_count == 0) &&
-		    (object->fetch.fetch == NULL) &&
-		    (object->fetch.outstanding_query == false) &&
-		    (object->store_state == LLCACHE_STATE_RAM) &&
-		    (remaining_lifetime > llcache->minimum_lifetime)) {
+		if (score < object->persist_score) {
+			/* score has decayed, reposition object */
+			object->persist_score = score;
+			llcache_persist_queue_sift(0);
+			if (llcache->persist_queue[0] != object) {
+				continue;
+			}
+		}
+
+		llcache_persist_queue_remove(object);
+
+		if ((object->candidate_count != 0) ||
+		    (object->fetch.fetch != NULL) ||
+		    (object->fetch.outstanding_query != false)) {
+			deferred++;
+			lst[MAX_PERSIST_PER_RUN - deferred] = object;
+		} else {
 			lst[lst_len] = object;
 			lst_len++;
-			if (lst_len == MAX_PERSIST_PER_RUN)
-				break;
+		}
+	}
+
+	/* return deferred objects to the queue */
+	while (deferred > 0) {
+		object = lst[MAX_PERSIST_PER_RUN - deferred];
+		lst[MAX_PERSIST_PER_RUN - deferred] = NULL;
+		deferred--;
+		if (llcache_persist_queue_insert(object) != NSERROR_OK) {
+			NSLOG(llcache, INFO,
+			      "Unable to requeue %p for persistence", object);
 		}
 	}
 
@@ -2541,8 +4290,6 @@ build_candidate_list(struct llcache_object ***lst_out, int *lst_len_out)
 		return NSERROR_NOT_FOUND;
 	}
 
-	/** \todo sort list here */
-
 	*lst_len_out = lst_len;
 	*lst_out = lst;
 
@@ -2551,6 +4298,57 @@ build_candidate_list(struct llcache_object ***lst_out, int *lst_len_out)
 	return NSERROR_OK;
 }
 
+/**
+ * Determine if an object's source data is already compressed.
+ *
+ * Compressing the data again in the backing store would gain little
+ * so such objects are stored as is.
+ *
+ * \param object The object to examine.
+ * \return true if the content type is a compressed format else false.
+ */
+static bool llcache_object_source_compressed(const llcache_object *object)
+{
+	static const char *compressed_types[] = {
+		"audio/",
+		"video/",
+		"font/woff",
+		"application/font-woff",
+		"application/gzip",
+		"application/x-gzip",
+		"application/zip",
+	};
+	const char *type = NULL;
+	size_t tloop;
+
+	for (tloop = 0; tloop < object->num_headers; tloop++) {
+		if (strcasecmp(object->headers[tloop].name,
+			       "Content-Type") == 0) {
+			type = object->headers[tloop].value;
+			break;
+		}
+	}
+	if (type == NULL) {
+		return false;
+	}
+
+	/* images other than svg are compressed formats */
+	if (strncasecmp(type, "image/", SLEN("image/")) == 0) {
+		return (strncasecmp(type, "image/svg", SLEN("image/svg")) != 0);
+	}
+
+	for (tloop = 0;
+	     tloop < sizeof(compressed_types) / sizeof(compressed_types[0]);
+	     tloop++) {
+		if (strncasecmp(type, compressed_types[tloop],
+				strlen(compressed_types[tloop])) == 0) {
+			return true;
+		}
+	}
+
+	return false;
+}
+
 /**
  * Write an object to the backing store.
  *
@@ -2572,9 +4370,16 @@ write_backing_store(struct llcache_object *object,
 
 	nsu_getmonotonic_ms(&startms);
 
+	/* the backing store requires contiguous data */
+	ret = llcache_object_flatten(object);
+	if (ret != NSERROR_OK) {
+		return ret;
+	}
+
 	/* put object data in backing store */
 	ret = guit->llcache->store(object->url,
-				   BACKING_STORE_NONE,
+				   llcache_object_source_compressed(object) ?
+				   BACKING_STORE_COMPRESSED : BACKING_STORE_NONE,
 				   object->source_data,
 				   object->source_len);
 	if (ret != NSERROR_OK) {
@@ -2595,18 +4400,25 @@ write_backing_store(struct llcache_object *object,
 				   BACKING_STORE_META,
 				   metadata,
 				   metadatasize);
-	guit->llcache->release(object->url, BACKING_STORE_META);
 	if (ret != NSERROR_OK) {
 		/* There has been an error putting the metadata in the
-		 * backing store. Ensure the data object is invalidated.
+		 * backing store, which leaves the metadata with us.
+		 * Ensure the data object is invalidated.
 		 */
+		free(metadata);
 		guit->llcache->invalidate(object->url);
 		return ret;
 	}
+	guit->llcache->release(object->url, BACKING_STORE_META);
 	nsu_getmonotonic_ms(&endms);
 
 	object->store_state = LLCACHE_STATE_DISC;
 
+	/* the backing store now owns any shared source data */
+	if (object->source_buffer != NULL) {
+		object->source_buffer->url = nsurl_ref(object->url);
+	}
+
 	*written_out = object->source_len + metadatasize;
 
 	/* by ignoring the overflow this assumes the writeout took
@@ -2665,7 +4477,9 @@ static void llcache_persist(void *p)
 	struct llcache_object **lst; /* candidate object list */
 	int lst_count; /* number of candidates in list */
 	int idx; /* current candidate object index in list */
+	int rdx; /* unwritten candidate object index in list */
 	int next = -1; /* when the next run should be scheduled for */
+	bool store_ready = true; /* backing store accepted writes */
 
 	unsigned long write_limit; /* max number of bytes to write in this run*/
 
@@ -2676,6 +4490,10 @@ static void llcache_persist(void *p)
 	unsigned long total_elapsed = 1; /* total ms used to write bytes */
 	unsigned long total_bandwidth = 0; /* total bandwidth */
 
+	if (llcache->store_readonly) {
+		return;
+	}
+
 	ret = build_candidate_list(&lst, &lst_count);
 	if (ret != NSERROR_OK) {
 		NSLOG(llcache, DEBUG, "Unable to construct candidate list for persistent writeout");
@@ -2687,7 +4505,27 @@ static void llcache_persist(void *p)
 	/* obtained a candidate list, make each object persistent in turn */
 	for (idx = 0; idx < lst_count; idx++) {
 		ret = write_backing_store(lst[idx], &written, &elapsed);
+		if (ret == NSERROR_PERMISSION) {
+			/* the store will never accept writes so the
+			 * candidates are dropped and writeout stops.
+			 */
+			NSLOG(llcache, INFO,
+			      "Backing store is read only, not persisting");
+			llcache->store_readonly = true;
+			llcache_persist_queue_clear();
+			free(lst);
+			return;
+		}
 		if (ret != NSERROR_OK) {
+			/* the object remains a candidate for a later run */
+			if (llcache_persist_queue_insert(lst[idx]) != NSERROR_OK) {
+				NSLOG(llcache, INFO,
+				      "Unable to requeue %p for persistence",
+				      lst[idx]);
+			}
+			if (ret == NSERROR_INIT_FAILED) {
+				store_ready = false;
+			}
 			continue;
 		}
 
@@ -2749,6 +4587,15 @@ static void llcache_persist(void *p)
 		}
 
 	}
+
+	/* return candidates which were not attempted to the queue */
+	for (rdx = idx + 1; rdx < lst_count; rdx++) {
+		if (llcache_persist_queue_insert(lst[rdx]) != NSERROR_OK) {
+			NSLOG(llcache, INFO,
+			      "Unable to requeue %p for persistence",
+			      lst[rdx]);
+		}
+	}
 	free(lst);
 
 	/* Completed list without running out of allowed bytes or time */
@@ -2756,6 +4603,9 @@ static void llcache_persist(void *p)
 		/* only reschedule if writing is making any progress at all */
 		if (total_written > 0) {
 			next = llcache->time_quantum - total_elapsed;
+		} else if (store_ready == false) {
+			/* retry once the backing store is ready */
+			next = llcache->time_quantum;
 		} else {
 			next = -1;
 		}
@@ -2825,18 +4675,46 @@ static void llcache_fetch_callback(const fetch_msg *msg, void *p)
 	case FETCH_FINISHED:
 		/* Finished fetching */
 	{
-		uint8_t *temp;
+		uint64_t wire_size;
+		uint64_t decoded_size;
+
+		/* account the body as transferred by the fetcher */
+		fetch_transfer_size(object->fetch.fetch,
+				    &wire_size,
+				    &decoded_size);
+		llcache->stats.wire_size += wire_size;
+		llcache->stats.decoded_size += decoded_size;
 
 		object->fetch.state = LLCACHE_FETCH_COMPLETE;
 		object->fetch.fetch = NULL;
 
-		/* Shrink source buffer to required size */
-		temp = realloc(object->source_data,
-				object->source_len);
-		/* If source_len is 0, then temp may be NULL */
-		if (temp != NULL || object->source_len == 0) {
-			object->source_data = temp;
-			object->source_alloc = object->source_len;
+		/* a completed revalidation supersedes the stale object */
+		object->revalidating = false;
+
+		/* Data received in chunks is left there until a
+		 * contiguous view of it is required.
+		 */
+
+		/* Shrink a presized buffer if less data arrived */
+		if ((object->source_chunks == NULL) &&
+		    (object->source_alloc > object->source_len)) {
+			uint8_t *temp = realloc(object->source_data,
+						object->source_len);
+			/* If source_len is 0, then temp may be NULL */
+			if (temp != NULL || object->source_len == 0) {
+				object->source_data = temp;
+				object->source_alloc = object->source_len;
+			}
+		}
+
+		if ((object->source_expected_len != 0) &&
+		    (object->source_expected_len != object->source_len)) {
+			NSLOG(llcache, DEBUG,
+			      "Length mismatch for %p expected %"PRIsizet" got %"PRIsizet,
+			      object,
+			      object->source_expected_len,
+			      object->source_len);
+			llcache->length_mismatch_count++;
 		}
 
 		llcache_object_cache_update(object);
@@ -2867,6 +4745,12 @@ static void llcache_fetch_callback(const fetch_msg *msg, void *p)
 		object->fetch.state = LLCACHE_FETCH_COMPLETE;
 		object->fetch.fetch = NULL;
 
+		/* Serve a stale candidate instead, if permitted */
+		if (llcache_fetch_stale_if_error(object)) {
+			llcache_invalidate_cache_control_data(object);
+			break;
+		}
+
 		/* Release candidate, if any */
 		if (object->candidate != NULL) {
 			object->candidate->candidate_count--;
@@ -3034,6 +4918,13 @@ static nserror llcache_object_notify_users(llcache_object *object)
 	 * DONE	      : on transition from DATA -> COMPLETE state
 	 */
 
+	if (object->source_pending == true) {
+		/* users are brought up to date once the source data
+		 * has been retrieved from the persistent store.
+		 */
+		return NSERROR_OK;
+	}
+
 	for (user = object->users; user != NULL; user = next_user) {
 		/* Emit necessary events to bring the user up-to-date */
 		llcache_handle *handle = user->handle;
@@ -3132,12 +5023,31 @@ static nserror llcache_object_notify_users(llcache_object *object)
 				object->source_len > handle->bytes) {
 			size_t orig_handle_read;
 
-			/* Construct HAD_DATA event */
+			/* Streamed data is discarded from the start as
+			 * it is emitted, contiguous data only precedes
+			 * chunks if a contiguous view was requested.
+			 */
+			if ((object->fetch.flags &
+					LLCACHE_RETRIEVE_STREAM_DATA) &&
+			    (object->source_chunks != NULL) &&
+			    (object->source_len >
+					object->source_chunked_len)) {
+				error = llcache_object_flatten(object);
+				if (error != NSERROR_OK) {
+					user->iterator_target = false;
+					return error;
+				}
+			}
+
+			/* Construct HAD_DATA event from the
+			 * contiguous span following the last byte
+			 * emitted
+			 */
 			event.type = LLCACHE_EVENT_HAD_DATA;
-			event.data.data.buf =
-					object->source_data + handle->bytes;
-			event.data.data.len =
-					object->source_len - handle->bytes;
+			event.data.data.buf = llcache_object_source_span(
+					object,
+					handle->bytes,
+					&event.data.data.len);
 
 			/* Update record of last byte emitted */
 			if (object->fetch.flags &
@@ -3147,10 +5057,26 @@ static nserror llcache_object_notify_users(llcache_object *object)
 				 * Additionally, we don't support replay
 				 * when streaming. */
 				orig_handle_read = 0;
-				handle->bytes = object->source_len = 0;
+				handle->bytes = 0;
+				llcache_object_source_discard(object,
+						event.data.data.len);
+
+				/* remaining spans are emitted on
+				 * subsequent catch up passes
+				 */
+				if (object->source_len > 0) {
+					llcache_users_not_caught_up();
+				}
 			} else {
 				orig_handle_read = handle->bytes;
-				handle->bytes = object->source_len;
+				handle->bytes += event.data.data.len;
+
+				/* remaining spans are emitted on
+				 * subsequent catch up passes
+				 */
+				if (handle->bytes < object->source_len) {
+					llcache_users_not_caught_up();
+				}
 			}
 
 			/* Emit event */
@@ -3243,21 +5169,26 @@ llcache_object_snapshot(llcache_object *object,	llcache_object **snapshot)
 	llcache_object *newobj;
 	nserror error;
 
+	error = llcache_object_flatten(object);
+	if (error != NSERROR_OK)
+		return error;
+
 	error = llcache_object_new(object->url, &newobj);
 
 	if (error != NSERROR_OK)
 		return error;
 
-	newobj->source_alloc = newobj->source_len = object->source_len;
-
 	if (object->source_len > 0) {
-		newobj->source_data = malloc(newobj->source_alloc);
-		if (newobj->source_data == NULL) {
+		/* share the source data rather than copying it */
+		error = llcache_object_share_source(object,
+						    &newobj->source_buffer);
+		if (error != NSERROR_OK) {
 			llcache_object_destroy(newobj);
-			return NSERROR_NOMEM;
+			return error;
 		}
-		memcpy(newobj->source_data, object->source_data,
-				newobj->source_len);
+		newobj->source_data = newobj->source_buffer->data;
+		newobj->source_alloc = newobj->source_len =
+			newobj->source_buffer->len;
 	}
 
 	if (object->num_headers > 0) {
@@ -3304,7 +5235,8 @@ total_object_size(llcache_object *object)
 	tot = sizeof(*object);
 	tot += nsurl_length(object->url);
 
-	if (object->source_data != NULL) {
+	if ((object->source_data != NULL) ||
+	    (object->source_chunks != NULL)) {
 		tot += object->source_len;
 	}
 
@@ -3322,6 +5254,146 @@ total_object_size(llcache_object *object)
 	return tot;
 }
 
+/**
+ * Scale of the GDSF frequency per byte term.
+ *
+ * Use counts are shifted left by this amount before division by the
+ * object size so small differences in value are not lost.
+ */
+#define LLCACHE_GDSF_SHIFT 24
+
+/**
+ * Compute the eviction ordering key of an object.
+ *
+ * Objects with lower keys are less valuable and evicted first.
+ *
+ * \param object The object to compute the key for.
+ * \return The eviction key.
+ */
+static uint64_t llcache_object_evict_key(llcache_object *object)
+{
+	uint64_t key;
+
+	switch (llcache->eviction_policy) {
+	case LLCACHE_EVICT_LFU:
+		/* use count with least recent use breaking ties */
+		key = ((uint64_t)object->hit_count << 32) |
+			(uint32_t)object->last_used;
+		break;
+
+	case LLCACHE_EVICT_GDSF:
+		key = object->gdsf_base +
+			(((uint64_t)object->hit_count << LLCACHE_GDSF_SHIFT) /
+			 total_object_size(object));
+		break;
+
+	case LLCACHE_EVICT_LRU:
+	default:
+		key = (uint64_t)object->last_used;
+		break;
+	}
+
+	return key;
+}
+
+/**
+ * Merge two eviction ordered object lists.
+ *
+ * \param a First list, terminated by a NULL next pointer.
+ * \param b Second list, terminated by a NULL next pointer.
+ * \return The head of the merged list. Only next pointers are valid.
+ */
+static llcache_object *
+llcache_evict_merge(llcache_object *a, llcache_object *b)
+{
+	llcache_object *head = NULL;
+	llcache_object **tail = &head;
+
+	while ((a != NULL) && (b != NULL)) {
+		if (b->evict_key < a->evict_key) {
+			*tail = b;
+			b = b->next;
+		} else {
+			*tail = a;
+			a = a->next;
+		}
+		tail = &(*tail)->next;
+	}
+	*tail = (a != NULL) ? a : b;
+
+	return head;
+}
+
+/**
+ * Sort the cached object list into eviction order.
+ *
+ * The list is reordered in place, least valuable object first,
+ * according to the configured eviction policy. A bottom up merge
+ * sort is used so no allocation is required and the sort is stable.
+ */
+static void llcache_sort_for_eviction(void)
+{
+	/* enough bins for 2^32 objects */
+	llcache_object *bins[32];
+	llcache_object *object, *next, *run, *prev;
+	unsigned int bin;
+	unsigned int maxbin = 0;
+
+	for (object = llcache->cached_objects;
+	     object != NULL;
+	     object = object->next) {
+		object->evict_key = llcache_object_evict_key(object);
+	}
+
+	memset(bins, 0, sizeof(bins));
+
+	for (object = llcache->cached_objects; object != NULL; object = next) {
+		next = object->next;
+		object->next = NULL;
+
+		run = object;
+		for (bin = 0; (bin < 31) && (bins[bin] != NULL); bin++) {
+			run = llcache_evict_merge(bins[bin], run);
+			bins[bin] = NULL;
+		}
+		if (bins[bin] != NULL) {
+			run = llcache_evict_merge(bins[bin], run);
+		}
+		bins[bin] = run;
+		if (bin > maxbin) {
+			maxbin = bin;
+		}
+	}
+
+	run = NULL;
+	for (bin = 0; bin <= maxbin; bin++) {
+		run = llcache_evict_merge(bins[bin], run);
+	}
+
+	/* restore the back links */
+	prev = NULL;
+	for (object = run; object != NULL; object = object->next) {
+		object->prev = prev;
+		prev = object;
+	}
+
+	llcache->cached_objects = run;
+	llcache->entry_cursor = NULL;
+}
+
+/**
+ * Account for the eviction of an object in the policy state.
+ *
+ * \param object The object being evicted.
+ */
+static inline void llcache_object_evicted(llcache_object *object)
+{
+	if ((llcache->eviction_policy == LLCACHE_EVICT_GDSF) &&
+	    (object->evict_key > llcache->gdsf_inflation)) {
+		llcache->gdsf_inflation = object->evict_key;
+	}
+}
+
 /******************************************************************************
  * Public API								      *
  ******************************************************************************/
@@ -3385,6 +5457,7 @@ void llcache_clean(bool purge)
 		    (object->candidate_count == 0) &&
 		    (object->fetch.fetch == NULL) &&
 		    (object->fetch.outstanding_query == false) &&
+		    (object->source_pending == false) &&
 		    (remaining_lifetime <= 0)) {
 			/* object is stale */
 			NSLOG(llcache, DEBUG, "discarding stale cacheable object with no "
@@ -3412,6 +5485,11 @@ void llcache_clean(bool purge)
 	 */
 	if (limit < llcache_size) {
 		llcache_persist(NULL);
+
+		/* order the remaining objects so the least valuable
+		 * are released first
+		 */
+		llcache_sort_for_eviction();
 	}
 
 	/* Source data of fresh cacheable objects with no users, no
@@ -3426,10 +5504,9 @@ void llcache_clean(bool purge)
 		    (object->candidate_count == 0) &&
 		    (object->fetch.fetch == NULL) &&
 		    (object->fetch.outstanding_query == false) &&
+		    (object->source_pending == false) &&
 		    (object->store_state == LLCACHE_STATE_DISC)) {
-			guit->llcache->release(object->url, BACKING_STORE_NONE);
-
-			object->source_data = NULL;
+			llcache_object_release_source(object);
 
 			llcache_size -=	object->source_len;
 
@@ -3451,6 +5528,7 @@ void llcache_clean(bool purge)
 		    (object->candidate_count == 0) &&
 		    (object->fetch.fetch == NULL) &&
 		    (object->fetch.outstanding_query == false) &&
+		    (object->source_pending == false) &&
 		    (object->store_state == LLCACHE_STATE_DISC) &&
 		    (object->source_data == NULL)) {
 			NSLOG(llcache, DEBUG,
@@ -3462,6 +5540,7 @@ void llcache_clean(bool purge)
 
 			llcache_size -=	total_object_size(object);
 
+			llcache_object_evicted(object);
 			llcache_object_remove_from_list(object,
 						&llcache->cached_objects);
 			llcache_object_destroy(object);
@@ -3493,6 +5572,7 @@ void llcache_clean(bool purge)
 
 			llcache_size -=	object->source_len + sizeof(*object);
 
+			llcache_object_evicted(object);
 			llcache_object_remove_from_list(object,
 						&llcache->cached_objects);
 			llcache_object_destroy(object);
@@ -3520,10 +5600,19 @@ llcache_initialise(const struct llcache_parameters *prm)
 	llcache->time_quantum = prm->time_quantum;
 	llcache->fetch_attempts = prm->fetch_attempts;
 	llcache->all_caught_up = true;
+	llcache->eviction_policy = prm->eviction_policy;
+
+	if ((llcache_index_init(&llcache->cached_index) != NSERROR_OK) ||
+	    (llcache_index_init(&llcache->uncached_index) != NSERROR_OK)) {
+		llcache_index_fini(&llcache->cached_index);
+		free(llcache);
+		llcache = NULL;
+		return NSERROR_NOMEM;
+	}
 
 	NSLOG(llcache, INFO,
-	      "llcache initialising with a limit of %d bytes",
-	      llcache->limit);
+	      "llcache initialising with a limit of %d bytes and eviction policy %d",
+	      llcache->limit, llcache->eviction_policy);
 
 	/* backing store initialisation */
 	return guit->llcache->initialise(&prm->store);
@@ -3592,6 +5681,14 @@ void llcache_finalise(void)
 	      llcache->total_elapsed,
 	      total_bandwidth);
 
+	NSLOG(llcache, INFO,
+	      "Content-Length mismatched received data %"PRIu32" times",
+	      llcache->length_mismatch_count);
+
+	llcache_index_fini(&llcache->cached_index);
+	llcache_index_fini(&llcache->uncached_index);
+	free(llcache->persist_queue);
+
 	free(llcache);
 	llcache = NULL;
 }
@@ -3680,6 +5777,9 @@ nserror llcache_handle_retrieve(nsurl *url, uint32_t flags,
 	/* Add user to object */
 	llcache_object_add_user(object, user);
 
+	/* A shared object is fetched with the most urgent priority */
+	llcache_object_set_priority(object, flags);
+
 	*result = user->handle;
 
 	/* Users exist which are now not caught up! */
@@ -3826,6 +5926,14 @@ nserror llcache_handle_force_stream(llcache_handle *handle)
 	return NSERROR_OK;
 }
 
+/* See llcache.h for documentation */
+nserror llcache_handle_set_priority(llcache_handle *handle, uint32_t priority)
+{
+	llcache_object_set_priority(handle->object, priority);
+
+	return NSERROR_OK;
+}
+
 /* See llcache.h for documentation */
 nserror llcache_handle_invalidate_cache_data(llcache_handle *handle)
 {
@@ -3846,12 +5954,75 @@ nsurl *llcache_handle_get_url(const llcache_handle *handle)
 }
 
 /* See llcache.h for documentation */
-const uint8_t *llcache_handle_get_source_data(const llcache_handle *handle,
+const uint8_t *llcache_handle_get_source_data(llcache_handle *handle,
+		size_t *size)
+{
+	if (handle->object == NULL) {
+		*size = 0;
+		return NULL;
+	}
+
+	/* provide a contiguous view of the source data */
+	if (llcache_object_flatten(handle->object) != NSERROR_OK) {
+		*size = 0;
+		return NULL;
+	}
+
+	*size = handle->object->source_len;
+
+	return handle->object->source_data;
+}
+
+/* See llcache.h for documentation */
+nserror llcache_handle_get_source_buffer(llcache_handle *handle,
+		llcache_buffer **buffer)
+{
+	nserror error;
+
+	if (handle->object == NULL) {
+		return NSERROR_BAD_PARAMETER;
+	}
+
+	/* the shared data must be contiguous */
+	error = llcache_object_flatten(handle->object);
+	if (error != NSERROR_OK) {
+		return error;
+	}
+
+	return llcache_object_share_source(handle->object, buffer);
+}
+
+/* See llcache.h for documentation */
+const uint8_t *llcache_buffer_get_data(const llcache_buffer *buffer,
 		size_t *size)
 {
-	*size = handle->object != NULL ? handle->object->source_len : 0;
+	*size = buffer->len;
+
+	return buffer->data;
+}
+
+/* See llcache.h for documentation */
+llcache_buffer *llcache_buffer_ref(llcache_buffer *buffer)
+{
+	buffer->refcnt++;
+
+	return buffer;
+}
+
+/* See llcache.h for documentation */
+void llcache_buffer_unref(llcache_buffer *buffer)
+{
+	if (--buffer->refcnt > 0) {
+		return;
+	}
 
-	return handle->object != NULL ? handle->object->source_data : NULL;
+	if (buffer->url != NULL) {
+		guit->llcache->release(buffer->url, BACKING_STORE_NONE);
+		nsurl_unref(buffer->url);
+	} else {
+		free(buffer->data);
+	}
+	free(buffer);
 }
 
 /* See llcache.h for documentation */
@@ -3879,3 +6050,292 @@ bool llcache_handle_references_same_object(const llcache_handle *a,
 {
 	return a->object == b->object;
 }
+
+/**
+ * Find the nth object in the cache
+ *
+ * Cached objects are enumerated before uncached objects. The search
+ * continues from the previously found entry where possible so
+ * enumerating every entry in order walks the lists only once.
+ *
+ * \param entryn The entry number to find.
+ * \param cached_out Updated with whether the object is in the cached list.
+ * \return The object or NULL if there is no such entry.
+ */
+static llcache_object *
+llcache_object_findn(unsigned int entryn, bool *cached_out)
+{
+	llcache_object *object;
+	unsigned int count;
+	bool cached;
+
+	if ((llcache->entry_cursor != NULL) &&
+	    (entryn >= llcache->entry_cursor_n)) {
+		object = llcache->entry_cursor;
+		cached = llcache->entry_cursor_cached;
+		count = entryn - llcache->entry_cursor_n;
+	} else {
+		object = llcache->cached_objects;
+		cached = true;
+		count = entryn;
+	}
+
+	for (;;) {
+		if ((object == NULL) && cached) {
+			object = llcache->uncached_objects;
+			cached = false;
+			continue;
+		}
+		if ((object == NULL) || (count == 0)) {
+			break;
+		}
+		object = object->next;
+		count--;
+	}
+
+	if (object != NULL) {
+		llcache->entry_cursor = object;
+		llcache->entry_cursor_n = entryn;
+		llcache->entry_cursor_cached = cached;
+	}
+
+	*cached_out = cached;
+	return object;
+}
+
+/* See llcache.h for documentation */
+int llcache_snsummaryf(char *string, size_t size, const char *fmt)
+{
+	size_t slen = 0; /* current output string length */
+	int fmtc = 0; /* current index into format string */
+	bool pct;
+	const struct llcache_stats *stats;
+	llcache_object *object;
+	unsigned int op_count;
+	uint64_t op_size;
+	uint64_t cache_size = 0;
+	uint64_t bandwidth = 0;
+	struct llcache_store_stats store_stats = { 0 };
+
+	if (llcache == NULL) {
+		return -1;
+	}
+
+	if (guit->llcache->stats != NULL) {
+		(void) guit->llcache->stats(&store_stats);
+	}
+
+	stats = &llcache->stats;
+
+	op_count = stats->ram_hit_count +
+		stats->disc_hit_count +
+		stats->stale_count +
+		stats->validate_count +
+		stats->miss_count +
+		stats->uncached_count;
+
+	op_size = stats->ram_size + stats->disc_size + stats->network_size;
+
+	for (object = llcache->cached_objects;
+	     object != NULL;
+	     object = object->next) {
+		cache_size += total_object_size(object);
+	}
+	for (object = llcache->uncached_objects;
+	     object != NULL;
+	     object = object->next) {
+		cache_size += total_object_size(object);
+	}
+
+	if (llcache->total_elapsed > 0) {
+		bandwidth = (llcache->total_written * 1000) /
+			llcache->total_elapsed;
+	}
+
+	while((slen < size) && (fmt[fmtc] != 0)) {
+		if (fmt[fmtc] == '%') {
+			fmtc++;
+
+			/* check for percentage modifier */
+			if (fmt[fmtc] == 'p') {
+				fmtc++;
+				pct = true;
+			} else {
+				pct = false;
+			}
+
+#define FMTCHR(chr,fmt,var) case chr : \
+slen += snprintf(string + slen, size - slen, "%"fmt, var); break
+
+#define FMTPCHR(chr,fmt,var,div) \
+case chr :					\
+	if (pct) {							\
+		if (div > 0) {						\
+			slen += snprintf(string + slen, size - slen, "%"PRIu64, (uint64_t)((var * 100) / div)); \
+		} else {						\
+			slen += snprintf(string + slen, size - slen, "100"); \
+		}							\
+	} else {							\
+		slen += snprintf(string + slen, size - slen, "%"fmt, var); \
+	} break
+
+
+			switch (fmt[fmtc]) {
+			case '%':
+				string[slen] = '%';
+				slen++;
+				break;
+
+			FMTCHR('a', PRIu32, llcache->limit);
+			FMTCHR('b', PRIu64, cache_size);
+			FMTCHR('c', PRIu32, llcache->cached_index.count);
+			FMTCHR('d', PRIu32, llcache->uncached_index.count);
+			FMTCHR('e', PRIu32, llcache->length_mismatch_count);
+			FMTCHR('f', PRIu32, stats->collision_count);
+			FMTCHR('g', PRIu64, store_stats.probe_count);
+			FMTCHR('h', PRIu64, stats->wire_size);
+			FMTCHR('i', PRIu64, stats->decoded_size);
+
+			case 'j':
+				slen += snprintf(string + slen, size - slen,
+						 "%u", pct?100:op_count);
+				break;
+
+			FMTPCHR('k', PRIu32, stats->ram_hit_count, op_count);
+			FMTPCHR('l', PRIu32, stats->disc_hit_count, op_count);
+			FMTPCHR('m', PRIu32, stats->stale_count, op_count);
+			FMTPCHR('n', PRIu32, stats->validate_count, op_count);
+			FMTPCHR('o', PRIu32, stats->miss_count, op_count);
+			FMTPCHR('q', PRIu32, stats->uncached_count, op_count);
+
+			FMTCHR('r', PRIu32, stats->conditional_count);
+			FMTPCHR('s', PRIu32, stats->notmodified_count,
+				stats->conditional_count);
+
+			case 't':
+				slen += snprintf(string + slen, size - slen,
+						 "%"PRIu64, pct?100:op_size);
+				break;
+
+			FMTPCHR('u', PRIu64, stats->ram_size, op_size);
+			FMTPCHR('v', PRIu64, stats->disc_size, op_size);
+			FMTPCHR('w', PRIu64, stats->network_size, op_size);
+
+			FMTCHR('x', PRIu64, llcache->total_written);
+			FMTCHR('y', PRIu64, llcache->total_elapsed);
+			FMTCHR('z', PRIu64, bandwidth);
+
+			}
+#undef FMTCHR
+#undef FMTPCHR
+
+			fmtc++;
+		} else {
+			string[slen] = fmt[fmtc];
+			slen++;
+			fmtc++;
+		}
+	}
+
+	/* Ensure that we NUL-terminate the output */
+	string[min(slen, size - 1)] = '\0';
+
+	return slen;
+}
+
+/* See llcache.h for documentation */
+int llcache_snentryf(char *string,
+		     size_t size,
+		     unsigned int entryn,
+		     const char *fmt)
+{
+	const llcache_object *object;
+	const llcache_object_user *user;
+	size_t slen = 0; /* current output string length */
+	int fmtc = 0; /* current index into format string */
+	int current_age, freshness_lifetime;
+	unsigned int user_count = 0;
+	bool cached;
+
+	if (llcache == NULL) {
+		return -1;
+	}
+
+	object = llcache_object_findn(entryn, &cached);
+	if (object == NULL) {
+		return -1;
+	}
+
+	for (user = object->users; user != NULL; user = user->next) {
+		user_count++;
+	}
+
+	llcache_object_rfc2616_age(&object->cache,
+				   &current_age,
+				   &freshness_lifetime);
+
+	while((slen < size) && (fmt[fmtc] != 0)) {
+		if (fmt[fmtc] == '%') {
+			fmtc++;
+			switch (fmt[fmtc]) {
+			case 'e':
+				slen += snprintf(string + slen, size - slen,
+						 "%u", entryn);
+				break;
+
+			case 'U':
+				slen += snprintf(string + slen, size - slen,
+						 "%s", nsurl_access(object->url));
+				break;
+
+			case 's':
+				slen += snprintf(string + slen, size - slen,
+						 "%" PRIsizet, object->source_len);
+				break;
+
+			case 'a':
+				slen += snprintf(string + slen, size - slen,
+						 "%d", current_age);
+				break;
+
+			case 'f':
+				slen += snprintf(string + slen, size - slen,
+						 "%d", llcache_object_rfc2616_remaining_lifetime(&object->cache));
+				break;
+
+			case 'd':
+				slen += snprintf(string + slen, size - slen,
+						 "%s",
+						 llcache_object_source_in_ram(object) ?
+						 "RAM" : "disc");
+				break;
+
+			case 'u':
+				slen += snprintf(string + slen, size - slen,
+						 "%u", user_count);
+				break;
+
+			case 'h':
+				slen += snprintf(string + slen, size - slen,
+						 "%" PRIu32, object->hit_count);
+				break;
+
+			case 'c':
+				slen += snprintf(string + slen, size - slen,
+						 "%s",
+						 cached ? "cached" : "uncached");
+				break;
+			}
+			fmtc++;
+		} else {
+			string[slen] = fmt[fmtc];
+			slen++;
+			fmtc++;
+		}
+	}
+
+	/* Ensure that we NUL-terminate the output */
+	string[min(slen, size - 1)] = '\0';
+
+	return slen;
+}
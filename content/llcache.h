@@ -36,6 +36,9 @@ struct fetch_multipart_data;
 /** Handle for low-level cache object */
 typedef struct llcache_handle llcache_handle;
 
+/** Reference counted immutable source data buffer */
+typedef struct llcache_buffer llcache_buffer;
+
 /** POST data object for low-level cache requests */
 typedef struct llcache_post_data {
 	enum {
@@ -99,9 +102,27 @@ enum llcache_retrieve_flag {
 	/**< No error pages */
 	LLCACHE_RETRIEVE_NO_ERROR_PAGES = (1 << 2),
 	/**< Stream data (implies that object is not cacheable) */
-	LLCACHE_RETRIEVE_STREAM_DATA    = (1 << 3)
+	LLCACHE_RETRIEVE_STREAM_DATA    = (1 << 3),
+	/* The fetch priority class; if none is set the fetch is normal
+	 * priority. Where several are set the most urgent applies.
+	 */
+	/** Top level document or frame */
+	LLCACHE_RETRIEVE_PRIORITY_DOCUMENT = (1 << 4),
+	/** Render blocking stylesheet or script */
+	LLCACHE_RETRIEVE_PRIORITY_BLOCKING = (1 << 5),
+	/** Object visible to the user */
+	LLCACHE_RETRIEVE_PRIORITY_VISIBLE  = (1 << 6),
+	/** Speculative or decorative fetch */
+	LLCACHE_RETRIEVE_PRIORITY_PREFETCH = (1 << 7)
 };
 
+/** All the fetch priority class retrieval flags */
+#define LLCACHE_RETRIEVE_PRIORITY_MASK			\
+	(LLCACHE_RETRIEVE_PRIORITY_DOCUMENT |		\
+	 LLCACHE_RETRIEVE_PRIORITY_BLOCKING |		\
+	 LLCACHE_RETRIEVE_PRIORITY_VISIBLE |		\
+	 LLCACHE_RETRIEVE_PRIORITY_PREFETCH)
+
 /** Low-level cache query types */
 typedef enum {
 	LLCACHE_QUERY_AUTH,		/**< Need authentication details */
@@ -183,24 +204,51 @@ struct llcache_store_parameters {
 	 * need some way to map url to cache entries so it is a
 	 * generally useful configuration value.
 	 *
-	 * Too small a value will cause unecessary collisions and
-	 * cache misses and larger values cause proportionaly larger
-	 * amounts of memory to be used.
-	 *
-	 * The "birthday paradox" means that the hash will experience
-	 * a collision in every 2^(address_size/2) urls the cache
-	 * stores.
+	 * The mapping is an open addressing table so must be larger
+	 * than the maximum number of entries, a smaller value is
+	 * increased to entry_size + 1. Larger values reduce the
+	 * length of lookup probe sequences and cause proportionaly
+	 * larger amounts of memory to be used. Collisions in the
+	 * mapping do not cause cache misses.
 	 *
-	 * A value of 20 means one object stored in every 1024 will
-	 * cause a collion and a cache miss while using two megabytes
-	 * of storage.
-	 *
-	 * If unset this defaults to 20 (1048576 entries using two
-	 * megabytes) The cache control file takes precedence so cache
+	 * If unset this defaults to 17 (131072 entries using 256
+	 * kilobytes) The cache control file takes precedence so cache
 	 * data remains portable between builds with differing
 	 * defaults.
 	 */
 	unsigned int address_size;
+
+	/** Compress objects placed in the backing store where it
+	 * reduces their size.
+	 */
+	bool compress;
+
+	/** Share the backing store with other processes.
+	 *
+	 * The first process to open a shared store is its writer,
+	 * others only read objects from it and follow the changes
+	 * made by the writer. A reader remains a reader until it is
+	 * restarted, even if the writer exits.
+	 */
+	bool shared;
+};
+
+/**
+ * Low level cache memory eviction policy.
+ *
+ * Selects the order in which unused objects are discarded when the
+ * RAM cache exceeds its configured limit.
+ */
+enum llcache_eviction_policy {
+	/** Discard least recently used objects first */
+	LLCACHE_EVICT_LRU = 0,
+	/** Discard least frequently used objects first */
+	LLCACHE_EVICT_LFU,
+	/** Greedy dual size frequency, discard objects with the
+	 * lowest use count per byte first, aged by an inflation
+	 * value.
+	 */
+	LLCACHE_EVICT_GDSF,
 };
 
 /**
@@ -233,6 +281,9 @@ struct llcache_parameters {
 	/** The number of fetches to attempt when timing out */
 	uint32_t fetch_attempts;
 
+	/** The order in which objects are evicted from RAM */
+	enum llcache_eviction_policy eviction_policy;
+
 	struct llcache_store_parameters store;
 };
 
@@ -322,6 +373,21 @@ nserror llcache_handle_abort(llcache_handle *handle);
  */
 nserror llcache_handle_force_stream(llcache_handle *handle);
 
+/**
+ * Raise the fetch priority of a low-level cache object
+ *
+ * The priority applies to the object so affects all its users. The
+ * object is fetched with the most urgent priority any of them has
+ * asked for, a less urgent priority leaves it unchanged. It is only
+ * of consequence while the object fetch is waiting to start.
+ *
+ * \param handle  Handle to the object
+ * \param priority  LLCACHE_RETRIEVE_PRIORITY_ flag of the priority class,
+ *                  or 0 for normal priority.
+ * \return NSERROR_OK on success, appropriate error otherwise
+ */
+nserror llcache_handle_set_priority(llcache_handle *handle, uint32_t priority);
+
 /**
  * Invalidate cache data for a low-level cache object
  *
@@ -341,13 +407,56 @@ nsurl *llcache_handle_get_url(const llcache_handle *handle);
 /**
  * Retrieve source data of a low-level cache object
  *
+ * Any source data held in chunks is first coalesced into a single
+ * contiguous block.
+ *
  * \param handle  Handle to retrieve source data from
  * \param size    Pointer to location to receive byte length of data
  * \return Pointer to source data
  */
-const uint8_t *llcache_handle_get_source_data(const llcache_handle *handle,
+const uint8_t *llcache_handle_get_source_data(llcache_handle *handle,
+		size_t *size);
+
+/**
+ * Retrieve a reference to the source data of a low-level cache object
+ *
+ * The returned buffer is immutable and remains valid, independent of
+ * the lifetime of the cache object, until the reference is released
+ * with llcache_buffer_unref(). The buffer contains the source data
+ * received when it was obtained.
+ *
+ * \param handle  Handle to retrieve source data from
+ * \param buffer  Pointer to location to receive buffer reference
+ * \return NSERROR_OK on success, appropriate error otherwise
+ */
+nserror llcache_handle_get_source_buffer(llcache_handle *handle,
+		llcache_buffer **buffer);
+
+/**
+ * Retrieve the data held in a source data buffer
+ *
+ * \param buffer  Buffer to retrieve data from
+ * \param size    Pointer to location to receive byte length of data
+ * \return Pointer to the data
+ */
+const uint8_t *llcache_buffer_get_data(const llcache_buffer *buffer,
 		size_t *size);
 
+/**
+ * Take an additional reference to a source data buffer
+ *
+ * \param buffer  Buffer to reference
+ * \return The referenced buffer
+ */
+llcache_buffer *llcache_buffer_ref(llcache_buffer *buffer);
+
+/**
+ * Release a reference to a source data buffer
+ *
+ * \param buffer  Buffer to release
+ */
+void llcache_buffer_unref(llcache_buffer *buffer);
+
 /**
  * Retrieve a header value associated with a low-level cache object
  *
@@ -374,4 +483,78 @@ const char *llcache_handle_get_header(const llcache_handle *handle,
 bool llcache_handle_references_same_object(const llcache_handle *a,
 		const llcache_handle *b);
 
+/**
+ * Fill a buffer with information about a cache entry using a format.
+ *
+ * Cached objects are enumerated before uncached ones.
+ *
+ * The format string is copied into the output buffer with the
+ * following replaced:
+ * %e - The entry number
+ * %U - The object URL
+ * %s - The size of the object source data
+ * %a - The current age of the object in seconds
+ * %f - The remaining freshness lifetime of the object in seconds
+ * %d - Where the source data is held, RAM or disc
+ * %u - The number of users of the object
+ * %h - The number of users ever added to the object
+ * %c - Whether the object is cached or uncached
+ *
+ * \param string  The buffer in which to place the results.
+ * \param size    The size of the string buffer.
+ * \param entryn  The opaque entry number.
+ * \param fmt     The format string.
+ * \return The number of bytes written to \a string or -1 on error
+ */
+int llcache_snentryf(char *string, size_t size, unsigned int entryn,
+		const char *fmt);
+
+/**
+ * Fill a buffer with information about the low level cache using a format.
+ *
+ * The format string is copied into the output buffer with the
+ * following replaced:
+ *
+ * a The configured RAM limit of the cache.
+ * b The current RAM usage of the cache.
+ * c The number of cached objects.
+ * d The number of uncached objects.
+ * e The number of fetches whose length differed from their
+ *     Content-Length.
+ * f The number of backing store retrievals which returned the object
+ *     of another URL with the same identifier.
+ * g The number of backing store index lookups which probed past the
+ *     identifier's home slot.
+ * h The body bytes fetchers received before content decoding.
+ * i The body bytes fetchers received after content decoding.
+ * j The total number of retrievals.
+ * k The number of retrievals satisfied by a fresh object in RAM.
+ * l The number of retrievals satisfied by a fresh object from the
+ *     backing store.
+ * m The number of retrievals satisfied by a stale object while it
+ *     was revalidated.
+ * n The number of retrievals which required validation.
+ * o The number of retrievals which were not in the cache.
+ * q The number of retrievals of objects which may not be cached.
+ * r The number of conditional requests made.
+ * s The number of conditional requests answered not modified.
+ * t The total source size of retrievals.
+ * u The source size of retrievals satisfied from RAM.
+ * v The source size of retrievals satisfied from the backing store.
+ * w The source size received from the network.
+ * x The total number of bytes written to the backing store.
+ * y The total time in ms taken to write to the backing store.
+ * z The average backing store write bandwidth in bytes per second.
+ *
+ * format modifiers:
+ * A p before the value modifies the replacement to be a percentage.
+ * Not modified responses are a percentage of conditional requests.
+ *
+ * \param string  The buffer in which to place the results.
+ * \param size    The size of the string buffer.
+ * \param fmt     The format string.
+ * \return The number of bytes written to \a string or -1 on error
+ */
+int llcache_snsummaryf(char *string, size_t size, const char *fmt);
+
 #endif
@@ -1223,7 +1223,9 @@ browser_window_update_favicon(hlcache_handle *c,
 		      lwc_string_data(link->rel), nsurl_access(nsurl));
 	}
 
-	hlcache_handle_retrieve(nsurl, HLCACHE_RETRIEVE_SNIFF_TYPE,
+	hlcache_handle_retrieve(nsurl,
+			HLCACHE_RETRIEVE_SNIFF_TYPE |
+			LLCACHE_RETRIEVE_PRIORITY_PREFETCH,
 			nsref, NULL, browser_window_favicon_callback,
 			bw, NULL, CONTENT_IMAGE, &bw->favicon.loading);
 
@@ -2154,7 +2156,8 @@ browser_window_navigate(struct browser_window *bw,
 	}
 
 	error = hlcache_handle_retrieve(url,
-			fetch_flags | HLCACHE_RETRIEVE_SNIFF_TYPE,
+			fetch_flags | HLCACHE_RETRIEVE_SNIFF_TYPE |
+			LLCACHE_RETRIEVE_PRIORITY_DOCUMENT,
 			referrer,
 			fetch_is_post ? &post : NULL,
 			browser_window_callback, bw,
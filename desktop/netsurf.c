@@ -368,6 +368,17 @@ nserror netsurf_init(const char *store_path)
 		      hlcache_parameters.llcache.limit);
 	} 
 
+	/* select memory cache eviction order */
+	if (nsoption_uint(memory_cache_policy) > LLCACHE_EVICT_GDSF) {
+		NSLOG(netsurf, WARNING,
+		      "Unknown memory cache policy %u, using LRU",
+		      nsoption_uint(memory_cache_policy));
+		hlcache_parameters.llcache.eviction_policy = LLCACHE_EVICT_LRU;
+	} else {
+		hlcache_parameters.llcache.eviction_policy =
+			nsoption_uint(memory_cache_policy);
+	}
+
 	/* Set up the max attempts made to fetch a timing out resource */
 	hlcache_parameters.llcache.fetch_attempts = nsoption_uint(max_retried_fetches);
 
@@ -389,6 +400,12 @@ nserror netsurf_init(const char *store_path)
 	/* set the path to the backing store */
 	hlcache_parameters.llcache.store.path = store_path;
 
+	/* compress objects in the backing store */
+	hlcache_parameters.llcache.store.compress = nsoption_bool(disc_cache_compress);
+
+	/* share the backing store with other processes */
+	hlcache_parameters.llcache.store.shared = nsoption_bool(disc_cache_shared);
+
 	/* image handler bitmap cache */
 	ret = image_cache_init(&image_cache_parameters);
 	if (ret != NSERROR_OK)
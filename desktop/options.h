@@ -88,15 +88,27 @@ NSOPTION_STRING(accept_language, NULL)
 /** Accept-Charset header. */
 NSOPTION_STRING(accept_charset, NULL)
 
+/** Accept-Encoding header, NULL accepts all supported content codings. */
+NSOPTION_STRING(accept_encoding, NULL)
+
 /** Preferred maximum size of memory cache / bytes. */
 NSOPTION_INTEGER(memory_cache_size, 12 * 1024 * 1024)
 
+/** Memory cache eviction policy. 0 = LRU, 1 = LFU, 2 = GDSF */
+NSOPTION_UINT(memory_cache_policy, 0)
+
 /** Preferred expiry size of disc cache / bytes. */
 NSOPTION_UINT(disc_cache_size, 1024 * 1024 * 1024)
 
 /** Preferred expiry age of disc cache / days. */
 NSOPTION_INTEGER(disc_cache_age, 28)
 
+/** Whether to compress objects in the disc cache */
+NSOPTION_BOOL(disc_cache_compress, true)
+
+/** Whether the disc cache is shared with other browser processes */
+NSOPTION_BOOL(disc_cache_shared, false)
+
 /** Whether to block advertisements */
 NSOPTION_BOOL(block_advertisements, false)
 
@@ -205,6 +217,17 @@ NSOPTION_INTEGER(max_fetchers, 24)
  */
 NSOPTION_INTEGER(max_fetchers_per_host, 5)
 
+/** Maximum simultaneous active fetchers per host when the host
+ * multiplexes fetches over a single connection (e.g. HTTP/2). These
+ * fetches are not counted against option_max_fetchers.
+ */
+NSOPTION_INTEGER(max_streams_per_host, 100)
+
+/** Maximum simultaneous active fetchers in total over multiplexed
+ * connections.
+ */
+NSOPTION_INTEGER(max_streams, 200)
+
 /** Maximum number of inactive fetchers cached.  The total number of
  * handles netsurf will therefore have open is this plus
  * option_max_fetchers.
@@ -259,11 +259,25 @@ static void monkey_run(void)
 	int schedtm;
 	struct timeval tv;
 	struct timeval* timeout;
+	int event_fd;
+	bool use_events;
+
+	/* wait on the fetchers event descriptor where possible */
+	use_events = (fetch_event_fd(&event_fd) == NSERROR_OK);
 
 	while (!monkey_done) {
 
-		/* clears fdset */
-		fetch_fdset(&read_fd_set, &write_fd_set, &exc_fd_set, &max_fd);
+		if (use_events) {
+			FD_ZERO(&read_fd_set);
+			FD_ZERO(&write_fd_set);
+			FD_ZERO(&exc_fd_set);
+			FD_SET(event_fd, &read_fd_set);
+			max_fd = event_fd;
+		} else {
+			/* clears fdset */
+			fetch_fdset(&read_fd_set, &write_fd_set,
+				    &exc_fd_set, &max_fd);
+		}
 
 		/* add stdin to the set */
 		if (max_fd < 0) {
@@ -307,6 +321,9 @@ static void monkey_run(void)
 		if (rdy_fd < 0) {
 			monkey_done = true;
 		} else if (rdy_fd > 0) {
+			if (use_events && FD_ISSET(event_fd, &read_fd_set)) {
+				fetch_event_process();
+			}
 			if (FD_ISSET(0, &read_fd_set)) {
 				monkey_process_command();
 			}
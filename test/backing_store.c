@@ -0,0 +1,1149 @@
+/*
+ * Copyright 2026 The NetSurf Browser Project
+ *
+ * This file is part of NetSurf, http://www.netsurf-browser.org/
+ *
+ * NetSurf is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; version 2 of the License.
+ *
+ * NetSurf is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/**
+ * \file
+ * Test filesystem backing store operations.
+ *
+ * The store is driven through its gui_llcache_table interface. I/O
+ * failures are injected by wrapping the system calls the store uses
+ * at link time. The tests are also built against a store using the
+ * I/O thread (WITH_BACKING_STORE_THREAD).
+ *
+ * When built with BACKING_STORE_BENCH a synthetic workload benchmark
+ * is run instead of the tests which reports throughput, latency,
+ * eviction pauses and on disc amplification. The workload may be
+ * adjusted with the environment variables BACKING_STORE_BENCH_OPS,
+ * BACKING_STORE_BENCH_URLS and BACKING_STORE_BENCH_LIMIT (in bytes).
+ */
+
+#define _XOPEN_SOURCE 600
+
+#include <assert.h>
+#include <errno.h>
+#include <ftw.h>
+#include <inttypes.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/uio.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+#include <sys/wait.h>
+#include <check.h>
+
+#include "utils/corestrings.h"
+#include "utils/errors.h"
+#include "utils/file.h"
+#include "utils/nsurl.h"
+#include "netsurf/misc.h"
+#include "desktop/gui_internal.h"
+#include "content/backing_store.h"
+
+#define NELEMS(x)  (sizeof(x) / sizeof((x)[0]))
+
+struct netsurf_table *guit = NULL;
+
+/* Stubs */
+nserror nslog_set_filter_by_options() { return NSERROR_OK; }
+
+
+/* Scheduler */
+
+/** Maximum number of scheduled callbacks */
+#define SCHED_SIZE 8
+
+/** scheduled callbacks */
+static struct {
+	void (*callback)(void *p);
+	void *p;
+} sched[SCHED_SIZE];
+
+/**
+ * Schedule a callback.
+ *
+ * Callbacks are only run by sched_run() and the time is ignored.
+ */
+static nserror test_schedule(int t, void (*callback)(void *p), void *p)
+{
+	unsigned int idx;
+	unsigned int empty = SCHED_SIZE;
+
+	for (idx = 0; idx < SCHED_SIZE; idx++) {
+		if ((sched[idx].callback == callback) && (sched[idx].p == p)) {
+			if (t < 0) {
+				sched[idx].callback = NULL;
+			}
+			return NSERROR_OK;
+		}
+		if (sched[idx].callback == NULL) {
+			empty = idx;
+		}
+	}
+
+	if (t < 0) {
+		return NSERROR_NOT_FOUND;
+	}
+
+	ck_assert(empty != SCHED_SIZE);
+
+	sched[empty].callback = callback;
+	sched[empty].p = p;
+
+	return NSERROR_OK;
+}
+
+/**
+ * Run scheduled callbacks until none remain.
+ *
+ * With the I/O thread the store reschedules itself until all its
+ * jobs complete so this waits for outstanding I/O.
+ */
+static void sched_run(void)
+{
+	unsigned int idx;
+	void (*callback)(void *p);
+	bool ran;
+
+	do {
+		ran = false;
+		for (idx = 0; idx < SCHED_SIZE; idx++) {
+			callback = sched[idx].callback;
+			if (callback != NULL) {
+				sched[idx].callback = NULL;
+				callback(sched[idx].p);
+				ran = true;
+			}
+		}
+#ifdef WITH_BACKING_STORE_THREAD
+		if (ran) {
+			struct timespec ts = { 0, 1000000 };
+			nanosleep(&ts, NULL);
+		}
+#endif
+	} while (ran);
+}
+
+static struct gui_misc_table tst_misc_table = {
+	.schedule = test_schedule,
+};
+
+static struct netsurf_table tst_table = {
+	.misc = &tst_misc_table,
+};
+
+
+/* I/O fault injection */
+
+/** number of I/O operations to allow before failing or -1 to never fail */
+static int io_fault_countdown = -1;
+
+/** number of I/O operations failed */
+static unsigned int io_fault_count;
+
+/** number of vectored writes made */
+static unsigned int pwritev_count;
+
+/**
+ * Fail all I/O operations after a number have succeeded.
+ *
+ * \param count The number of operations to allow or -1 to clear faults.
+ */
+static void io_fault_after(int count)
+{
+	io_fault_countdown = count;
+	io_fault_count = 0;
+}
+
+/**
+ * Check if the current I/O operation should fail.
+ */
+static bool io_fault(void)
+{
+	if (io_fault_countdown < 0) {
+		return false;
+	}
+	if (io_fault_countdown > 0) {
+		io_fault_countdown--;
+		return false;
+	}
+	io_fault_count++;
+	errno = EIO;
+	return true;
+}
+
+ssize_t __real_write(int fd, const void *buf, size_t count);
+ssize_t __wrap_write(int fd, const void *buf, size_t count);
+ssize_t __real_read(int fd, void *buf, size_t count);
+ssize_t __wrap_read(int fd, void *buf, size_t count);
+ssize_t __real_nsu_pwrite(int fd, const void *buf, size_t count, off_t offset);
+ssize_t __wrap_nsu_pwrite(int fd, const void *buf, size_t count, off_t offset);
+ssize_t __real_nsu_pread(int fd, void *buf, size_t count, off_t offset);
+ssize_t __wrap_nsu_pread(int fd, void *buf, size_t count, off_t offset);
+ssize_t __real_pwritev(int fd, const struct iovec *iov, int iovcnt, off_t offset);
+ssize_t __wrap_pwritev(int fd, const struct iovec *iov, int iovcnt, off_t offset);
+void *__real_mmap(void *addr, size_t length, int prot, int flags, int fd, off_t offset);
+void *__wrap_mmap(void *addr, size_t length, int prot, int flags, int fd, off_t offset);
+
+ssize_t __wrap_write(int fd, const void *buf, size_t count)
+{
+	if (io_fault()) {
+		return -1;
+	}
+	return __real_write(fd, buf, count);
+}
+
+ssize_t __wrap_read(int fd, void *buf, size_t count)
+{
+	if (io_fault()) {
+		return -1;
+	}
+	return __real_read(fd, buf, count);
+}
+
+ssize_t __wrap_nsu_pwrite(int fd, const void *buf, size_t count, off_t offset)
+{
+	if (io_fault()) {
+		return -1;
+	}
+	return __real_nsu_pwrite(fd, buf, count, offset);
+}
+
+ssize_t __wrap_nsu_pread(int fd, void *buf, size_t count, off_t offset)
+{
+	if (io_fault()) {
+		return -1;
+	}
+	return __real_nsu_pread(fd, buf, count, offset);
+}
+
+ssize_t __wrap_pwritev(int fd, const struct iovec *iov, int iovcnt, off_t offset)
+{
+	pwritev_count++;
+	if (io_fault()) {
+		return -1;
+	}
+	return __real_pwritev(fd, iov, iovcnt, offset);
+}
+
+void *__wrap_mmap(void *addr, size_t length, int prot, int flags, int fd, off_t offset)
+{
+	if (io_fault()) {
+		return MAP_FAILED;
+	}
+	return __real_mmap(addr, length, prot, flags, fd, offset);
+}
+
+
+/* Helpers */
+
+/** directory the store under test is placed in */
+static char store_path[64];
+
+/** whether the store under test is opened shared */
+static bool store_shared;
+
+/**
+ * Make a url for a test object.
+ */
+static nsurl *test_url(unsigned int idx)
+{
+	char str[64];
+	nsurl *url;
+
+	snprintf(str, sizeof(str), "http://test%u.example.com/object/%u",
+		 idx % 17, idx);
+	ck_assert(nsurl_create(str, &url) == NSERROR_OK);
+
+	return url;
+}
+
+/**
+ * Make data for a test object.
+ *
+ * The content is derived from the index and may be made
+ * compressible so both stored forms are exercised.
+ */
+static uint8_t *test_data(unsigned int idx, size_t size, bool compressible)
+{
+	uint8_t *data;
+	uint32_t seed = idx * 2654435761U;
+	size_t loop;
+
+	data = malloc(size);
+	ck_assert(data != NULL);
+
+	for (loop = 0; loop < size; loop++) {
+		if (compressible) {
+			data[loop] = "netsurf backing store "[(idx + loop) % 22];
+		} else {
+			seed = seed * 1103515245U + 12345U;
+			data[loop] = seed >> 24;
+		}
+	}
+
+	return data;
+}
+
+/**
+ * Check data fetched for a test object.
+ */
+static void
+check_data(const uint8_t *data, size_t datalen,
+	   unsigned int idx, size_t size, bool compressible)
+{
+	uint8_t *ref;
+
+	ck_assert_uint_eq(datalen, size);
+
+	ref = test_data(idx, size, compressible);
+	ck_assert(memcmp(data, ref, size) == 0);
+	free(ref);
+}
+
+/**
+ * Initialise the store in a new directory.
+ */
+static void store_create(size_t limit)
+{
+	struct llcache_store_parameters params = {
+		.limit = limit,
+		.hysteresis = limit / 5,
+		.compress = true,
+	};
+
+	params.path = store_path;
+	params.shared = store_shared;
+
+	ck_assert(filesystem_llcache_table->initialise(&params) == NSERROR_OK);
+
+	/* wait for an index loaded on the I/O thread */
+	sched_run();
+}
+
+/**
+ * Place a test object in the store.
+ *
+ * The store takes the data on success, a failed store leaves it with
+ * the caller.
+ *
+ * \return The result of the store operation.
+ */
+static nserror
+store_object(unsigned int idx, size_t size, bool compressible)
+{
+	nsurl *url;
+	uint8_t *data;
+	nserror res;
+
+	url = test_url(idx);
+	data = test_data(idx, size, compressible);
+
+	res = filesystem_llcache_table->store(url, BACKING_STORE_NONE, data, size);
+	if (res == NSERROR_OK) {
+		ck_assert(filesystem_llcache_table->release(url, BACKING_STORE_NONE) == NSERROR_OK);
+	} else {
+		free(data);
+	}
+
+	nsurl_unref(url);
+
+	return res;
+}
+
+/**
+ * Retrieve a test object from the store and check its content.
+ *
+ * \return The result of the fetch operation.
+ */
+static nserror
+fetch_object(unsigned int idx, size_t size, bool compressible)
+{
+	nsurl *url;
+	uint8_t *data;
+	size_t datalen;
+	nserror res;
+
+	url = test_url(idx);
+
+	res = filesystem_llcache_table->fetch(url, BACKING_STORE_NONE,
+					      &data, &datalen);
+	if (res == NSERROR_OK) {
+		check_data(data, datalen, idx, size, compressible);
+		ck_assert(filesystem_llcache_table->release(url, BACKING_STORE_NONE) == NSERROR_OK);
+	}
+
+	nsurl_unref(url);
+
+	return res;
+}
+
+/* Fixtures */
+
+static void backing_store_create(void)
+{
+	guit = &tst_table;
+	tst_table.file = default_file_table;
+	memset(sched, 0, sizeof(sched));
+	io_fault_after(-1);
+	store_shared = false;
+
+	ck_assert(corestrings_init() == NSERROR_OK);
+
+	snprintf(store_path, sizeof(store_path), "/tmp/nsbstest-XXXXXX");
+	ck_assert(mkdtemp(store_path) != NULL);
+}
+
+static void backing_store_teardown(void)
+{
+	char cmd[128];
+
+	io_fault_after(-1);
+	filesystem_llcache_table->finalise();
+
+	snprintf(cmd, sizeof(cmd), "rm -rf %s", store_path);
+	ck_assert(system(cmd) == 0);
+
+	corestrings_fini();
+}
+
+
+#ifndef BACKING_STORE_BENCH
+
+/* Tests */
+
+/** sizes of objects used to exercise each form of storage */
+static const size_t object_sizes[] = {
+	1, 200, 512, 513, 1500, 2048, 6000, 8192, 30000, 32768, 32769, 300000
+};
+
+/**
+ * Operations on a store which has not been initialised
+ */
+START_TEST(backing_store_api_uninitialised_test)
+{
+	nsurl *url;
+	uint8_t *data;
+	size_t datalen;
+	uint8_t buf[4];
+
+	url = test_url(0);
+
+	ck_assert(filesystem_llcache_table->store(url, BACKING_STORE_NONE, buf, sizeof(buf)) == NSERROR_INIT_FAILED);
+	ck_assert(filesystem_llcache_table->fetch(url, BACKING_STORE_NONE, &data, &datalen) == NSERROR_INIT_FAILED);
+	ck_assert(filesystem_llcache_table->release(url, BACKING_STORE_NONE) == NSERROR_INIT_FAILED);
+	ck_assert(filesystem_llcache_table->invalidate(url) == NSERROR_INIT_FAILED);
+
+	nsurl_unref(url);
+}
+END_TEST
+
+/**
+ * Objects of each size are retrieved as stored
+ */
+START_TEST(backing_store_store_fetch_test)
+{
+	unsigned int idx;
+	bool compressible = (_i == 1);
+
+	store_create(64 * 1024 * 1024);
+
+	for (idx = 0; idx < NELEMS(object_sizes); idx++) {
+		ck_assert(store_object(idx, object_sizes[idx], compressible) == NSERROR_OK);
+	}
+
+	/* objects are retrieved while their writes are held */
+	for (idx = 0; idx < NELEMS(object_sizes); idx++) {
+		ck_assert(fetch_object(idx, object_sizes[idx], compressible) == NSERROR_OK);
+	}
+
+	/* and from disc once the held writes are flushed */
+	sched_run();
+	for (idx = 0; idx < NELEMS(object_sizes); idx++) {
+		ck_assert(fetch_object(idx, object_sizes[idx], compressible) == NSERROR_OK);
+	}
+
+	/* an object which was never stored */
+	ck_assert(fetch_object(NELEMS(object_sizes), 1, compressible) == NSERROR_NOT_FOUND);
+}
+END_TEST
+
+/**
+ * Metadata is stored separately from the object data
+ */
+START_TEST(backing_store_meta_test)
+{
+	nsurl *url;
+	uint8_t *data;
+	uint8_t *meta;
+	size_t datalen;
+
+	store_create(64 * 1024 * 1024);
+
+	url = test_url(1);
+	data = test_data(1, 5000, false);
+	meta = test_data(2, 300, true);
+
+	ck_assert(filesystem_llcache_table->store(url, BACKING_STORE_NONE, data, 5000) == NSERROR_OK);
+	ck_assert(filesystem_llcache_table->release(url, BACKING_STORE_NONE) == NSERROR_OK);
+	ck_assert(filesystem_llcache_table->store(url, BACKING_STORE_META, meta, 300) == NSERROR_OK);
+	ck_assert(filesystem_llcache_table->release(url, BACKING_STORE_META) == NSERROR_OK);
+
+	ck_assert(filesystem_llcache_table->fetch(url, BACKING_STORE_META, &data, &datalen) == NSERROR_OK);
+	check_data(data, datalen, 2, 300, true);
+	ck_assert(filesystem_llcache_table->release(url, BACKING_STORE_META) == NSERROR_OK);
+
+	ck_assert(filesystem_llcache_table->fetch(url, BACKING_STORE_NONE, &data, &datalen) == NSERROR_OK);
+	check_data(data, datalen, 1, 5000, false);
+	ck_assert(filesystem_llcache_table->release(url, BACKING_STORE_NONE) == NSERROR_OK);
+
+	nsurl_unref(url);
+}
+END_TEST
+
+/**
+ * Invalidated objects are no longer found
+ */
+START_TEST(backing_store_invalidate_test)
+{
+	nsurl *url;
+
+	store_create(64 * 1024 * 1024);
+
+	ck_assert(store_object(3, 1000, false) == NSERROR_OK);
+	ck_assert(store_object(4, 100000, false) == NSERROR_OK);
+
+	url = test_url(3);
+	ck_assert(filesystem_llcache_table->invalidate(url) == NSERROR_OK);
+	nsurl_unref(url);
+
+	url = test_url(4);
+	ck_assert(filesystem_llcache_table->invalidate(url) == NSERROR_OK);
+	nsurl_unref(url);
+
+	ck_assert(fetch_object(3, 1000, false) == NSERROR_NOT_FOUND);
+	ck_assert(fetch_object(4, 100000, false) == NSERROR_NOT_FOUND);
+
+	/* storing again after invalidation */
+	ck_assert(store_object(3, 2000, true) == NSERROR_OK);
+	ck_assert(fetch_object(3, 2000, true) == NSERROR_OK);
+}
+END_TEST
+
+/**
+ * Objects are found again after the store is finalised and initialised
+ */
+START_TEST(backing_store_persist_test)
+{
+	unsigned int idx;
+	nsurl *url;
+
+	store_create(64 * 1024 * 1024);
+
+	for (idx = 0; idx < NELEMS(object_sizes); idx++) {
+		ck_assert(store_object(idx, object_sizes[idx], false) == NSERROR_OK);
+	}
+	url = test_url(0);
+	ck_assert(filesystem_llcache_table->invalidate(url) == NSERROR_OK);
+	nsurl_unref(url);
+
+	sched_run();
+
+	ck_assert(filesystem_llcache_table->finalise() == NSERROR_OK);
+	store_create(64 * 1024 * 1024);
+
+	ck_assert(fetch_object(0, object_sizes[0], false) == NSERROR_NOT_FOUND);
+	for (idx = 1; idx < NELEMS(object_sizes); idx++) {
+		ck_assert(fetch_object(idx, object_sizes[idx], false) == NSERROR_OK);
+	}
+}
+END_TEST
+
+/**
+ * Changes are recovered from the journal after an unclean shutdown
+ */
+START_TEST(backing_store_journal_test)
+{
+	char crashed_path[sizeof(store_path)];
+	char cmd[256];
+	unsigned int idx;
+	FILE *journal;
+
+	store_create(64 * 1024 * 1024);
+
+	/* the first objects are in the entries file */
+	for (idx = 0; idx < 4; idx++) {
+		ck_assert(store_object(idx, object_sizes[idx], false) == NSERROR_OK);
+	}
+	ck_assert(filesystem_llcache_table->finalise() == NSERROR_OK);
+	store_create(64 * 1024 * 1024);
+
+	/* the remainder only in the journal */
+	for (idx = 4; idx < NELEMS(object_sizes); idx++) {
+		ck_assert(store_object(idx, object_sizes[idx], false) == NSERROR_OK);
+	}
+	sched_run();
+
+	/* copy the store as it would be left by a crash */
+	snprintf(crashed_path, sizeof(crashed_path), "%s-crash", store_path);
+	snprintf(cmd, sizeof(cmd), "cp -R %s %s", store_path, crashed_path);
+	ck_assert(system(cmd) == 0);
+	ck_assert(filesystem_llcache_table->finalise() == NSERROR_OK);
+	snprintf(cmd, sizeof(cmd), "rm -rf %s", store_path);
+	ck_assert(system(cmd) == 0);
+	snprintf(cmd, sizeof(cmd), "mv %s %s", crashed_path, store_path);
+	ck_assert(system(cmd) == 0);
+
+	/* a partially written record at the end of the journal */
+	snprintf(cmd, sizeof(cmd), "%s/journal", store_path);
+	journal = fopen(cmd, "a");
+	ck_assert(journal != NULL);
+	fputs("partial record", journal);
+	fclose(journal);
+
+	store_create(64 * 1024 * 1024);
+
+	for (idx = 0; idx < NELEMS(object_sizes); idx++) {
+		ck_assert(fetch_object(idx, object_sizes[idx], false) == NSERROR_OK);
+	}
+}
+END_TEST
+
+/**
+ * Run the writer of a shared store in a child process.
+ *
+ * The writer stores the objects, then once the reader has checked
+ * them invalidates the first and stores another. Each step is
+ * signalled to the reader on the \a ready pipe and the writer waits
+ * on the \a done pipe before continuing.
+ */
+static void shared_writer(int ready, int done)
+{
+	unsigned int idx;
+	nsurl *url;
+	char c;
+
+	store_create(64 * 1024 * 1024);
+
+	for (idx = 0; idx < NELEMS(object_sizes); idx++) {
+		if (store_object(idx, object_sizes[idx], false) != NSERROR_OK) {
+			_exit(1);
+		}
+	}
+	sched_run();
+	if ((write(ready, "s", 1) != 1) || (read(done, &c, 1) != 1)) {
+		_exit(2);
+	}
+
+	url = test_url(0);
+	filesystem_llcache_table->invalidate(url);
+	nsurl_unref(url);
+	if (store_object(NELEMS(object_sizes), 1000, false) != NSERROR_OK) {
+		_exit(3);
+	}
+	sched_run();
+	if ((write(ready, "s", 1) != 1) || (read(done, &c, 1) != 1)) {
+		_exit(4);
+	}
+
+	filesystem_llcache_table->finalise();
+	_exit(0);
+}
+
+/**
+ * A shared store is read by a process which is not its writer
+ */
+START_TEST(backing_store_shared_test)
+{
+	int ready[2];
+	int done[2];
+	unsigned int idx;
+	pid_t pid;
+	int status;
+	char c;
+
+	store_shared = true;
+
+	ck_assert(pipe(ready) == 0);
+	ck_assert(pipe(done) == 0);
+
+	pid = fork();
+	ck_assert(pid != -1);
+	if (pid == 0) {
+		shared_writer(ready[1], done[0]);
+	}
+
+	/* the writer holds the lock so this process is a reader */
+	ck_assert(read(ready[0], &c, 1) == 1);
+	store_create(64 * 1024 * 1024);
+
+	for (idx = 0; idx < NELEMS(object_sizes); idx++) {
+		ck_assert(fetch_object(idx, object_sizes[idx], false) == NSERROR_OK);
+	}
+	ck_assert(store_object(NELEMS(object_sizes) + 1, 1000, false) == NSERROR_PERMISSION);
+
+	/* changes made by the writer are followed */
+	ck_assert(write(done[1], "r", 1) == 1);
+	ck_assert(read(ready[0], &c, 1) == 1);
+
+	ck_assert(fetch_object(0, object_sizes[0], false) == NSERROR_NOT_FOUND);
+	ck_assert(fetch_object(1, object_sizes[1], false) == NSERROR_OK);
+	ck_assert(fetch_object(NELEMS(object_sizes), 1000, false) == NSERROR_OK);
+
+	ck_assert(write(done[1], "r", 1) == 1);
+	ck_assert(waitpid(pid, &status, 0) == pid);
+	ck_assert(WIFEXITED(status) && (WEXITSTATUS(status) == 0));
+
+	close(ready[0]);
+	close(ready[1]);
+	close(done[0]);
+	close(done[1]);
+}
+END_TEST
+
+/**
+ * Small block writes are coalesced into vectored writes
+ */
+START_TEST(backing_store_coalesce_test)
+{
+	unsigned int idx;
+
+	store_create(64 * 1024 * 1024);
+
+	pwritev_count = 0;
+	for (idx = 0; idx < 16; idx++) {
+		ck_assert(store_object(idx, 200, false) == NSERROR_OK);
+	}
+
+	/* the writes are held until they are flushed */
+	ck_assert_uint_eq(pwritev_count, 0);
+	sched_run();
+	ck_assert(pwritev_count > 0);
+	ck_assert(pwritev_count < 8);
+
+	for (idx = 0; idx < 16; idx++) {
+		ck_assert(fetch_object(idx, 200, false) == NSERROR_OK);
+	}
+}
+END_TEST
+
+/**
+ * Failed writes do not leave objects which can be found
+ */
+START_TEST(backing_store_write_fault_test)
+{
+	size_t size = object_sizes[_i];
+
+	store_create(64 * 1024 * 1024);
+
+	ck_assert(store_object(1, 100, false) == NSERROR_OK);
+	sched_run();
+
+	/* small block writes are held so only fail when flushed */
+	io_fault_after(0);
+	store_object(2, size, false);
+	sched_run();
+	ck_assert(io_fault_count > 0);
+	io_fault_after(-1);
+
+	ck_assert(fetch_object(2, size, false) == NSERROR_NOT_FOUND);
+	ck_assert(fetch_object(1, 100, false) == NSERROR_OK);
+
+	/* the store recovers once the fault clears */
+	ck_assert(store_object(2, size, false) == NSERROR_OK);
+	ck_assert(fetch_object(2, size, false) == NSERROR_OK);
+}
+END_TEST
+
+/**
+ * Failed reads are reported and do not return bad data
+ */
+START_TEST(backing_store_read_fault_test)
+{
+	size_t size = object_sizes[_i];
+	nserror res;
+
+	store_create(64 * 1024 * 1024);
+
+	ck_assert(store_object(1, size, true) == NSERROR_OK);
+	ck_assert(store_object(2, size, false) == NSERROR_OK);
+	sched_run();
+
+	io_fault_after(0);
+	ck_assert(fetch_object(1, size, true) != NSERROR_OK);
+	ck_assert(fetch_object(2, size, false) != NSERROR_OK);
+	io_fault_after(-1);
+
+	/* data is either correct or not found once the fault clears */
+	res = fetch_object(1, size, true);
+	ck_assert((res == NSERROR_OK) || (res == NSERROR_NOT_FOUND));
+	res = fetch_object(2, size, false);
+	ck_assert((res == NSERROR_OK) || (res == NSERROR_NOT_FOUND));
+}
+END_TEST
+
+#else
+
+/* Benchmark */
+
+/** Number of operations performed by the benchmark */
+#define BENCH_OPS 20000
+
+/** Number of distinct urls used by the benchmark */
+#define BENCH_URLS 4000
+
+/** Backing store size limit used by the benchmark */
+#define BENCH_LIMIT (16 * 1024 * 1024)
+
+/** total size of files found by disc_usage_cb */
+static uint64_t disc_usage_total;
+
+static int
+disc_usage_cb(const char *fpath, const struct stat *sb, int typeflag, struct FTW *ftwbuf)
+{
+	if (typeflag == FTW_F) {
+		disc_usage_total += (uint64_t)sb->st_blocks * 512;
+	}
+	return 0;
+}
+
+/**
+ * Get the disc space used by the store.
+ */
+static uint64_t disc_usage(void)
+{
+	disc_usage_total = 0;
+	nftw(store_path, disc_usage_cb, 16, FTW_PHYS);
+	return disc_usage_total;
+}
+
+/**
+ * Get monotonic time in nanoseconds.
+ */
+static uint64_t bench_time_ns(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+
+	return ((uint64_t)ts.tv_sec * 1000000000) + ts.tv_nsec;
+}
+
+static int bench_cmp(const void *a, const void *b)
+{
+	uint64_t va = *(const uint64_t *)a;
+	uint64_t vb = *(const uint64_t *)b;
+
+	return (va > vb) - (va < vb);
+}
+
+/**
+ * Report latency distribution of an operation.
+ */
+static void
+bench_report(const char *name, uint64_t *lat, unsigned int count, uint64_t total)
+{
+	if (count == 0) {
+		return;
+	}
+
+	qsort(lat, count, sizeof(uint64_t), bench_cmp);
+
+	printf("%-10s %8u ops %10.0f ops/s p50 %8.1fus p99 %8.1fus max %8.1fus\n",
+	       name, count,
+	       (count * 1e9) / (total ? total : 1),
+	       lat[count / 2] / 1000.0,
+	       lat[(count * 99) / 100] / 1000.0,
+	       lat[count - 1] / 1000.0);
+}
+
+/**
+ * Get a workload parameter from the environment.
+ */
+static unsigned int bench_param(const char *name, unsigned int def)
+{
+	const char *val = getenv(name);
+
+	if (val == NULL) {
+		return def;
+	}
+	return strtoul(val, NULL, 0);
+}
+
+/**
+ * Synthetic workload
+ *
+ * Urls are chosen with a skewed distribution so a small number are
+ * popular, and object sizes follow a distribution weighted towards
+ * small objects similar to web content. A fetch which misses is
+ * followed by a store as the low level cache would.
+ */
+START_TEST(backing_store_bench_test)
+{
+	/* object size classes and their relative weights */
+	static const struct {
+		size_t size;
+		unsigned int weight;
+	} size_dist[] = {
+		{ 400, 30 }, { 1800, 25 }, { 7000, 20 },
+		{ 25000, 15 }, { 90000, 8 }, { 600000, 2 }
+	};
+	unsigned int ops = bench_param("BACKING_STORE_BENCH_OPS", BENCH_OPS);
+	unsigned int urls = bench_param("BACKING_STORE_BENCH_URLS", BENCH_URLS);
+	unsigned int limit = bench_param("BACKING_STORE_BENCH_LIMIT", BENCH_LIMIT);
+	uint64_t *store_lat;
+	uint64_t *fetch_lat;
+	uint64_t *inval_lat;
+	unsigned int store_count = 0;
+	unsigned int fetch_count = 0;
+	unsigned int inval_count = 0;
+	unsigned int pause_count = 0;
+	uint64_t store_total = 0;
+	uint64_t fetch_total = 0;
+	uint64_t inval_total = 0;
+	uint64_t live_bytes = 0;
+	uint64_t start;
+	uint64_t elapsed;
+	uint32_t seed = 1;
+	unsigned int op;
+	unsigned int idx;
+	unsigned int weight_total = 0;
+	unsigned int pick;
+	unsigned int sclass;
+	size_t size;
+	nsurl *url;
+	nserror res;
+
+	store_lat = calloc(ops, sizeof(uint64_t));
+	fetch_lat = calloc(ops, sizeof(uint64_t));
+	inval_lat = calloc(ops, sizeof(uint64_t));
+	ck_assert((store_lat != NULL) && (fetch_lat != NULL) && (inval_lat != NULL));
+
+	for (idx = 0; idx < NELEMS(size_dist); idx++) {
+		weight_total += size_dist[idx].weight;
+	}
+
+	store_create(limit);
+
+	for (op = 0; op < ops; op++) {
+		seed = seed * 1103515245U + 12345U;
+
+		/* skewed url choice, the product of two uniform picks */
+		idx = (((seed >> 8) % urls) * ((seed >> 16) % urls)) / urls;
+
+		/* the size of an object is fixed by its url */
+		pick = (idx * 2654435761U) % weight_total;
+		for (sclass = 0; sclass < NELEMS(size_dist); sclass++) {
+			if (pick < size_dist[sclass].weight) {
+				break;
+			}
+			pick -= size_dist[sclass].weight;
+		}
+		size = size_dist[sclass].size + (idx % 97);
+
+		if ((seed >> 28) == 0) {
+			/* occasional invalidation */
+			url = test_url(idx);
+			start = bench_time_ns();
+			filesystem_llcache_table->invalidate(url);
+			elapsed = bench_time_ns() - start;
+			nsurl_unref(url);
+
+			inval_lat[inval_count++] = elapsed;
+			inval_total += elapsed;
+			continue;
+		}
+
+		start = bench_time_ns();
+		res = fetch_object(idx, size, (idx & 1) != 0);
+		elapsed = bench_time_ns() - start;
+		fetch_lat[fetch_count++] = elapsed;
+		fetch_total += elapsed;
+
+		if (res != NSERROR_OK) {
+			start = bench_time_ns();
+			res = store_object(idx, size, (idx & 1) != 0);
+			elapsed = bench_time_ns() - start;
+			ck_assert(res == NSERROR_OK);
+
+			store_lat[store_count++] = elapsed;
+			store_total += elapsed;
+		}
+
+		/* maintenance would run from the scheduler periodically */
+		if ((op % 1000) == 999) {
+			sched_run();
+		}
+	}
+	sched_run();
+
+	/* stores which take much longer than the median include an
+	 * eviction pause.
+	 */
+	qsort(store_lat, store_count, sizeof(uint64_t), bench_cmp);
+	for (idx = 0; idx < store_count; idx++) {
+		if (store_lat[idx] > (store_lat[store_count / 2] * 10)) {
+			pause_count++;
+		}
+	}
+
+	/* find what remains in the store */
+	for (idx = 0; idx < urls; idx++) {
+		uint8_t *data;
+		size_t datalen;
+
+		url = test_url(idx);
+		if (filesystem_llcache_table->fetch(url, BACKING_STORE_NONE, &data, &datalen) == NSERROR_OK) {
+			live_bytes += datalen;
+			filesystem_llcache_table->release(url, BACKING_STORE_NONE);
+		}
+		nsurl_unref(url);
+	}
+
+	printf("backing store benchmark: %u ops over %u urls, limit %u bytes\n",
+	       ops, urls, limit);
+	bench_report("fetch", fetch_lat, fetch_count, fetch_total);
+	bench_report("store", store_lat, store_count, store_total);
+	bench_report("invalidate", inval_lat, inval_count, inval_total);
+	printf("eviction pauses (stores over 10x median) %u max %.1fus\n",
+	       pause_count,
+	       store_count ? store_lat[store_count - 1] / 1000.0 : 0.0);
+	printf("live data %"PRIu64" bytes on disc %"PRIu64" bytes amplification %.2f\n",
+	       live_bytes, disc_usage(),
+	       live_bytes ? (double)disc_usage() / live_bytes : 0.0);
+
+	ck_assert(live_bytes > 0);
+
+	free(store_lat);
+	free(fetch_lat);
+	free(inval_lat);
+}
+END_TEST
+
+#endif
+
+
+#ifndef BACKING_STORE_BENCH
+
+static TCase *backing_store_api_case_create(void)
+{
+	TCase *tc;
+	tc = tcase_create("API_checks");
+
+	tcase_add_test(tc, backing_store_api_uninitialised_test);
+
+	return tc;
+}
+
+static TCase *backing_store_case_create(void)
+{
+	TCase *tc;
+	tc = tcase_create("Store");
+
+	tcase_add_checked_fixture(tc,
+				  backing_store_create,
+				  backing_store_teardown);
+
+	tcase_add_loop_test(tc, backing_store_store_fetch_test, 0, 2);
+	tcase_add_test(tc, backing_store_meta_test);
+	tcase_add_test(tc, backing_store_invalidate_test);
+	tcase_add_test(tc, backing_store_persist_test);
+	tcase_add_test(tc, backing_store_journal_test);
+	tcase_add_test(tc, backing_store_shared_test);
+	tcase_add_test(tc, backing_store_coalesce_test);
+
+	return tc;
+}
+
+static TCase *backing_store_fault_case_create(void)
+{
+	TCase *tc;
+	tc = tcase_create("Faults");
+
+	tcase_add_checked_fixture(tc,
+				  backing_store_create,
+				  backing_store_teardown);
+
+	tcase_add_loop_test(tc, backing_store_write_fault_test,
+			    0, NELEMS(object_sizes));
+	tcase_add_loop_test(tc, backing_store_read_fault_test,
+			    0, NELEMS(object_sizes));
+
+	return tc;
+}
+
+static Suite *backing_store_suite_create(void)
+{
+	Suite *s;
+	s = suite_create("Backing store");
+
+	suite_add_tcase(s, backing_store_api_case_create());
+	suite_add_tcase(s, backing_store_case_create());
+	suite_add_tcase(s, backing_store_fault_case_create());
+
+	return s;
+}
+
+#else
+
+static TCase *backing_store_bench_case_create(void)
+{
+	TCase *tc;
+	tc = tcase_create("Benchmark");
+
+	tcase_add_checked_fixture(tc,
+				  backing_store_create,
+				  backing_store_teardown);
+
+	tcase_set_timeout(tc, 300);
+
+	tcase_add_test(tc, backing_store_bench_test);
+
+	return tc;
+}
+
+static Suite *backing_store_suite_create(void)
+{
+	Suite *s;
+	s = suite_create("Backing store benchmark");
+
+	suite_add_tcase(s, backing_store_bench_case_create());
+
+	return s;
+}
+
+#endif
+
+int main(int argc, char **argv)
+{
+	int number_failed;
+	SRunner *sr;
+
+	sr = srunner_create(backing_store_suite_create());
+
+	srunner_run_all(sr, CK_ENV);
+
+	number_failed = srunner_ntests_failed(sr);
+	srunner_free(sr);
+
+	return (number_failed == 0) ? EXIT_SUCCESS : EXIT_FAILURE;
+}
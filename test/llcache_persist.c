@@ -0,0 +1,411 @@
+/*
+ * Copyright 2026 The NetSurf Browser Project
+ *
+ * This file is part of NetSurf, http://www.netsurf-browser.org/
+ *
+ * NetSurf is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; version 2 of the License.
+ *
+ * NetSurf is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/**
+ * \file
+ * Test low level cache persistence to the backing store.
+ *
+ * The fetch layer and the backing store are replaced by stubs so
+ * objects can be fetched and written out under the control of the
+ * test.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <check.h>
+
+#include "utils/corestrings.h"
+#include "utils/errors.h"
+#include "utils/nsurl.h"
+#include "utils/utils.h"
+#include "netsurf/misc.h"
+#include "desktop/gui_internal.h"
+#include "content/fetch.h"
+#include "content/llcache.h"
+#include "content/backing_store.h"
+#include "content/urldb.h"
+
+#define NELEMS(x)  (sizeof(x) / sizeof((x)[0]))
+
+/** Number of objects fetched by the tests */
+#define OBJECT_COUNT 4
+
+struct netsurf_table *guit = NULL;
+
+/* Stubs */
+nserror nslog_set_filter_by_options() { return NSERROR_OK; }
+
+
+/* Fetch layer */
+
+/** fetches started by the low level cache */
+static struct test_fetch {
+	fetch_callback callback;
+	void *p;
+} fetches[OBJECT_COUNT];
+
+/** number of fetches started */
+static unsigned int fetch_count;
+
+nserror fetch_start(nsurl *url, nsurl *referer, fetch_callback callback,
+		    void *p, bool only_2xx, const char *post_urlenc,
+		    const struct fetch_multipart_data *post_multipart,
+		    bool verifiable, bool downgrade_tls,
+		    const char *headers[], fetch_priority priority,
+		    struct fetch **fetch_out)
+{
+	ck_assert(fetch_count < NELEMS(fetches));
+
+	fetches[fetch_count].callback = callback;
+	fetches[fetch_count].p = p;
+	*fetch_out = (struct fetch *)&fetches[fetch_count];
+	fetch_count++;
+
+	return NSERROR_OK;
+}
+
+void fetch_set_priority(struct fetch *fetch, fetch_priority priority)
+{
+}
+
+void fetch_abort(struct fetch *f)
+{
+}
+
+bool fetch_can_fetch(const nsurl *url)
+{
+	return true;
+}
+
+long fetch_http_code(struct fetch *fetch)
+{
+	return 200;
+}
+
+void fetch_transfer_size(struct fetch *fetch,
+			 uint64_t *wire_size,
+			 uint64_t *decoded_size)
+{
+	*wire_size = 0;
+	*decoded_size = 0;
+}
+
+void fetch_multipart_data_destroy(struct fetch_multipart_data *list)
+{
+}
+
+struct fetch_multipart_data *
+fetch_multipart_data_clone(const struct fetch_multipart_data *list)
+{
+	return NULL;
+}
+
+const char *urldb_get_auth_details(nsurl *url, const char *realm)
+{
+	return NULL;
+}
+
+bool urldb_get_hsts_enabled(struct nsurl *url)
+{
+	return false;
+}
+
+bool urldb_set_hsts_policy(struct nsurl *url, const char *header)
+{
+	return true;
+}
+
+
+/* Scheduler */
+
+/** Maximum number of passes over the schedule before giving up */
+#define SCHED_PASS_LIMIT 16
+
+/** callbacks scheduled by the low level cache */
+static struct test_sched {
+	void (*callback)(void *p);
+	void *p;
+} sched[8];
+
+static nserror test_schedule(int t, void (*callback)(void *p), void *p)
+{
+	unsigned int idx;
+	unsigned int empty = NELEMS(sched);
+
+	for (idx = 0; idx < NELEMS(sched); idx++) {
+		if ((sched[idx].callback == callback) && (sched[idx].p == p)) {
+			sched[idx].callback = NULL;
+		}
+		if (sched[idx].callback == NULL) {
+			empty = idx;
+		}
+	}
+
+	if (t >= 0) {
+		ck_assert(empty < NELEMS(sched));
+		sched[empty].callback = callback;
+		sched[empty].p = p;
+	}
+
+	return NSERROR_OK;
+}
+
+/**
+ * Run scheduled callbacks until nothing remains scheduled.
+ *
+ * \return The number of passes made or SCHED_PASS_LIMIT if callbacks
+ *         were still rescheduling themselves.
+ */
+static unsigned int sched_run(void)
+{
+	unsigned int pass;
+	unsigned int idx;
+	bool ran;
+
+	for (pass = 0; pass < SCHED_PASS_LIMIT; pass++) {
+		ran = false;
+		for (idx = 0; idx < NELEMS(sched); idx++) {
+			void (*callback)(void *p) = sched[idx].callback;
+			if (callback != NULL) {
+				sched[idx].callback = NULL;
+				callback(sched[idx].p);
+				ran = true;
+			}
+		}
+		if (ran == false) {
+			break;
+		}
+	}
+
+	return pass;
+}
+
+static struct gui_misc_table tst_misc_table = {
+	.schedule = test_schedule,
+};
+
+
+/* Backing store */
+
+/** number of store operations made */
+static unsigned int store_count;
+
+static nserror ro_initialise(const struct llcache_store_parameters *p)
+{
+	return NSERROR_OK;
+}
+
+static nserror ro_finalise(void)
+{
+	return NSERROR_OK;
+}
+
+/** a reader of a shared store may not place objects in it */
+static nserror
+ro_store(nsurl *url, enum backing_store_flags flags,
+	 uint8_t *data, const size_t datalen)
+{
+	store_count++;
+	return NSERROR_PERMISSION;
+}
+
+static nserror
+ro_fetch(nsurl *url, enum backing_store_flags flags,
+	 uint8_t **data, size_t *datalen)
+{
+	return NSERROR_NOT_FOUND;
+}
+
+static nserror ro_invalidate(nsurl *url)
+{
+	return NSERROR_NOT_FOUND;
+}
+
+static nserror ro_release(nsurl *url, enum backing_store_flags flags)
+{
+	return NSERROR_NOT_FOUND;
+}
+
+static struct gui_llcache_table ro_llcache_table = {
+	.initialise = ro_initialise,
+	.finalise = ro_finalise,
+	.store = ro_store,
+	.fetch = ro_fetch,
+	.invalidate = ro_invalidate,
+	.release = ro_release,
+};
+
+static struct netsurf_table tst_table = {
+	.misc = &tst_misc_table,
+	.llcache = &ro_llcache_table,
+};
+
+
+/* Helpers */
+
+static nserror
+handle_callback(llcache_handle *handle, const llcache_event *event, void *pw)
+{
+	return NSERROR_OK;
+}
+
+/**
+ * Send a message to a fetch.
+ */
+static void
+fetch_send(unsigned int idx, fetch_msg_type type, const char *buf, size_t len)
+{
+	fetch_msg msg;
+
+	msg.type = type;
+	msg.data.header_or_data.buf = (const uint8_t *)buf;
+	msg.data.header_or_data.len = len;
+
+	fetches[idx].callback(&msg, fetches[idx].p);
+}
+
+/**
+ * Fetch a cacheable object to completion.
+ *
+ * \return The handle of the object.
+ */
+static llcache_handle *object_fetch(unsigned int idx)
+{
+	static const char header[] = "Cache-Control: max-age=86400";
+	static const char data[] = "persistent object data";
+	llcache_handle *handle;
+	char str[64];
+	nsurl *url;
+
+	snprintf(str, sizeof(str), "http://test.example.com/object/%u", idx);
+	ck_assert(nsurl_create(str, &url) == NSERROR_OK);
+
+	ck_assert(llcache_handle_retrieve(url, 0, NULL, NULL,
+					  handle_callback, NULL,
+					  &handle) == NSERROR_OK);
+	nsurl_unref(url);
+
+	ck_assert_uint_eq(fetch_count, idx + 1);
+
+	fetch_send(idx, FETCH_HEADER, header, SLEN(header));
+	fetch_send(idx, FETCH_DATA, data, SLEN(data));
+	fetch_send(idx, FETCH_FINISHED, NULL, 0);
+
+	return handle;
+}
+
+
+/* Fixtures */
+
+static void llcache_persist_create(void)
+{
+	struct llcache_parameters params = {
+		.limit = 1024 * 1024,
+		.hysteresis = 64 * 1024,
+		.minimum_lifetime = 60,
+		.minimum_bandwidth = 0,
+		.maximum_bandwidth = 1024 * 1024,
+		.time_quantum = 100,
+		.fetch_attempts = 1,
+	};
+
+	guit = &tst_table;
+	memset(sched, 0, sizeof(sched));
+	store_count = 0;
+	fetch_count = 0;
+
+	ck_assert(corestrings_init() == NSERROR_OK);
+	ck_assert(llcache_initialise(&params) == NSERROR_OK);
+}
+
+static void llcache_persist_teardown(void)
+{
+	llcache_finalise();
+	corestrings_fini();
+}
+
+
+/* Tests */
+
+/**
+ * A store which does not accept writes stops persistence
+ */
+START_TEST(llcache_persist_readonly_test)
+{
+	llcache_handle *handle[OBJECT_COUNT];
+	unsigned int idx;
+
+	for (idx = 0; idx < OBJECT_COUNT - 1; idx++) {
+		handle[idx] = object_fetch(idx);
+	}
+
+	/* the first write is refused and writeout is not requeued */
+	ck_assert(sched_run() < SCHED_PASS_LIMIT);
+	ck_assert_uint_eq(store_count, 1);
+
+	/* later objects are not queued for writeout either */
+	handle[idx] = object_fetch(idx);
+	ck_assert(sched_run() < SCHED_PASS_LIMIT);
+	ck_assert_uint_eq(store_count, 1);
+
+	for (idx = 0; idx < OBJECT_COUNT; idx++) {
+		llcache_handle_release(handle[idx]);
+	}
+}
+END_TEST
+
+
+static TCase *llcache_persist_case_create(void)
+{
+	TCase *tc;
+	tc = tcase_create("Persist");
+
+	tcase_add_checked_fixture(tc,
+				  llcache_persist_create,
+				  llcache_persist_teardown);
+
+	tcase_add_test(tc, llcache_persist_readonly_test);
+
+	return tc;
+}
+
+static Suite *llcache_persist_suite_create(void)
+{
+	Suite *s;
+	s = suite_create("Low level cache persistence");
+
+	suite_add_tcase(s, llcache_persist_case_create());
+
+	return s;
+}
+
+int main(int argc, char **argv)
+{
+	int number_failed;
+	SRunner *sr;
+
+	sr = srunner_create(llcache_persist_suite_create());
+
+	srunner_run_all(sr, CK_ENV);
+
+	number_failed = srunner_ntests_failed(sr);
+	srunner_free(sr);
+
+	return (number_failed == 0) ? EXIT_SUCCESS : EXIT_FAILURE;
+}
@@ -103,6 +103,16 @@ char *realpath(const char *path, char *resolved_path);
 #undef HAVE_MMAP
 #endif
 
+#define HAVE_PWRITEV
+#if (defined(_WIN32) || defined(__riscos__) || defined(__HAIKU__) || defined(__BEOS__) || defined(__amigaos4__) || defined(__AMIGA__) || defined(__MINT__))
+#undef HAVE_PWRITEV
+#endif
+
+#define HAVE_EPOLL
+#if !defined(__linux__)
+#undef HAVE_EPOLL
+#endif
+
 #define HAVE_SCANDIR
 #if (defined(_WIN32))
 #undef HAVE_SCANDIR